@@ -59,6 +59,7 @@ struct _GClueSimplePrivate
         GClueAccuracyLevel accuracy_level;
         guint distance_threshold;
         guint time_threshold;
+        gboolean inline_location;
 
         GClueClient *client;
         GClueLocation *location;
@@ -88,6 +89,7 @@ enum
         PROP_LOCATION,
         PROP_DISTANCE_THRESHOLD,
         PROP_TIME_THRESHOLD,
+        PROP_INLINE_LOCATION,
         LAST_PROP
 };
 
@@ -138,6 +140,10 @@ gclue_simple_get_property (GObject    *object,
                 g_value_set_uint (value, simple->priv->time_threshold);
                 break;
 
+        case PROP_INLINE_LOCATION:
+                g_value_set_boolean (value, simple->priv->inline_location);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         }
@@ -168,6 +174,10 @@ gclue_simple_set_property (GObject      *object,
                 simple->priv->time_threshold = g_value_get_uint (value);
                 break;
 
+        case PROP_INLINE_LOCATION:
+                simple->priv->inline_location = g_value_get_boolean (value);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         }
@@ -280,6 +290,65 @@ gclue_simple_class_init (GClueSimpleClass *klass)
         g_object_class_install_property (object_class,
                                          PROP_TIME_THRESHOLD,
                                          gParamSpecs[PROP_TIME_THRESHOLD]);
+
+        /**
+         * GClueSimple:inline-location:
+         *
+         * Whether to ask the service to send each location inline with the
+         * InlineLocationUpdated signal rather than as a new location object.
+         * It is only used if the service supports it, and the Location
+         * property of #GClueSimple:client is then not updated.
+         *
+         * Defaults to %FALSE.
+         */
+        gParamSpecs[PROP_INLINE_LOCATION] = g_param_spec_boolean
+                ("inline-location",
+                 "InlineLocation",
+                 "InlineLocation",
+                 FALSE,
+                 G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT_ONLY);
+        g_object_class_install_property (object_class,
+                                         PROP_INLINE_LOCATION,
+                                         gParamSpecs[PROP_INLINE_LOCATION]);
+}
+
+/* Sets the location from the a{sv} of the portal and of the service's
+ * InlineLocationUpdated signal, which have the Location properties as keys */
+static void
+set_location_from_variant (GClueSimple *simple,
+                           GVariant    *data)
+{
+        GClueSimplePrivate *priv = simple->priv;
+        g_autoptr (GClueLocation) location = gclue_location_skeleton_new ();
+        g_autoptr (GVariant) timestamp = NULL;
+        const char *description;
+        double value;
+
+        if (g_variant_lookup (data, "Latitude", "d", &value))
+                gclue_location_set_latitude (location, value);
+        if (g_variant_lookup (data, "Longitude", "d", &value))
+                gclue_location_set_longitude (location, value);
+        if (g_variant_lookup (data, "Altitude", "d", &value))
+                gclue_location_set_altitude (location, value);
+        if (g_variant_lookup (data, "Accuracy", "d", &value))
+                gclue_location_set_accuracy (location, value);
+        if (g_variant_lookup (data, "Speed", "d", &value))
+                gclue_location_set_speed (location, value);
+        if (g_variant_lookup (data, "Heading", "d", &value))
+                gclue_location_set_heading (location, value);
+        if (g_variant_lookup (data, "Description", "&s", &description))
+                gclue_location_set_description (location, description);
+        if (g_variant_lookup (data, "Timestamp", "@(tt)", &timestamp))
+                gclue_location_set_timestamp (location, timestamp);
+
+        g_set_object (&priv->location, location);
+
+        if (priv->task) {
+                g_task_return_boolean (priv->task, TRUE);
+        }
+        else {
+                g_object_notify (G_OBJECT (simple), "location");
+        }
 }
 
 static void
@@ -322,6 +391,14 @@ on_location_updated (GClueClient *client,
         if (new_location == NULL || g_strcmp0 (new_location, "/") == 0)
                 return;
 
+        /* The service updated the location we have a proxy for already */
+        if (priv->location != NULL && priv->task == NULL &&
+            g_strcmp0 (g_dbus_proxy_get_object_path (G_DBUS_PROXY (priv->location)),
+                       new_location) == 0) {
+                g_object_notify (G_OBJECT (user_data), "location");
+                return;
+        }
+
         gclue_location_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
                                           G_DBUS_PROXY_FLAGS_NONE,
                                           BUS_NAME,
@@ -331,6 +408,14 @@ on_location_updated (GClueClient *client,
                                           user_data);
 }
 
+static void
+on_inline_location_updated (GClueClient *client,
+                            GVariant    *location,
+                            gpointer     user_data)
+{
+        set_location_from_variant (GCLUE_SIMPLE (user_data), location);
+}
+
 static void
 async_init_return_error_when_cancelled (GTask *task)
 {
@@ -399,6 +484,16 @@ on_client_created (GObject      *source_object,
                 gclue_client_set_time_threshold
                         (priv->client, priv->time_threshold);
         }
+        if (priv->inline_location) {
+                g_autoptr (GVariant) supported = NULL;
+
+                /* Older services don't have the property and would warn
+                 * about setting it */
+                supported = g_dbus_proxy_get_cached_property
+                        (G_DBUS_PROXY (priv->client), "InlineLocation");
+                if (supported != NULL)
+                        gclue_client_set_inline_location (priv->client, TRUE);
+        }
 
         priv->task = g_steal_pointer (&task);
         g_object_add_weak_pointer (G_OBJECT (priv->task), (gpointer*) &priv->task);
@@ -408,6 +503,11 @@ on_client_created (GObject      *source_object,
                                  G_CALLBACK (on_location_updated),
                                  simple,
                                  G_CONNECT_DEFAULT);
+        g_signal_connect_object (priv->client,
+                                 "inline-location-updated",
+                                 G_CALLBACK (on_inline_location_updated),
+                                 simple,
+                                 G_CONNECT_DEFAULT);
 
         gclue_client_call_start (priv->client,
                                  g_task_get_cancellable (priv->task),
@@ -476,44 +576,7 @@ on_portal_location_updated (XdpLocation *portal,
                             GVariant *data,
                             gpointer user_data)
 {
-        GClueSimple *simple = user_data;
-        GClueSimplePrivate *priv = simple->priv;
-        double latitude;
-        double longitude;
-        double altitude;
-        double accuracy;
-        double speed;
-        double heading;
-        const char *description;
-        GVariant *timestamp;
-        g_autoptr (GClueLocation) location = gclue_location_skeleton_new ();
-
-        g_variant_lookup (data, "Latitude", "d", &latitude);
-        g_variant_lookup (data, "Longitude", "d", &longitude);
-        g_variant_lookup (data, "Altitude", "d", &altitude);
-        g_variant_lookup (data, "Accuracy", "d", &accuracy);
-        g_variant_lookup (data, "Speed", "d", &speed);
-        g_variant_lookup (data, "Heading", "d", &heading);
-        g_variant_lookup (data, "Description", "&s", &description);
-        g_variant_lookup (data, "Timestamp", "@(tt)", &timestamp);
-
-        gclue_location_set_latitude (location, latitude);
-        gclue_location_set_longitude (location, longitude);
-        gclue_location_set_altitude (location, altitude);
-        gclue_location_set_accuracy (location, accuracy);
-        gclue_location_set_speed (location, speed);
-        gclue_location_set_heading (location, heading);
-        gclue_location_set_description (location, description);
-        gclue_location_set_timestamp (location, timestamp);
-
-        g_set_object (&priv->location, location);
-
-        if (priv->task) {
-                g_task_return_boolean (priv->task, TRUE);
-        }
-        else {
-                g_object_notify (G_OBJECT (simple), "location");
-        }
+        set_location_from_variant (GCLUE_SIMPLE (user_data), data);
 }
 
 static void
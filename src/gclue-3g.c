@@ -71,10 +71,14 @@ static SoupMessage *
 gclue_3g_create_query (GClueWebSource *web,
                        const char **query_data_description,
                        GError        **error);
-static SoupMessage *
-gclue_3g_create_submit_query (GClueWebSource  *web,
-                              GClueLocation   *location,
-                              GError         **error);
+static GClueLocation *
+gclue_3g_locate_offline (GClueWebSource *web,
+                         GClueOfflineDB *db,
+                         GError        **error);
+static JsonNode *
+gclue_3g_create_submit_item (GClueWebSource  *web,
+                             GClueLocation   *location,
+                             GError         **error);
 static GClueAccuracyLevel
 gclue_3g_get_available_accuracy_level (GClueWebSource *web,
                                        gboolean available);
@@ -140,15 +144,6 @@ gclue_3g_parse_response (GClueWebSource *source,
         return gclue_mozilla_parse_response (content, location_description, error);
 }
 
-static gboolean
-gclue_3g_parse_submit_response (GClueWebSource *source,
-                                const char     *content,
-                                gint            status_code,
-                                GError        **error)
-{
-        return gclue_mozilla_parse_submit_response (content, status_code, error);
-}
-
 static void
 gclue_3g_finalize (GObject *g3g)
 {
@@ -182,9 +177,9 @@ gclue_3g_class_init (GClue3GClass *klass)
         source_class->start = gclue_3g_start;
         source_class->stop = gclue_3g_stop;
         web_class->create_query = gclue_3g_create_query;
+        web_class->locate_offline = gclue_3g_locate_offline;
         web_class->parse_response = gclue_3g_parse_response;
-        web_class->create_submit_query = gclue_3g_create_submit_query;
-        web_class->parse_submit_response = gclue_3g_parse_submit_response;
+        web_class->create_submit_item = gclue_3g_create_submit_item;
         web_class->get_available_accuracy_level =
                 gclue_3g_get_available_accuracy_level;
 }
@@ -293,13 +288,32 @@ gclue_3g_create_query (GClueWebSource *web,
                                            query_data_description, error);
 }
 
-static SoupMessage *
-gclue_3g_create_submit_query (GClueWebSource  *web,
-                              GClueLocation   *location,
-                              GError         **error)
+static GClueLocation *
+gclue_3g_locate_offline (GClueWebSource *web,
+                         GClueOfflineDB *db,
+                         GError        **error)
+{
+        GClue3G *g3g = GCLUE_3G (web);
+
+        if (!gclue_mozilla_has_tower (g3g->priv->mozilla)) {
+                g_set_error_literal (error,
+                                     G_IO_ERROR,
+                                     G_IO_ERROR_NOT_INITIALIZED,
+                                     "3GPP cell tower info unavailable");
+                return NULL;
+        }
+
+        return gclue_mozilla_locate_offline (g3g->priv->mozilla, db,
+                                             FALSE, g3g_should_skip_bsss (g3g),
+                                             error);
+}
+
+static JsonNode *
+gclue_3g_create_submit_item (GClueWebSource  *web,
+                             GClueLocation   *location,
+                             GError         **error)
 {
         GClue3GPrivate *priv = GCLUE_3G (web)->priv;
-        const char *submit_url;
         GClueConfig *config = gclue_config_get_singleton ();
 
         if (!gclue_config_get_wifi_submit_data (config))
@@ -313,11 +327,9 @@ gclue_3g_create_submit_query (GClueWebSource  *web,
                 return NULL; /* Not initialized yet */
         }
 
-        submit_url = gclue_web_source_get_submit_url (web);
-        return gclue_mozilla_create_submit_query (priv->mozilla,
-                                                  submit_url,
-                                                  location,
-                                                  error);
+        return gclue_mozilla_create_submit_item (priv->mozilla,
+                                                 location,
+                                                 error);
 }
 
 static GClueAccuracyLevel
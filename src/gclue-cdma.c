@@ -205,7 +205,7 @@ on_fix_cdma (GClueModem *modem,
 
         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (user_data),
                                             location);
-        g_object_unref (location);
+        gclue_location_unref (location);
 }
 
 static GClueLocationSourceStartResult
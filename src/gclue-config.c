@@ -39,22 +39,33 @@ struct _GClueConfigPrivate
         char **agents;
         gsize num_agents;
 
+        gboolean locator_fusion;
+        guint locator_prediction_interval;
+
         char *wifi_url;
         gboolean wifi_submit;
         gboolean enable_nmea_source;
         gboolean enable_3g_source;
         gboolean enable_cdma_source;
         gboolean enable_modem_gps_source;
+        gboolean modem_gps_duty_cycle;
         gboolean enable_wifi_source;
         gboolean enable_compass;
         gboolean enable_static_source;
         gboolean enable_ip_source;
         char *wifi_submit_url;
         char *wifi_submit_nick;
+        gboolean wifi_persistent_cache;
+        guint wifi_cache_max_entries;
+        guint wifi_cache_max_memory;
+        char *wifi_offline_database;
+        gboolean wifi_learn_locations;
         char *nmea_socket;
+        guint nmea_max_services;
         char *ip_method;
         char *ip_url;
         double ip_accuracy;
+        gboolean ip_cache;
 
         GList *app_configs;
 };
@@ -93,6 +104,7 @@ gclue_config_finalize (GObject *object)
         g_clear_pointer (&priv->wifi_url, g_free);
         g_clear_pointer (&priv->wifi_submit_url, g_free);
         g_clear_pointer (&priv->wifi_submit_nick, g_free);
+        g_clear_pointer (&priv->wifi_offline_database, g_free);
         g_clear_pointer (&priv->nmea_socket, g_free);
         g_clear_pointer (&priv->ip_method, g_free);
 
@@ -137,6 +149,37 @@ load_boolean_value (GClueConfig *config,
         return FALSE;
 }
 
+static gboolean
+load_uint_value (GClueConfig *config,
+                 const gchar *group_name,
+                 const gchar *key,
+                 guint       *value_storage)
+{
+        GClueConfigPrivate *priv = config->priv;
+
+        g_return_val_if_fail (value_storage != NULL, FALSE);
+
+        if (g_key_file_has_key (priv->key_file, group_name, key, NULL)) {
+                g_autoptr(GError) error = NULL;
+                guint64 value =
+                        g_key_file_get_uint64 (priv->key_file,
+                                               group_name, key,
+                                               &error);
+                if (error == NULL && value <= G_MAXUINT) {
+                        *value_storage = value;
+                        return TRUE;
+                } else if (error == NULL)
+                        g_warning ("Failed to get config \"%s/%s\": "
+                                   "value out of range",
+                                   group_name, key);
+                else
+                        g_warning ("Failed to get config \"%s/%s\": %s",
+                                   group_name, key, error->message);
+        }
+
+        return FALSE;
+}
+
 static gboolean
 load_string_value (GClueConfig  *config,
                    const gchar  *group_name,
@@ -205,10 +248,19 @@ load_agent_config (GClueConfig *config)
                                 &config->priv->num_agents);
 }
 
+static void
+load_locator_config (GClueConfig *config)
+{
+        load_boolean_value (config, "locator", "fusion",
+                            &config->priv->locator_fusion);
+        load_uint_value (config, "locator", "prediction-interval",
+                         &config->priv->locator_prediction_interval);
+}
+
 static void
 load_app_configs (GClueConfig *config)
 {
-        const char *known_groups[] = { "agent", "wifi", "3g", "cdma",
+        const char *known_groups[] = { "agent", "locator", "wifi", "3g", "cdma",
                                        "modem-gps", "network-nmea", "compass",
                                        "static-source", "ip", NULL };
         GClueConfigPrivate *priv = config->priv;
@@ -335,6 +387,8 @@ load_enable_source (GClueConfig *config,
 }
 
 #define DEFAULT_WIFI_SUBMIT_NICK "geoclue"
+#define DEFAULT_WIFI_CACHE_MAX_ENTRIES 10000
+#define DEFAULT_WIFI_CACHE_MAX_MEMORY 8192
 
 static void
 load_wifi_config (GClueConfig *config)
@@ -367,6 +421,20 @@ load_wifi_config (GClueConfig *config)
                         g_warning ("\"wifi/submission-nick\" must be empty "
                                    "or between 2 to 32 characters long");
         }
+
+        load_boolean_value (config, "wifi", "persistent-cache",
+                            &priv->wifi_persistent_cache);
+        load_uint_value (config, "wifi", "cache-max-entries",
+                         &priv->wifi_cache_max_entries);
+        load_uint_value (config, "wifi", "cache-max-memory",
+                         &priv->wifi_cache_max_memory);
+
+        load_string_value (config, "wifi", "offline-database",
+                           &priv->wifi_offline_database);
+        if (priv->wifi_offline_database && priv->wifi_offline_database[0] == '\0')
+                g_clear_pointer (&priv->wifi_offline_database, g_free);
+        load_boolean_value (config, "wifi", "learn-locations",
+                            &priv->wifi_learn_locations);
 }
 
 static void
@@ -388,6 +456,8 @@ load_modem_gps_config (GClueConfig *config)
 {
         load_enable_source (config, "modem-gps", GCLUE_USE_MODEM_GPS_SOURCE,
                             &config->priv->enable_modem_gps_source);
+        load_boolean_value (config, "modem-gps", "duty-cycle",
+                            &config->priv->modem_gps_duty_cycle);
 }
 
 static void
@@ -397,6 +467,13 @@ load_network_nmea_config (GClueConfig *config)
                             &config->priv->enable_nmea_source);
         load_string_value (config, "network-nmea", "nmea-socket",
                            &config->priv->nmea_socket);
+        load_uint_value (config, "network-nmea", "max-services",
+                         &config->priv->nmea_max_services);
+        if (config->priv->nmea_max_services == 0) {
+                g_warning ("Config \"network-nmea/max-services\" must be at "
+                           "least 1");
+                config->priv->nmea_max_services = 1;
+        }
 }
 
 static void
@@ -425,6 +502,8 @@ load_ip_source_config (GClueConfig *config)
 
         load_string_value (config, "ip", "url", &priv->ip_url);
 
+        load_boolean_value (config, "ip", "cache", &priv->ip_cache);
+
         if (g_key_file_has_key (priv->key_file, "ip", "accuracy", NULL)) {
                 g_autoptr(GError) error = NULL;
                 double value = g_key_file_get_double (priv->key_file,
@@ -455,6 +534,7 @@ load_config_file (GClueConfig *config, const char *path) {
         }
 
         load_agent_config (config);
+        load_locator_config (config);
         load_app_configs (config);
         load_wifi_config (config);
         load_3g_config (config);
@@ -534,16 +614,27 @@ gclue_config_print (GClueConfig *config)
                         g_debug ("\t%s", priv->agents[i]);
         } else
                 g_debug ("Allowed agents: none");
+        g_debug ("Location fusion: %s",
+                 enabled_disabled (priv->locator_fusion));
+        if (priv->locator_prediction_interval > 0)
+                g_debug ("Location prediction interval: %u s",
+                         priv->locator_prediction_interval);
+        else
+                g_debug ("Location prediction: disabled");
         g_debug ("Network NMEA source: %s",
                  enabled_disabled (priv->enable_nmea_source));
         g_debug ("\tNetwork NMEA socket: %s",
                  string_or_none (priv->nmea_socket));
+        g_debug ("\tNetwork NMEA max services: %u",
+                 priv->nmea_max_services);
         g_debug ("3G source: %s",
                  enabled_disabled (priv->enable_3g_source));
         g_debug ("CDMA source: %s",
                  enabled_disabled (priv->enable_cdma_source));
         g_debug ("Modem GPS source: %s",
                  enabled_disabled (priv->enable_modem_gps_source));
+        g_debug ("\tModem GPS duty cycling: %s",
+                 enabled_disabled (priv->modem_gps_duty_cycle));
         g_debug ("WiFi source: %s",
                  enabled_disabled (priv->enable_wifi_source));
         {
@@ -562,6 +653,16 @@ gclue_config_print (GClueConfig *config)
                  enabled_disabled (priv->wifi_submit));
         g_debug ("\tWiFi submission nickname: %s",
                  string_or_none (priv->wifi_submit_nick));
+        g_debug ("\tWiFi persistent cache: %s",
+                 enabled_disabled (priv->wifi_persistent_cache));
+        g_debug ("\tWiFi cache max entries: %u",
+                 priv->wifi_cache_max_entries);
+        g_debug ("\tWiFi cache max memory: %u KiB",
+                 priv->wifi_cache_max_memory);
+        g_debug ("\tWiFi offline database: %s",
+                 string_or_none (priv->wifi_offline_database));
+        g_debug ("\tWiFi learn locations: %s",
+                 enabled_disabled (priv->wifi_learn_locations));
         g_debug ("Static source: %s",
                  enabled_disabled (priv->enable_static_source));
         g_debug ("IP source: %s",
@@ -574,6 +675,8 @@ gclue_config_print (GClueConfig *config)
                 g_debug ("\tIP accuracy: %g", priv->ip_accuracy);
         else
                 g_debug ("\tIP accuracy: (method default)");
+        g_debug ("\tIP cache: %s",
+                 enabled_disabled (priv->ip_cache));
         g_debug ("Compass: %s",
                  enabled_disabled (priv->enable_compass));
         g_debug ("Application configs:");
@@ -605,6 +708,7 @@ gclue_config_init (GClueConfig *config)
 
         /* Sources should be enabled by default */
         priv->enable_nmea_source = TRUE;
+        priv->nmea_max_services = 1;
         priv->enable_3g_source = TRUE;
         priv->enable_cdma_source = TRUE;
         priv->enable_modem_gps_source = TRUE;
@@ -617,8 +721,12 @@ gclue_config_init (GClueConfig *config)
         priv->wifi_url = g_strdup (DEFAULT_WIFI_URL);
         priv->wifi_submit_url = g_strdup (DEFAULT_WIFI_SUBMIT_URL);
         priv->wifi_submit_nick = g_strdup (DEFAULT_WIFI_SUBMIT_NICK);
+        priv->wifi_persistent_cache = TRUE;
+        priv->wifi_cache_max_entries = DEFAULT_WIFI_CACHE_MAX_ENTRIES;
+        priv->wifi_cache_max_memory = DEFAULT_WIFI_CACHE_MAX_MEMORY;
         priv->ip_url = NULL;
         priv->ip_accuracy = GCLUE_LOCATION_ACCURACY_UNKNOWN;
+        priv->ip_cache = FALSE;
 
         /* Load config file from default path, log all missing parameters */
         priv->key_file = g_key_file_new ();
@@ -786,6 +894,12 @@ gclue_config_get_nmea_socket (GClueConfig *config)
         return config->priv->nmea_socket;
 }
 
+guint
+gclue_config_get_nmea_max_services (GClueConfig *config)
+{
+        return config->priv->nmea_max_services;
+}
+
 const char *
 gclue_config_get_wifi_url (GClueConfig *config)
 {
@@ -825,6 +939,49 @@ gclue_config_set_wifi_submit_data (GClueConfig *config,
         config->priv->wifi_submit = submit;
 }
 
+gboolean
+gclue_config_get_wifi_persistent_cache (GClueConfig *config)
+{
+        return config->priv->wifi_persistent_cache;
+}
+
+guint
+gclue_config_get_wifi_cache_max_entries (GClueConfig *config)
+{
+        return config->priv->wifi_cache_max_entries;
+}
+
+/* In KiB. */
+guint
+gclue_config_get_wifi_cache_max_memory (GClueConfig *config)
+{
+        return config->priv->wifi_cache_max_memory;
+}
+
+const char *
+gclue_config_get_wifi_offline_database (GClueConfig *config)
+{
+        return config->priv->wifi_offline_database;
+}
+
+gboolean
+gclue_config_get_wifi_learn_locations (GClueConfig *config)
+{
+        return config->priv->wifi_learn_locations;
+}
+
+gboolean
+gclue_config_get_locator_fusion (GClueConfig *config)
+{
+        return config->priv->locator_fusion;
+}
+
+guint
+gclue_config_get_locator_prediction_interval (GClueConfig *config)
+{
+        return config->priv->locator_prediction_interval;
+}
+
 gboolean
 gclue_config_get_enable_wifi_source (GClueConfig *config)
 {
@@ -843,6 +1000,12 @@ gclue_config_get_enable_modem_gps_source (GClueConfig *config)
         return config->priv->enable_modem_gps_source;
 }
 
+gboolean
+gclue_config_get_modem_gps_duty_cycle (GClueConfig *config)
+{
+        return config->priv->modem_gps_duty_cycle;
+}
+
 gboolean
 gclue_config_get_enable_cdma_source (GClueConfig *config)
 {
@@ -898,3 +1061,9 @@ gclue_config_get_ip_accuracy (GClueConfig *config)
 {
         return config->priv->ip_accuracy;
 }
+
+gboolean
+gclue_config_get_ip_cache (GClueConfig *config)
+{
+        return config->priv->ip_cache;
+}
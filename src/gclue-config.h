@@ -74,6 +74,7 @@ GClueAppPerm        gclue_config_get_app_perm           (GClueConfig     *config
 gboolean            gclue_config_is_system_component    (GClueConfig     *config,
                                                          const char      *desktop_id);
 const char *        gclue_config_get_nmea_socket        (GClueConfig     *config);
+guint               gclue_config_get_nmea_max_services  (GClueConfig     *config);
 void                gclue_config_set_nmea_socket        (GClueConfig     *config,
                                                          const char  *nmea_socket);
 
@@ -85,14 +86,30 @@ void                gclue_config_set_wifi_submit_nick   (GClueConfig     *config
 gboolean            gclue_config_get_wifi_submit_data   (GClueConfig     *config);
 void                gclue_config_set_wifi_submit_data   (GClueConfig     *config,
                                                          gboolean         submit);
+gboolean            gclue_config_get_wifi_persistent_cache
+                                                        (GClueConfig     *config);
+guint               gclue_config_get_wifi_cache_max_entries
+                                                        (GClueConfig     *config);
+guint               gclue_config_get_wifi_cache_max_memory
+                                                        (GClueConfig     *config);
+const char *        gclue_config_get_wifi_offline_database
+                                                        (GClueConfig     *config);
+gboolean            gclue_config_get_wifi_learn_locations
+                                                        (GClueConfig     *config);
+gboolean            gclue_config_get_locator_fusion     (GClueConfig     *config);
+guint               gclue_config_get_locator_prediction_interval
+                                                        (GClueConfig     *config);
 const char *        gclue_config_get_ip_method          (GClueConfig     *config);
 const char *        gclue_config_get_ip_url             (GClueConfig     *config);
 double              gclue_config_get_ip_accuracy        (GClueConfig     *config);
+gboolean            gclue_config_get_ip_cache           (GClueConfig     *config);
 gboolean            gclue_config_get_enable_wifi_source (GClueConfig     *config);
 gboolean            gclue_config_get_enable_3g_source   (GClueConfig     *config);
 gboolean            gclue_config_get_enable_cdma_source (GClueConfig     *config);
 gboolean            gclue_config_get_enable_modem_gps_source
                                                         (GClueConfig     *config);
+gboolean            gclue_config_get_modem_gps_duty_cycle
+                                                        (GClueConfig     *config);
 gboolean            gclue_config_get_enable_nmea_source (GClueConfig     *config);
 gboolean            gclue_config_get_enable_compass     (GClueConfig     *config);
 gboolean            gclue_config_get_enable_static_source
@@ -0,0 +1,1037 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * geoclue-db-compile turns CSV dumps of WiFi AP and cell tower positions into
+ * the offline database read by the daemon.
+ *
+ * The rows are collected into chunks of bounded size, each sorted and
+ * written to a temporary file next to the output, and then all of these are
+ * merged in a single pass (an external merge sort). An existing database can
+ * take part in the merge, so updates don't need the full dumps again. When
+ * the same network appears several times, the last one read wins, the
+ * existing database being read first.
+ *
+ * The output is written to a temporary file that is then renamed over the
+ * destination, so a running daemon never sees a partial file.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gio/gunixinputstream.h>
+
+#include "gclue-3g-tower.h"
+#include "gclue-offline-db-format.h"
+
+#define MAX_RECORD_SIZE GCLUE_OFFLINE_DB_CELL_RECORD_SIZE
+#define MAX_INDEX_ENTRY_SIZE GCLUE_OFFLINE_DB_CELL_INDEX_ENTRY_SIZE
+#define MAX_COLUMNS 64
+#define IO_BUFFER_SIZE (1024 * 1024)
+
+/* Commandline options */
+static char *output_path = NULL;
+static char *merge_path = NULL;
+static gint memory_limit = 512; /* MiB */
+static gint block_records = GCLUE_OFFLINE_DB_DEFAULT_BLOCK_RECORDS;
+static char **input_paths = NULL;
+
+static GOptionEntry entries[] =
+{
+        { "output",
+          'o',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &output_path,
+          N_("Write the database to FILE"),
+          "FILE" },
+        { "merge",
+          'm',
+          0,
+          G_OPTION_ARG_FILENAME,
+          &merge_path,
+          N_("Merge the CSV data into the existing database FILE, "
+             "the CSV data taking precedence. Can be the output file"),
+          "FILE" },
+        { "memory",
+          'M',
+          0,
+          G_OPTION_ARG_INT,
+          &memory_limit,
+          N_("Use about M MiB of memory for sorting. Default: 512"),
+          "M" },
+        { "block-records",
+          'b',
+          0,
+          G_OPTION_ARG_INT,
+          &block_records,
+          N_("Index every N records. Default: 256"),
+          "N" },
+        { G_OPTION_REMAINING,
+          0,
+          0,
+          G_OPTION_ARG_FILENAME_ARRAY,
+          &input_paths,
+          NULL,
+          NULL },
+        { NULL }
+};
+
+typedef enum {
+        TABLE_WIFI,
+        TABLE_CELL,
+        N_TABLES
+} TableType;
+
+typedef struct {
+        const char *name;
+        gsize record_size;
+        gsize key_size;
+        gsize index_entry_size;
+} TableInfo;
+
+static const TableInfo tables_info[N_TABLES] = {
+        { "WiFi APs",
+          GCLUE_OFFLINE_DB_WIFI_RECORD_SIZE,
+          GCLUE_OFFLINE_DB_WIFI_KEY_SIZE,
+          GCLUE_OFFLINE_DB_WIFI_INDEX_ENTRY_SIZE },
+        { "cells",
+          GCLUE_OFFLINE_DB_CELL_RECORD_SIZE,
+          GCLUE_OFFLINE_DB_CELL_KEY_SIZE,
+          GCLUE_OFFLINE_DB_CELL_INDEX_ENTRY_SIZE },
+};
+
+/* A sorted sequence of records without duplicate keys, either in a
+ * temporary file or in memory. */
+typedef struct {
+        guint age; /* Runs with a higher age are newer */
+        FILE *stream;
+        const guint8 *data;
+        guint64 n_records;
+        guint8 record[MAX_RECORD_SIZE];
+} Run;
+
+typedef struct {
+        const TableInfo *info;
+        GByteArray *chunk; /* Not sorted yet */
+        GPtrArray *runs;   /* (element-type Run) */
+        guint64 n_records;
+} Table;
+
+typedef struct {
+        Table tables[N_TABLES];
+        gsize chunk_limit;
+        char *tmp_template;
+        GMappedFile *merge_file;
+} Compiler;
+
+typedef struct {
+        FILE *stream;
+        GChecksum *checksum;
+        guint64 offset;
+} Output;
+
+typedef struct {
+        TableType type;
+        guint n_columns;
+        gint bssid;
+        gint radio;
+        gint mcc;
+        gint mnc;
+        gint lac;
+        gint cell_id;
+        gint latitude;
+        gint longitude;
+        gint range;
+} CsvColumns;
+
+static void
+set_error_from_errno (GError    **error,
+                      const char *message)
+{
+        int saved_errno = errno;
+
+        g_set_error (error,
+                     G_IO_ERROR,
+                     g_io_error_from_errno (saved_errno),
+                     "%s: %s",
+                     message,
+                     g_strerror (saved_errno));
+}
+
+static void
+run_free (Run *run)
+{
+        if (run->stream)
+                fclose (run->stream);
+        g_free (run);
+}
+
+static Run *
+table_add_run (Table *table)
+{
+        Run *run = g_new0 (Run, 1);
+
+        run->age = table->runs->len;
+        g_ptr_array_add (table->runs, run);
+
+        return run;
+}
+
+/* Returns FALSE at the end of @run or on error */
+static gboolean
+run_read (Run     *run,
+          gsize    record_size,
+          GError **error)
+{
+        if (run->n_records == 0)
+                return FALSE;
+
+        if (run->stream) {
+                if (fread (run->record, record_size, 1, run->stream) != 1) {
+                        set_error_from_errno (error, "Failed to read temporary file");
+                        return FALSE;
+                }
+        } else {
+                memcpy (run->record, run->data, record_size);
+                run->data += record_size;
+        }
+        run->n_records--;
+
+        return TRUE;
+}
+
+static gint
+compare_keys (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+        return memcmp (a, b, GPOINTER_TO_SIZE (user_data));
+}
+
+/* Sorts the chunk and removes duplicates from it, keeping the last one */
+static guint64
+table_sort_chunk (Table *table)
+{
+        const TableInfo *info = table->info;
+        guint8 *data = table->chunk->data;
+        gsize size = info->record_size;
+        guint64 n_records = table->chunk->len / size;
+        guint64 i, n_unique = 0;
+
+        /* Needs to be stable, for the last duplicate to stay last */
+#if GLIB_CHECK_VERSION (2, 82, 0)
+        g_sort_array (data, n_records, size,
+                      compare_keys, GSIZE_TO_POINTER (info->key_size));
+#else
+        g_qsort_with_data (data, n_records, size,
+                           compare_keys, GSIZE_TO_POINTER (info->key_size));
+#endif
+
+        for (i = 0; i < n_records; i++) {
+                guint8 *record = data + i * size;
+
+                if (i + 1 < n_records &&
+                    memcmp (record, record + size, info->key_size) == 0)
+                        continue;
+
+                if (n_unique != i)
+                        memmove (data + n_unique * size, record, size);
+                n_unique++;
+        }
+        g_byte_array_set_size (table->chunk, n_unique * size);
+
+        return n_unique;
+}
+
+static gboolean
+table_flush_chunk (Compiler *compiler,
+                   Table    *table,
+                   GError  **error)
+{
+        g_autofree char *path = g_strdup (compiler->tmp_template);
+        guint64 n_records;
+        FILE *stream;
+        Run *run;
+        int fd;
+
+        n_records = table_sort_chunk (table);
+        if (n_records == 0)
+                return TRUE;
+
+        fd = g_mkstemp (path);
+        if (fd < 0) {
+                set_error_from_errno (error, "Failed to create temporary file");
+                return FALSE;
+        }
+        /* Only needed as long as it's open */
+        g_unlink (path);
+
+        stream = fdopen (fd, "w+b");
+        if (stream == NULL) {
+                set_error_from_errno (error, "Failed to open temporary file");
+                close (fd);
+                return FALSE;
+        }
+
+        run = table_add_run (table);
+        run->stream = stream;
+        run->n_records = n_records;
+
+        if (fwrite (table->chunk->data, table->info->record_size,
+                    n_records, stream) != n_records ||
+            fflush (stream) != 0 ||
+            fseek (stream, 0, SEEK_SET) != 0) {
+                set_error_from_errno (error, "Failed to write temporary file");
+                return FALSE;
+        }
+
+        g_byte_array_set_size (table->chunk, 0);
+
+        return TRUE;
+}
+
+static gboolean
+compiler_add_record (Compiler     *compiler,
+                     TableType     type,
+                     const guint8 *record,
+                     GError      **error)
+{
+        Table *table = &compiler->tables[type];
+
+        g_byte_array_append (table->chunk, record, table->info->record_size);
+        if (table->chunk->len < compiler->chunk_limit)
+                return TRUE;
+
+        return table_flush_chunk (compiler, table, error);
+}
+
+static gboolean
+compiler_load_merge_file (Compiler   *compiler,
+                          const char *path,
+                          GError    **error)
+{
+        GClueOfflineDBHeader header;
+        const guint8 *data;
+        Run *run;
+
+        compiler->merge_file = g_mapped_file_new (path, FALSE, error);
+        if (compiler->merge_file == NULL)
+                return FALSE;
+
+        data = (const guint8 *) g_mapped_file_get_contents (compiler->merge_file);
+        if (!gclue_offline_db_header_read (data,
+                                           g_mapped_file_get_length (compiler->merge_file),
+                                           &header,
+                                           TRUE,
+                                           error)) {
+                g_prefix_error (error, "%s: ", path);
+                return FALSE;
+        }
+
+        run = table_add_run (&compiler->tables[TABLE_WIFI]);
+        run->data = data + header.wifi_offset;
+        run->n_records = header.n_wifi;
+
+        run = table_add_run (&compiler->tables[TABLE_CELL]);
+        run->data = data + header.cell_offset;
+        run->n_records = header.n_cells;
+
+        g_print ("%s: %u WiFi APs, %u cells\n",
+                 path, header.n_wifi, header.n_cells);
+
+        return TRUE;
+}
+
+static gint
+find_column (char              **fields,
+             guint               n_fields,
+             const char * const *names)
+{
+        guint i, j;
+
+        for (i = 0; i < n_fields; i++) {
+                for (j = 0; names[j] != NULL; j++) {
+                        if (g_ascii_strcasecmp (fields[i], names[j]) == 0)
+                                return i;
+                }
+        }
+
+        return -1;
+}
+
+/* Splits @line in place */
+static guint
+split_fields (char  *line,
+              char **fields)
+{
+        guint n_fields = 0;
+        char *field = line;
+
+        while (n_fields < MAX_COLUMNS) {
+                char *end = strchr (field, ',');
+                gsize len;
+
+                if (end != NULL)
+                        *end = '\0';
+
+                g_strstrip (field);
+                len = strlen (field);
+                if (len >= 2 && field[0] == '"' && field[len - 1] == '"') {
+                        field[len - 1] = '\0';
+                        field++;
+                }
+                fields[n_fields++] = field;
+
+                if (end == NULL)
+                        break;
+                field = end + 1;
+        }
+
+        return n_fields;
+}
+
+#define UPDATE_N_COLUMNS(columns, column) \
+        (columns)->n_columns = MAX ((columns)->n_columns, (guint) (column) + 1)
+
+static gboolean
+parse_header (char       *line,
+              CsvColumns *columns,
+              GError    **error)
+{
+        static const char * const bssid_names[] = { "bssid", "mac", "macaddress", NULL };
+        static const char * const radio_names[] = { "radio", "radiotype", NULL };
+        static const char * const mcc_names[] = { "mcc", NULL };
+        static const char * const mnc_names[] = { "mnc", "net", NULL };
+        static const char * const lac_names[] = { "lac", "area", "tac", NULL };
+        static const char * const cell_id_names[] = { "cell", "cid", "cellid", NULL };
+        static const char * const latitude_names[] = { "lat", "latitude", NULL };
+        static const char * const longitude_names[] = { "lon", "lng", "longitude", NULL };
+        static const char * const range_names[] = { "range", "radius", "accuracy", NULL };
+        char *fields[MAX_COLUMNS];
+        guint n_fields;
+
+        n_fields = split_fields (line, fields);
+        memset (columns, 0, sizeof (CsvColumns));
+
+        columns->bssid = find_column (fields, n_fields, bssid_names);
+        columns->radio = find_column (fields, n_fields, radio_names);
+        columns->mcc = find_column (fields, n_fields, mcc_names);
+        columns->mnc = find_column (fields, n_fields, mnc_names);
+        columns->lac = find_column (fields, n_fields, lac_names);
+        columns->cell_id = find_column (fields, n_fields, cell_id_names);
+        columns->latitude = find_column (fields, n_fields, latitude_names);
+        columns->longitude = find_column (fields, n_fields, longitude_names);
+        columns->range = find_column (fields, n_fields, range_names);
+
+        if (columns->latitude < 0 || columns->longitude < 0)
+                goto unknown_format;
+        UPDATE_N_COLUMNS (columns, columns->latitude);
+        UPDATE_N_COLUMNS (columns, columns->longitude);
+        /* The range is optional */
+
+        if (columns->bssid >= 0) {
+                columns->type = TABLE_WIFI;
+                UPDATE_N_COLUMNS (columns, columns->bssid);
+        } else if (columns->radio >= 0 && columns->mcc >= 0 && columns->mnc >= 0 &&
+                   columns->lac >= 0 && columns->cell_id >= 0) {
+                columns->type = TABLE_CELL;
+                UPDATE_N_COLUMNS (columns, columns->radio);
+                UPDATE_N_COLUMNS (columns, columns->mcc);
+                UPDATE_N_COLUMNS (columns, columns->mnc);
+                UPDATE_N_COLUMNS (columns, columns->lac);
+                UPDATE_N_COLUMNS (columns, columns->cell_id);
+        } else
+                goto unknown_format;
+
+        return TRUE;
+
+unknown_format:
+        g_set_error_literal (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "CSV header has neither WiFi (bssid, lat, lon) "
+                             "nor cell (radio, mcc, net, area, cell, lat, lon) "
+                             "columns");
+        return FALSE;
+}
+
+static gboolean
+parse_bssid (const char *str,
+             guint8     *bssid)
+{
+        guint n_digits = 0;
+
+        for (; *str != '\0'; str++) {
+                int digit = g_ascii_xdigit_value (*str);
+
+                if (digit < 0) {
+                        if (*str == ':' || *str == '-' || *str == '.')
+                                continue;
+                        return FALSE;
+                }
+
+                if (n_digits == GCLUE_OFFLINE_DB_WIFI_KEY_SIZE * 2)
+                        return FALSE;
+
+                if (n_digits % 2 == 0)
+                        bssid[n_digits / 2] = digit << 4;
+                else
+                        bssid[n_digits / 2] |= digit;
+                n_digits++;
+        }
+
+        return n_digits == GCLUE_OFFLINE_DB_WIFI_KEY_SIZE * 2;
+}
+
+static GClueTowerTec
+parse_radio (const char *str)
+{
+        if (g_ascii_strcasecmp (str, "GSM") == 0)
+                return GCLUE_TOWER_TEC_2G;
+        if (g_ascii_strcasecmp (str, "UMTS") == 0 ||
+            g_ascii_strcasecmp (str, "WCDMA") == 0)
+                return GCLUE_TOWER_TEC_3G;
+        if (g_ascii_strcasecmp (str, "LTE") == 0)
+                return GCLUE_TOWER_TEC_4G;
+
+        /* CDMA uses other IDs, and others are never looked up */
+        return GCLUE_TOWER_TEC_UNKNOWN;
+}
+
+static gboolean
+parse_uint (const char *str,
+            guint64     max,
+            guint64    *value)
+{
+        return g_ascii_string_to_unsigned (str, 10, 0, max, value, NULL);
+}
+
+static gboolean
+parse_coordinate (const char *str,
+                  gdouble     limit,
+                  guint8     *data)
+{
+        char *end;
+        gdouble value;
+
+        value = g_ascii_strtod (str, &end);
+        if (end == str || *end != '\0' || !isfinite (value) ||
+            value < -limit || value > limit)
+                return FALSE;
+
+        gclue_offline_db_write_uint32
+                (data,
+                 (guint32) (gint32) round (value * GCLUE_OFFLINE_DB_COORDINATE_SCALE));
+
+        return TRUE;
+}
+
+/* The range is optional, and may have decimals */
+static guint32
+parse_range (char             **fields,
+             const CsvColumns  *columns,
+             guint32            max)
+{
+        gdouble range;
+
+        if (columns->range < 0 || (guint) columns->range >= columns->n_columns)
+                return 0;
+
+        range = g_ascii_strtod (fields[columns->range], NULL);
+        if (!(range > 0))
+                return 0;
+
+        return MIN (range, max);
+}
+
+static gboolean
+parse_wifi_row (char             **fields,
+                const CsvColumns  *columns,
+                guint8            *record)
+{
+        if (!parse_bssid (fields[columns->bssid], record) ||
+            !parse_coordinate (fields[columns->latitude], 90, record + 8) ||
+            !parse_coordinate (fields[columns->longitude], 180, record + 12))
+                return FALSE;
+
+        gclue_offline_db_write_uint16 (record + 6,
+                                       parse_range (fields, columns, G_MAXUINT16));
+
+        return TRUE;
+}
+
+static gboolean
+parse_cell_row (char             **fields,
+                const CsvColumns  *columns,
+                guint8            *record)
+{
+        GClueTowerTec tec;
+        guint64 mcc, mnc, lac, cell_id;
+
+        tec = parse_radio (fields[columns->radio]);
+        if (tec == GCLUE_TOWER_TEC_UNKNOWN ||
+            !parse_uint (fields[columns->mcc], 999, &mcc) ||
+            !parse_uint (fields[columns->mnc], 999, &mnc) ||
+            !parse_uint (fields[columns->lac], G_MAXUINT32, &lac) ||
+            !parse_uint (fields[columns->cell_id], G_MAXUINT32, &cell_id))
+                return FALSE;
+
+        memset (record, 0, GCLUE_OFFLINE_DB_CELL_RECORD_SIZE);
+        gclue_offline_db_write_uint16 (record, mcc);
+        gclue_offline_db_write_uint16 (record + 2, mnc);
+        gclue_offline_db_write_uint32 (record + 4, lac);
+        gclue_offline_db_write_uint32 (record + 8, cell_id);
+        record[GCLUE_OFFLINE_DB_CELL_ID_SIZE] = tec;
+        gclue_offline_db_write_uint32 (record + 16,
+                                       parse_range (fields, columns, G_MAXUINT32));
+
+        return parse_coordinate (fields[columns->latitude], 90, record + 20) &&
+               parse_coordinate (fields[columns->longitude], 180, record + 24);
+}
+
+static GInputStream *
+open_input (const char *path,
+            GError    **error)
+{
+        g_autoptr(GFile) file = NULL;
+
+        if (g_strcmp0 (path, "-") == 0)
+                return g_unix_input_stream_new (STDIN_FILENO, FALSE);
+
+        file = g_file_new_for_commandline_arg (path);
+
+        return G_INPUT_STREAM (g_file_read (file, NULL, error));
+}
+
+static gboolean
+compiler_import_csv (Compiler   *compiler,
+                     const char *path,
+                     GError    **error)
+{
+        g_autoptr(GInputStream) input = NULL;
+        g_autoptr(GDataInputStream) data_input = NULL;
+        g_autoptr(GError) local_error = NULL;
+        g_autofree char *header = NULL;
+        CsvColumns columns;
+        guint64 n_rows = 0, n_skipped = 0;
+        char *line;
+
+        input = open_input (path, error);
+        if (input == NULL)
+                return FALSE;
+
+        data_input = g_data_input_stream_new (input);
+        g_buffered_input_stream_set_buffer_size (G_BUFFERED_INPUT_STREAM (data_input),
+                                                 IO_BUFFER_SIZE);
+
+        header = g_data_input_stream_read_line (data_input, NULL, NULL, &local_error);
+        if (header == NULL) {
+                if (local_error == NULL)
+                        g_set_error_literal (&local_error,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_INVALID_DATA,
+                                             "Empty file");
+                goto error;
+        }
+
+        if (!parse_header (header, &columns, &local_error))
+                goto error;
+
+        while ((line = g_data_input_stream_read_line (data_input,
+                                                      NULL,
+                                                      NULL,
+                                                      &local_error))) {
+                char *fields[MAX_COLUMNS];
+                guint8 record[MAX_RECORD_SIZE];
+                gboolean valid;
+
+                n_rows++;
+                if (split_fields (line, fields) < columns.n_columns)
+                        valid = FALSE;
+                else if (columns.type == TABLE_WIFI)
+                        valid = parse_wifi_row (fields, &columns, record);
+                else
+                        valid = parse_cell_row (fields, &columns, record);
+                g_free (line);
+
+                if (!valid) {
+                        n_skipped++;
+                        continue;
+                }
+
+                if (!compiler_add_record (compiler, columns.type, record, error))
+                        return FALSE;
+        }
+        if (local_error != NULL)
+                goto error;
+
+        g_print ("%s: %" G_GUINT64_FORMAT " %s, %" G_GUINT64_FORMAT
+                 " invalid rows skipped\n",
+                 path, n_rows - n_skipped, tables_info[columns.type].name,
+                 n_skipped);
+
+        return TRUE;
+
+error:
+        g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                    "%s: ", path);
+        return FALSE;
+}
+
+static gboolean
+output_write (Output       *output,
+              const guint8 *data,
+              gsize         size,
+              GError      **error)
+{
+        if (fwrite (data, 1, size, output->stream) != size) {
+                set_error_from_errno (error, "Failed to write database");
+                return FALSE;
+        }
+
+        g_checksum_update (output->checksum, data, size);
+        output->offset += size;
+
+        return TRUE;
+}
+
+/* Whether @a should come out of the merge before @b. For equal keys, the
+ * newer run comes first so that its record is the one kept. */
+static gboolean
+run_before (const Run *a,
+            const Run *b,
+            gsize      key_size)
+{
+        int cmp = memcmp (a->record, b->record, key_size);
+
+        return cmp < 0 || (cmp == 0 && a->age > b->age);
+}
+
+static void
+heap_sift_down (Run   **heap,
+                guint   n_runs,
+                guint   i,
+                gsize   key_size)
+{
+        while (TRUE) {
+                guint first = i, left = 2 * i + 1, right = 2 * i + 2;
+                Run *tmp;
+
+                if (left < n_runs && run_before (heap[left], heap[first], key_size))
+                        first = left;
+                if (right < n_runs && run_before (heap[right], heap[first], key_size))
+                        first = right;
+                if (first == i)
+                        return;
+
+                tmp = heap[i];
+                heap[i] = heap[first];
+                heap[first] = tmp;
+                i = first;
+        }
+}
+
+/* Merges all the runs of @table into @output, also building its index */
+static gboolean
+table_merge (Table      *table,
+             Output     *output,
+             GByteArray *index,
+             GError    **error)
+{
+        const TableInfo *info = table->info;
+        g_autofree Run **heap = NULL;
+        g_autoptr(GError) local_error = NULL;
+        guint8 last_key[MAX_RECORD_SIZE];
+        guint n_runs = 0, i;
+
+        heap = g_new (Run *, table->runs->len);
+        for (i = 0; i < table->runs->len; i++) {
+                Run *run = g_ptr_array_index (table->runs, i);
+
+                if (run_read (run, info->record_size, &local_error)) {
+                        heap[n_runs++] = run;
+                } else if (local_error != NULL) {
+                        g_propagate_error (error, g_steal_pointer (&local_error));
+                        return FALSE;
+                }
+        }
+        for (i = n_runs / 2; i > 0; i--)
+                heap_sift_down (heap, n_runs, i - 1, info->key_size);
+
+        table->n_records = 0;
+        while (n_runs > 0) {
+                Run *run = heap[0];
+
+                /* Older duplicates come right after the newest one */
+                if (table->n_records == 0 ||
+                    memcmp (run->record, last_key, info->key_size) != 0) {
+                        if (table->n_records == G_MAXUINT32) {
+                                g_set_error (error,
+                                             G_IO_ERROR,
+                                             G_IO_ERROR_NO_SPACE,
+                                             "Too many %s",
+                                             info->name);
+                                return FALSE;
+                        }
+
+                        if (table->n_records % block_records == 0) {
+                                guint8 entry[MAX_INDEX_ENTRY_SIZE] = { 0 };
+
+                                memcpy (entry, run->record, info->key_size);
+                                g_byte_array_append (index, entry,
+                                                     info->index_entry_size);
+                        }
+
+                        if (!output_write (output, run->record,
+                                           info->record_size, error))
+                                return FALSE;
+
+                        memcpy (last_key, run->record, info->key_size);
+                        table->n_records++;
+                }
+
+                if (!run_read (run, info->record_size, &local_error)) {
+                        if (local_error != NULL) {
+                                g_propagate_error (error, g_steal_pointer (&local_error));
+                                return FALSE;
+                        }
+                        heap[0] = heap[--n_runs];
+                }
+                heap_sift_down (heap, n_runs, 0, info->key_size);
+        }
+
+        return TRUE;
+}
+
+static gboolean
+compiler_write (Compiler   *compiler,
+                const char *path,
+                GError    **error)
+{
+        g_autofree char *tmp_path = g_strdup_printf ("%s.XXXXXX", path);
+        g_autoptr(GChecksum) checksum = NULL;
+        GByteArray *indexes[N_TABLES] = { NULL, NULL };
+        guint8 header_data[GCLUE_OFFLINE_DB_HEADER_SIZE] = { 0 };
+        GClueOfflineDBHeader header;
+        Output output = { 0 };
+        guint i;
+        int fd;
+
+        fd = g_mkstemp (tmp_path);
+        if (fd < 0) {
+                set_error_from_errno (error, "Failed to create database");
+                return FALSE;
+        }
+
+        output.stream = fdopen (fd, "wb");
+        if (output.stream == NULL) {
+                set_error_from_errno (error, "Failed to open database");
+                close (fd);
+                goto error;
+        }
+        setvbuf (output.stream, NULL, _IOFBF, IO_BUFFER_SIZE);
+        checksum = g_checksum_new (GCLUE_OFFLINE_DB_CHECKSUM_TYPE);
+        output.checksum = checksum;
+
+        /* Written for real once everything else is */
+        if (fwrite (header_data, 1, sizeof (header_data), output.stream) != sizeof (header_data)) {
+                set_error_from_errno (error, "Failed to write database");
+                goto error;
+        }
+        output.offset = sizeof (header_data);
+
+        for (i = 0; i < N_TABLES; i++) {
+                Table *table = &compiler->tables[i];
+
+                indexes[i] = g_byte_array_new ();
+                if (!table_merge (table, &output, indexes[i], error))
+                        goto error;
+        }
+
+        for (i = 0; i < N_TABLES; i++) {
+                if (!output_write (&output, indexes[i]->data, indexes[i]->len, error))
+                        goto error;
+        }
+
+        gclue_offline_db_header_init (&header,
+                                      block_records,
+                                      compiler->tables[TABLE_WIFI].n_records,
+                                      compiler->tables[TABLE_CELL].n_records);
+        g_assert (header.size == output.offset);
+        gclue_offline_db_header_write (&header, checksum, header_data);
+
+        if (fseek (output.stream, 0, SEEK_SET) != 0 ||
+            fwrite (header_data, 1, sizeof (header_data), output.stream) != sizeof (header_data) ||
+            fflush (output.stream) != 0 ||
+            fsync (fileno (output.stream)) != 0) {
+                set_error_from_errno (error, "Failed to write database");
+                goto error;
+        }
+        fclose (g_steal_pointer (&output.stream));
+
+        if (g_chmod (tmp_path, 0644) != 0 ||
+            g_rename (tmp_path, path) != 0) {
+                set_error_from_errno (error, "Failed to replace database");
+                goto error;
+        }
+
+        g_print ("%s: %u WiFi APs, %u cells, %" G_GUINT64_FORMAT " bytes\n",
+                 path, header.n_wifi, header.n_cells, header.size);
+
+        for (i = 0; i < N_TABLES; i++)
+                g_byte_array_unref (indexes[i]);
+
+        return TRUE;
+
+error:
+        for (i = 0; i < N_TABLES; i++)
+                g_clear_pointer (&indexes[i], g_byte_array_unref);
+        g_clear_pointer (&output.stream, fclose);
+        g_unlink (tmp_path);
+        return FALSE;
+}
+
+static void
+compiler_init (Compiler   *compiler,
+               const char *output)
+{
+        g_autofree char *dir = g_path_get_dirname (output);
+        guint i;
+
+        /* Sorting may need as much memory again */
+        compiler->chunk_limit = MIN ((gsize) memory_limit * 1024 * 1024 / N_TABLES / 2,
+                                     G_MAXINT / 2);
+        compiler->tmp_template = g_build_filename (dir,
+                                                   ".geoclue-db-compile-XXXXXX",
+                                                   NULL);
+
+        for (i = 0; i < N_TABLES; i++) {
+                Table *table = &compiler->tables[i];
+
+                table->info = &tables_info[i];
+                table->chunk = g_byte_array_new ();
+                table->runs = g_ptr_array_new_with_free_func ((GDestroyNotify) run_free);
+        }
+}
+
+static void
+compiler_clear (Compiler *compiler)
+{
+        guint i;
+
+        for (i = 0; i < N_TABLES; i++) {
+                Table *table = &compiler->tables[i];
+
+                g_clear_pointer (&table->runs, g_ptr_array_unref);
+                g_clear_pointer (&table->chunk, g_byte_array_unref);
+        }
+
+        g_clear_pointer (&compiler->merge_file, g_mapped_file_unref);
+        g_clear_pointer (&compiler->tmp_template, g_free);
+}
+
+static gboolean
+compile (GError **error)
+{
+        Compiler compiler = { 0 };
+        gboolean ret = FALSE;
+        guint i;
+
+        compiler_init (&compiler, output_path);
+
+        /* First, so that anything else overrides it */
+        if (merge_path != NULL &&
+            !compiler_load_merge_file (&compiler, merge_path, error))
+                goto out;
+
+        for (i = 0; input_paths != NULL && input_paths[i] != NULL; i++) {
+                if (!compiler_import_csv (&compiler, input_paths[i], error))
+                        goto out;
+        }
+
+        /* What's left is merged straight from memory */
+        for (i = 0; i < N_TABLES; i++) {
+                Table *table = &compiler.tables[i];
+                Run *run;
+
+                run = table_add_run (table);
+                run->n_records = table_sort_chunk (table);
+                run->data = table->chunk->data;
+        }
+
+        ret = compiler_write (&compiler, output_path, error);
+
+out:
+        compiler_clear (&compiler);
+        return ret;
+}
+
+int
+main (int argc, char *argv[])
+{
+        g_autoptr(GOptionContext) context = NULL;
+        g_autoptr(GError) error = NULL;
+
+        setlocale (LC_ALL, "");
+        textdomain (GETTEXT_PACKAGE);
+        bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
+        bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+
+        context = g_option_context_new ("[FILE.csv…] - Compile an offline location database");
+        g_option_context_set_description
+                (context,
+                 "Each CSV file, or the standard input for \"-\", holds either WiFi\n"
+                 "APs with bssid, lat, lon and optionally range columns, or cells\n"
+                 "with radio, mcc, net, area, cell, lat, lon and optionally range\n"
+                 "columns, as in OpenCellID exports.\n");
+        g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+        if (!g_option_context_parse (context, &argc, &argv, &error)) {
+                g_printerr ("Option parsing failed: %s\n", error->message);
+                return EXIT_FAILURE;
+        }
+
+        if (output_path == NULL ||
+            ((input_paths == NULL || input_paths[0] == NULL) && merge_path == NULL)) {
+                g_autofree char *help = g_option_context_get_help (context, TRUE, NULL);
+
+                g_printerr ("%s", help);
+                return EXIT_FAILURE;
+        }
+
+        if (memory_limit < 1 || block_records < 1) {
+                g_printerr ("Memory and block size must be positive\n");
+                return EXIT_FAILURE;
+        }
+
+        if (!compile (&error)) {
+                g_printerr ("%s\n", error->message);
+                return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,398 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <math.h>
+#include <string.h>
+#include <json-glib/json-glib.h>
+#include "gclue-gnss-protocols.h"
+
+/**
+ * SECTION:gclue-gnss-protocols
+ * @short_description: Decoders of binary and JSON GNSS protocols
+ *
+ * Besides NMEA, network GNSS sources may send u-blox UBX or gpsd JSON. Both
+ * report a complete fix, with its accuracy, velocity and full date, in a
+ * single message, so there is no need to combine sentences or to guess the
+ * date.
+ **/
+
+#define UBX_NAV_PVT_LENGTH 92
+
+/* NAV-PVT fixType values */
+#define UBX_FIX_2D 2
+#define UBX_FIX_3D 3
+#define UBX_FIX_GNSS_DR 4
+
+/**
+ * gclue_gnss_protocol_detect:
+ * @data: the start of a stream
+ * @length: the length of @data
+ * @offset: (out): where the first message starts
+ *
+ * Guesses the protocol of a stream from the first message start found in
+ * @data: a '$' for NMEA, a '{' for gpsd, whose greeting is a JSON object,
+ * and the sync characters of UBX.
+ *
+ * Returns: the protocol, or %GCLUE_GNSS_PROTOCOL_UNKNOWN if there is no
+ * message start in @data.
+ **/
+GClueGNSSProtocol
+gclue_gnss_protocol_detect (const guint8 *data,
+                            gsize         length,
+                            gsize        *offset)
+{
+        gsize i;
+
+        for (i = 0; i < length; i++) {
+                *offset = i;
+
+                if (data[i] == '$')
+                        return GCLUE_GNSS_PROTOCOL_NMEA;
+                if (data[i] == '{')
+                        return GCLUE_GNSS_PROTOCOL_GPSD;
+                if (data[i] == GCLUE_UBX_SYNC_1 &&
+                    i + 1 < length && data[i + 1] == GCLUE_UBX_SYNC_2)
+                        return GCLUE_GNSS_PROTOCOL_UBX;
+        }
+
+        *offset = length;
+
+        return GCLUE_GNSS_PROTOCOL_UNKNOWN;
+}
+
+const char *
+gclue_gnss_protocol_to_string (GClueGNSSProtocol protocol)
+{
+        switch (protocol) {
+        case GCLUE_GNSS_PROTOCOL_NMEA:
+                return "NMEA";
+        case GCLUE_GNSS_PROTOCOL_UBX:
+                return "UBX";
+        case GCLUE_GNSS_PROTOCOL_GPSD:
+                return "gpsd";
+        default:
+                return "unknown";
+        }
+}
+
+/**
+ * gclue_ubx_frame_parse:
+ * @data: data starting with the UBX sync characters
+ * @length: the length of @data
+ * @frame_length: (out): the length of the whole frame
+ * @class: (out): the message class
+ * @id: (out): the message ID
+ * @payload: (out) (transfer none): the payload, pointing into @data
+ * @payload_length: (out): the length of @payload
+ *
+ * Parses the UBX frame at the start of @data and verifies its checksum.
+ * @frame_length is set as soon as the frame header is complete.
+ *
+ * Returns: %GCLUE_UBX_FRAME_INCOMPLETE if more data is needed,
+ * %GCLUE_UBX_FRAME_INVALID if @data doesn't start with a valid frame.
+ **/
+GClueUBXFrameResult
+gclue_ubx_frame_parse (const guint8  *data,
+                       gsize          length,
+                       gsize         *frame_length,
+                       guint8        *class,
+                       guint8        *id,
+                       const guint8 **payload,
+                       gsize         *payload_length)
+{
+        guint8 ck_a = 0, ck_b = 0;
+        gsize i;
+
+        if (length >= 1 && data[0] != GCLUE_UBX_SYNC_1)
+                return GCLUE_UBX_FRAME_INVALID;
+        if (length >= 2 && data[1] != GCLUE_UBX_SYNC_2)
+                return GCLUE_UBX_FRAME_INVALID;
+        if (length < 6)
+                return GCLUE_UBX_FRAME_INCOMPLETE;
+
+        *payload_length = data[4] | (data[5] << 8);
+        *frame_length = *payload_length + GCLUE_UBX_FRAME_OVERHEAD;
+        if (length < *frame_length)
+                return GCLUE_UBX_FRAME_INCOMPLETE;
+
+        /* 8-bit Fletcher over class, ID, length and payload */
+        for (i = 2; i < *frame_length - 2; i++) {
+                ck_a += data[i];
+                ck_b += ck_a;
+        }
+        if (ck_a != data[*frame_length - 2] || ck_b != data[*frame_length - 1])
+                return GCLUE_UBX_FRAME_INVALID;
+
+        *class = data[2];
+        *id = data[3];
+        *payload = data + 6;
+
+        return GCLUE_UBX_FRAME_OK;
+}
+
+static guint16
+read_u16 (const guint8 *data)
+{
+        return data[0] | (data[1] << 8);
+}
+
+static guint32
+read_u32 (const guint8 *data)
+{
+        return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32) data[3] << 24);
+}
+
+static gint32
+read_i32 (const guint8 *data)
+{
+        return (gint32) read_u32 (data);
+}
+
+/* Like the NMEA parser, don't trust what comes from the network */
+static gboolean
+fix_is_valid (gdouble latitude,
+              gdouble longitude,
+              gdouble accuracy)
+{
+        if (!(latitude >= -90.0 && latitude <= 90.0 &&
+              longitude >= -180.0 && longitude <= 180.0)) {
+                g_warning ("Invalid coordinates (%f, %f) in GNSS fix",
+                           latitude, longitude);
+                return FALSE;
+        }
+
+        if (accuracy != GCLUE_LOCATION_ACCURACY_UNKNOWN &&
+            !(isfinite (accuracy) && accuracy >= 0)) {
+                g_warning ("Invalid accuracy %f in GNSS fix", accuracy);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* Days since 1970-01-01 of a proleptic Gregorian date */
+static gint64
+days_from_civil (gint64 year,
+                 guint  month,
+                 guint  day)
+{
+        gint64 era, year_of_era, day_of_year, day_of_era;
+
+        year -= month <= 2;
+        era = (year >= 0 ? year : year - 399) / 400;
+        year_of_era = year - era * 400;
+        day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+        day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+                     day_of_year;
+
+        return era * 146097 + day_of_era - 719468;
+}
+
+/**
+ * gclue_ubx_nav_pvt_to_location:
+ * @payload: the payload of a UBX NAV-PVT message
+ * @length: the length of @payload
+ *
+ * Returns: (transfer full): a new #GClueLocation, or %NULL if the message
+ * has no valid fix.
+ **/
+GClueLocation *
+gclue_ubx_nav_pvt_to_location (const guint8 *payload,
+                               gsize         length)
+{
+        guint8 valid, fix_type, flags;
+        gdouble latitude, longitude, accuracy, altitude, speed, heading;
+        guint64 timestamp;
+
+        /* Older protocol versions have a shorter message */
+        if (length < UBX_NAV_PVT_LENGTH) {
+                g_debug ("Ignoring short UBX NAV-PVT message");
+                return NULL;
+        }
+
+        fix_type = payload[20];
+        flags = payload[21];
+        if ((flags & 0x01) == 0 ||
+            (fix_type != UBX_FIX_2D && fix_type != UBX_FIX_3D &&
+             fix_type != UBX_FIX_GNSS_DR))
+                return NULL;
+
+        longitude = read_i32 (payload + 24) / 1e7;
+        latitude = read_i32 (payload + 28) / 1e7;
+        accuracy = read_u32 (payload + 40) / 1000.0;
+        if (!fix_is_valid (latitude, longitude, accuracy))
+                return NULL;
+
+        altitude = GCLUE_LOCATION_ALTITUDE_UNKNOWN;
+        if (fix_type != UBX_FIX_2D)
+                altitude = read_i32 (payload + 36) / 1000.0;
+
+        speed = read_i32 (payload + 60) / 1000.0;
+        heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+        if (speed > 0)
+                heading = read_i32 (payload + 64) / 1e5;
+
+        /* The date and time are reported once they are known for sure */
+        valid = payload[11];
+        if ((valid & 0x03) == 0x03) {
+                gint64 days;
+
+                days = days_from_civil (read_u16 (payload + 4),
+                                        payload[6],
+                                        payload[7]);
+                timestamp = days * 86400 +
+                            payload[8] * 3600 + payload[9] * 60 + payload[10];
+        } else {
+                timestamp = g_get_real_time () / G_USEC_PER_SEC;
+        }
+
+        return gclue_location_new_full (latitude,
+                                        longitude,
+                                        accuracy,
+                                        speed,
+                                        heading,
+                                        altitude,
+                                        timestamp,
+                                        "GPS UBX NAV-PVT");
+}
+
+static gboolean
+get_double_member (JsonObject *object,
+                   const char *name,
+                   gdouble    *value)
+{
+        JsonNode *node;
+
+        node = json_object_get_member (object, name);
+        if (node == NULL || !JSON_NODE_HOLDS_VALUE (node) ||
+            json_node_get_value_type (node) == G_TYPE_STRING)
+                return FALSE;
+
+        *value = json_node_get_double (node);
+
+        return TRUE;
+}
+
+/* Unlike json_object_get_string_member(), doesn't warn about a member of
+ * another type, which gpsd's output is not trusted not to have */
+static const char *
+get_string_member (JsonObject *object,
+                   const char *name)
+{
+        JsonNode *node;
+
+        node = json_object_get_member (object, name);
+        if (node == NULL || !JSON_NODE_HOLDS_VALUE (node) ||
+            json_node_get_value_type (node) != G_TYPE_STRING)
+                return NULL;
+
+        return json_node_get_string (node);
+}
+
+/**
+ * gclue_gpsd_report_to_location:
+ * @json: a line of gpsd's JSON output
+ * @length: the length of @json, or -1 if it is nul-terminated
+ *
+ * Reads the fix from a gpsd TPV (time-position-velocity) report, other
+ * reports are ignored.
+ *
+ * Returns: (transfer full): a new #GClueLocation, or %NULL if @json is not a
+ * TPV report with a valid fix.
+ **/
+GClueLocation *
+gclue_gpsd_report_to_location (const char *json,
+                               gssize      length)
+{
+        g_autoptr(JsonParser) parser = NULL;
+        g_autoptr(GError) error = NULL;
+        JsonNode *root;
+        JsonObject *object;
+        const char *class, *time;
+        gdouble mode, latitude, longitude, accuracy, altitude, speed, heading;
+        gdouble epx, epy;
+        guint64 timestamp;
+
+        /* Cheap check before parsing, gpsd sends the class first */
+        if (g_strstr_len (json, length, "\"TPV\"") == NULL)
+                return NULL;
+
+        parser = json_parser_new ();
+        if (!json_parser_load_from_data (parser, json, length, &error)) {
+                g_debug ("Failed to parse gpsd report: %s", error->message);
+                return NULL;
+        }
+
+        root = json_parser_get_root (parser);
+        if (root == NULL || !JSON_NODE_HOLDS_OBJECT (root))
+                return NULL;
+        object = json_node_get_object (root);
+
+        class = get_string_member (object, "class");
+        if (g_strcmp0 (class, "TPV") != 0)
+                return NULL;
+
+        /* See https://gpsd.gitlab.io/gpsd/gpsd_json.html#_tpv */
+        if (!get_double_member (object, "mode", &mode) || mode < 2)
+                return NULL;
+
+        if (!get_double_member (object, "lat", &latitude) ||
+            !get_double_member (object, "lon", &longitude))
+                return NULL;
+
+        /* "eph" is only in gpsd 3.20 and later */
+        if (!get_double_member (object, "eph", &accuracy)) {
+                if (get_double_member (object, "epx", &epx) &&
+                    get_double_member (object, "epy", &epy))
+                        accuracy = sqrt (epx * epx + epy * epy);
+                else
+                        accuracy = GCLUE_LOCATION_ACCURACY_UNKNOWN;
+        }
+        if (!fix_is_valid (latitude, longitude, accuracy))
+                return NULL;
+
+        /* Before gpsd 3.20, "alt" was the altitude above mean sea level */
+        altitude = GCLUE_LOCATION_ALTITUDE_UNKNOWN;
+        if (mode >= 3 &&
+            !get_double_member (object, "altMSL", &altitude) &&
+            !get_double_member (object, "alt", &altitude))
+                altitude = GCLUE_LOCATION_ALTITUDE_UNKNOWN;
+
+        if (!get_double_member (object, "speed", &speed))
+                speed = GCLUE_LOCATION_SPEED_UNKNOWN;
+        if (!get_double_member (object, "track", &heading))
+                heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+
+        timestamp = g_get_real_time () / G_USEC_PER_SEC;
+        time = get_string_member (object, "time");
+        if (time != NULL) {
+                g_autoptr(GDateTime) date_time = NULL;
+
+                date_time = g_date_time_new_from_iso8601 (time, NULL);
+                if (date_time != NULL)
+                        timestamp = g_date_time_to_unix (date_time);
+        }
+
+        return gclue_location_new_full (latitude,
+                                        longitude,
+                                        accuracy,
+                                        speed,
+                                        heading,
+                                        altitude,
+                                        timestamp,
+                                        "GPS gpsd TPV");
+}
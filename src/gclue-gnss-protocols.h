@@ -0,0 +1,78 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_GNSS_PROTOCOLS_H
+#define GCLUE_GNSS_PROTOCOLS_H
+
+#include <glib.h>
+#include "gclue-location.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+        GCLUE_GNSS_PROTOCOL_UNKNOWN,
+        GCLUE_GNSS_PROTOCOL_NMEA,
+        GCLUE_GNSS_PROTOCOL_UBX,
+        GCLUE_GNSS_PROTOCOL_GPSD,
+} GClueGNSSProtocol;
+
+typedef enum {
+        GCLUE_UBX_FRAME_OK,
+        GCLUE_UBX_FRAME_INCOMPLETE,
+        GCLUE_UBX_FRAME_INVALID,
+} GClueUBXFrameResult;
+
+#define GCLUE_UBX_SYNC_1 0xb5
+#define GCLUE_UBX_SYNC_2 0x62
+
+/* Sync characters, class, ID, length and checksum */
+#define GCLUE_UBX_FRAME_OVERHEAD 8
+
+#define GCLUE_UBX_CLASS_NAV 0x01
+#define GCLUE_UBX_ID_NAV_PVT 0x07
+
+/* Sent to gpsd to have it stream reports as JSON */
+#define GCLUE_GPSD_WATCH_COMMAND "?WATCH={\"enable\":true,\"json\":true};\n"
+
+GClueGNSSProtocol
+gclue_gnss_protocol_detect (const guint8 *data,
+                            gsize         length,
+                            gsize        *offset);
+
+const char *
+gclue_gnss_protocol_to_string (GClueGNSSProtocol protocol);
+
+GClueUBXFrameResult
+gclue_ubx_frame_parse (const guint8  *data,
+                       gsize          length,
+                       gsize         *frame_length,
+                       guint8        *class,
+                       guint8        *id,
+                       const guint8 **payload,
+                       gsize         *payload_length);
+
+GClueLocation *
+gclue_ubx_nav_pvt_to_location (const guint8 *payload,
+                               gsize         length);
+
+GClueLocation *
+gclue_gpsd_report_to_location (const char *json,
+                               gssize      length);
+
+G_END_DECLS
+
+#endif /* GCLUE_GNSS_PROTOCOLS_H */
@@ -0,0 +1,355 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <config.h>
+#include "gclue-http.h"
+
+/**
+ * SECTION:gclue-http
+ * @short_description: Shared HTTP session
+ *
+ * All web requests go through a single #SoupSession, so connections (and
+ * their TLS sessions) to a host are kept alive and reused by all sources,
+ * including HTTP/2 multiplexing where the server supports it.
+ *
+ * Queries created with gclue_http_query_new() are also coalesced: sending a
+ * query while an identical one (same method, URL and body) is in flight
+ * doesn't send anything, the caller gets the response of the one in flight.
+ * A query is only aborted once all its callers have cancelled.
+ **/
+
+#define QUERY_KEY_DATA "gclue-http-query-key"
+
+typedef struct {
+        char *key;           /* NULL if not shared */
+        SoupMessage *query;
+        GList *waiters;      /* Waiter, one per caller */
+        GCancellable *cancellable;
+} InFlightQuery;
+
+typedef struct {
+        GTask *task;
+        InFlightQuery *in_flight; /* NULL once cancelled */
+        gulong cancelled_id;
+} Waiter;
+
+/* Query key → InFlightQuery */
+static GHashTable *in_flight_queries = NULL;
+
+static char *
+get_os_info (void)
+{
+        g_autofree char *pretty_name = NULL;
+        g_autofree char *os_name = g_get_os_info (G_OS_INFO_KEY_NAME);
+        g_autofree char *os_version = g_get_os_info (G_OS_INFO_KEY_VERSION);
+
+        if (os_name && os_version)
+                return g_strdup_printf ("%s; %s", os_name, os_version);
+
+        pretty_name = g_get_os_info (G_OS_INFO_KEY_PRETTY_NAME);
+        if (pretty_name)
+                return g_steal_pointer (&pretty_name);
+
+        /* Translators: Not marked as translatable as debug output should stay English */
+        return g_strdup ("Unknown");
+}
+
+#define USER_AGENT (PACKAGE_NAME "/" PACKAGE_VERSION)
+
+static char *
+get_user_agent (void)
+{
+        g_autofree char *os_info = get_os_info ();
+        return g_strdup_printf ("%s (%s)", USER_AGENT, os_info);
+}
+
+/* Not a weak reference, so idle connections outlive the sources of a client
+ * and are reused by the next one. Released by gclue_http_shutdown(). */
+static SoupSession *shared_session = NULL;
+
+/**
+ * gclue_http_get_session:
+ *
+ * Returns: (transfer full): the session shared by all sources.
+ **/
+SoupSession *
+gclue_http_get_session (void)
+{
+        if (shared_session == NULL) {
+                g_autofree char *user_agent = get_user_agent ();
+
+                shared_session = soup_session_new ();
+                soup_session_set_proxy_resolver (shared_session, NULL);
+                soup_session_set_user_agent (shared_session, user_agent);
+        }
+
+        return g_object_ref (shared_session);
+}
+
+/**
+ * gclue_http_shutdown:
+ *
+ * Closes the connections of the shared session and releases it. Call it when
+ * the service shuts down.
+ **/
+void
+gclue_http_shutdown (void)
+{
+        if (shared_session == NULL)
+                return;
+
+        soup_session_abort (shared_session);
+        g_clear_object (&shared_session);
+}
+
+/**
+ * gclue_http_query_new:
+ * @method: the HTTP method
+ * @url: the URL to send the query to
+ * @content_type: (nullable): the content type of @body
+ * @body: (nullable): the request body
+ *
+ * Creates a query that can be coalesced with identical ones by
+ * gclue_http_query_send_async(). Only use it for queries without side
+ * effects.
+ *
+ * Returns: (transfer full) (nullable): the query, or %NULL if @url is invalid.
+ **/
+SoupMessage *
+gclue_http_query_new (const char *method,
+                      const char *url,
+                      const char *content_type,
+                      GBytes     *body)
+{
+        SoupMessage *query;
+        GString *key;
+
+        query = soup_message_new (method, url);
+        if (query == NULL)
+                return NULL;
+
+        key = g_string_new (method);
+        g_string_append_c (key, ' ');
+        g_string_append (key, url);
+        g_string_append_c (key, '\n');
+        if (body != NULL) {
+                gsize size;
+                const char *data = g_bytes_get_data (body, &size);
+
+                soup_message_set_request_body_from_bytes (query, content_type, body);
+                if (content_type != NULL)
+                        g_string_append (key, content_type);
+                g_string_append_c (key, '\n');
+                g_string_append_len (key, data, size);
+        }
+
+        g_object_set_data_full (G_OBJECT (query),
+                                QUERY_KEY_DATA,
+                                g_string_free (key, FALSE),
+                                g_free);
+
+        return query;
+}
+
+static void
+waiter_free (Waiter *waiter)
+{
+        g_clear_object (&waiter->task);
+        g_free (waiter);
+}
+
+static void
+in_flight_query_free (InFlightQuery *in_flight)
+{
+        g_free (in_flight->key);
+        g_object_unref (in_flight->query);
+        g_list_free (in_flight->waiters);
+        g_object_unref (in_flight->cancellable);
+        g_free (in_flight);
+}
+
+/* Later identical queries need a fresh response */
+static void
+in_flight_query_unshare (InFlightQuery *in_flight)
+{
+        if (in_flight->key != NULL &&
+            g_hash_table_lookup (in_flight_queries, in_flight->key) == in_flight)
+                g_hash_table_remove (in_flight_queries, in_flight->key);
+}
+
+/* Handlers can't be disconnected from within, so the waiter is freed along
+ * with the handler, whenever that is. */
+static void
+on_cancelled (GCancellable *cancellable,
+              Waiter       *waiter)
+{
+        InFlightQuery *in_flight = waiter->in_flight;
+
+        if (in_flight == NULL)
+                return;
+
+        in_flight->waiters = g_list_remove (in_flight->waiters, waiter);
+        waiter->in_flight = NULL;
+        if (in_flight->waiters == NULL) {
+                in_flight_query_unshare (in_flight);
+                g_cancellable_cancel (in_flight->cancellable);
+        }
+
+        g_task_return_error_if_cancelled (waiter->task);
+        g_clear_object (&waiter->task);
+}
+
+static void
+query_sent_cb (SoupSession  *session,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+        InFlightQuery *in_flight = user_data;
+        g_autoptr(GBytes) body = NULL;
+        g_autoptr(GError) error = NULL;
+        GList *l;
+
+        body = soup_session_send_and_read_finish (session, result, &error);
+        in_flight_query_unshare (in_flight);
+
+        for (l = in_flight->waiters; l != NULL; l = l->next) {
+                Waiter *waiter = l->data;
+                g_autoptr(GTask) task = g_steal_pointer (&waiter->task);
+
+                waiter->in_flight = NULL;
+                if (waiter->cancelled_id != 0)
+                        g_cancellable_disconnect (g_task_get_cancellable (task),
+                                                  waiter->cancelled_id);
+                else
+                        waiter_free (waiter);
+
+                g_task_set_task_data (task,
+                                      g_object_ref (in_flight->query),
+                                      g_object_unref);
+                if (body != NULL)
+                        g_task_return_pointer (task,
+                                               g_bytes_ref (body),
+                                               (GDestroyNotify) g_bytes_unref);
+                else
+                        g_task_return_error (task, g_error_copy (error));
+        }
+
+        in_flight_query_free (in_flight);
+}
+
+/**
+ * gclue_http_query_send_async:
+ * @query: the query to send
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: the callback to call once done
+ * @user_data: the data to pass to @callback
+ *
+ * Sends @query through the shared session, or waits for the response of an
+ * identical query already in flight.
+ *
+ * Cancelling @cancellable makes this call fail with %G_IO_ERROR_CANCELLED
+ * right away. The request itself is only aborted if no one else is waiting
+ * for it.
+ **/
+void
+gclue_http_query_send_async (SoupMessage         *query,
+                             GCancellable        *cancellable,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+        g_autoptr(SoupSession) session = NULL;
+        InFlightQuery *in_flight = NULL;
+        const char *key;
+        Waiter *waiter;
+        GTask *task;
+
+        g_return_if_fail (SOUP_IS_MESSAGE (query));
+
+        task = g_task_new (NULL, cancellable, callback, user_data);
+        g_task_set_source_tag (task, gclue_http_query_send_async);
+        if (g_task_return_error_if_cancelled (task)) {
+                g_object_unref (task);
+                return;
+        }
+
+        if (in_flight_queries == NULL)
+                in_flight_queries = g_hash_table_new (g_str_hash, g_str_equal);
+
+        key = g_object_get_data (G_OBJECT (query), QUERY_KEY_DATA);
+        if (key != NULL)
+                in_flight = g_hash_table_lookup (in_flight_queries, key);
+        if (in_flight != NULL) {
+                g_autofree char *uri_str =
+                        g_uri_to_string (soup_message_get_uri (query));
+
+                g_debug ("Identical query to '%s' already in flight, "
+                         "waiting for its response", uri_str);
+        } else {
+                in_flight = g_new0 (InFlightQuery, 1);
+                in_flight->key = g_strdup (key);
+                in_flight->query = g_object_ref (query);
+                in_flight->cancellable = g_cancellable_new ();
+                if (in_flight->key != NULL)
+                        g_hash_table_insert (in_flight_queries,
+                                             in_flight->key,
+                                             in_flight);
+
+                session = gclue_http_get_session ();
+                soup_session_send_and_read_async (session,
+                                                  query,
+                                                  G_PRIORITY_DEFAULT,
+                                                  in_flight->cancellable,
+                                                  (GAsyncReadyCallback) query_sent_cb,
+                                                  in_flight);
+        }
+
+        waiter = g_new0 (Waiter, 1);
+        waiter->task = task;
+        waiter->in_flight = in_flight;
+        in_flight->waiters = g_list_append (in_flight->waiters, waiter);
+        if (cancellable != NULL)
+                waiter->cancelled_id = g_cancellable_connect
+                        (cancellable,
+                         G_CALLBACK (on_cancelled),
+                         waiter,
+                         (GDestroyNotify) waiter_free);
+}
+
+/**
+ * gclue_http_query_send_finish:
+ * @result: the #GAsyncResult
+ * @sent_query: (out) (optional) (transfer full): the query that was actually
+ * sent, to get the response status and headers from
+ * @error: return location for a #GError
+ *
+ * Returns: (transfer full): the response body, or %NULL on error.
+ **/
+GBytes *
+gclue_http_query_send_finish (GAsyncResult  *result,
+                              SoupMessage  **sent_query,
+                              GError       **error)
+{
+        GTask *task = G_TASK (result);
+        GBytes *body;
+
+        body = g_task_propagate_pointer (task, error);
+        if (body != NULL && sent_query != NULL)
+                *sent_query = g_object_ref (g_task_get_task_data (task));
+
+        return body;
+}
@@ -0,0 +1,43 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_HTTP_H
+#define GCLUE_HTTP_H
+
+#include <gio/gio.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+SoupSession *gclue_http_get_session       (void);
+void         gclue_http_shutdown          (void);
+
+SoupMessage *gclue_http_query_new         (const char          *method,
+                                           const char          *url,
+                                           const char          *content_type,
+                                           GBytes              *body);
+void         gclue_http_query_send_async  (SoupMessage         *query,
+                                           GCancellable        *cancellable,
+                                           GAsyncReadyCallback  callback,
+                                           gpointer             user_data);
+GBytes *     gclue_http_query_send_finish (GAsyncResult        *result,
+                                           SoupMessage        **sent_query,
+                                           GError             **error);
+
+G_END_DECLS
+
+#endif /* GCLUE_HTTP_H */
@@ -19,6 +19,8 @@
  * Authors: Teemu Ikonen <tpikonen@mailbox.org>
  */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <glib.h>
@@ -29,6 +31,7 @@
 #include "gclue-config.h"
 #include "gclue-error.h"
 #include "gclue-mozilla.h"
+#include "gclue-http.h"
 #include "gclue-location.h"
 
 /**
@@ -47,6 +50,9 @@ struct _GClueIpPrivate {
         GClueMozilla *mozilla;
         /* GMaps */
         GRegex *gregex;
+
+        GHashTable *cache; /* Network ID → IpCacheEntry, NULL if disabled */
+        char *cache_path;
 };
 
 G_DEFINE_TYPE_WITH_CODE (GClueIp,
@@ -104,7 +110,7 @@ gmaps_create_query (GClueWebSource *source,
         g_autoptr(SoupMessage) query = NULL;
         const char *url = gclue_web_source_get_locate_url (source);
 
-        query = soup_message_new ("GET", url);
+        query = gclue_http_query_new ("GET", url, NULL, NULL);
         if (query_data_description) {
                 *query_data_description = "GeoIP (gmaps)";
         }
@@ -177,7 +183,7 @@ reallyfreegeoip_create_query (GClueWebSource *source,
         g_autoptr(SoupMessage) query = NULL;
         const char *url = gclue_web_source_get_locate_url (source);
 
-        query = soup_message_new ("GET", url);
+        query = gclue_http_query_new ("GET", url, NULL, NULL);
         if (query_data_description) {
                 *query_data_description = "GeoIP (reallyfreegeoip)";
         }
@@ -226,6 +232,400 @@ reallyfreegeoip_parse_response (GClueWebSource *source,
 
 /* GClueIp common */
 
+/* Cached locations are used for this long after they were looked up */
+#define IP_CACHE_TTL (7 * 24 * 60 * 60) /* seconds */
+/* and are looked up again in the background when older than this */
+#define IP_CACHE_REVALIDATE_AGE (10 * 60) /* seconds */
+#define IP_CACHE_MAX_ENTRIES 64
+#define IP_CACHE_FILE_NAME "ip-cache"
+
+#define RTF_UP_GATEWAY 0x3
+
+typedef struct {
+        GClueLocation *location;
+        guint64 fetched; /* seconds */
+} IpCacheEntry;
+
+static void
+ip_cache_entry_free (IpCacheEntry *entry)
+{
+        g_clear_pointer (&entry->location, gclue_location_unref);
+        g_free (entry);
+}
+
+/* Finds the IPv4 default gateway of the system in /proc/net/route */
+static gboolean
+get_default_gateway (char **address, char **interface)
+{
+        g_autofree char *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        guint i;
+
+        if (!g_file_get_contents ("/proc/net/route", &contents, NULL, NULL))
+                return FALSE;
+
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 1; lines[i] != NULL; i++) {
+                g_auto(GStrv) fields = g_strsplit_set (lines[i], " \t", -1);
+                g_autoptr(GInetAddress) gateway = NULL;
+                char *ifname = NULL, *destination = NULL, *gateway_hex = NULL;
+                guint64 flags = 0;
+                guint32 gateway_addr;
+                guint j, n = 0;
+
+                /* Iface Destination Gateway Flags ..., any amount of blanks */
+                for (j = 0; fields[j] != NULL && n < 4; j++) {
+                        if (fields[j][0] == '\0')
+                                continue;
+                        if (n == 0)
+                                ifname = fields[j];
+                        else if (n == 1)
+                                destination = fields[j];
+                        else if (n == 2)
+                                gateway_hex = fields[j];
+                        else
+                                flags = g_ascii_strtoull (fields[j], NULL, 16);
+                        n++;
+                }
+
+                if (n < 4 || g_strcmp0 (destination, "00000000") != 0 ||
+                    (flags & RTF_UP_GATEWAY) != RTF_UP_GATEWAY)
+                        continue;
+
+                /* In network byte order, printed as a host integer */
+                gateway_addr = g_ascii_strtoull (gateway_hex, NULL, 16);
+                gateway = g_inet_address_new_from_bytes ((const guint8 *) &gateway_addr,
+                                                         G_SOCKET_FAMILY_IPV4);
+                *address = g_inet_address_to_string (gateway);
+                *interface = g_strdup (ifname);
+
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+/* The MAC address of the default gateway identifies the network we're on,
+ * whichever interface it is reached from, without any traffic. */
+static char *
+get_network_id (void)
+{
+        g_autofree char *gateway = NULL;
+        g_autofree char *interface = NULL;
+        g_autofree char *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        guint i;
+
+        if (!get_default_gateway (&gateway, &interface) ||
+            !g_file_get_contents ("/proc/net/arp", &contents, NULL, NULL))
+                return NULL;
+
+        /* IP address, HW type, Flags, HW address, Mask, Device */
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 1; lines[i] != NULL; i++) {
+                char address[64], flags[16], mac[32], device[64];
+
+                if (sscanf (lines[i], "%63s %*s %15s %31s %*s %63s",
+                            address, flags, mac, device) != 4)
+                        continue;
+
+                if (strcmp (address, gateway) == 0 &&
+                    strcmp (device, interface) == 0 &&
+                    strcmp (flags, "0x0") != 0 &&
+                    strcmp (mac, "00:00:00:00:00:00") != 0)
+                        return g_ascii_strdown (mac, -1);
+        }
+
+        return NULL;
+}
+
+static void
+ip_cache_save (GClueIp *ip)
+{
+        GClueIpPrivate *priv = ip->priv;
+        g_autoptr(GKeyFile) key_file = g_key_file_new ();
+        g_autoptr(GError) error = NULL;
+        g_autofree char *data = NULL;
+        g_autofree char *dir = NULL;
+        GHashTableIter iter;
+        gpointer key, value;
+        gsize length;
+
+        g_hash_table_iter_init (&iter, priv->cache);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                IpCacheEntry *entry = value;
+                const char *description;
+
+                g_key_file_set_double (key_file, key, "Latitude",
+                                       gclue_location_get_latitude (entry->location));
+                g_key_file_set_double (key_file, key, "Longitude",
+                                       gclue_location_get_longitude (entry->location));
+                g_key_file_set_double (key_file, key, "Accuracy",
+                                       gclue_location_get_accuracy (entry->location));
+                g_key_file_set_uint64 (key_file, key, "Timestamp", entry->fetched);
+                description = gclue_location_get_description (entry->location);
+                if (description != NULL)
+                        g_key_file_set_string (key_file, key, "Description",
+                                               description);
+        }
+
+        data = g_key_file_to_data (key_file, &length, NULL);
+
+        dir = g_path_get_dirname (priv->cache_path);
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("Failed to create directory '%s': %s",
+                           dir, g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (priv->cache_path,
+                                       data,
+                                       length,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600,
+                                       &error))
+                g_warning ("Failed to save GeoIP cache: %s", error->message);
+}
+
+static void
+ip_cache_load (GClueIp *ip)
+{
+        GClueIpPrivate *priv = ip->priv;
+        g_autoptr(GKeyFile) key_file = g_key_file_new ();
+        g_autoptr(GError) error = NULL;
+        g_auto(GStrv) groups = NULL;
+        guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+        guint i;
+
+        if (!g_key_file_load_from_file (key_file, priv->cache_path,
+                                        G_KEY_FILE_NONE, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load GeoIP cache: %s",
+                                   error->message);
+                return;
+        }
+
+        groups = g_key_file_get_groups (key_file, NULL);
+        for (i = 0; groups[i] != NULL; i++) {
+                g_autofree char *description = NULL;
+                gdouble latitude, longitude, accuracy;
+                IpCacheEntry *entry;
+                guint64 fetched;
+
+                latitude = g_key_file_get_double (key_file, groups[i], "Latitude", NULL);
+                longitude = g_key_file_get_double (key_file, groups[i], "Longitude", NULL);
+                accuracy = g_key_file_get_double (key_file, groups[i], "Accuracy", NULL);
+                fetched = g_key_file_get_uint64 (key_file, groups[i], "Timestamp", NULL);
+                description = g_key_file_get_string (key_file, groups[i], "Description", NULL);
+
+                if (!(latitude >= -90 && latitude <= 90 &&
+                      longitude >= -180 && longitude <= 180 &&
+                      isfinite (accuracy) && accuracy >= 0) ||
+                    fetched > now || now - fetched > IP_CACHE_TTL)
+                        continue;
+
+                entry = g_new0 (IpCacheEntry, 1);
+                entry->location = gclue_location_new_full (latitude,
+                                                           longitude,
+                                                           accuracy,
+                                                           GCLUE_LOCATION_SPEED_UNKNOWN,
+                                                           GCLUE_LOCATION_HEADING_UNKNOWN,
+                                                           GCLUE_LOCATION_ALTITUDE_UNKNOWN,
+                                                           fetched,
+                                                           description);
+                entry->fetched = fetched;
+                g_hash_table_insert (priv->cache, g_strdup (groups[i]), entry);
+        }
+
+        g_debug ("Loaded %u entries from GeoIP cache",
+                 g_hash_table_size (priv->cache));
+}
+
+static IpCacheEntry *
+ip_cache_lookup (GClueIp    *ip,
+                 const char *network_id)
+{
+        IpCacheEntry *entry;
+        guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+        if (ip->priv->cache == NULL)
+                return NULL;
+
+        entry = g_hash_table_lookup (ip->priv->cache, network_id);
+        if (entry == NULL)
+                return NULL;
+
+        if (entry->fetched > now || now - entry->fetched > IP_CACHE_TTL) {
+                g_hash_table_remove (ip->priv->cache, network_id);
+                return NULL;
+        }
+
+        return entry;
+}
+
+static void
+ip_cache_store (GClueIp       *ip,
+                const char    *network_id,
+                GClueLocation *location)
+{
+        GClueIpPrivate *priv = ip->priv;
+        g_autofree char *current_id = NULL;
+        IpCacheEntry *entry;
+
+        if (priv->cache == NULL)
+                return;
+
+        /* Don't file the answer under another network if we've switched
+         * while waiting for it. */
+        current_id = get_network_id ();
+        if (g_strcmp0 (current_id, network_id) != 0)
+                return;
+
+        if (!g_hash_table_contains (priv->cache, network_id) &&
+            g_hash_table_size (priv->cache) >= IP_CACHE_MAX_ENTRIES) {
+                GHashTableIter iter;
+                gpointer key, value;
+                const char *oldest_key = NULL;
+                guint64 oldest = G_MAXUINT64;
+
+                g_hash_table_iter_init (&iter, priv->cache);
+                while (g_hash_table_iter_next (&iter, &key, &value)) {
+                        if (((IpCacheEntry *) value)->fetched < oldest) {
+                                oldest = ((IpCacheEntry *) value)->fetched;
+                                oldest_key = key;
+                        }
+                }
+                g_hash_table_remove (priv->cache, oldest_key);
+        }
+
+        entry = g_new0 (IpCacheEntry, 1);
+        entry->location = gclue_location_ref (location);
+        entry->fetched = g_get_real_time () / G_USEC_PER_SEC;
+        g_hash_table_replace (priv->cache, g_strdup (network_id), entry);
+
+        ip_cache_save (ip);
+}
+
+static GClueLocation *
+gclue_ip_get_cached_location (GClueWebSource *source)
+{
+        g_autofree char *network_id = NULL;
+        IpCacheEntry *entry;
+
+        network_id = get_network_id ();
+        if (network_id == NULL)
+                return NULL;
+
+        entry = ip_cache_lookup (GCLUE_IP (source), network_id);
+        if (entry == NULL)
+                return NULL;
+
+        g_debug ("Using GeoIP location cached for network %s", network_id);
+        return gclue_location_duplicate_fresh (entry->location);
+}
+
+static void
+revalidate_cb (GObject      *source_object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+        GClueWebSource *source = GCLUE_WEB_SOURCE (source_object);
+        g_autofree char *network_id = user_data;
+        g_autoptr(GClueLocation) location = NULL;
+        g_autoptr(GError) local_error = NULL;
+
+        location = GCLUE_WEB_SOURCE_CLASS (gclue_ip_parent_class)->refresh_finish
+                        (source, result, &local_error);
+        if (location == NULL) {
+                g_debug ("Failed to revalidate cached GeoIP location: %s",
+                         local_error->message);
+                return;
+        }
+
+        ip_cache_store (GCLUE_IP (source), network_id, location);
+}
+
+static void
+refresh_cb (GObject      *source_object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+        GClueWebSource *source = GCLUE_WEB_SOURCE (source_object);
+        g_autoptr(GTask) task = g_steal_pointer (&user_data);
+        g_autoptr(GClueLocation) location = NULL;
+        g_autoptr(GError) local_error = NULL;
+        const char *network_id;
+
+        location = GCLUE_WEB_SOURCE_CLASS (gclue_ip_parent_class)->refresh_finish
+                        (source, result, &local_error);
+        if (location == NULL) {
+                g_task_return_error (task, g_steal_pointer (&local_error));
+                return;
+        }
+
+        network_id = g_task_get_task_data (task);
+        if (network_id != NULL)
+                ip_cache_store (GCLUE_IP (source), network_id, location);
+
+        g_task_return_pointer (task, g_steal_pointer (&location), (GDestroyNotify) gclue_location_unref);
+}
+
+static void
+gclue_ip_refresh_async (GClueWebSource      *source,
+                        GCancellable        *cancellable,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+        GClueIp *ip = GCLUE_IP (source);
+        g_autoptr(GTask) task = g_task_new (source, cancellable, callback, user_data);
+        g_autofree char *network_id = NULL;
+        IpCacheEntry *entry = NULL;
+
+        g_task_set_source_tag (task, gclue_ip_refresh_async);
+
+        network_id = get_network_id ();
+        if (network_id != NULL)
+                entry = ip_cache_lookup (ip, network_id);
+
+        if (entry != NULL &&
+            gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source))) {
+                g_autoptr(GClueLocation) location = NULL;
+                guint64 age;
+
+                /* Serve the cached answer right away, the network just
+                 * came up and the query would take a round trip. */
+                gclue_web_source_refresh_available_accuracy_level (source);
+                location = gclue_location_duplicate_fresh (entry->location);
+                gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source),
+                                                    location);
+                g_task_return_pointer (task, g_steal_pointer (&location), (GDestroyNotify) gclue_location_unref);
+
+                age = g_get_real_time () / G_USEC_PER_SEC - entry->fetched;
+                g_debug ("Using GeoIP location cached %" G_GUINT64_FORMAT
+                         " s ago for network %s", age, network_id);
+                if (age < IP_CACHE_REVALIDATE_AGE)
+                        return;
+
+                GCLUE_WEB_SOURCE_CLASS (gclue_ip_parent_class)->refresh_async
+                        (source, NULL, revalidate_cb, g_steal_pointer (&network_id));
+                return;
+        }
+
+        g_task_set_task_data (task, g_steal_pointer (&network_id), g_free);
+        GCLUE_WEB_SOURCE_CLASS (gclue_ip_parent_class)->refresh_async
+                (source, cancellable, refresh_cb, g_steal_pointer (&task));
+}
+
+static GClueLocation *
+gclue_ip_refresh_finish (GClueWebSource  *source,
+                         GAsyncResult    *result,
+                         GError         **error)
+{
+        GTask *task = G_TASK (result);
+
+        return g_task_propagate_pointer (task, error);
+}
+
 static void
 gclue_ip_finalize (GObject *gip)
 {
@@ -238,6 +638,8 @@ gclue_ip_finalize (GObject *gip)
         g_clear_object (&ip->priv->cancellable);
         g_clear_object (&ip->priv->mozilla);
         g_clear_pointer (&ip->priv->gregex, g_regex_unref);
+        g_clear_pointer (&ip->priv->cache, g_hash_table_unref);
+        g_clear_pointer (&ip->priv->cache_path, g_free);
 }
 
 static GClueLocationSourceStartResult
@@ -281,7 +683,10 @@ gclue_ip_class_init (GClueIpClass *klass)
 
         source_class->start = gclue_ip_start;
 
+        web_class->refresh_async = gclue_ip_refresh_async;
+        web_class->refresh_finish = gclue_ip_refresh_finish;
         web_class->get_available_accuracy_level = gclue_ip_get_available_accuracy_level;
+        web_class->get_cached_location = gclue_ip_get_cached_location;
         method = gclue_config_get_ip_method (config);
         if (g_strcmp0 (method, "ichnaea") == 0) {
                 web_class->create_query = ichnaea_create_query;
@@ -311,6 +716,18 @@ gclue_ip_init (GClueIp *ip)
         ip->priv->cancellable = g_cancellable_new ();
         ip->priv->accuracy = gclue_config_get_ip_accuracy (config);
 
+        if (gclue_config_get_ip_cache (config)) {
+                ip->priv->cache = g_hash_table_new_full
+                        (g_str_hash,
+                         g_str_equal,
+                         g_free,
+                         (GDestroyNotify) ip_cache_entry_free);
+                ip->priv->cache_path = g_build_filename (STATEDIR,
+                                                         IP_CACHE_FILE_NAME,
+                                                         NULL);
+                ip_cache_load (ip);
+        }
+
         method = gclue_config_get_ip_method (config);
         ip_url = gclue_config_get_ip_url (config);
         if (g_strcmp0 (method, "ichnaea") == 0) {
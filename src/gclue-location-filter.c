@@ -0,0 +1,414 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <math.h>
+#include "gclue-location-filter.h"
+
+/**
+ * SECTION:gclue-location-filter
+ * @short_description: Kalman filter combining locations
+ *
+ * Combines locations from any number of sources into a single estimate
+ * with an extended Kalman filter. The state is the position and the
+ * velocity along the east and north axes under a constant velocity model,
+ * the linearization being around the current estimate on the local tangent
+ * plane. Each measurement is weighted by its accuracy.
+ *
+ * Since the measurement noise is the same along both axes, so is the
+ * covariance and the axes are filtered independently with a shared 2x2
+ * covariance matrix.
+ **/
+
+#define EARTH_RADIUS_M 6372795.0
+#define METERS_PER_DEGREE (EARTH_RADIUS_M * G_PI / 180)
+
+/* Accuracy is the radius of the 68% circle, this is sigma along an axis */
+#define ACCURACY_PER_SIGMA 1.515
+#define MIN_SIGMA 1.0 /* Meters */
+
+/* Spectral density of the acceleration noise, m²/s³ */
+#define ACCELERATION_NOISE 2.0
+#define INITIAL_VELOCITY_SIGMA 10.0 /* Meters per second */
+#define VELOCITY_SIGMA 1.0          /* Meters per second, of GPS speeds */
+/* Velocity is only reported when known at least that well */
+#define MAX_REPORTED_VELOCITY_SIGMA 2.0
+
+/* Don't propagate the state for longer than that */
+#define MAX_PREDICTION_AGE (30 * 60) /* Seconds */
+
+/* 99.9% quantile of the chi-squared distribution with 2 degrees of freedom */
+#define GATE_THRESHOLD 13.8
+/* Consecutive rejected measurements before restarting from the latest one */
+#define MAX_REJECTED 3
+
+struct _GClueLocationFilter {
+        gboolean initialized;
+        guint64 timestamp;
+
+        gdouble latitude;
+        gdouble longitude;
+        gdouble velocity_east;  /* Meters per second */
+        gdouble velocity_north;
+
+        /* Covariance of position (m²), position and velocity, velocity */
+        gdouble p_pos;
+        gdouble p_cross;
+        gdouble p_vel;
+
+        guint n_rejected;
+};
+
+GClueLocationFilter *
+gclue_location_filter_new (void)
+{
+        return g_new0 (GClueLocationFilter, 1);
+}
+
+void
+gclue_location_filter_free (GClueLocationFilter *filter)
+{
+        g_free (filter);
+}
+
+/**
+ * gclue_location_filter_reset:
+ * @filter: a #GClueLocationFilter
+ *
+ * Forgets the current estimate, the next measurement will be taken as is.
+ **/
+void
+gclue_location_filter_reset (GClueLocationFilter *filter)
+{
+        filter->initialized = FALSE;
+        filter->n_rejected = 0;
+}
+
+static gdouble
+get_measurement_variance (GClueLocation *location)
+{
+        gdouble sigma;
+
+        sigma = MAX (gclue_location_get_accuracy (location) / ACCURACY_PER_SIGMA,
+                     MIN_SIGMA);
+
+        return sigma * sigma;
+}
+
+static gboolean
+get_measured_velocity (GClueLocation *location,
+                       gdouble       *east,
+                       gdouble       *north)
+{
+        gdouble speed, heading;
+
+        speed = gclue_location_get_speed (location);
+        heading = gclue_location_get_heading (location);
+        if (speed == GCLUE_LOCATION_SPEED_UNKNOWN)
+                return FALSE;
+
+        if (speed == 0) {
+                *east = *north = 0;
+                return TRUE;
+        }
+
+        if (heading == GCLUE_LOCATION_HEADING_UNKNOWN)
+                return FALSE;
+
+        *east = speed * sin (heading * G_PI / 180);
+        *north = speed * cos (heading * G_PI / 180);
+
+        return TRUE;
+}
+
+static void
+get_offset (GClueLocationFilter *filter,
+            GClueLocation       *location,
+            gdouble             *east,
+            gdouble             *north)
+{
+        gdouble dlon;
+
+        dlon = gclue_location_get_longitude (location) - filter->longitude;
+        if (dlon > 180)
+                dlon -= 360;
+        else if (dlon < -180)
+                dlon += 360;
+
+        *north = (gclue_location_get_latitude (location) - filter->latitude) *
+                 METERS_PER_DEGREE;
+        *east = dlon * METERS_PER_DEGREE * cos (filter->latitude * G_PI / 180);
+}
+
+static void
+move (GClueLocationFilter *filter,
+      gdouble              east,
+      gdouble              north)
+{
+        gdouble cos_lat;
+
+        cos_lat = MAX (cos (filter->latitude * G_PI / 180), 1e-6);
+        filter->latitude = CLAMP (filter->latitude + north / METERS_PER_DEGREE,
+                                  -90, 90);
+        filter->longitude += east / (METERS_PER_DEGREE * cos_lat);
+        if (filter->longitude > 180)
+                filter->longitude -= 360;
+        else if (filter->longitude < -180)
+                filter->longitude += 360;
+}
+
+static void
+initialize (GClueLocationFilter *filter,
+            GClueLocation       *measurement,
+            gboolean             use_velocity)
+{
+        filter->latitude = gclue_location_get_latitude (measurement);
+        filter->longitude = gclue_location_get_longitude (measurement);
+        filter->timestamp = gclue_location_get_timestamp (measurement);
+        filter->p_pos = get_measurement_variance (measurement);
+        filter->p_cross = 0;
+
+        if (use_velocity &&
+            get_measured_velocity (measurement,
+                                   &filter->velocity_east,
+                                   &filter->velocity_north)) {
+                filter->p_vel = VELOCITY_SIGMA * VELOCITY_SIGMA;
+        } else {
+                filter->velocity_east = filter->velocity_north = 0;
+                filter->p_vel = INITIAL_VELOCITY_SIGMA * INITIAL_VELOCITY_SIGMA;
+        }
+
+        filter->initialized = TRUE;
+        filter->n_rejected = 0;
+}
+
+static void
+predict (GClueLocationFilter *filter,
+         guint64              timestamp)
+{
+        gdouble dt, q = ACCELERATION_NOISE;
+
+        if (timestamp <= filter->timestamp)
+                return;
+
+        dt = timestamp - filter->timestamp;
+        move (filter,
+              filter->velocity_east * dt,
+              filter->velocity_north * dt);
+
+        filter->p_pos += 2 * filter->p_cross * dt + filter->p_vel * dt * dt +
+                         q * dt * dt * dt / 3;
+        filter->p_cross += filter->p_vel * dt + q * dt * dt / 2;
+        filter->p_vel += q * dt;
+
+        filter->timestamp = timestamp;
+}
+
+static void
+correct_position (GClueLocationFilter *filter,
+                  gdouble              innovation_east,
+                  gdouble              innovation_north,
+                  gdouble              r)
+{
+        gdouble s = filter->p_pos + r;
+        gdouble k_pos = filter->p_pos / s;
+        gdouble k_vel = filter->p_cross / s;
+        gdouble p_pos = filter->p_pos, p_cross = filter->p_cross;
+
+        move (filter, k_pos * innovation_east, k_pos * innovation_north);
+        filter->velocity_east += k_vel * innovation_east;
+        filter->velocity_north += k_vel * innovation_north;
+
+        filter->p_pos = p_pos - p_pos * p_pos / s;
+        filter->p_cross = p_cross - p_pos * p_cross / s;
+        filter->p_vel -= p_cross * p_cross / s;
+}
+
+static void
+correct_position_velocity (GClueLocationFilter *filter,
+                           gdouble              innovation_east,
+                           gdouble              innovation_north,
+                           gdouble              innovation_velocity_east,
+                           gdouble              innovation_velocity_north,
+                           gdouble              r)
+{
+        gdouble rv = VELOCITY_SIGMA * VELOCITY_SIGMA;
+        gdouble a = filter->p_pos, b = filter->p_cross, c = filter->p_vel;
+        gdouble det, k00, k01, k10, k11;
+
+        /* K = P (P + R)⁻¹ with both position and velocity measured */
+        det = (a + r) * (c + rv) - b * b;
+        k00 = (a * (c + rv) - b * b) / det;
+        k01 = b * r / det;
+        k10 = b * rv / det;
+        k11 = (c * (a + r) - b * b) / det;
+
+        move (filter,
+              k00 * innovation_east + k01 * innovation_velocity_east,
+              k00 * innovation_north + k01 * innovation_velocity_north);
+        filter->velocity_east += k10 * innovation_east +
+                                 k11 * innovation_velocity_east;
+        filter->velocity_north += k10 * innovation_north +
+                                  k11 * innovation_velocity_north;
+
+        filter->p_pos = (1 - k00) * a - k01 * b;
+        filter->p_cross = (1 - k00) * b - k01 * c;
+        filter->p_vel = (1 - k11) * c - k10 * b;
+}
+
+static GClueLocation *
+create_location (GClueLocationFilter *filter,
+                 gdouble              altitude,
+                 const char          *description)
+{
+        gdouble speed = GCLUE_LOCATION_SPEED_UNKNOWN;
+        gdouble heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+        gdouble velocity_sigma = sqrt (filter->p_vel);
+
+        if (velocity_sigma <= MAX_REPORTED_VELOCITY_SIGMA) {
+                speed = hypot (filter->velocity_east, filter->velocity_north);
+
+                /* Direction of a speed within the noise means nothing */
+                if (speed > 2 * velocity_sigma) {
+                        heading = atan2 (filter->velocity_east,
+                                         filter->velocity_north) * 180 / G_PI;
+                        if (heading < 0)
+                                heading += 360;
+                }
+        }
+
+        return gclue_location_new_full (filter->latitude,
+                                        filter->longitude,
+                                        sqrt (filter->p_pos) * ACCURACY_PER_SIGMA,
+                                        speed,
+                                        heading,
+                                        altitude,
+                                        filter->timestamp,
+                                        description);
+}
+
+/**
+ * gclue_location_filter_update:
+ * @filter: a #GClueLocationFilter
+ * @measurement: a new location
+ * @use_velocity: whether the speed and heading of @measurement are measured
+ * rather than derived from previous locations
+ *
+ * Propagates the estimate to the time of @measurement and corrects it with
+ * @measurement.
+ *
+ * Measurements older than the estimate are ignored, as are ones not
+ * consistent with it, unless several come in a row, in which case the
+ * filter starts over from the latest.
+ *
+ * Returns: (transfer full) (nullable): the new estimate, or %NULL if
+ * @measurement was ignored.
+ **/
+GClueLocation *
+gclue_location_filter_update (GClueLocationFilter *filter,
+                              GClueLocation       *measurement,
+                              gboolean             use_velocity)
+{
+        guint64 timestamp = gclue_location_get_timestamp (measurement);
+        gdouble r = get_measurement_variance (measurement);
+        gdouble east, north, velocity_east, velocity_north, distance2;
+
+        if (filter->initialized &&
+            (timestamp < filter->timestamp ||
+             timestamp - filter->timestamp > MAX_PREDICTION_AGE)) {
+                if (timestamp < filter->timestamp) {
+                        g_debug ("Ignoring location older than the estimate");
+                        return NULL;
+                }
+
+                g_debug ("Estimate too old, restarting the filter");
+                gclue_location_filter_reset (filter);
+        }
+
+        if (!filter->initialized) {
+                initialize (filter, measurement, use_velocity);
+
+                return create_location (filter,
+                                        gclue_location_get_altitude (measurement),
+                                        gclue_location_get_description (measurement));
+        }
+
+        predict (filter, timestamp);
+
+        get_offset (filter, measurement, &east, &north);
+        distance2 = (east * east + north * north) / (filter->p_pos + r);
+        if (distance2 > GATE_THRESHOLD) {
+                if (++filter->n_rejected < MAX_REJECTED) {
+                        g_debug ("Ignoring location %.0f m away from the "
+                                 "estimate (normalized squared distance %.1f)",
+                                 hypot (east, north), distance2);
+                        return NULL;
+                }
+
+                g_debug ("Several locations inconsistent with the estimate, "
+                         "restarting the filter");
+                initialize (filter, measurement, use_velocity);
+
+                return create_location (filter,
+                                        gclue_location_get_altitude (measurement),
+                                        gclue_location_get_description (measurement));
+        }
+        filter->n_rejected = 0;
+
+        if (use_velocity &&
+            get_measured_velocity (measurement, &velocity_east, &velocity_north))
+                correct_position_velocity (filter,
+                                           east,
+                                           north,
+                                           velocity_east - filter->velocity_east,
+                                           velocity_north - filter->velocity_north,
+                                           r);
+        else
+                correct_position (filter, east, north, r);
+
+        return create_location (filter,
+                                gclue_location_get_altitude (measurement),
+                                gclue_location_get_description (measurement));
+}
+
+/**
+ * gclue_location_filter_predict:
+ * @filter: a #GClueLocationFilter
+ * @timestamp: the time to predict the location at
+ *
+ * Extrapolates the estimate to @timestamp without changing it, so that
+ * measurements taken before @timestamp can still be used.
+ *
+ * Returns: (transfer full) (nullable): the predicted location, or %NULL if
+ * there is no estimate or it is too old.
+ **/
+GClueLocation *
+gclue_location_filter_predict (GClueLocationFilter *filter,
+                               guint64              timestamp)
+{
+        GClueLocationFilter prediction = *filter;
+
+        if (!filter->initialized ||
+            timestamp < filter->timestamp ||
+            timestamp - filter->timestamp > MAX_PREDICTION_AGE)
+                return NULL;
+
+        predict (&prediction, timestamp);
+
+        return create_location (&prediction,
+                                GCLUE_LOCATION_ALTITUDE_UNKNOWN,
+                                NULL);
+}
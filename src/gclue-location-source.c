@@ -83,29 +83,26 @@ static GParamSpec *gParamSpecs[LAST_PROP];
 
 #if GCLUE_USE_COMPASS
 static gboolean
-set_heading_from_compass (GClueLocationSource *source,
-                          GClueLocation       *location)
+get_heading_from_compass (GClueLocationSource *source,
+                          GClueLocation       *location,
+                          gdouble             *heading)
 {
         GClueLocationSourcePrivate *priv = source->priv;
-        gdouble heading, curr_heading;
 
         if (priv->compass == NULL)
                 return FALSE;
 
-        heading = gclue_compass_get_heading (priv->compass);
-        curr_heading = gclue_location_get_heading (location);
+        *heading = gclue_compass_get_heading (priv->compass);
 
-        if (heading == GCLUE_LOCATION_HEADING_UNKNOWN  ||
-            heading == curr_heading)
+        if (*heading == GCLUE_LOCATION_HEADING_UNKNOWN  ||
+            *heading == gclue_location_get_heading (location))
                 return FALSE;
 
         g_debug ("%s got new heading from compass: %f",
-                 G_OBJECT_TYPE_NAME (source), heading);
+                 G_OBJECT_TYPE_NAME (source), *heading);
         /* We trust heading from compass more than any other source so we always
          * override existing heading
          */
-        gclue_location_set_heading (location, heading);
-
         return TRUE;
 }
 
@@ -115,12 +112,21 @@ on_compass_heading_changed (GObject    *gobject,
                             gpointer    user_data)
 {
         GClueLocationSource* source = GCLUE_LOCATION_SOURCE (user_data);
+        GClueLocationSourcePrivate *priv = source->priv;
+        GClueLocation *location;
+        gdouble heading;
 
-        if (source->priv->location == NULL)
+        if (priv->location == NULL ||
+            !get_heading_from_compass (source, priv->location, &heading))
                 return;
 
-        if (set_heading_from_compass (source, source->priv->location))
-                g_object_notify (G_OBJECT (source), "location");
+        /* The current location may be shared already */
+        location = gclue_location_duplicate (priv->location);
+        gclue_location_set_heading (location, heading);
+        gclue_location_unref (priv->location);
+        priv->location = location;
+
+        g_object_notify (G_OBJECT (source), "location");
 }
 #endif /* GCLUE_USE_COMPASS */
 
@@ -134,7 +140,7 @@ gclue_location_source_get_property (GObject    *object,
 
         switch (prop_id) {
         case PROP_LOCATION:
-                g_value_set_object (value, source->priv->location);
+                g_value_set_boxed (value, source->priv->location);
                 break;
 
         case PROP_ACTIVE:
@@ -178,7 +184,7 @@ gclue_location_source_set_property (GObject      *object,
         switch (prop_id) {
         case PROP_LOCATION:
         {
-                GClueLocation *location = g_value_get_object (value);
+                GClueLocation *location = g_value_get_boxed (value);
 
                 gclue_location_source_set_location (source, location);
                 break;
@@ -211,7 +217,7 @@ gclue_location_source_finalize (GObject *object)
         GClueLocationSourcePrivate *priv = GCLUE_LOCATION_SOURCE (object)->priv;
 
         gclue_location_source_stop (GCLUE_LOCATION_SOURCE (object));
-        g_clear_object (&priv->location);
+        g_clear_pointer (&priv->location, gclue_location_unref);
         g_clear_object (&priv->time_threshold);
 
         G_OBJECT_CLASS (gclue_location_source_parent_class)->finalize (object);
@@ -230,11 +236,11 @@ gclue_location_source_class_init (GClueLocationSourceClass *klass)
         object_class->set_property = gclue_location_source_set_property;
         object_class->finalize = gclue_location_source_finalize;
 
-        gParamSpecs[PROP_LOCATION] = g_param_spec_object ("location",
-                                                          "Location",
-                                                          "Location",
-                                                          GCLUE_TYPE_LOCATION,
-                                                          G_PARAM_READWRITE);
+        gParamSpecs[PROP_LOCATION] = g_param_spec_boxed ("location",
+                                                         "Location",
+                                                         "Location",
+                                                         GCLUE_TYPE_LOCATION,
+                                                         G_PARAM_READWRITE);
         g_object_class_install_property (object_class,
                                          PROP_LOCATION,
                                          gParamSpecs[PROP_LOCATION]);
@@ -423,9 +429,51 @@ gclue_location_source_get_location (GClueLocationSource *source)
 /* 1 km in latitude is always .00899928005759539236 degrees */
 #define LATITUDE_IN_KM .00899928005759539236
 
+static GClueLocation *
+scramble_location (GClueLocationSource *source,
+                   GClueLocation       *location)
+{
+        gdouble latitude, distance, accuracy, scramble_range;
+
+        latitude = gclue_location_get_latitude (location);
+        accuracy = gclue_location_get_accuracy (location);
+
+        scramble_range = GCLUE_LOCATION_ACCURACY_NEIGHBORHOOD;
+        if (accuracy >= scramble_range) {
+                /* If the location source is already pretty inaccurate
+                 * do just a limited range scrambling to be sure.
+                 */
+                scramble_range /= 3;
+        }
+
+        /* Randomization is needed to stop apps from calculationg the
+         * actual location.
+         */
+        distance = g_random_double_range (0, scramble_range);
+        distance /= 1000;
+
+        if (g_random_boolean ())
+                latitude += distance * LATITUDE_IN_KM;
+        else
+                latitude -= distance * LATITUDE_IN_KM;
+        accuracy += scramble_range;
+
+        g_debug ("%s location scrambled", G_OBJECT_TYPE_NAME (source));
+
+        return gclue_location_new_full (latitude,
+                                        gclue_location_get_longitude (location),
+                                        accuracy,
+                                        gclue_location_get_speed (location),
+                                        gclue_location_get_heading (location),
+                                        gclue_location_get_altitude (location),
+                                        gclue_location_get_timestamp (location),
+                                        gclue_location_get_description (location));
+}
+
 /**
  * gclue_location_source_set_location:
  * @source: a #GClueLocationSource
+ * @location: the new location, not to be modified afterwards
  *
  * Set the current location to @location. Its meant to be only used by
  * subclasses.
@@ -436,75 +484,49 @@ gclue_location_source_set_location (GClueLocationSource *source,
 {
         GClueLocationSourcePrivate *priv = source->priv;
         GClueLocation *cur_location;
-        gdouble speed, heading;
+        gboolean compute_speed = FALSE, compute_heading = FALSE;
+        gboolean set_heading = FALSE;
+        gdouble heading = GCLUE_LOCATION_HEADING_UNKNOWN;
 
         cur_location = priv->location;
-        priv->location = gclue_location_duplicate (location);
-
-        if (priv->scramble_location) {
-                gdouble latitude, distance, accuracy, scramble_range;
-
-                latitude = gclue_location_get_latitude (priv->location);
-                accuracy = gclue_location_get_accuracy (priv->location);
-
-                scramble_range = GCLUE_LOCATION_ACCURACY_NEIGHBORHOOD;
-                if (accuracy >= scramble_range) {
-                        /* If the location source is already pretty inaccurate
-                         * do just a limited range scrambling to be sure.
-                         */
-                        scramble_range /= 3;
-                }
-
-                /* Randomization is needed to stop apps from calculationg the
-                 * actual location.
-                 */
-                distance = g_random_double_range (0, scramble_range);
-                distance /= 1000;
-
-                if (g_random_boolean ())
-                        latitude += distance * LATITUDE_IN_KM;
-                else
-                        latitude -= distance * LATITUDE_IN_KM;
-                accuracy += scramble_range;
-
-                g_object_set (G_OBJECT (priv->location),
-                              "latitude", latitude,
-                              "accuracy", accuracy,
-                              NULL);
-                g_debug ("%s location scrambled", G_OBJECT_TYPE_NAME (source));
-        }
-
-        speed = gclue_location_get_speed (location);
-        if (speed == GCLUE_LOCATION_SPEED_UNKNOWN) {
-                if (cur_location != NULL && priv->compute_movement) {
-                        guint64 cur_timestamp, timestamp;
-
-                        timestamp = gclue_location_get_timestamp (location);
-                        cur_timestamp = gclue_location_get_timestamp
-                                        (cur_location);
 
-                        if (timestamp != cur_timestamp)
-                                gclue_location_set_speed_from_prev_location
-                                        (priv->location, cur_location);
-                }
-        } else {
-                gclue_location_set_speed (priv->location, speed);
+        if (cur_location != NULL && priv->compute_movement) {
+                compute_speed =
+                        gclue_location_get_speed (location) ==
+                        GCLUE_LOCATION_SPEED_UNKNOWN &&
+                        gclue_location_get_timestamp (location) !=
+                        gclue_location_get_timestamp (cur_location);
+                compute_heading =
+                        gclue_location_get_heading (location) ==
+                        GCLUE_LOCATION_HEADING_UNKNOWN;
         }
 
 #if GCLUE_USE_COMPASS
-        set_heading_from_compass (source, location);
+        set_heading = get_heading_from_compass (source, location, &heading);
+        if (set_heading)
+                compute_heading = FALSE;
 #endif
-        heading = gclue_location_get_heading (location);
-        if (heading == GCLUE_LOCATION_HEADING_UNKNOWN) {
-                if (cur_location != NULL && priv->compute_movement)
-                        gclue_location_set_heading_from_prev_location
-                                (priv->location, cur_location);
-        } else {
+
+        /* Locations are shared with the locator and the clients, so only
+         * the ones that need changes are copied */
+        if (priv->scramble_location)
+                priv->location = scramble_location (source, location);
+        else if (compute_speed || compute_heading || set_heading)
+                priv->location = gclue_location_duplicate (location);
+        else
+                priv->location = gclue_location_ref (location);
+
+        if (compute_speed)
+                gclue_location_set_speed_from_prev_location (priv->location,
+                                                             cur_location);
+        if (set_heading)
                 gclue_location_set_heading (priv->location, heading);
-        }
+        else if (compute_heading)
+                gclue_location_set_heading_from_prev_location (priv->location,
+                                                               cur_location);
 
         g_object_notify (G_OBJECT (source), "location");
-        g_clear_object (&cur_location);
+        g_clear_pointer (&cur_location, gclue_location_unref);
 }
 
 /**
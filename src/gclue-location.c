@@ -35,8 +35,19 @@
 #define RMC_TIME_DIFF_THRESHOLD 5 /* 5 seconds */
 #define RMC_DEFAULT_ACCURACY 5    /* 5 meters */
 
-struct _GClueLocationPrivate {
-        char   *description;
+/**
+ * SECTION:gclue-location
+ * @short_description: A location fix
+ *
+ * Locations are reference counted plain structures, shared as they are by the
+ * sources, the locator and the clients. They must not be modified once
+ * shared, the setters are only meant for filling in a new location.
+ **/
+
+struct _GClueLocation {
+        gatomicrefcount ref_count;
+
+        const char *description; /* Interned */
 
         gdouble longitude;
         gdouble latitude;
@@ -47,77 +58,58 @@ struct _GClueLocationPrivate {
         gdouble heading;
 };
 
-enum {
-        PROP_0,
-
-        PROP_LATITUDE,
-        PROP_LONGITUDE,
-        PROP_ACCURACY,
-        PROP_DESCRIPTION,
-        PROP_TIMESTAMP,
-        PROP_ALTITUDE,
-        PROP_SPEED,
-        PROP_HEADING,
-};
+G_DEFINE_BOXED_TYPE (GClueLocation,
+                     gclue_location,
+                     gclue_location_ref,
+                     gclue_location_unref)
 
-G_DEFINE_TYPE_WITH_CODE (GClueLocation,
-                         gclue_location,
-                         G_TYPE_OBJECT,
-                         G_ADD_PRIVATE (GClueLocation));
+/* Only the owner of the single reference may modify a location */
+#define LOCATION_IS_EXCLUSIVE(loc) \
+        ((loc) != NULL && g_atomic_ref_count_compare (&(loc)->ref_count, 1))
 
-static void
-gclue_location_get_property (GObject    *object,
-                             guint       property_id,
-                             GValue     *value,
-                             GParamSpec *pspec)
+/**
+ * gclue_location_ref:
+ * @location: a #GClueLocation
+ *
+ * Returns: (transfer full): @location
+ **/
+GClueLocation *
+gclue_location_ref (GClueLocation *location)
 {
-        GClueLocation *location = GCLUE_LOCATION (object);
-
-        switch (property_id) {
-        case PROP_DESCRIPTION:
-                g_value_set_string (value,
-                                    gclue_location_get_description (location));
-                break;
-
-        case PROP_LATITUDE:
-                g_value_set_double (value,
-                                    gclue_location_get_latitude (location));
-                break;
-
-        case PROP_LONGITUDE:
-                g_value_set_double (value,
-                                    gclue_location_get_longitude (location));
-                break;
-
-        case PROP_ALTITUDE:
-                g_value_set_double (value,
-                                    gclue_location_get_altitude (location));
-                break;
-
-        case PROP_ACCURACY:
-                g_value_set_double (value,
-                                    gclue_location_get_accuracy (location));
-                break;
-
-        case PROP_TIMESTAMP:
-                g_value_set_uint64 (value,
-                                    gclue_location_get_timestamp (location));
-                break;
-        case PROP_SPEED:
-                g_value_set_double (value,
-                                    gclue_location_get_speed (location));
-                break;
-
-        case PROP_HEADING:
-                g_value_set_double (value,
-                                    gclue_location_get_heading (location));
-                break;
-
-        default:
-                /* We don't have any other property... */
-                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-                break;
-        }
+        g_return_val_if_fail (location != NULL, NULL);
+
+        g_atomic_ref_count_inc (&location->ref_count);
+
+        return location;
+}
+
+/**
+ * gclue_location_unref:
+ * @location: a #GClueLocation
+ *
+ * Releases a reference on @location, freeing it with the last one.
+ **/
+void
+gclue_location_unref (GClueLocation *location)
+{
+        g_return_if_fail (location != NULL);
+
+        if (g_atomic_ref_count_dec (&location->ref_count))
+                g_free (location);
+}
+
+static GClueLocation *
+location_new (void)
+{
+        GClueLocation *location = g_new0 (GClueLocation, 1);
+
+        g_atomic_ref_count_init (&location->ref_count);
+        location->altitude = GCLUE_LOCATION_ALTITUDE_UNKNOWN;
+        location->accuracy = GCLUE_LOCATION_ACCURACY_UNKNOWN;
+        location->speed = GCLUE_LOCATION_SPEED_UNKNOWN;
+        location->heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+
+        return location;
 }
 
 static void
@@ -126,7 +118,7 @@ gclue_location_set_latitude (GClueLocation *loc,
 {
         g_return_if_fail (latitude >= -90.0 && latitude <= 90.0);
 
-        loc->priv->latitude = latitude;
+        loc->latitude = latitude;
 }
 
 static void
@@ -135,271 +127,49 @@ gclue_location_set_longitude (GClueLocation *loc,
 {
         g_return_if_fail (longitude >= -180.0 && longitude <= 180.0);
 
-        loc->priv->longitude = longitude;
+        loc->longitude = longitude;
 }
 
 static void
 gclue_location_set_altitude (GClueLocation *loc,
                              gdouble        altitude)
 {
-        loc->priv->altitude = altitude;
+        loc->altitude = altitude;
 }
 
+/**
+ * gclue_location_set_accuracy:
+ * @loc: a new #GClueLocation, not shared yet
+ * @accuracy: accuracy in meters
+ *
+ * Sets the accuracy.
+ **/
 void
 gclue_location_set_accuracy (GClueLocation *loc,
                              gdouble        accuracy)
 {
+        g_return_if_fail (LOCATION_IS_EXCLUSIVE (loc));
         g_return_if_fail (accuracy >= GCLUE_LOCATION_ACCURACY_UNKNOWN);
 
-        loc->priv->accuracy = accuracy;
-}
-
-static void
-gclue_location_set_timestamp (GClueLocation *loc,
-                              guint64        timestamp)
-{
-        g_return_if_fail (GCLUE_IS_LOCATION (loc));
-
-        loc->priv->timestamp = timestamp;
+        loc->accuracy = accuracy;
 }
 
+/**
+ * gclue_location_set_description:
+ * @loc: a new #GClueLocation, not shared yet
+ * @description: a description for the location
+ *
+ * Sets the description.
+ **/
 void
 gclue_location_set_description (GClueLocation *loc,
                                 const char    *description)
 {
-        g_return_if_fail (GCLUE_IS_LOCATION (loc));
-
-        g_free (loc->priv->description);
-        loc->priv->description = g_strdup (description);
-}
-
-static void
-gclue_location_set_property (GObject      *object,
-                             guint         property_id,
-                             const GValue *value,
-                             GParamSpec   *pspec)
-{
-        GClueLocation *location = GCLUE_LOCATION (object);
-
-        switch (property_id) {
-        case PROP_DESCRIPTION:
-                gclue_location_set_description (location,
-                                                g_value_get_string (value));
-                break;
-
-        case PROP_LATITUDE:
-                gclue_location_set_latitude (location,
-                                             g_value_get_double (value));
-                break;
-
-        case PROP_LONGITUDE:
-                gclue_location_set_longitude (location,
-                                              g_value_get_double (value));
-                break;
-
-        case PROP_ALTITUDE:
-                gclue_location_set_altitude (location,
-                                             g_value_get_double (value));
-                break;
-
-        case PROP_ACCURACY:
-                gclue_location_set_accuracy (location,
-                                             g_value_get_double (value));
-                break;
-
-        case PROP_TIMESTAMP:
-                gclue_location_set_timestamp (location,
-                                              g_value_get_uint64 (value));
-                break;
-        case PROP_SPEED:
-                gclue_location_set_speed (location,
-                                          g_value_get_double (value));
-                break;
-
-        case PROP_HEADING:
-                gclue_location_set_heading (location,
-                                            g_value_get_double (value));
-                break;
-
-        default:
-                /* We don't have any other property... */
-                G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
-                break;
-        }
-}
-
-static void
-gclue_location_constructed (GObject *object)
-{
-        GClueLocation *location = GCLUE_LOCATION (object);
-        gint64 timestamp;
+        g_return_if_fail (LOCATION_IS_EXCLUSIVE (loc));
 
-        if (location->priv->timestamp != 0)
-                return;
-
-        timestamp = g_get_real_time () / G_USEC_PER_SEC;
-        gclue_location_set_timestamp (location, timestamp);
-}
-
-static void
-gclue_location_finalize (GObject *glocation)
-{
-        g_clear_pointer (&GCLUE_LOCATION (glocation)->priv->description,
-                         g_free);
-
-        G_OBJECT_CLASS (gclue_location_parent_class)->finalize (glocation);
-}
-
-static void
-gclue_location_class_init (GClueLocationClass *klass)
-{
-        GObjectClass *glocation_class = G_OBJECT_CLASS (klass);
-        GParamSpec *pspec;
-
-        glocation_class->constructed = gclue_location_constructed;
-        glocation_class->finalize = gclue_location_finalize;
-        glocation_class->get_property = gclue_location_get_property;
-        glocation_class->set_property = gclue_location_set_property;
-
-        /**
-         * GClueLocation:description:
-         *
-         * The description of this location.
-         */
-        pspec = g_param_spec_string ("description",
-                                     "Description",
-                                     "Description of this location",
-                                     NULL,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_DESCRIPTION, pspec);
-
-        /**
-         * GClueLocation:latitude:
-         *
-         * The latitude of this location in degrees.
-         */
-        pspec = g_param_spec_double ("latitude",
-                                     "Latitude",
-                                     "The latitude of this location in degrees",
-                                     -90.0,
-                                     90.0,
-                                     0.0,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_LATITUDE, pspec);
-
-        /**
-         * GClueLocation:longitude:
-         *
-         * The longitude of this location in degrees.
-         */
-        pspec = g_param_spec_double ("longitude",
-                                     "Longitude",
-                                     "The longitude of this location in degrees",
-                                     -180.0,
-                                     180.0,
-                                     0.0,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_LONGITUDE, pspec);
-
-        /**
-         * GClueLocation:altitude:
-         *
-         * The altitude of this location in meters.
-         */
-        pspec = g_param_spec_double ("altitude",
-                                     "Altitude",
-                                     "The altitude of this location in meters",
-                                     GCLUE_LOCATION_ALTITUDE_UNKNOWN,
-                                     G_MAXDOUBLE,
-                                     GCLUE_LOCATION_ALTITUDE_UNKNOWN,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_ALTITUDE, pspec);
-
-        /**
-         * GClueLocation:accuracy:
-         *
-         * The accuracy of this location in meters.
-         */
-        pspec = g_param_spec_double ("accuracy",
-                                     "Accuracy",
-                                     "The accuracy of this location in meters",
-                                     GCLUE_LOCATION_ACCURACY_UNKNOWN,
-                                     G_MAXDOUBLE,
-                                     GCLUE_LOCATION_ACCURACY_UNKNOWN,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_ACCURACY, pspec);
-
-
-        /**
-         * GClueLocation:timestamp:
-         *
-         * A timestamp in seconds since
-         * <ulink url="http://en.wikipedia.org/wiki/Unix_epoch">Epoch</ulink>,
-         * giving when the location was resolved from an address.
-         *
-         * A value of 0 (zero) will be interpreted as the current time.
-         */
-        pspec = g_param_spec_uint64 ("timestamp",
-                                     "Timestamp",
-                                     "The timestamp of this location "
-                                     "in seconds since Epoch",
-                                     0,
-                                     G_MAXINT64,
-                                     0,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_CONSTRUCT_ONLY |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_TIMESTAMP, pspec);
-
-        /**
-         * GClueLocation:speed
-         *
-         * The speed in meters per second.
-         */
-        pspec = g_param_spec_double ("speed",
-                                     "Speed",
-                                     "Speed in meters per second",
-                                     GCLUE_LOCATION_SPEED_UNKNOWN,
-                                     G_MAXDOUBLE,
-                                     GCLUE_LOCATION_SPEED_UNKNOWN,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_SPEED, pspec);
-
-        /**
-         * GClueLocation:heading
-         *
-         * The positive angle between the direction of movement and the North
-         * direction, in clockwise direction. The angle is measured in degrees.
-         */
-        pspec = g_param_spec_double ("heading",
-                                     "Heading",
-                                     "The positive Angle between the direction"
-                                     " of movement and the North direction, in"
-                                     " clockwise direction. The angle is "
-                                     "measured in degrees.",
-                                     GCLUE_LOCATION_HEADING_UNKNOWN,
-                                     G_MAXDOUBLE,
-                                     GCLUE_LOCATION_HEADING_UNKNOWN,
-                                     G_PARAM_READWRITE |
-                                     G_PARAM_STATIC_STRINGS);
-        g_object_class_install_property (glocation_class, PROP_HEADING, pspec);
-}
-
-static void
-gclue_location_init (GClueLocation *location)
-{
-        location->priv = gclue_location_get_instance_private (location);
-
-        location->priv->altitude = GCLUE_LOCATION_ALTITUDE_UNKNOWN;
-        location->priv->accuracy = GCLUE_LOCATION_ACCURACY_UNKNOWN;
-        location->priv->speed = GCLUE_LOCATION_SPEED_UNKNOWN;
-        location->priv->heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+        /* There are only a few different descriptions, so this saves
+         * copying them along with every location */
+        loc->description = g_intern_string (description);
 }
 
 static gdouble
@@ -423,57 +193,22 @@ get_accuracy_from_hdop (gdouble hdop)
 }
 
 static gdouble
-parse_coordinate_string (const char *coordinate,
-                         const char *direction)
+parse_coordinate (const GClueNMEAField *coordinate,
+                  const GClueNMEAField *direction)
 {
-        gdouble minutes, degrees, out;
-        g_autofree gchar *degrees_str = NULL;
-        const char *c, *dot_str, *coordinate_end;
-        char *conversion_end;
-        gint dot_offset;
-
-        if (!coordinate || !direction || coordinate[0] == '\0' || direction[0] == '\0')
-                return INVALID_COORDINATE;
-
-        if (direction[0] != 'N' &&
-            direction[0] != 'S' &&
-            direction[0] != 'E' &&
-            direction[0] != 'W') {
-                g_warning ("Unknown direction '%s' for coordinates, ignoring..",
-                           direction);
-                return INVALID_COORDINATE;
-        }
-
-        for (c = coordinate; *c != '\0'; c++) {
-                if (!(g_ascii_isdigit (*c) || *c == '.')) {
-                        g_warning ("Invalid coordinate string '%s'", coordinate);
-                        return INVALID_COORDINATE;
-                }
-        }
-        coordinate_end = c;
+        gdouble out;
 
-        dot_str = g_strstr_len (coordinate, 6, ".");
-        dot_offset = dot_str - coordinate;
-        if (!dot_str || dot_offset < 3) {
-                g_warning ("Invalid coordinate string '%s'", coordinate);
+        if (gclue_nmea_field_is_empty (coordinate) ||
+            gclue_nmea_field_is_empty (direction))
                 return INVALID_COORDINATE;
-        }
-
-        degrees_str = g_strndup (coordinate, dot_offset - 2);
-        degrees = g_ascii_strtod (degrees_str, NULL);
 
-        minutes = g_ascii_strtod (dot_str - 2, &conversion_end);
-        if (conversion_end != coordinate_end) {
-                g_warning ("Invalid coordinate string '%s'", coordinate);
+        if (!gclue_nmea_field_to_coordinate (coordinate, direction, &out)) {
+                g_warning ("Invalid coordinate '%.*s,%.*s'",
+                           (int) coordinate->length, coordinate->data,
+                           (int) direction->length, direction->data);
                 return INVALID_COORDINATE;
         }
 
-        /* Include the minutes as part of the degrees */
-        out = degrees + (minutes / 60.0);
-
-        if (direction[0] == 'S' || direction[0] == 'W')
-                out = 0 - out;
-
         return out;
 }
 
@@ -489,69 +224,64 @@ coordinates_ok (double latitude,
 }
 
 static gdouble
-parse_altitude_string (const char *altitude,
-                       const char *unit)
+parse_altitude (const GClueNMEAField *altitude,
+                const GClueNMEAField *unit)
 {
-        if (altitude[0] == '\0' || unit[0] == '\0')
+        gdouble out;
+
+        if (gclue_nmea_field_is_empty (altitude) ||
+            gclue_nmea_field_is_empty (unit))
                 return GCLUE_LOCATION_ALTITUDE_UNKNOWN;
 
-        if (unit[0] != 'M') {
-                g_warning ("Unknown unit '%s' for altitude, ignoring..",
-                           unit);
+        if (!gclue_nmea_field_equal (unit, "M")) {
+                g_warning ("Unknown unit '%.*s' for altitude, ignoring..",
+                           (int) unit->length, unit->data);
 
                 return GCLUE_LOCATION_ALTITUDE_UNKNOWN;
         }
 
-        return g_ascii_strtod (altitude, NULL);
+        if (!gclue_nmea_field_to_double (altitude, &out))
+                return GCLUE_LOCATION_ALTITUDE_UNKNOWN;
+
+        return out;
 }
 
 /* Return a timestamp derived from the NMEA timestamp and system date as
  * seconds since epoch.
- * If system time cannot be retrieved, return 0.
  * If timestamp parsing fails, return system time.
  * If the parsed time is in the future when compared to the system time,
  * return the parsed time yesterday.
  */
 static gint64
-parse_nmea_timestamp (const char *nmea_ts)
+parse_nmea_timestamp (const GClueNMEAField *nmea_ts)
 {
-        g_autoptr(GDateTime) now = NULL;
-        g_autoptr(GDateTime) midnight = NULL;
-        g_autoptr(GDateTime) ts = NULL;
+        gint64 now, midnight, ts;
         GTimeSpan timespan;
 
-        now = g_date_time_new_now_utc ();
-        if (now == NULL) {
-                g_warning ("Failed to get the current UTC time");
-                return 0;
-        }
+        now = g_get_real_time ();
 
-        if (!nmea_ts || !*nmea_ts) {  /* Empty timestamp, no warning */
-                return g_date_time_to_unix (now);
+        if (gclue_nmea_field_is_empty (nmea_ts)) {  /* Empty timestamp, no warning */
+                return now / G_USEC_PER_SEC;
         }
 
-        timespan = gclue_nmea_timestamp_to_timespan (nmea_ts);
+        timespan = gclue_nmea_field_to_timespan (nmea_ts);
         if (timespan < 0) {
-                g_warning ("Failed to parse NMEA timestamp '%s'", nmea_ts);
-                return g_date_time_to_unix (now);
+                g_warning ("Failed to parse NMEA timestamp '%.*s'",
+                           (int) nmea_ts->length, nmea_ts->data);
+                return now / G_USEC_PER_SEC;
         }
 
-        midnight = g_date_time_new_utc (g_date_time_get_year (now),
-                                        g_date_time_get_month (now),
-                                        g_date_time_get_day_of_month (now),
-                                        0,
-                                        0,
-                                        0);
-        ts = g_date_time_add (midnight, timespan);
-
-        if (g_date_time_difference (ts, now) > TIME_DIFF_THRESHOLD) {
-                g_debug ("NMEA timestamp '%s' in future. Assuming yesterday's.",
-                         nmea_ts);
-                g_clear_pointer (&ts, g_date_time_unref);
-                ts = g_date_time_add (midnight, timespan - G_TIME_SPAN_DAY);
+        /* Unix time has no leap seconds, so UTC days are all the same length */
+        midnight = now - now % G_TIME_SPAN_DAY;
+        ts = midnight + timespan;
+
+        if (ts - now > TIME_DIFF_THRESHOLD) {
+                g_debug ("NMEA timestamp '%.*s' in future. Assuming yesterday's.",
+                         (int) nmea_ts->length, nmea_ts->data);
+                ts -= G_TIME_SPAN_DAY;
         }
 
-        return g_date_time_to_unix (ts);
+        return ts / G_USEC_PER_SEC;
 }
 
 /**
@@ -561,9 +291,9 @@ parse_nmea_timestamp (const char *nmea_ts)
  * @accuracy: accuracy of location in meters
  * @description: a description for the location
  *
- * Creates a new #GClueLocation object.
+ * Creates a new #GClueLocation, with the current time as timestamp.
  *
- * Returns: a new #GClueLocation object. Use g_object_unref() when done.
+ * Returns: a new #GClueLocation. Use gclue_location_unref() when done.
  **/
 GClueLocation *
 gclue_location_new (gdouble latitude,
@@ -571,12 +301,14 @@ gclue_location_new (gdouble latitude,
                     gdouble accuracy,
                     const char *description)
 {
-        return g_object_new (GCLUE_TYPE_LOCATION,
-                             "latitude", latitude,
-                             "longitude", longitude,
-                             "accuracy", accuracy,
-                             "description", description,
-                             NULL);
+        return gclue_location_new_full (latitude,
+                                        longitude,
+                                        accuracy,
+                                        GCLUE_LOCATION_SPEED_UNKNOWN,
+                                        GCLUE_LOCATION_HEADING_UNKNOWN,
+                                        GCLUE_LOCATION_ALTITUDE_UNKNOWN,
+                                        0,
+                                        description);
 }
 
 /**
@@ -587,12 +319,12 @@ gclue_location_new (gdouble latitude,
  * @speed: speed in meters per second
  * @heading: heading in degrees
  * @altitude: altitude of location in meters
- * @timestamp: timestamp in seconds since the Epoch
+ * @timestamp: timestamp in seconds since the Epoch, 0 for the current time
  * @description: a description for the location
  *
- * Creates a new #GClueLocation object.
+ * Creates a new #GClueLocation.
  *
- * Returns: a new #GClueLocation object. Use g_object_unref() when done.
+ * Returns: a new #GClueLocation. Use gclue_location_unref() when done.
  **/
 GClueLocation *
 gclue_location_new_full (gdouble     latitude,
@@ -604,34 +336,38 @@ gclue_location_new_full (gdouble     latitude,
                          guint64     timestamp,
                          const char *description)
 {
-        return g_object_new (GCLUE_TYPE_LOCATION,
-                             "latitude", latitude,
-                             "longitude", longitude,
-                             "accuracy", accuracy,
-                             "speed", speed,
-                             "heading", heading,
-                             "altitude", altitude,
-                             "timestamp", timestamp,
-                             "description", description,
-                             NULL);
+        GClueLocation *location = location_new ();
+
+        gclue_location_set_latitude (location, latitude);
+        gclue_location_set_longitude (location, longitude);
+        gclue_location_set_accuracy (location, accuracy);
+        gclue_location_set_speed (location, speed);
+        gclue_location_set_heading (location, heading);
+        gclue_location_set_altitude (location, altitude);
+        gclue_location_set_description (location, description);
+
+        if (timestamp == 0)
+                timestamp = g_get_real_time () / G_USEC_PER_SEC;
+        location->timestamp = timestamp;
+
+        return location;
 }
 
 static GClueLocation *
-gclue_location_create_from_gga (const char *gga)
+gclue_location_create_from_gga (const GClueNMEASentence *gga)
 {
-        GClueLocation *location;
         gdouble latitude, longitude, accuracy, altitude;
         gdouble hdop; /* Horizontal Dilution Of Precision */
+        gint64 fix_quality;
         guint64 timestamp;
-        g_auto(GStrv) parts = NULL;
 
-        parts = g_strsplit (gga, ",", -1);
-        if (g_strv_length (parts) < 11) {
+        if (gga->n_fields < 11) {
                 g_warning ("Received short NMEA GGA sentence, discarding.");
                 return NULL;
         }
 
-        if (g_ascii_strtoll (parts[6], NULL, 10) == 0) {
+        if (!gclue_nmea_field_to_int (&gga->fields[6], &fix_quality) ||
+            fix_quality == 0) {
                 /* No fix, ignore. */
                 return NULL;
         }
@@ -639,56 +375,51 @@ gclue_location_create_from_gga (const char *gga)
         /* For syntax of GGA sentences:
          * https://gpsd.gitlab.io/gpsd/NMEA.html#_gga_global_positioning_system_fix_data
          */
-        timestamp = parse_nmea_timestamp (parts[1]);
-        latitude = parse_coordinate_string (parts[2], parts[3]);
-        longitude = parse_coordinate_string (parts[4], parts[5]);
+        timestamp = parse_nmea_timestamp (&gga->fields[1]);
+        latitude = parse_coordinate (&gga->fields[2], &gga->fields[3]);
+        longitude = parse_coordinate (&gga->fields[4], &gga->fields[5]);
         if (!coordinates_ok (latitude, longitude)) {
                 g_warning ("Invalid coordinates (%f, %f) on NMEA GGA sentence.",
                            latitude, longitude);
                 return NULL;
         }
 
-        altitude = parse_altitude_string (parts[9], parts[10]);
+        altitude = parse_altitude (&gga->fields[9], &gga->fields[10]);
 
-        hdop = g_ascii_strtod (parts[8], NULL);
+        if (!gclue_nmea_field_to_double (&gga->fields[8], &hdop))
+                hdop = 0;
         accuracy = get_accuracy_from_hdop (hdop);
 
-        location = g_object_new (GCLUE_TYPE_LOCATION,
-                                 "latitude", latitude,
-                                 "longitude", longitude,
-                                 "accuracy", accuracy,
-                                 "timestamp", timestamp,
-                                 "description", "GPS GGA",
-                                 NULL);
-        if (altitude != GCLUE_LOCATION_ALTITUDE_UNKNOWN)
-                g_object_set (location, "altitude", altitude, NULL);
-
-        return location;
+        return gclue_location_new_full (latitude,
+                                        longitude,
+                                        accuracy,
+                                        GCLUE_LOCATION_SPEED_UNKNOWN,
+                                        GCLUE_LOCATION_HEADING_UNKNOWN,
+                                        altitude,
+                                        timestamp,
+                                        "GPS GGA");
 }
 
 static GClueLocation *
-gclue_location_create_from_rmc (const char     *rmc,
-                                GClueLocation  *prev_location)
+gclue_location_create_from_rmc (const GClueNMEASentence *rmc,
+                                GClueLocation           *prev_location)
 {
-        GClueLocation *location;
-        g_auto(GStrv) parts = NULL;
         gdouble accuracy;
         gdouble altitude;
 
-        parts = g_strsplit (rmc, ",", -1);
-        if (g_strv_length (parts) < 12) {
+        if (rmc->n_fields < 12) {
                 g_warning ("Invalid NMEA RMC sentence.");
                 return NULL;
         }
 
         /* RMC sentence is invalid */
-        if (g_strcmp0 (parts[2], "A") != 0) {
+        if (!gclue_nmea_field_equal (&rmc->fields[2], "A")) {
                 return NULL;
         }
 
-        guint64 timestamp = parse_nmea_timestamp (parts[1]);
-        gdouble lat = parse_coordinate_string (parts[3], parts[4]);
-        gdouble lon = parse_coordinate_string (parts[5], parts[6]);
+        guint64 timestamp = parse_nmea_timestamp (&rmc->fields[1]);
+        gdouble lat = parse_coordinate (&rmc->fields[3], &rmc->fields[4]);
+        gdouble lon = parse_coordinate (&rmc->fields[5], &rmc->fields[6]);
         if (!coordinates_ok (lat, lon)) {
                 g_warning ("Invalid coordinates (%f, %f) on NMEA RMC sentence.",
                            lat, lon);
@@ -696,12 +427,14 @@ gclue_location_create_from_rmc (const char     *rmc,
         }
 
         gdouble speed = GCLUE_LOCATION_SPEED_UNKNOWN;
-        if (parts[7][0] != '\0')
-                speed = g_ascii_strtod (parts[7], NULL) * KNOTS_IN_METERS_PER_SECOND;
+        if (gclue_nmea_field_to_double (&rmc->fields[7], &speed))
+                speed *= KNOTS_IN_METERS_PER_SECOND;
+        else
+                speed = GCLUE_LOCATION_SPEED_UNKNOWN;
 
         gdouble heading = GCLUE_LOCATION_HEADING_UNKNOWN;
-        if (parts[8][0] != '\0')
-                heading = g_ascii_strtod (parts[8], NULL);
+        if (!gclue_nmea_field_to_double (&rmc->fields[8], &heading))
+                heading = GCLUE_LOCATION_HEADING_UNKNOWN;
 
         /* Some receivers use '0.0,0.0' as invalid speed and heading */
         if (speed == 0.0 && heading == 0.0) {
@@ -726,18 +459,112 @@ gclue_location_create_from_rmc (const char     *rmc,
                 }
         }
 
-        location = g_object_new (GCLUE_TYPE_LOCATION,
-                                 "latitude", lat,
-                                 "longitude", lon,
-                                 "timestamp", timestamp,
-                                 "speed", speed,
-                                 "heading", heading,
-                                 "description", "GPS RMC",
-                                 "accuracy", accuracy,
-                                 "altitude", altitude,
-                                 NULL);
+        return gclue_location_new_full (lat,
+                                        lon,
+                                        accuracy,
+                                        speed,
+                                        heading,
+                                        altitude,
+                                        timestamp,
+                                        "GPS RMC");
+}
 
-        return location;
+/* Error estimate of the fix, in meters, or -1 */
+static gdouble
+get_accuracy_from_gst (const GClueNMEASentence *gst)
+{
+        gdouble a, b;
+
+        /* For syntax of GST sentences:
+         * https://gpsd.gitlab.io/gpsd/NMEA.html#_gst_gps_pseudorange_noise_statistics
+         *
+         * Standard deviations of latitude and longitude errors, with the
+         * axes of the error ellipse as fallback as some receivers only
+         * fill these in. */
+        if (!gclue_nmea_field_to_double
+                (gclue_nmea_sentence_get_field (gst, 6), &a) ||
+            !gclue_nmea_field_to_double
+                (gclue_nmea_sentence_get_field (gst, 7), &b)) {
+                if (!gclue_nmea_field_to_double
+                        (gclue_nmea_sentence_get_field (gst, 3), &a) ||
+                    !gclue_nmea_field_to_double
+                        (gclue_nmea_sentence_get_field (gst, 4), &b))
+                        return -1;
+        }
+
+        /* Receivers without an estimate send zeros */
+        if (a <= 0 && b <= 0)
+                return -1;
+
+        return sqrt (a * a + b * b);
+}
+
+static void
+apply_vtg (GClueLocation           *location,
+           const GClueNMEASentence *vtg)
+{
+        gdouble speed, heading;
+
+        /* For syntax of VTG sentences:
+         * https://gpsd.gitlab.io/gpsd/NMEA.html#_vtg_track_made_good_and_ground_speed
+         */
+        if (gclue_nmea_field_equal (gclue_nmea_sentence_get_field (vtg, 9), "N"))
+                return; /* Data not valid, NMEA 2.3 and later */
+
+        if (gclue_nmea_field_to_double
+                (gclue_nmea_sentence_get_field (vtg, 7), &speed))
+                speed /= 3.6;
+        else if (gclue_nmea_field_to_double
+                (gclue_nmea_sentence_get_field (vtg, 5), &speed))
+                speed *= KNOTS_IN_METERS_PER_SECOND;
+        else
+                return;
+
+        if (!gclue_nmea_field_to_double
+                (gclue_nmea_sentence_get_field (vtg, 1), &heading))
+                heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+
+        /* Same as for RMC */
+        if (speed == 0.0 && heading == 0.0)
+                return;
+
+        gclue_location_set_speed (location, speed);
+        if (heading != GCLUE_LOCATION_HEADING_UNKNOWN)
+                gclue_location_set_heading (location, heading);
+}
+
+/* Position in gclue_nmea_get_gnss_talkers(), lower is better */
+static guint
+get_talker_rank (const GClueNMEASentence *sentence)
+{
+        const char * const *talkers = gclue_nmea_get_gnss_talkers ();
+        guint i;
+
+        for (i = 0; talkers[i] != NULL; i++) {
+                if (memcmp (sentence->fields[0].data, talkers[i], 2) == 0)
+                        break;
+        }
+
+        return i;
+}
+
+/* Whether to use @sentence rather than the one of the same type found
+ * before, if any: receivers may send both the solution of each
+ * constellation and the combined one. */
+static gboolean
+prefer_sentence (const GClueNMEASentence *sentence,
+                 gboolean                *found,
+                 guint                   *rank)
+{
+        guint sentence_rank = get_talker_rank (sentence);
+
+        if (*found && sentence_rank >= *rank)
+                return FALSE;
+
+        *found = TRUE;
+        *rank = sentence_rank;
+
+        return TRUE;
 }
 
 /**
@@ -746,106 +573,172 @@ gclue_location_create_from_rmc (const char     *rmc,
  * @prev_location: Previous location provided from the location source
  *
  * Creates a new #GClueLocation object by combining data from multiple NMEA
- * sentences.
+ * sentences. Sentences of all satellite constellations are accepted. Position
+ * comes from GGA and RMC, while GST, GSA and VTG refine the accuracy, the
+ * altitude and the velocity, respectively. Where several constellations
+ * send the same type, the combined solution is preferred, as ranked by
+ * gclue_nmea_get_gnss_talkers().
  *
  * Returns: a new #GClueLocation object if GGA or RMC sentences are found,
- * a %NULL on all other cases and errors. Unref using #g_object_unref() when
- * done with it.
+ * a %NULL on all other cases and errors. Unref using gclue_location_unref()
+ * when done with it.
  **/
 GClueLocation *
 gclue_location_create_from_nmeas (const char     *nmeas[],
                                   GClueLocation  *prev_location)
 {
-        GClueLocation *gga_loc = NULL;
+        GClueLocation *location = NULL;
         GClueLocation *rmc_loc = NULL;
+        GClueNMEASentence gga, rmc, gsa, gst, vtg;
+        gboolean has_gga = FALSE, has_rmc = FALSE, has_gsa = FALSE;
+        gboolean has_gst = FALSE, has_vtg = FALSE;
+        guint gga_rank = 0, rmc_rank = 0, gst_rank = 0, vtg_rank = 0;
+        gint64 n_in_view = 0;
+        gdouble accuracy;
         const char **iter;
 
         for (iter = nmeas; *iter != NULL; iter++) {
-                if (!gga_loc && gclue_nmea_type_is (*iter, "GGA"))
-                        gga_loc = gclue_location_create_from_gga (*iter);
-                if (!rmc_loc && gclue_nmea_type_is (*iter, "RMC"))
-                        rmc_loc = gclue_location_create_from_rmc
-                                (*iter, prev_location);
-                if (gga_loc && rmc_loc)
-                    break;
+                GClueNMEASentence sentence;
+                gint64 n;
+
+                if (!gclue_nmea_sentence_parse (&sentence, *iter, -1)) {
+                        g_debug ("Ignoring invalid NMEA sentence '%s'", *iter);
+                        continue;
+                }
+                if (!gclue_nmea_sentence_is_gnss (&sentence))
+                        continue;
+
+                if (gclue_nmea_sentence_is_type (&sentence, "GGA")) {
+                        if (prefer_sentence (&sentence, &has_gga, &gga_rank))
+                                gga = sentence;
+                } else if (gclue_nmea_sentence_is_type (&sentence, "RMC")) {
+                        if (prefer_sentence (&sentence, &has_rmc, &rmc_rank))
+                                rmc = sentence;
+                } else if (gclue_nmea_sentence_is_type (&sentence, "GSA")) {
+                        /* Sent once per constellation, with the same DOPs */
+                        if (!has_gsa)
+                                gsa = sentence;
+                        has_gsa = TRUE;
+                } else if (gclue_nmea_sentence_is_type (&sentence, "GST")) {
+                        if (prefer_sentence (&sentence, &has_gst, &gst_rank))
+                                gst = sentence;
+                } else if (gclue_nmea_sentence_is_type (&sentence, "VTG")) {
+                        if (prefer_sentence (&sentence, &has_vtg, &vtg_rank))
+                                vtg = sentence;
+                } else if (gclue_nmea_sentence_is_type (&sentence, "GSV") &&
+                           gclue_nmea_field_equal
+                                (gclue_nmea_sentence_get_field (&sentence, 2), "1") &&
+                           gclue_nmea_field_to_int
+                                (gclue_nmea_sentence_get_field (&sentence, 3), &n)) {
+                        /* One sequence per constellation */
+                        n_in_view += n;
+                }
         }
 
-        if (gga_loc && rmc_loc) {
+        if (has_gga)
+                location = gclue_location_create_from_gga (&gga);
+        if (has_rmc)
+                rmc_loc = gclue_location_create_from_rmc (&rmc, prev_location);
+
+        if (location && rmc_loc) {
                 gclue_location_set_speed
-                        (gga_loc, gclue_location_get_speed(rmc_loc));
+                        (location, gclue_location_get_speed(rmc_loc));
                 gclue_location_set_heading
-                        (gga_loc, gclue_location_get_heading(rmc_loc));
-                g_object_set (gga_loc, "description", "GPS GGA+RMC", NULL);
-                g_object_unref (rmc_loc);
+                        (location, gclue_location_get_heading(rmc_loc));
+                gclue_location_set_description (location, "GPS GGA+RMC");
+                gclue_location_unref (rmc_loc);
+        } else if (rmc_loc) {
+                location = rmc_loc;
+        } else if (!location) {
+                g_debug ("Valid NMEA GGA or RMC sentence not found");
+                return NULL;
+        }
 
-                return gga_loc;
+        if (has_vtg &&
+            gclue_location_get_speed (location) == GCLUE_LOCATION_SPEED_UNKNOWN)
+                apply_vtg (location, &vtg);
+
+        if (has_gsa) {
+                gint64 mode;
+                gdouble hdop;
+
+                /* For syntax of GSA sentences:
+                 * https://gpsd.gitlab.io/gpsd/NMEA.html#_gsa_gps_dop_and_active_satellites
+                 */
+                if (gclue_nmea_field_to_int
+                        (gclue_nmea_sentence_get_field (&gsa, 2), &mode) &&
+                    mode == 2) {
+                        /* 2D fix, the altitude is only a guess */
+                        gclue_location_set_altitude
+                                (location, GCLUE_LOCATION_ALTITUDE_UNKNOWN);
+                }
+
+                /* GGA has the HDOP already */
+                if (!has_gga &&
+                    gclue_nmea_field_to_double
+                        (gclue_nmea_sentence_get_field (&gsa, 16), &hdop))
+                        gclue_location_set_accuracy
+                                (location, get_accuracy_from_hdop (hdop));
         }
-        if (gga_loc)
-                return gga_loc;
-        if (rmc_loc)
-                return rmc_loc;
 
-        g_debug ("Valid NMEA GGA or RMC sentence not found");
-        return NULL;
+        if (has_gst && (accuracy = get_accuracy_from_gst (&gst)) >= 0)
+                gclue_location_set_accuracy (location, accuracy);
+
+        if (n_in_view > 0)
+                g_debug ("%" G_GINT64_FORMAT " satellites in view", n_in_view);
+
+        return location;
 }
 
 /**
  * gclue_location_duplicate:
- * @location: the #GClueLocation instance to duplicate.
+ * @location: the #GClueLocation to duplicate.
  *
- * Creates a new copy of @location object (with the same timestamp).
+ * Creates a new copy of @location (with the same timestamp), to be modified.
+ * Use gclue_location_ref() to share it otherwise.
  *
- * Returns: a new #GClueLocation object. Use g_object_unref() when done.
+ * Returns: a new #GClueLocation. Use gclue_location_unref() when done.
  **/
 GClueLocation *
 gclue_location_duplicate (GClueLocation *location)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (location), NULL);
-
-        return g_object_new
-                (GCLUE_TYPE_LOCATION,
-                 "latitude", location->priv->latitude,
-                 "longitude", location->priv->longitude,
-                 "accuracy", location->priv->accuracy,
-                 "altitude", location->priv->altitude,
-                 "timestamp", location->priv->timestamp,
-                 "speed", location->priv->speed,
-                 "heading", location->priv->heading,
-                 "description", location->priv->description,
-                 NULL);
+        GClueLocation *copy;
+
+        g_return_val_if_fail (location != NULL, NULL);
+
+        copy = g_memdup2 (location, sizeof (GClueLocation));
+        g_atomic_ref_count_init (&copy->ref_count);
+
+        return copy;
 }
 
 /**
  * gclue_location_duplicate_fresh:
- * @location: the #GClueLocation instance to duplicate.
+ * @location: the #GClueLocation to duplicate.
  *
- * Creates a new copy of @location object with a refreshed timestamp.
+ * Creates a new copy of @location with a refreshed timestamp.
  *
- * Returns: a new #GClueLocation object. Use g_object_unref() when done.
+ * Returns: a new #GClueLocation. Use gclue_location_unref() when done.
  **/
 GClueLocation *
 gclue_location_duplicate_fresh (GClueLocation *location)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (location), NULL);
-
-        return g_object_new
-                (GCLUE_TYPE_LOCATION,
-                 "latitude", location->priv->latitude,
-                 "longitude", location->priv->longitude,
-                 "accuracy", location->priv->accuracy,
-                 "altitude", location->priv->altitude,
-                 "speed", location->priv->speed,
-                 "heading", location->priv->heading,
-                 "description", location->priv->description,
-                 NULL);
+        GClueLocation *copy;
+
+        g_return_val_if_fail (location != NULL, NULL);
+
+        copy = gclue_location_duplicate (location);
+        copy->timestamp = g_get_real_time () / G_USEC_PER_SEC;
+
+        return copy;
 }
 
 const char *
 gclue_location_get_description (GClueLocation *loc)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loc), NULL);
+        g_return_val_if_fail (loc != NULL, NULL);
 
-        return loc->priv->description;
+        return loc->description;
 }
 
 /**
@@ -859,9 +752,9 @@ gclue_location_get_description (GClueLocation *loc)
 gdouble
 gclue_location_get_latitude (GClueLocation *loc)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loc), 0.0);
+        g_return_val_if_fail (loc != NULL, 0.0);
 
-        return loc->priv->latitude;
+        return loc->latitude;
 }
 
 /**
@@ -875,9 +768,9 @@ gclue_location_get_latitude (GClueLocation *loc)
 gdouble
 gclue_location_get_longitude (GClueLocation *loc)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loc), 0.0);
+        g_return_val_if_fail (loc != NULL, 0.0);
 
-        return loc->priv->longitude;
+        return loc->longitude;
 }
 
 /**
@@ -891,10 +784,10 @@ gclue_location_get_longitude (GClueLocation *loc)
 gdouble
 gclue_location_get_altitude (GClueLocation *loc)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loc),
+        g_return_val_if_fail (loc != NULL,
                               GCLUE_LOCATION_ALTITUDE_UNKNOWN);
 
-        return loc->priv->altitude;
+        return loc->altitude;
 }
 
 /**
@@ -908,10 +801,10 @@ gclue_location_get_altitude (GClueLocation *loc)
 gdouble
 gclue_location_get_accuracy (GClueLocation *loc)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loc),
+        g_return_val_if_fail (loc != NULL,
                               GCLUE_LOCATION_ACCURACY_UNKNOWN);
 
-        return loc->priv->accuracy;
+        return loc->accuracy;
 }
 
 /**
@@ -926,9 +819,9 @@ gclue_location_get_accuracy (GClueLocation *loc)
 guint64
 gclue_location_get_timestamp (GClueLocation *loc)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loc), 0);
+        g_return_val_if_fail (loc != NULL, 0);
 
-        return loc->priv->timestamp;
+        return loc->timestamp;
 }
 
 /**
@@ -942,15 +835,15 @@ gclue_location_get_timestamp (GClueLocation *loc)
 gdouble
 gclue_location_get_speed (GClueLocation *location)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (location),
+        g_return_val_if_fail (location != NULL,
                               GCLUE_LOCATION_SPEED_UNKNOWN);
 
-        return location->priv->speed;
+        return location->speed;
 }
 
 /**
  * gclue_location_set_speed:
- * @location: a #GClueLocation
+ * @location: a new #GClueLocation, not shared yet
  * @speed: speed in meters per second
  *
  * Sets the speed.
@@ -959,14 +852,14 @@ void
 gclue_location_set_speed (GClueLocation *location,
                           gdouble        speed)
 {
-        location->priv->speed = speed;
+        g_return_if_fail (LOCATION_IS_EXCLUSIVE (location));
 
-        g_object_notify (G_OBJECT (location), "speed");
+        location->speed = speed;
 }
 
 /**
  * gclue_location_set_speed_from_prev_location:
- * @location: a #GClueLocation
+ * @location: a new #GClueLocation, not shared yet
  * @prev_location: a #GClueLocation
  *
  * Calculates the speed based on provided previous location @prev_location
@@ -979,9 +872,7 @@ gclue_location_set_speed_from_prev_location (GClueLocation *location,
         gdouble speed;
         guint64 timestamp, prev_timestamp;
 
-        g_return_if_fail (GCLUE_IS_LOCATION (location));
-        g_return_if_fail (prev_location == NULL ||
-                          GCLUE_IS_LOCATION (prev_location));
+        g_return_if_fail (LOCATION_IS_EXCLUSIVE (location));
 
         if (prev_location == NULL) {
                speed = GCLUE_LOCATION_SPEED_UNKNOWN;
@@ -1002,9 +893,7 @@ gclue_location_set_speed_from_prev_location (GClueLocation *location,
                 (timestamp - prev_timestamp);
 
 out:
-        location->priv->speed = speed;
-
-        g_object_notify (G_OBJECT (location), "speed");
+        location->speed = speed;
 }
 
 /**
@@ -1020,15 +909,15 @@ out:
 gdouble
 gclue_location_get_heading (GClueLocation *location)
 {
-        g_return_val_if_fail (GCLUE_IS_LOCATION (location),
+        g_return_val_if_fail (location != NULL,
                               GCLUE_LOCATION_HEADING_UNKNOWN);
 
-        return location->priv->heading;
+        return location->heading;
 }
 
 /**
  * gclue_location_set_heading:
- * @location: a #GClueLocation
+ * @location: a new #GClueLocation, not shared yet
  * @heading: heading in degrees
  *
  * Sets the heading.
@@ -1037,14 +926,14 @@ void
 gclue_location_set_heading (GClueLocation *location,
                             gdouble        heading)
 {
-        location->priv->heading = heading;
+        g_return_if_fail (LOCATION_IS_EXCLUSIVE (location));
 
-        g_object_notify (G_OBJECT (location), "heading");
+        location->heading = heading;
 }
 
 /**
  * gclue_location_set_heading_from_prev_location:
- * @location: a #GClueLocation
+ * @location: a new #GClueLocation, not shared yet
  * @prev_location: a #GClueLocation
  *
  * Calculates the heading direction in degrees with respect to North direction
@@ -1056,12 +945,10 @@ gclue_location_set_heading_from_prev_location (GClueLocation *location,
 {
         gdouble dlat, dlon, x, y, angle, lat, lon, prev_lat, prev_lon;
 
-        g_return_if_fail (GCLUE_IS_LOCATION (location));
-        g_return_if_fail (prev_location == NULL ||
-                          GCLUE_IS_LOCATION (prev_location));
+        g_return_if_fail (LOCATION_IS_EXCLUSIVE (location));
 
         if (prev_location == NULL) {
-               location->priv->heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+               location->heading = GCLUE_LOCATION_HEADING_UNKNOWN;
 
                return;
         }
@@ -1072,7 +959,7 @@ gclue_location_set_heading_from_prev_location (GClueLocation *location,
         prev_lon = gclue_location_get_longitude (prev_location);
 
         if (lat == prev_lat && lon == prev_lon) {
-               location->priv->heading = GCLUE_LOCATION_HEADING_UNKNOWN;
+               location->heading = GCLUE_LOCATION_HEADING_UNKNOWN;
 
                return;
         }
@@ -1106,9 +993,7 @@ gclue_location_set_heading_from_prev_location (GClueLocation *location,
          * vector (south == 180 deg). If the angle is negative, we need to
          * add its negative to the heading of the reference vector. Both
          * cases result in */
-        location->priv->heading = 180.0 - angle;
-
-        g_object_notify (G_OBJECT (location), "heading");
+        location->heading = 180.0 - angle;
 }
 
 /**
@@ -1129,16 +1014,16 @@ gclue_location_get_distance_from (GClueLocation *loca,
         gdouble dlat, dlon, lat1, lat2;
         gdouble a, c;
 
-        g_return_val_if_fail (GCLUE_IS_LOCATION (loca), 0.0);
-        g_return_val_if_fail (GCLUE_IS_LOCATION (locb), 0.0);
+        g_return_val_if_fail (loca != NULL, 0.0);
+        g_return_val_if_fail (locb != NULL, 0.0);
 
         /* Algorithm from:
          * http://www.movable-type.co.uk/scripts/latlong.html */
 
-        dlat = (locb->priv->latitude - loca->priv->latitude) * M_PI / 180.0;
-        dlon = (locb->priv->longitude - loca->priv->longitude) * M_PI / 180.0;
-        lat1 = loca->priv->latitude * M_PI / 180.0;
-        lat2 = locb->priv->latitude * M_PI / 180.0;
+        dlat = (locb->latitude - loca->latitude) * M_PI / 180.0;
+        dlon = (locb->longitude - loca->longitude) * M_PI / 180.0;
+        lat1 = loca->latitude * M_PI / 180.0;
+        lat2 = locb->latitude * M_PI / 180.0;
 
         a = sin (dlat / 2) * sin (dlat / 2) +
             sin (dlon / 2) * sin (dlon / 2) * cos (lat1) * cos (lat2);
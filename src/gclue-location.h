@@ -31,36 +31,18 @@
 
 G_BEGIN_DECLS
 
-#define GCLUE_TYPE_LOCATION            (gclue_location_get_type ())
-#define GCLUE_LOCATION(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_LOCATION, GClueLocation))
-#define GCLUE_IS_LOCATION(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_LOCATION))
-#define GCLUE_LOCATION_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_LOCATION, GClueLocationClass))
-#define GCLUE_IS_LOCATION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_LOCATION))
-#define GCLUE_LOCATION_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_LOCATION, GClueLocationClass))
+#define GCLUE_TYPE_LOCATION (gclue_location_get_type ())
 
 #define INVALID_COORDINATE -G_MAXDOUBLE
 
-typedef struct _GClueLocation        GClueLocation;
-typedef struct _GClueLocationClass   GClueLocationClass;
-typedef struct _GClueLocationPrivate GClueLocationPrivate;
+typedef struct _GClueLocation GClueLocation;
 
-struct _GClueLocation
-{
-        /* Parent instance structure */
-        GObject parent_instance;
-
-        GClueLocationPrivate *priv;
-};
-
-struct _GClueLocationClass
-{
-        /* Parent class structure */
-        GObjectClass parent_class;
-};
+GType gclue_location_get_type (void);
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (GClueLocation, g_object_unref)
+GClueLocation *gclue_location_ref   (GClueLocation *location);
+void           gclue_location_unref (GClueLocation *location);
 
-GType gclue_location_get_type (void);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GClueLocation, gclue_location_unref)
 
 /**
  * GCLUE_LOCATION_ALTITUDE_UNKNOWN:
@@ -24,11 +24,13 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <glib/gi18n.h>
 
 #include "gclue-locator.h"
 
 #include "gclue-config.h"
+#include "gclue-location-filter.h"
 
 #if GCLUE_USE_WIFI_SOURCE
 #include "gclue-wifi.h"
@@ -58,6 +60,10 @@
 #include "gclue-ip.h"
 #endif
 
+#if GCLUE_USE_COMPASS
+#include "gclue-compass.h"
+#endif
+
 /* This class is like a master location source that hides all individual
  * location sources from rest of the code
  */
@@ -75,6 +81,17 @@ struct _GClueLocatorPrivate
         GClueAccuracyLevel accuracy_level;
         gboolean priority_source_lock;
         guint64 priority_source_lock_timestamp;
+
+        /* Only in fusion mode */
+        GClueLocationFilter *filter;
+
+        /* Latest location from the sources, as opposed to predicted ones */
+        GClueLocation *fix;
+        guint prediction_interval;
+        guint prediction_timeout_id;
+#if GCLUE_USE_COMPASS
+        GClueCompass *compass;
+#endif
 };
 
 G_DEFINE_TYPE_WITH_CODE (GClueLocator,
@@ -95,6 +112,236 @@ static GParamSpec *gParamSpecs[LAST_PROP];
 #define MAX_LOCATION_AGE (30 * 60) /* Seconds. */
 #define MAX_PRIORITY_SOURCE_AGE         30        /* Seconds. */
 #define PRIORITY_ACCURACY_THRESHOLD 20        /* Meters */
+#define MAX_PREDICTION_AGE 60     /* Seconds */
+#define MIN_PREDICTION_SPEED 0.5  /* Meters per second */
+/* Growth of the accuracy radius of dead-reckoned locations, per second and
+ * per meter per second of speed */
+#define PREDICTION_ERROR_RATE 1.0
+#define PREDICTION_SPEED_ERROR 0.2
+#define METERS_PER_DEGREE (6372795.0 * G_PI / 180)
+/* An hour of fixes, at one per second */
+#define HISTORY_SIZE 3600
+/* Older locations may have been found for other applications long before */
+#define HISTORY_MAX_AGE (60 * 60) /* Seconds */
+/* Fixes older than the latest by more than that mean the clock was set back */
+#define HISTORY_MAX_CLOCK_STEP 60 /* Seconds */
+
+/* Recent fixes, oldest first in a ring. The locators of an accuracy level
+ * share one, as they get the same, possibly scrambled, locations from the
+ * sources. */
+typedef struct {
+        GClueLocatorHistoryEntry entries[HISTORY_SIZE];
+        guint start;
+        guint length;
+} History;
+
+static History *histories[GCLUE_ACCURACY_LEVEL_EXACT + 1];
+
+static GClueLocatorHistoryEntry *
+history_get (History *history,
+             guint    index)
+{
+        return &history->entries[(history->start + index) % HISTORY_SIZE];
+}
+
+/* Index of the first entry newer than @since */
+static guint
+history_find (History *history,
+              guint64  since)
+{
+        guint low = 0, high = history->length;
+
+        while (low < high) {
+                guint middle = low + (high - low) / 2;
+
+                if (history_get (history, middle)->timestamp <= since)
+                        low = middle + 1;
+                else
+                        high = middle;
+        }
+
+        return low;
+}
+
+static void
+add_to_history (GClueLocator  *locator,
+                GClueLocation *location)
+{
+        History *history;
+        GClueLocatorHistoryEntry *entry;
+        guint64 timestamp;
+
+        if (histories[locator->priv->accuracy_level] == NULL)
+                histories[locator->priv->accuracy_level] = g_new0 (History, 1);
+        history = histories[locator->priv->accuracy_level];
+
+        timestamp = gclue_location_get_timestamp (location);
+        if (history->length > 0) {
+                entry = history_get (history, history->length - 1);
+
+                /* The ring is ordered by time, start over rather than have
+                 * new fixes ignored until the clock catches up */
+                if (timestamp + HISTORY_MAX_CLOCK_STEP < entry->timestamp) {
+                        g_debug ("Clock set back, clearing location history");
+                        history->start = 0;
+                        history->length = 0;
+                } else if (timestamp <= entry->timestamp) {
+                        /* Other locators of the level may have added it
+                         * already, and in fusion mode each has its own,
+                         * slightly different, fix from the same source
+                         * update. */
+                        return;
+                }
+        }
+
+        if (history->length < HISTORY_SIZE)
+                history->length++;
+        else
+                history->start = (history->start + 1) % HISTORY_SIZE;
+
+        entry = history_get (history, history->length - 1);
+        entry->timestamp = timestamp;
+        entry->latitude = gclue_location_get_latitude (location);
+        entry->longitude = gclue_location_get_longitude (location);
+        entry->accuracy = gclue_location_get_accuracy (location);
+        entry->altitude = gclue_location_get_altitude (location);
+        entry->speed = gclue_location_get_speed (location);
+        entry->heading = gclue_location_get_heading (location);
+}
+
+static gboolean
+on_prediction_timeout (gpointer user_data);
+
+static void
+apply_location (GClueLocator  *locator,
+                GClueLocation *location)
+{
+        GClueLocatorPrivate *priv = locator->priv;
+        guint interval;
+
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (locator),
+                                            location);
+        g_clear_pointer (&priv->fix, gclue_location_unref);
+        priv->fix = gclue_location_ref (gclue_location_source_get_location
+                                        (GCLUE_LOCATION_SOURCE (locator)));
+        add_to_history (locator, priv->fix);
+
+        g_clear_handle_id (&priv->prediction_timeout_id, g_source_remove);
+        if (priv->prediction_interval == 0)
+                return;
+
+        /* No point in predicting more often than the client wants */
+        interval = MAX (priv->prediction_interval,
+                        gclue_locator_get_time_threshold (locator));
+        priv->prediction_timeout_id = g_timeout_add_seconds
+                (interval, on_prediction_timeout, locator);
+}
+
+/* Extrapolates the latest fix along a straight line */
+static GClueLocation *
+dead_reckon (GClueLocator *locator,
+             guint64       timestamp)
+{
+        GClueLocation *fix = locator->priv->fix;
+        gdouble speed, heading, latitude, longitude, accuracy, distance, dt;
+
+        speed = gclue_location_get_speed (fix);
+        heading = gclue_location_get_heading (fix);
+#if GCLUE_USE_COMPASS
+        if (locator->priv->compass != NULL &&
+            gclue_compass_get_heading (locator->priv->compass) !=
+            GCLUE_LOCATION_HEADING_UNKNOWN)
+                heading = gclue_compass_get_heading (locator->priv->compass);
+#endif
+        if (speed == GCLUE_LOCATION_SPEED_UNKNOWN ||
+            heading == GCLUE_LOCATION_HEADING_UNKNOWN)
+                return NULL;
+
+        dt = timestamp - gclue_location_get_timestamp (fix);
+        distance = speed * dt;
+        latitude = gclue_location_get_latitude (fix);
+        longitude = gclue_location_get_longitude (fix);
+
+        longitude += distance * sin (heading * G_PI / 180) /
+                     (METERS_PER_DEGREE * MAX (cos (latitude * G_PI / 180), 1e-6));
+        latitude += distance * cos (heading * G_PI / 180) / METERS_PER_DEGREE;
+        if (latitude > 90 || latitude < -90)
+                return NULL;
+        if (longitude > 180)
+                longitude -= 360;
+        else if (longitude < -180)
+                longitude += 360;
+
+        accuracy = gclue_location_get_accuracy (fix) +
+                   dt * (PREDICTION_ERROR_RATE + PREDICTION_SPEED_ERROR * speed);
+
+        return gclue_location_new_full (latitude,
+                                        longitude,
+                                        accuracy,
+                                        speed,
+                                        heading,
+                                        gclue_location_get_altitude (fix),
+                                        timestamp,
+                                        gclue_location_get_description (fix));
+}
+
+static gboolean
+on_prediction_timeout (gpointer user_data)
+{
+        GClueLocator *locator = GCLUE_LOCATOR (user_data);
+        GClueLocatorPrivate *priv = locator->priv;
+        g_autoptr(GClueLocation) location = NULL;
+        guint64 timestamp, fix_timestamp;
+
+        timestamp = g_get_real_time () / G_USEC_PER_SEC;
+        fix_timestamp = gclue_location_get_timestamp (priv->fix);
+        if (timestamp <= fix_timestamp)
+                return G_SOURCE_CONTINUE;
+
+        if (timestamp - fix_timestamp > MAX_PREDICTION_AGE) {
+                g_debug ("No new location for %u s, stopping prediction",
+                         (guint) (timestamp - fix_timestamp));
+                priv->prediction_timeout_id = 0;
+                return G_SOURCE_REMOVE;
+        }
+
+        if (priv->filter != NULL)
+                location = gclue_location_filter_predict (priv->filter,
+                                                          timestamp);
+        else
+                location = dead_reckon (locator, timestamp);
+
+        /* Not moving, or we don't know where to */
+        if (location == NULL ||
+            gclue_location_get_speed (location) < MIN_PREDICTION_SPEED)
+                return G_SOURCE_CONTINUE;
+
+        g_debug ("Predicted location %u s after the latest",
+                 (guint) (timestamp - fix_timestamp));
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (locator),
+                                            location);
+
+        return G_SOURCE_CONTINUE;
+}
+
+static void
+fuse_location (GClueLocator        *locator,
+               GClueLocationSource *source)
+{
+        g_autoptr(GClueLocation) location = NULL;
+
+        /* GPS sources measure their speed, the others derive it from
+         * consecutive locations, which would count them twice. */
+        location = gclue_location_filter_update
+                (locator->priv->filter,
+                 gclue_location_source_get_location (source),
+                 gclue_location_source_get_priority_source (source));
+        if (location == NULL)
+                return;
+
+        g_debug ("New location fused from %s", G_OBJECT_TYPE_NAME (source));
+        apply_location (locator, location);
+}
 
 static void
 set_location (GClueLocator  *locator,
@@ -116,8 +363,13 @@ set_location (GClueLocator  *locator,
                 return;
         }
 
-        cur_location = gclue_location_source_get_location
-                        (GCLUE_LOCATION_SOURCE (locator));
+        if (locator->priv->filter != NULL) {
+                fuse_location (locator, source);
+                return;
+        }
+
+        /* Predicted locations don't count */
+        cur_location = locator->priv->fix;
 
         if (cur_location != NULL) {
             guint64 cur_timestamp, new_timestamp;
@@ -187,8 +439,7 @@ set_location (GClueLocator  *locator,
         }
 
         g_debug ("New location available from %s", src_name);
-        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (locator),
-                                            location);
+        apply_location (locator, location);
 }
 
 static gint
@@ -402,10 +653,61 @@ gclue_locator_finalize (GObject *gsource)
         priv->sources = NULL;
         g_list_free (priv->active_sources);
         priv->active_sources = NULL;
+        g_clear_pointer (&priv->filter, gclue_location_filter_free);
+        g_clear_handle_id (&priv->prediction_timeout_id, g_source_remove);
+        g_clear_pointer (&priv->fix, gclue_location_unref);
+#if GCLUE_USE_COMPASS
+        g_clear_object (&priv->compass);
+#endif
 
         G_OBJECT_CLASS (gclue_locator_parent_class)->finalize (gsource);
 }
 
+#if GCLUE_USE_WIFI_SOURCE && GCLUE_USE_MODEM_GPS_SOURCE
+/* Scans sharing less than that fraction of access points hint at movement */
+#define MOVEMENT_BSS_OVERLAP 0.5
+
+static void
+on_wifi_bss_set_changed (GClueWifi *wifi,
+                         gdouble    overlap,
+                         gpointer   user_data)
+{
+        if (overlap < MOVEMENT_BSS_OVERLAP)
+                gclue_modem_gps_wake (GCLUE_MODEM_GPS (user_data));
+}
+
+/* Lets a parked GPS know when WiFi sees the device has moved */
+static void
+connect_movement_hints (GClueLocator *locator)
+{
+        GClueWifi *wifi = NULL;
+        GClueModemGPS *gps = NULL;
+        GList *node;
+
+        for (node = locator->priv->sources; node != NULL; node = node->next) {
+                if (GCLUE_IS_WIFI (node->data))
+                        wifi = GCLUE_WIFI (node->data);
+                else if (GCLUE_IS_MODEM_GPS (node->data))
+                        gps = GCLUE_MODEM_GPS (node->data);
+        }
+
+        /* Both are singletons, shared by all locators */
+        if (wifi == NULL || gps == NULL ||
+            g_signal_handler_find (wifi,
+                                   G_SIGNAL_MATCH_FUNC | G_SIGNAL_MATCH_DATA,
+                                   0, 0, NULL,
+                                   on_wifi_bss_set_changed,
+                                   gps) != 0)
+                return;
+
+        g_signal_connect_object (wifi,
+                                 "bss-set-changed",
+                                 G_CALLBACK (on_wifi_bss_set_changed),
+                                 gps,
+                                 0);
+}
+#endif
+
 static void
 gclue_locator_constructed (GObject *object)
 {
@@ -492,6 +794,9 @@ gclue_locator_constructed (GObject *object)
                         gclue_web_source_set_submit_source
                                 (GCLUE_WEB_SOURCE (node->data), submit_source);
         }
+#if GCLUE_USE_WIFI_SOURCE && GCLUE_USE_MODEM_GPS_SOURCE
+        connect_movement_hints (locator);
+#endif
 
         threshold = gclue_location_source_get_time_threshold
                         (GCLUE_LOCATION_SOURCE (locator));
@@ -532,9 +837,16 @@ gclue_locator_class_init (GClueLocatorClass *klass)
 static void
 gclue_locator_init (GClueLocator *locator)
 {
+        GClueConfig *config = gclue_config_get_singleton ();
+
         locator->priv = gclue_locator_get_instance_private (locator);
         locator->priv->priority_source_lock = FALSE;
         locator->priv->priority_source_lock_timestamp = 0;
+
+        if (gclue_config_get_locator_fusion (config))
+                locator->priv->filter = gclue_location_filter_new ();
+        locator->priv->prediction_interval =
+                gclue_config_get_locator_prediction_interval (config);
 }
 
 static GClueLocationSourceStartResult
@@ -554,6 +866,12 @@ gclue_locator_start (GClueLocationSource *source)
         if (base_result != GCLUE_LOCATION_SOURCE_START_RESULT_OK)
                 return base_result;
 
+#if GCLUE_USE_COMPASS
+        if (locator->priv->prediction_interval > 0 &&
+            gclue_config_get_enable_compass (gclue_config_get_singleton ()))
+                locator->priv->compass = gclue_compass_get_singleton ();
+#endif
+
         for (node = locator->priv->sources; node != NULL; node = node->next) {
                 GClueLocationSource *src = GCLUE_LOCATION_SOURCE (node->data);
                 GClueAccuracyLevel level;
@@ -608,6 +926,11 @@ gclue_locator_stop (GClueLocationSource *source)
 
         g_list_free (locator->priv->active_sources);
         locator->priv->active_sources = NULL;
+        g_clear_handle_id (&locator->priv->prediction_timeout_id,
+                           g_source_remove);
+#if GCLUE_USE_COMPASS
+        g_clear_object (&locator->priv->compass);
+#endif
         return base_result;
 }
 
@@ -681,3 +1004,52 @@ gclue_locator_set_time_threshold (GClueLocator *locator,
                               GCLUE_LOCATION_SOURCE (locator),
                               value);
 }
+
+/**
+ * gclue_locator_get_history
+ * @locator: a #GClueLocator
+ * @since: only return locations newer than that, in seconds since the Epoch
+ * @max_entries: the maximum number of locations to return, 0 for no limit
+ *
+ * Gets the recent locations found by the locators of the accuracy level of
+ * @locator, predicted ones excluded, one per second at most. Locations older
+ * than an hour are never returned. If there are more than @max_entries, the
+ * newest are returned.
+ *
+ * Returns: (transfer full): an array of #GClueLocatorHistoryEntry, oldest
+ * first.
+ **/
+GArray *
+gclue_locator_get_history (GClueLocator *locator,
+                           guint64       since,
+                           guint         max_entries)
+{
+        History *history;
+        GArray *entries;
+        guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+        guint start, i;
+
+        g_return_val_if_fail (GCLUE_IS_LOCATOR (locator), NULL);
+
+        if (now > HISTORY_MAX_AGE)
+                since = MAX (since, now - HISTORY_MAX_AGE);
+
+        history = histories[locator->priv->accuracy_level];
+        if (history == NULL)
+                return g_array_new (FALSE,
+                                    FALSE,
+                                    sizeof (GClueLocatorHistoryEntry));
+
+        start = history_find (history, since);
+        if (max_entries > 0 && history->length - start > max_entries)
+                start = history->length - max_entries;
+
+        entries = g_array_sized_new (FALSE,
+                                     FALSE,
+                                     sizeof (GClueLocatorHistoryEntry),
+                                     history->length - start);
+        for (i = start; i < history->length; i++)
+                g_array_append_val (entries, *history_get (history, i));
+
+        return entries;
+}
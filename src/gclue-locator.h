@@ -55,6 +55,16 @@ struct _GClueLocatorClass
         GClueLocationSourceClass parent_class;
 };
 
+typedef struct {
+        guint64 timestamp;
+        gdouble latitude;
+        gdouble longitude;
+        gdouble accuracy;
+        gdouble altitude;
+        gdouble speed;
+        gdouble heading;
+} GClueLocatorHistoryEntry;
+
 GType gclue_locator_get_type (void) G_GNUC_CONST;
 
 GClueLocator *      gclue_locator_new                (GClueAccuracyLevel level);
@@ -62,6 +72,9 @@ GClueAccuracyLevel  gclue_locator_get_accuracy_level (GClueLocator *locator);
 guint               gclue_locator_get_time_threshold (GClueLocator *locator);
 void                gclue_locator_set_time_threshold (GClueLocator *locator,
                                                       guint         threshold);
+GArray *            gclue_locator_get_history        (GClueLocator *locator,
+                                                      guint64       since,
+                                                      guint         max_entries);
 
 G_END_DECLS
 
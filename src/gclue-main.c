@@ -28,6 +28,7 @@
 
 #include "gclue-service-manager.h"
 #include "gclue-config.h"
+#include "gclue-http.h"
 
 #define BUS_NAME "org.freedesktop.GeoClue2"
 
@@ -204,6 +205,7 @@ main (int argc, char **argv)
 
         if (manager != NULL)
                 g_object_unref (manager);
+        gclue_http_shutdown ();
         g_bus_unown_name (owner_id);
         g_main_loop_unref (main_loop);
 
@@ -25,6 +25,7 @@
 #include "gclue-modem-gps.h"
 #include "gclue-modem-manager.h"
 #include "gclue-location.h"
+#include "gclue-config.h"
 
 /**
  * SECTION:gclue-modem-gps
@@ -32,14 +33,36 @@
  * @include: gclue-glib/gclue-modem-gps.h
  *
  * Contains functions to get the geolocation from a GPS modem.
+ *
+ * With duty cycling enabled, the GPS is turned off once it has been reporting
+ * the same position for a while, and only turned on now and then, or when
+ * another source hints at movement through gclue_modem_gps_wake(), to check
+ * whether the device is still there.
  **/
 
+/* Fixes within that distance, or their accuracy, are the same position */
+#define STATIONARY_RADIUS 25      /* Meters */
+#define STATIONARY_SPEED 0.5      /* Meters per second */
+/* Park the GPS after being stationary for that long */
+#define STATIONARY_TIME 60        /* Seconds */
+#define MIN_PARK_INTERVAL 60      /* Seconds */
+#define MAX_PARK_INTERVAL (30 * 60) /* Seconds */
+/* Give up waiting for a fix after waking up after that long */
+#define WAKE_FIX_TIMEOUT 90       /* Seconds */
+
 struct _GClueModemGPSPrivate {
         GClueModem *modem;
 
         GCancellable *cancellable;
 
         gulong gps_notify_id;
+
+        gboolean duty_cycle;
+        GClueLocation *anchor; /* First fix at the current position */
+        gboolean parked;       /* GPS off while stationary */
+        gboolean waking;       /* GPS on to check if still stationary */
+        guint park_interval;
+        guint park_timeout_id;
 };
 
 
@@ -92,6 +115,140 @@ on_gps_enabled (GObject      *source_object,
         }
 }
 
+static void
+enable_gps (GClueModemGPS *source)
+{
+        GClueModemGPSPrivate *priv = source->priv;
+
+        if (gclue_modem_get_is_gps_available (priv->modem))
+                gclue_modem_enable_gps (priv->modem,
+                                        priv->cancellable,
+                                        on_gps_enabled,
+                                        source);
+}
+
+static void
+disable_gps (GClueModemGPS *source)
+{
+        GClueModemGPSPrivate *priv = source->priv;
+        g_autoptr(GError) error = NULL;
+
+        if (gclue_modem_get_is_gps_available (priv->modem))
+                if (!gclue_modem_disable_gps (priv->modem,
+                                              priv->cancellable,
+                                              &error)) {
+                        g_warning ("Failed to disable GPS: %s",
+                                   error->message);
+                }
+}
+
+static gboolean
+on_park_timeout (gpointer user_data);
+
+static void
+park (GClueModemGPS *source)
+{
+        GClueModemGPSPrivate *priv = source->priv;
+
+        g_debug ("Not moving, turning GPS off for %u s", priv->park_interval);
+        disable_gps (source);
+        priv->parked = TRUE;
+        priv->waking = FALSE;
+
+        g_clear_handle_id (&priv->park_timeout_id, g_source_remove);
+        priv->park_timeout_id = g_timeout_add_seconds (priv->park_interval,
+                                                       on_park_timeout,
+                                                       source);
+
+        /* Check less and less often while parked */
+        priv->park_interval = MIN (priv->park_interval * 2, MAX_PARK_INTERVAL);
+}
+
+static void
+unpark (GClueModemGPS *source)
+{
+        GClueModemGPSPrivate *priv = source->priv;
+
+        priv->parked = FALSE;
+        priv->waking = FALSE;
+        priv->park_interval = MIN_PARK_INTERVAL;
+        g_clear_handle_id (&priv->park_timeout_id, g_source_remove);
+}
+
+static gboolean
+on_wake_timeout (gpointer user_data)
+{
+        GClueModemGPS *source = GCLUE_MODEM_GPS (user_data);
+
+        /* No fix, likely indoors where the device got parked */
+        source->priv->park_timeout_id = 0;
+        park (source);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+wake (GClueModemGPS *source)
+{
+        GClueModemGPSPrivate *priv = source->priv;
+
+        g_debug ("Turning GPS on to check for movement");
+        priv->waking = TRUE;
+        enable_gps (source);
+
+        g_clear_handle_id (&priv->park_timeout_id, g_source_remove);
+        priv->park_timeout_id = g_timeout_add_seconds (WAKE_FIX_TIMEOUT,
+                                                       on_wake_timeout,
+                                                       source);
+}
+
+static gboolean
+on_park_timeout (gpointer user_data)
+{
+        GClueModemGPS *source = GCLUE_MODEM_GPS (user_data);
+
+        source->priv->park_timeout_id = 0;
+        wake (source);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+update_duty_cycle (GClueModemGPS *source,
+                   GClueLocation *location)
+{
+        GClueModemGPSPrivate *priv = source->priv;
+        gdouble speed, radius;
+        guint64 timestamp;
+
+        if (!priv->duty_cycle)
+                return;
+
+        speed = gclue_location_get_speed (location);
+        radius = MAX (gclue_location_get_accuracy (location), STATIONARY_RADIUS);
+        timestamp = gclue_location_get_timestamp (location);
+
+        if (priv->anchor == NULL ||
+            gclue_location_get_distance_from (location, priv->anchor) > radius ||
+            speed > STATIONARY_SPEED) {
+                if (priv->parked)
+                        g_debug ("Moving again, keeping GPS on");
+                unpark (source);
+                g_clear_pointer (&priv->anchor, gclue_location_unref);
+                priv->anchor = gclue_location_ref (location);
+                return;
+        }
+
+        if (priv->waking) {
+                park (source);
+                return;
+        }
+
+        if (!priv->parked &&
+            timestamp >= gclue_location_get_timestamp (priv->anchor) + STATIONARY_TIME)
+                park (source);
+}
+
 static void
 on_is_gps_available_notify (GObject    *gobject,
                             GParamSpec *pspec,
@@ -103,11 +260,8 @@ on_is_gps_available_notify (GObject    *gobject,
         refresh_accuracy_level (source);
 
         if (gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source)) &&
-            gclue_modem_get_is_gps_available (priv->modem))
-                gclue_modem_enable_gps (priv->modem,
-                                       priv->cancellable,
-                                       on_gps_enabled,
-                                       source);
+            (!priv->parked || priv->waking))
+                enable_gps (source);
 }
 
 static void
@@ -133,9 +287,11 @@ gclue_modem_gps_finalize (GObject *ggps)
                                      priv->gps_notify_id);
         priv->gps_notify_id = 0;
 
+        g_clear_handle_id (&priv->park_timeout_id, g_source_remove);
         g_cancellable_cancel (priv->cancellable);
         g_clear_object (&priv->cancellable);
         g_clear_object (&priv->modem);
+        g_clear_pointer (&priv->anchor, gclue_location_unref);
 }
 
 static void
@@ -160,6 +316,9 @@ gclue_modem_gps_init (GClueModemGPS *source)
         priv = source->priv;
 
         priv->cancellable = g_cancellable_new ();
+        priv->duty_cycle = gclue_config_get_modem_gps_duty_cycle
+                (gclue_config_get_singleton ());
+        priv->park_interval = MIN_PARK_INTERVAL;
 
         priv->modem = gclue_modem_manager_get_singleton ();
         priv->gps_notify_id =
@@ -224,9 +383,31 @@ on_fix_gps (GClueModem *modem,
 
         if (location) {
                 gclue_location_source_set_location (source, location);
+                update_duty_cycle (GCLUE_MODEM_GPS (source), location);
         }
 }
 
+/**
+ * gclue_modem_gps_wake:
+ * @source: a #GClueModemGPS
+ *
+ * Hints that the device might be moving. If the GPS has been turned off
+ * because the device was not, it's turned back on to check.
+ **/
+void
+gclue_modem_gps_wake (GClueModemGPS *source)
+{
+        GClueModemGPSPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_MODEM_GPS (source));
+        priv = source->priv;
+
+        if (!priv->parked || priv->waking)
+                return;
+
+        wake (source);
+}
+
 static GClueLocationSourceStartResult
 gclue_modem_gps_start (GClueLocationSource *source)
 {
@@ -248,11 +429,7 @@ gclue_modem_gps_start (GClueLocationSource *source)
                           G_CALLBACK (on_fix_gps),
                           source);
 
-        if (gclue_modem_get_is_gps_available (priv->modem))
-                gclue_modem_enable_gps (priv->modem,
-                                        priv->cancellable,
-                                        on_gps_enabled,
-                                        source);
+        enable_gps (source);
 
         return base_result;
 }
@@ -262,7 +439,6 @@ gclue_modem_gps_stop (GClueLocationSource *source)
 {
         GClueModemGPSPrivate *priv = GCLUE_MODEM_GPS (source)->priv;
         GClueLocationSourceClass *base_class;
-        g_autoptr(GError) error = NULL;
         GClueLocationSourceStopResult base_result;
 
         g_return_val_if_fail (GCLUE_IS_LOCATION_SOURCE (source),
@@ -277,13 +453,10 @@ gclue_modem_gps_stop (GClueLocationSource *source)
                                               G_CALLBACK (on_fix_gps),
                                               source);
 
-        if (gclue_modem_get_is_gps_available (priv->modem))
-                if (!gclue_modem_disable_gps (priv->modem,
-                                              priv->cancellable,
-                                              &error)) {
-                        g_warning ("Failed to disable GPS: %s",
-                                   error->message);
-                }
+        if (!priv->parked || priv->waking)
+                disable_gps (source);
+        unpark (source);
+        g_clear_pointer (&priv->anchor, gclue_location_unref);
 
         return base_result;
 }
@@ -63,6 +63,7 @@ struct _GClueModemGPSClass {
 };
 
 GClueModemGPS * gclue_modem_gps_get_singleton (void);
+void            gclue_modem_gps_wake          (GClueModemGPS *source);
 
 G_END_DECLS
 
@@ -494,6 +494,28 @@ on_location_changed_get_cdma (GObject *modem_object,
 #endif
 }
 
+/* Returns the trace of the given sentence type from the preferred talker,
+ * as receivers of several constellations may send e.g. $GNGGA only. */
+static const char *
+get_nmea_trace (MMLocationGpsNmea *location_nmea,
+                const char        *nmeatype)
+{
+        const char * const *talkers = gclue_nmea_get_gnss_talkers ();
+        guint i;
+
+        for (i = 0; talkers[i] != NULL; i++) {
+                char prefix[7];
+                const char *trace;
+
+                g_snprintf (prefix, sizeof (prefix), "$%s%s", talkers[i], nmeatype);
+                trace = mm_location_gps_nmea_get_trace (location_nmea, prefix);
+                if (trace != NULL && gclue_nmea_type_is (trace, nmeatype))
+                        return trace;
+        }
+
+        return NULL;
+}
+
 static gboolean
 is_location_gga_same (GClueModemManager *manager,
                        const char       *new_gga)
@@ -504,7 +526,7 @@ is_location_gga_same (GClueModemManager *manager,
         if (priv->location_nmea == NULL)
                 return FALSE;
 
-        gga = mm_location_gps_nmea_get_trace (priv->location_nmea, "$GPGGA");
+        gga = get_nmea_trace (priv->location_nmea, "GGA");
         return (g_strcmp0 (gga, new_gga) == 0);
 }
 
@@ -517,9 +539,11 @@ on_get_gps_nmea_ready (GObject      *source_object,
         GClueModemManagerPrivate *priv;
         MMModemLocation *modem_location = MM_MODEM_LOCATION (source_object);
         g_autoptr(MMLocationGpsNmea) location_nmea = NULL;
-        static const gchar *sentences[3];
+        /* GSV is left out as multi-part traces are joined by ModemManager */
+        static const gchar *extra_types[] = { "GSA", "GST", "VTG" };
+        static const gchar *sentences[G_N_ELEMENTS (extra_types) + 3];
         const gchar *gga, *rmc;
-        gint i = 0;
+        guint i = 0, j;
 #if !MM_CHECK_VERSION(1, 18, 0)
         g_autoptr(GError) error = NULL;
 
@@ -546,26 +570,35 @@ on_get_gps_nmea_ready (GObject      *source_object,
                 return;
         }
 
-        gga = mm_location_gps_nmea_get_trace (location_nmea, "$GPGGA");
-        if (gga != NULL && gclue_nmea_type_is (gga, "GGA")) {
+        gga = get_nmea_trace (location_nmea, "GGA");
+        if (gga != NULL) {
                 if (is_location_gga_same (manager, gga)) {
                         g_debug ("New GGA trace is same as last one: %s", gga);
                         return;
                 }
-                g_debug ("New GPGGA trace: %s", gga);
+                g_debug ("New GGA trace: %s", gga);
                 sentences[i++] = gga;
         }
-        rmc = mm_location_gps_nmea_get_trace (location_nmea, "$GPRMC");
-        if (rmc != NULL && gclue_nmea_type_is (rmc, "RMC")) {
-                g_debug ("New GPRMC trace: %s", rmc);
+        rmc = get_nmea_trace (location_nmea, "RMC");
+        if (rmc != NULL) {
+                g_debug ("New RMC trace: %s", rmc);
                 sentences[i++] = rmc;
         }
-        sentences[i] = NULL;
 
-        if (sentences[0] == NULL)
+        if (i == 0) {
                 g_debug ("No GGA or RMC trace");
-        else
+        } else {
+                for (j = 0; j < G_N_ELEMENTS (extra_types); j++) {
+                        const gchar *trace;
+
+                        trace = get_nmea_trace (location_nmea, extra_types[j]);
+                        if (trace != NULL)
+                                sentences[i++] = trace;
+                }
+                sentences[i] = NULL;
+
                 g_signal_emit (manager, signals[FIX_GPS], 0, sentences);
+        }
 
         g_clear_object (&priv->location_nmea);
         priv->location_nmea = g_steal_pointer (&location_nmea);
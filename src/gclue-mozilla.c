@@ -25,6 +25,7 @@
 #include <string.h>
 #include <config.h>
 #include "gclue-mozilla.h"
+#include "gclue-http.h"
 #include "gclue-3g-tower.h"
 #include "gclue-config.h"
 #include "gclue-error.h"
@@ -288,9 +289,8 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
         g_object_unref (builder);
         g_object_unref (generator);
 
-        ret = soup_message_new ("POST", url);
         body = g_bytes_new_take (data, data_len);
-        soup_message_set_request_body_from_bytes (ret, "application/json", body);
+        ret = gclue_http_query_new ("POST", url, "application/json", body);
         g_debug ("Sending following request to '%s':\n%s", url, data);
 
         if (query_data_description) {
@@ -308,6 +308,99 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
         return ret;
 }
 
+static GArray *
+get_offline_bsss (GClueMozilla *mozilla)
+{
+        g_autoptr(GList) bss_list = NULL;
+        GArray *bsss;
+        GList *iter;
+
+        if (mozilla->priv->wifi) {
+                bss_list = gclue_wifi_get_bss_list (mozilla->priv->wifi);
+        }
+
+        bsss = g_array_new (FALSE, FALSE, sizeof (GClueOfflineBss));
+        for (iter = bss_list; iter != NULL; iter = iter->next) {
+                WPABSS *bss = WPA_BSS (iter->data);
+                GClueOfflineBss offline_bss;
+                GVariant *variant;
+                const guint8 *bssid;
+                gsize bssid_len;
+
+                if (gclue_mozilla_should_ignore_bss (bss))
+                        continue;
+
+                variant = wpa_bss_get_bssid (bss);
+                bssid = g_variant_get_fixed_array (variant, &bssid_len, 1);
+                if (bssid_len != BSSID_LEN)
+                        continue;
+
+                memcpy (offline_bss.bssid, bssid, BSSID_LEN);
+                offline_bss.signal = wpa_bss_get_signal (bss);
+                offline_bss.age = wpa_bss_get_age (bss);
+                g_array_append_val (bsss, offline_bss);
+        }
+
+        return bsss;
+}
+
+/* Same networks as gclue_mozilla_create_query() would send */
+GClueLocation *
+gclue_mozilla_locate_offline (GClueMozilla   *mozilla,
+                              GClueOfflineDB *db,
+                              gboolean        skip_tower,
+                              gboolean        skip_bss,
+                              GError        **error)
+{
+        g_autoptr(GArray) bsss = NULL;
+        GClueOfflineCell cell, *cellp = NULL;
+        gint64 mcc, mnc;
+
+        if (!skip_bss)
+                bsss = get_offline_bsss (mozilla);
+        else
+                bsss = g_array_new (FALSE, FALSE, sizeof (GClueOfflineBss));
+
+        if (mozilla->priv->tower_valid && !skip_tower &&
+            operator_code_to_mcc_mnc (mozilla->priv->tower.opc, &mcc, &mnc)) {
+                cell.mcc = mcc;
+                cell.mnc = mnc;
+                cell.lac = mozilla->priv->tower.lac;
+                cell.cell_id = mozilla->priv->tower.cell_id;
+                cell.tec = mozilla->priv->tower.tec;
+                cellp = &cell;
+        }
+
+        return gclue_offline_db_locate (db,
+                                        (const GClueOfflineBss *) bsss->data,
+                                        bsss->len,
+                                        cellp,
+                                        error);
+}
+
+/* Same networks as gclue_mozilla_create_submit_query() would send */
+void
+gclue_mozilla_learn_offline (GClueMozilla   *mozilla,
+                             GClueOfflineDB *db,
+                             GClueLocation  *location)
+{
+        g_autoptr(GArray) bsss = NULL;
+
+        /* Called for every fix of the submission source, most of which
+         * aren't learned from */
+        if (!gclue_offline_db_should_learn (db, location))
+                return;
+
+        bsss = get_offline_bsss (mozilla);
+        if (bsss->len == 0)
+                return;
+
+        gclue_offline_db_learn (db,
+                                (const GClueOfflineBss *) bsss->data,
+                                bsss->len,
+                                location);
+}
+
 static gboolean
 parse_server_error (JsonObject *object, GError **error)
 {
@@ -391,27 +484,20 @@ gclue_mozilla_parse_submit_response (const char *response_contents,
         return status_code == SOUP_STATUS_OK;
 }
 
-SoupMessage *
-gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
-                                   const char    *url,
-                                   GClueLocation *location,
-                                   GError       **error)
+/* One element of the "items" array of a geosubmit v2 request */
+JsonNode *
+gclue_mozilla_create_submit_item (GClueMozilla  *mozilla,
+                                  GClueLocation *location,
+                                  GError       **error)
 {
-        SoupMessage *ret = NULL;
-        SoupMessageHeaders *request_headers;
+        JsonNode *ret = NULL;
         JsonBuilder *builder;
-        JsonGenerator *generator;
-        JsonNode *root_node;
-        char *data;
         g_autoptr(GList) bss_list = NULL;
-        const char *nick, *radiotype;
-        gsize data_len;
+        const char *radiotype;
         GList *iter;
         gdouble lat, lon, accuracy, altitude, speed;
         guint64 time_ms;
         gint64 mcc, mnc;
-        GClueConfig *config;
-        g_autoptr(GBytes) body = NULL;
 
         if (mozilla->priv->bss_submitted &&
             (!mozilla->priv->tower_valid ||
@@ -424,19 +510,9 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
                 goto out;
         }
 
-        g_assert (url != NULL);
-
-        config = gclue_config_get_singleton ();
-        nick = gclue_config_get_wifi_submit_nick (config);
-
         builder = json_builder_new ();
         json_builder_begin_object (builder);
 
-        json_builder_set_member_name (builder, "items");
-        json_builder_begin_array (builder);
-
-        json_builder_begin_object (builder);
-
         json_builder_set_member_name (builder, "timestamp");
         time_ms = 1000 * gclue_location_get_timestamp (location);
         json_builder_add_int_value (builder, time_ms);
@@ -542,18 +618,52 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
                 json_builder_end_array (builder); /* cellTowers */
         }
 
-        json_builder_end_object (builder);
-        json_builder_end_array (builder); /* items */
         json_builder_end_object (builder);
 
-        generator = json_generator_new ();
-        root_node = json_builder_get_root (builder);
-        json_generator_set_root (generator, root_node);
-        data = json_generator_to_data (generator, &data_len);
-
-        json_node_free (root_node);
+        ret = json_builder_get_root (builder);
         g_object_unref (builder);
-        g_object_unref (generator);
+
+        mozilla->priv->bss_submitted = TRUE;
+        mozilla->priv->tower_submitted = TRUE;
+
+out:
+        return ret;
+}
+
+/**
+ * gclue_mozilla_create_submit_query:
+ * @url: the geosubmit v2 URL
+ * @items: (array length=n_items): items serialized as JSON, as created by
+ * gclue_mozilla_create_submit_item()
+ * @n_items: the number of elements in @items
+ *
+ * Returns: (transfer full): a request submitting all @items at once.
+ **/
+SoupMessage *
+gclue_mozilla_create_submit_query (const char        *url,
+                                   const char *const *items,
+                                   guint              n_items)
+{
+        SoupMessage *ret;
+        SoupMessageHeaders *request_headers;
+        g_autoptr(GString) data = NULL;
+        g_autoptr(GBytes) body = NULL;
+        const char *nick;
+        GClueConfig *config;
+        guint i;
+
+        g_assert (url != NULL);
+
+        config = gclue_config_get_singleton ();
+        nick = gclue_config_get_wifi_submit_nick (config);
+
+        data = g_string_new ("{\"items\":[");
+        for (i = 0; i < n_items; i++) {
+                if (i > 0)
+                        g_string_append_c (data, ',');
+                g_string_append (data, items[i]);
+        }
+        g_string_append (data, "]}");
 
         ret = soup_message_new ("POST", url);
         request_headers = soup_message_get_request_headers (ret);
@@ -561,14 +671,10 @@ gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
                 soup_message_headers_append (request_headers,
                                              "X-Nickname",
                                              nick);
-        body = g_bytes_new_take (data, data_len);
+        g_debug ("Sending following request to '%s':\n%s", url, data->str);
+        body = g_string_free_to_bytes (g_steal_pointer (&data));
         soup_message_set_request_body_from_bytes (ret, "application/json", body);
-        g_debug ("Sending following request to '%s':\n%s", url, data);
-
-        mozilla->priv->bss_submitted = TRUE;
-        mozilla->priv->tower_submitted = TRUE;
 
-out:
         return ret;
 }
 
@@ -24,9 +24,11 @@
 
 #include <glib.h>
 #include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
 #include "wpa_supplicant-interface.h"
 #include "gclue-location.h"
 #include "gclue-3g-tower.h"
+#include "gclue-offline-db.h"
 
 G_BEGIN_DECLS
 
@@ -84,14 +86,27 @@ gclue_mozilla_create_query (GClueMozilla  *mozilla,
                             const char **query_data_description,
                             GError      **error);
 GClueLocation *
+gclue_mozilla_locate_offline (GClueMozilla   *mozilla,
+                              GClueOfflineDB *db,
+                              gboolean        skip_tower,
+                              gboolean        skip_bss,
+                              GError        **error);
+void
+gclue_mozilla_learn_offline (GClueMozilla   *mozilla,
+                             GClueOfflineDB *db,
+                             GClueLocation  *location);
+GClueLocation *
 gclue_mozilla_parse_response (const char *json,
                               const char *location_description,
                               GError    **error);
+JsonNode *
+gclue_mozilla_create_submit_item (GClueMozilla  *mozilla,
+                                  GClueLocation *location,
+                                  GError       **error);
 SoupMessage *
-gclue_mozilla_create_submit_query (GClueMozilla  *mozilla,
-                                   const char    *url,
-                                   GClueLocation *location,
-                                   GError       **error);
+gclue_mozilla_create_submit_query (const char        *url,
+                                   const char *const *items,
+                                   guint              n_items);
 gboolean
 gclue_mozilla_parse_submit_response (const char  *response_contents,
                                      gint         status_code,
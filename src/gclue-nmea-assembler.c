@@ -0,0 +1,292 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include "gclue-nmea-assembler.h"
+#include "gclue-nmea-utils.h"
+
+/**
+ * SECTION:gclue-nmea-assembler
+ * @short_description: Groups NMEA sentences by fix epoch
+ *
+ * Receivers send the sentences of a fix one after the other, and their
+ * number and order vary between receivers. The assembler collects the
+ * sentences of one epoch, as identified by the UTC time of GGA, RMC and GST,
+ * and hands them over once. That is as soon as all the sentence types of the
+ * previous epoch have arrived, or after a short deadline, for the first
+ * epoch or when a receiver stops sending some type.
+ **/
+
+/* Enough for the sentences of a few constellations */
+#define MAX_SENTENCES 16
+#define STORAGE_SIZE 2048
+
+/* Sentences of an epoch are normally sent in a single burst */
+#define EPOCH_DEADLINE 250 /* ms */
+
+typedef enum {
+        SENTENCE_GGA = 1 << 0,
+        SENTENCE_RMC = 1 << 1,
+        SENTENCE_GSA = 1 << 2,
+        SENTENCE_GST = 1 << 3,
+        SENTENCE_VTG = 1 << 4,
+        SENTENCE_GSV = 1 << 5,
+} SentenceType;
+
+static const char * const sentence_types[] = {
+        "GGA", "RMC", "GSA", "GST", "VTG", "GSV"
+};
+
+#define POSITION_TYPES (SENTENCE_GGA | SENTENCE_RMC)
+#define TIMED_TYPES (SENTENCE_GGA | SENTENCE_RMC | SENTENCE_GST)
+
+typedef struct {
+        /* Offsets into storage */
+        gsize sentences[MAX_SENTENCES];
+        guint n_sentences;
+        char storage[STORAGE_SIZE];
+        gsize storage_length;
+        guint types;
+} Epoch;
+
+struct _GClueNMEAAssembler {
+        GClueNMEAEpochFunc func;
+        gpointer user_data;
+
+        Epoch current;
+        GTimeSpan time; /* -1 if not known yet */
+        gboolean done;  /* Handed over already */
+
+        /* Sentences without time sent after the current epoch was handed
+         * over, they belong to the next one */
+        Epoch next;
+
+        guint seen_types;     /* Types of the current epoch, even late ones */
+        guint expected_types; /* Types of the previous epoch */
+        guint deadline_id;
+};
+
+static void
+epoch_clear (Epoch *epoch)
+{
+        epoch->n_sentences = 0;
+        epoch->storage_length = 0;
+        epoch->types = 0;
+}
+
+static void
+epoch_add (Epoch       *epoch,
+           SentenceType type,
+           const char  *message,
+           gsize        length)
+{
+        guint i;
+
+        if (epoch->storage_length + length + 1 > STORAGE_SIZE)
+                return;
+
+        /* Keep the last sentence of each type and talker, i.e. of each
+         * "$" and address */
+        for (i = 0; i < epoch->n_sentences; i++) {
+                if (strncmp (epoch->storage + epoch->sentences[i],
+                             message,
+                             6) == 0)
+                        break;
+        }
+        if (i == MAX_SENTENCES)
+                return;
+
+        memcpy (epoch->storage + epoch->storage_length, message, length);
+        epoch->storage[epoch->storage_length + length] = '\0';
+        epoch->sentences[i] = epoch->storage_length;
+        epoch->storage_length += length + 1;
+        if (i == epoch->n_sentences)
+                epoch->n_sentences++;
+
+        epoch->types |= type;
+}
+
+static void
+epoch_append (Epoch       *epoch,
+              const Epoch *other)
+{
+        guint i;
+
+        for (i = 0; i < other->n_sentences; i++) {
+                const char *message = other->storage + other->sentences[i];
+                SentenceType type = 0;
+                guint j;
+
+                for (j = 0; j < G_N_ELEMENTS (sentence_types); j++) {
+                        if (gclue_nmea_type_is (message, sentence_types[j]))
+                                type = 1 << j;
+                }
+                epoch_add (epoch, type, message, strlen (message));
+        }
+}
+
+static void
+hand_over (GClueNMEAAssembler *assembler)
+{
+        Epoch *epoch = &assembler->current;
+        const char *sentences[MAX_SENTENCES + 1];
+        guint i;
+
+        g_clear_handle_id (&assembler->deadline_id, g_source_remove);
+
+        if (assembler->done || (epoch->types & POSITION_TYPES) == 0)
+                return;
+
+        for (i = 0; i < epoch->n_sentences; i++)
+                sentences[i] = epoch->storage + epoch->sentences[i];
+        sentences[i] = NULL;
+
+        assembler->done = TRUE;
+        assembler->func (sentences, assembler->user_data);
+}
+
+static gboolean
+on_deadline (gpointer user_data)
+{
+        GClueNMEAAssembler *assembler = user_data;
+
+        assembler->deadline_id = 0;
+        g_debug ("NMEA epoch incomplete, types 0x%x of 0x%x",
+                 assembler->current.types,
+                 assembler->expected_types);
+        hand_over (assembler);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+start_epoch (GClueNMEAAssembler *assembler,
+             GTimeSpan           time)
+{
+        if (assembler->time >= 0)
+                assembler->expected_types = assembler->seen_types;
+
+        epoch_clear (&assembler->current);
+        epoch_append (&assembler->current, &assembler->next);
+        epoch_clear (&assembler->next);
+        assembler->seen_types = assembler->current.types;
+        assembler->time = time;
+        assembler->done = FALSE;
+
+        g_clear_handle_id (&assembler->deadline_id, g_source_remove);
+        assembler->deadline_id = g_timeout_add (EPOCH_DEADLINE,
+                                                on_deadline,
+                                                assembler);
+}
+
+GClueNMEAAssembler *
+gclue_nmea_assembler_new (GClueNMEAEpochFunc func,
+                          gpointer           user_data)
+{
+        GClueNMEAAssembler *assembler;
+
+        assembler = g_new0 (GClueNMEAAssembler, 1);
+        assembler->func = func;
+        assembler->user_data = user_data;
+        assembler->time = -1;
+
+        return assembler;
+}
+
+void
+gclue_nmea_assembler_free (GClueNMEAAssembler *assembler)
+{
+        g_clear_handle_id (&assembler->deadline_id, g_source_remove);
+        g_free (assembler);
+}
+
+/**
+ * gclue_nmea_assembler_reset:
+ * @assembler: a #GClueNMEAAssembler
+ *
+ * Drops the current epoch, e.g. when the stream is interrupted.
+ **/
+void
+gclue_nmea_assembler_reset (GClueNMEAAssembler *assembler)
+{
+        g_clear_handle_id (&assembler->deadline_id, g_source_remove);
+        epoch_clear (&assembler->current);
+        epoch_clear (&assembler->next);
+        assembler->time = -1;
+        assembler->done = FALSE;
+        assembler->seen_types = 0;
+        assembler->expected_types = 0;
+}
+
+/**
+ * gclue_nmea_assembler_add:
+ * @assembler: a #GClueNMEAAssembler
+ * @message: an NMEA sentence
+ * @length: the length of @message
+ *
+ * Adds @message to its epoch if it is used for fixes, which may hand over
+ * the epoch.
+ **/
+void
+gclue_nmea_assembler_add (GClueNMEAAssembler *assembler,
+                          const char         *message,
+                          gsize               length)
+{
+        GClueNMEASentence sentence;
+        SentenceType type = 0;
+        GTimeSpan time = -1;
+        guint i;
+
+        if (!gclue_nmea_sentence_parse (&sentence, message, length) ||
+            !gclue_nmea_sentence_is_fix_data (&sentence))
+                return;
+
+        for (i = 0; i < G_N_ELEMENTS (sentence_types); i++) {
+                if (gclue_nmea_sentence_is_type (&sentence, sentence_types[i]))
+                        type = 1 << i;
+        }
+
+        if (type & TIMED_TYPES) {
+                time = gclue_nmea_field_to_timespan
+                        (gclue_nmea_sentence_get_field (&sentence, 1));
+                if (time < 0)
+                        return;
+        }
+
+        if (time >= 0 && time != assembler->time) {
+                /* The previous epoch is complete, whatever is missing */
+                if (assembler->time >= 0)
+                        hand_over (assembler);
+                start_epoch (assembler, time);
+        } else if (time < 0 && (assembler->done || assembler->time < 0)) {
+                epoch_add (&assembler->next, type, message, length);
+                return;
+        } else if (assembler->done) {
+                /* Late sentence of an epoch already handed over, only
+                 * remember to wait for it next time */
+                assembler->seen_types |= type;
+                return;
+        }
+
+        epoch_add (&assembler->current, type, message, length);
+        assembler->seen_types |= type;
+
+        if (assembler->expected_types != 0 &&
+            (assembler->current.types & assembler->expected_types) ==
+            assembler->expected_types)
+                hand_over (assembler);
+}
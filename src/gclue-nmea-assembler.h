@@ -0,0 +1,49 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_NMEA_ASSEMBLER_H
+#define GCLUE_NMEA_ASSEMBLER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GClueNMEAAssembler GClueNMEAAssembler;
+
+/**
+ * GClueNMEAEpochFunc:
+ * @sentences: %NULL-terminated fix sentences of an epoch, with a GGA or RMC
+ * @user_data: user data given to gclue_nmea_assembler_new()
+ *
+ * Called once per epoch, with sentences only valid during the call.
+ */
+typedef void (*GClueNMEAEpochFunc) (const char *sentences[],
+                                    gpointer    user_data);
+
+GClueNMEAAssembler *gclue_nmea_assembler_new   (GClueNMEAEpochFunc  func,
+                                                gpointer            user_data);
+void                gclue_nmea_assembler_free  (GClueNMEAAssembler *assembler);
+void                gclue_nmea_assembler_add   (GClueNMEAAssembler *assembler,
+                                                const char         *message,
+                                                gsize               length);
+void                gclue_nmea_assembler_reset (GClueNMEAAssembler *assembler);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GClueNMEAAssembler, gclue_nmea_assembler_free)
+
+G_END_DECLS
+
+#endif /* GCLUE_NMEA_ASSEMBLER_H */
@@ -26,9 +26,11 @@
 #include <glib.h>
 #include "gclue-config.h"
 #include "gclue-location.h"
+#include "gclue-gnss-protocols.h"
+#include "gclue-location-filter.h"
+#include "gclue-nmea-assembler.h"
 #include "gclue-nmea-utils.h"
 #include "gclue-nmea-source.h"
-#include "gclue-utils.h"
 #include "config.h"
 #include "gclue-enum-types.h"
 
@@ -45,23 +47,51 @@
  */
 #define SERVICE_UNBREAK_TIME 5
 
+/* Sentences are read in bulk into a buffer of this size, so that a single
+ * main loop iteration handles all the sentences of an epoch. */
+#define NMEA_BUFFER_SIZE 4096
+
+/* How long the fixes of a service are preferred to those of less accurate
+ * ones after it stops sending them.
+ * In microseconds.
+ */
+#define FAILOVER_TIME (2 * G_USEC_PER_SEC)
+
 typedef struct AvahiServiceInfo AvahiServiceInfo;
 
-struct _GClueNMEASourcePrivate {
+/* A connection to a service, each is a separate receiver */
+typedef struct {
+        GClueNMEASource *source;
+        AvahiServiceInfo *service;
+
+        GSocketClient *client;
         GSocketConnection *connection;
         GDataInputStream *input_stream;
+        GCancellable *cancellable;
+        GClueGNSSProtocol protocol;
 
-        GSocketClient *client;
+        /* Read buffer of NMEA sentences */
+        char *buffer;
+        gsize buffer_length;
+        GClueNMEAAssembler *assembler;
 
-        GCancellable *cancellable;
+        GClueLocation *location;
+        gint64 location_time; /* Monotonic */
+} NMEAConnection;
 
+struct _GClueNMEASourcePrivate {
         AvahiGLibPoll *glib_poll;
 
         AvahiClient *avahi_client;
 
-        AvahiServiceInfo *active_service;
+        /* Connections to the most accurate services in try_services */
+        GList *connections;
+        guint max_connections;
+
+        /* Combines the fixes of several connections */
+        GClueLocationFilter *filter;
 
-        /* List of services to try but only the most accurate one is used. */
+        /* List of services to try, sorted by accuracy. */
         GList *try_services;
 
         /* List of known-broken services. */
@@ -81,7 +111,15 @@ static GClueLocationSourceStopResult
 gclue_nmea_source_stop (GClueLocationSource *source);
 
 static void
-try_connect_to_service (GClueNMEASource *source);
+connect_to_service (GClueNMEASource  *source,
+                    AvahiServiceInfo *service);
+static void
+on_read_nmea (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data);
+static void
+on_nmea_epoch (const char *sentences[],
+               gpointer    user_data);
 
 struct AvahiServiceInfo {
     char *identifier;
@@ -157,47 +195,111 @@ compare_avahi_service_by_accuracy_n_time (gconstpointer a,
                 return 0;
 }
 
+static NMEAConnection *
+nmea_connection_new (GClueNMEASource  *source,
+                     AvahiServiceInfo *service)
+{
+        NMEAConnection *connection = g_slice_new0 (NMEAConnection);
+
+        connection->source = source;
+        connection->service = service;
+        connection->cancellable = g_cancellable_new ();
+        connection->client = g_socket_client_new ();
+        connection->buffer = g_malloc (NMEA_BUFFER_SIZE);
+        connection->assembler = gclue_nmea_assembler_new (on_nmea_epoch,
+                                                          connection);
+
+        return connection;
+}
+
 static void
-disconnect_from_service (GClueNMEASource *source)
+nmea_connection_free (NMEAConnection *connection)
 {
-        GClueNMEASourcePrivate *priv = source->priv;
+        /* Pending operations only check for cancellation */
+        g_cancellable_cancel (connection->cancellable);
+
+        g_clear_object (&connection->input_stream);
+        g_clear_object (&connection->connection);
+        g_clear_object (&connection->client);
+        g_clear_object (&connection->cancellable);
+        g_clear_pointer (&connection->location, gclue_location_unref);
+        g_free (connection->buffer);
+        gclue_nmea_assembler_free (connection->assembler);
+        g_slice_free (NMEAConnection, connection);
+}
 
-        if (!priv->active_service)
-                return;
+static NMEAConnection *
+find_connection (GClueNMEASource  *source,
+                 AvahiServiceInfo *service)
+{
+        GList *l;
 
-        g_cancellable_cancel (priv->cancellable);
+        for (l = source->priv->connections; l != NULL; l = l->next) {
+                NMEAConnection *connection = l->data;
+
+                if (connection->service == service)
+                        return connection;
+        }
 
-        g_clear_object (&priv->input_stream);
-        g_clear_object (&priv->connection);
-        g_clear_object (&priv->client);
-        g_clear_object (&priv->cancellable);
-        priv->active_service = NULL;
+        return NULL;
 }
 
-static gboolean
-reconnection_required (GClueNMEASource *source)
+static void
+disconnect_from_service (GClueNMEASource *source,
+                         NMEAConnection  *connection)
 {
         GClueNMEASourcePrivate *priv = source->priv;
 
-        /* Basically, reconnection is required if either
-         *
-         * 1. service in use went down.
-         * 2. a more accurate service than one currently in use, is now
-         *    available.
-         */
-        return priv->active_service == NULL ||
-                priv->try_services == NULL ||
-                priv->active_service != priv->try_services->data;
+        g_debug ("Disconnecting from NMEA service %s",
+                 connection->service->identifier);
+
+        priv->connections = g_list_remove (priv->connections, connection);
+        nmea_connection_free (connection);
+
+        if (priv->connections == NULL && priv->filter != NULL)
+                gclue_location_filter_reset (priv->filter);
+}
+
+static void
+disconnect_from_services (GClueNMEASource *source)
+{
+        while (source->priv->connections != NULL)
+                disconnect_from_service (source,
+                                         source->priv->connections->data);
 }
 
+/* Connects to the most accurate services, up to the configured number, and
+ * disconnects from the others. */
 static void
-reconnect_service (GClueNMEASource *source)
+reconnect_services (GClueNMEASource *source)
 {
-        if (!reconnection_required (source))
+        GClueNMEASourcePrivate *priv = source->priv;
+        GList *l, *next;
+        guint i;
+
+        for (l = priv->connections; l != NULL; l = next) {
+                NMEAConnection *connection = l->data;
+                gint position;
+
+                next = l->next;
+                position = g_list_index (priv->try_services,
+                                         connection->service);
+                if (position < 0 || (guint) position >= priv->max_connections)
+                        disconnect_from_service (source, connection);
+        }
+
+        if (!gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source))) {
+                g_warn_if_fail (!priv->connections);
+
                 return;
+        }
 
-        disconnect_from_service (source);
-        try_connect_to_service (source);
+        for (l = priv->try_services, i = 0;
+             l != NULL && i < priv->max_connections;
+             l = l->next, i++) {
+                if (find_connection (source, l->data) == NULL)
+                        connect_to_service (source, l->data);
+        }
 }
 
 static GClueAccuracyLevel get_head_accuracy (GList *list)
@@ -265,7 +367,7 @@ on_service_unbreak_time (gpointer source)
                 priv->try_services = priv->broken_services;
                 priv->broken_services = NULL;
 
-                reconnect_service (source);
+                reconnect_services (source);
         }
 
         return G_SOURCE_REMOVE;
@@ -301,7 +403,7 @@ static void
 service_lists_changed (GClueNMEASource *source)
 {
         check_unbreak_timer (source);
-        reconnect_service (source);
+        reconnect_services (source);
         refresh_accuracy_level (source);
 }
 
@@ -433,14 +535,13 @@ add_new_service_socket (GClueNMEASource *source,
 }
 
 static void
-service_broken (GClueNMEASource *source)
+service_broken (NMEAConnection *connection)
 {
+        GClueNMEASource *source = connection->source;
         GClueNMEASourcePrivate *priv = source->priv;
-        AvahiServiceInfo *service = priv->active_service;
+        AvahiServiceInfo *service = connection->service;
 
-        g_assert (service);
-
-        disconnect_from_service (source);
+        disconnect_from_service (source, connection);
 
         priv->try_services = g_list_remove (priv->try_services,
                                             service);
@@ -480,9 +581,12 @@ remove_service_by_name (GClueNMEASource *source,
                                    service,
                                    compare_avahi_service_by_identifier);
         if (item) {
-                if (item->data == priv->active_service) {
+                NMEAConnection *connection;
+
+                connection = find_connection (source, item->data);
+                if (connection != NULL) {
                         g_debug ("Active NMEA service removed, disconnecting.");
-                        disconnect_from_service (source);
+                        disconnect_from_service (source, connection);
                 }
 
                 remove_service_from_list (&priv->try_services,
@@ -492,7 +596,7 @@ remove_service_by_name (GClueNMEASource *source,
                                            service,
                                            compare_avahi_service_by_identifier);
                 if (item) {
-                        g_assert (item->data != priv->active_service);
+                        g_assert (find_connection (source, item->data) == NULL);
                         remove_service_from_list (&priv->broken_services,
                                                   item);
                 }
@@ -651,145 +755,352 @@ browse_callback (AvahiServiceBrowser   *service_browser,
         }
 }
 
-#define NMEA_LINE_END "\r\n"
-#define NMEA_LINE_END_CTR (sizeof (NMEA_LINE_END) - 1)
+static void
+stream_failed (NMEAConnection *connection,
+               const GError   *error)
+{
+        if (error == NULL ||
+            g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED)) {
+                g_debug ("NMEA socket closed.");
+        } else {
+                g_warning ("Error when receiving message: %s",
+                           error->message);
+        }
+        service_broken (connection);
+}
 
-static void nmea_skip_delim (GBufferedInputStream *stream,
-                             GCancellable *cancellable)
+/* The connection to the most accurate service that sent a fix recently */
+static NMEAConnection *
+get_leading_connection (GClueNMEASource *source)
 {
-        const char *buf;
-        gsize buf_size;
-        size_t delim_skip;
-        g_autoptr(GError) error = NULL;
+        gint64 now = g_get_monotonic_time ();
+        GList *l;
 
-        buf = (const char *) g_buffered_input_stream_peek_buffer (stream,
-                                                                  &buf_size);
+        for (l = source->priv->try_services; l != NULL; l = l->next) {
+                NMEAConnection *connection = find_connection (source, l->data);
 
-        delim_skip = strnspn (buf, NMEA_LINE_END, buf_size);
-        for (size_t ctr = 0; ctr < delim_skip; ctr++) {
-                if (g_buffered_input_stream_read_byte (stream, cancellable, &error) < 0) {
-                        if (error && !g_error_matches (error, G_IO_ERROR,
-                                                       G_IO_ERROR_CANCELLED)) {
-                                g_warning ("Failed to skip %zu / %zu NMEA delimiter: %s",
-                                           ctr, delim_skip, error->message);
-                        }
-                        break;
-                }
+                if (connection != NULL && connection->location != NULL &&
+                    now - connection->location_time < FAILOVER_TIME)
+                        return connection;
         }
+
+        return NULL;
 }
 
-static gboolean nmea_check_delim (GBufferedInputStream *stream)
+static void
+on_connection_fix (NMEAConnection *connection,
+                   GClueLocation  *location)
 {
-        const char *buf;
-        gsize buf_size;
+        GClueNMEASource *source = connection->source;
+        GClueNMEASourcePrivate *priv = source->priv;
+        g_autoptr(GClueLocation) fused = NULL;
+
+        g_clear_pointer (&connection->location, gclue_location_unref);
+        connection->location = gclue_location_ref (location);
+        connection->location_time = g_get_monotonic_time ();
+
+        if (priv->filter != NULL) {
+                fused = gclue_location_filter_update (priv->filter,
+                                                      location,
+                                                      TRUE);
+                if (fused == NULL)
+                        return;
+                location = fused;
+        }
 
-        buf = (const char *) g_buffered_input_stream_peek_buffer (stream,
-                                                                  &buf_size);
+        /* Other receivers only refine the fused fix, so that there is a
+         * single update per epoch, until the leading one goes silent */
+        if (get_leading_connection (source) != connection)
+                return;
 
-        return strnpbrk (buf, NMEA_LINE_END, buf_size) != NULL;
+        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source),
+                                            location);
 }
 
-#define NMEA_STR_LEN 128
 static void
-on_read_nmea_sentence (GObject      *object,
-                       GAsyncResult *result,
-                       gpointer      user_data)
+on_nmea_epoch (const char *sentences[],
+               gpointer    user_data)
 {
-        GClueNMEASource *source = NULL;
-        GDataInputStream *data_input_stream = G_DATA_INPUT_STREAM (object);
+        NMEAConnection *connection = user_data;
+        g_autoptr(GClueLocation) location = NULL;
+
+        location = gclue_location_create_from_nmeas (sentences,
+                                                     connection->location);
+        if (location)
+                on_connection_fix (connection, location);
+}
+
+static void
+read_nmea (NMEAConnection *connection)
+{
+        g_input_stream_read_async (G_INPUT_STREAM (connection->input_stream),
+                                   connection->buffer + connection->buffer_length,
+                                   NMEA_BUFFER_SIZE - connection->buffer_length,
+                                   G_PRIORITY_DEFAULT,
+                                   connection->cancellable,
+                                   on_read_nmea,
+                                   connection);
+}
+
+static void
+on_read_nmea (GObject      *object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+        NMEAConnection *connection;
         g_autoptr(GError) error = NULL;
-        GClueLocation *prev_location;
+        char *line, *end, *p;
+        gssize n_read;
+
+        n_read = g_input_stream_read_finish (G_INPUT_STREAM (object),
+                                             result,
+                                             &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        connection = user_data;
+
+        if (n_read <= 0) {
+                stream_failed (connection, error);
+                return;
+        }
+
+        /* Frame the complete sentences in place, terminating them */
+        line = connection->buffer;
+        end = connection->buffer + connection->buffer_length + n_read;
+        for (p = connection->buffer + connection->buffer_length; p < end; p++) {
+                if (*p != '\r' && *p != '\n')
+                        continue;
+
+                *p = '\0';
+                if (p > line) {
+                        g_debug ("Network source sent: \"%s\"", line);
+                        gclue_nmea_assembler_add (connection->assembler,
+                                                  line,
+                                                  p - line);
+                }
+                line = p + 1;
+        }
+
+        /* Keep the incomplete sentence, unless it fills the whole buffer,
+         * which no valid sentence does */
+        connection->buffer_length = end - line;
+        if (connection->buffer_length == NMEA_BUFFER_SIZE) {
+                g_debug ("Discarding %d bytes without line end", NMEA_BUFFER_SIZE);
+                connection->buffer_length = 0;
+        } else {
+                memmove (connection->buffer, line, connection->buffer_length);
+        }
+
+        read_nmea (connection);
+}
+
+static void
+on_read_ubx (GObject      *object,
+             GAsyncResult *result,
+             gpointer      user_data)
+{
+        GBufferedInputStream *stream = G_BUFFERED_INPUT_STREAM (object);
+        NMEAConnection *connection;
         g_autoptr(GClueLocation) location = NULL;
-        gsize data_size = 0 ;
-        g_autofree char *message = NULL;
-        gint i;
-        const gchar *sentences[3];
-        gchar gga[NMEA_STR_LEN];
-        gchar rmc[NMEA_STR_LEN];
-
-        message = g_data_input_stream_read_upto_finish (data_input_stream,
-                                                        result,
-                                                        &data_size,
-                                                        &error);
-
-        gga[0] = '\0';
-        rmc[0] = '\0';
-
-        do {
+        g_autoptr(GError) error = NULL;
+        const guint8 *buf;
+        gsize buf_size, consumed = 0;
+
+        if (g_buffered_input_stream_fill_finish (stream, result, &error) <= 0) {
                 if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
                         return;
 
-                if (!source)
-                        source = GCLUE_NMEA_SOURCE (user_data);
-
-                if (message == NULL) {
-                        if (error != NULL) {
-                                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED)) {
-                                        g_debug ("NMEA socket closed.");
-                                } else {
-                                        g_warning ("Error when receiving message: %s",
-                                                   error->message);
-                                }
-                                service_broken (source);
-                                return;
-                        } else {
-                                g_debug ("NMEA empty read");
-                                /* GLib has a bug where g_data_input_stream_read_upto_finish
-                                 * returns NULL when reading a line with only stop chars.
-                                 * Convert this NULL to a zero-length message. See:
-                                 * https://gitlab.gnome.org/GNOME/glib/-/issues/655
-                                 */
-                                message = g_strdup ("");
-                        }
-
+                stream_failed (user_data, error);
+                return;
+        }
+        connection = user_data;
+
+        buf = g_buffered_input_stream_peek_buffer (stream, &buf_size);
+        while (consumed < buf_size) {
+                GClueUBXFrameResult frame_result;
+                gsize frame_length = 0, payload_length;
+                const guint8 *payload, *sync;
+                guint8 class, id;
+
+                frame_result = gclue_ubx_frame_parse (buf + consumed,
+                                                      buf_size - consumed,
+                                                      &frame_length,
+                                                      &class,
+                                                      &id,
+                                                      &payload,
+                                                      &payload_length);
+                if (frame_result == GCLUE_UBX_FRAME_INVALID) {
+                        /* Resynchronize on the next frame */
+                        sync = memchr (buf + consumed + 1,
+                                       GCLUE_UBX_SYNC_1,
+                                       buf_size - consumed - 1);
+                        consumed = sync ? (gsize) (sync - buf) : buf_size;
+                        continue;
                 }
-                g_debug ("Network source sent: \"%s\"", message);
 
-                if (gclue_nmea_type_is (message, "GGA")) {
-                        g_strlcpy (gga, message, NMEA_STR_LEN);
-                } else if (gclue_nmea_type_is (message, "RMC")) {
-                        g_strlcpy (rmc, message, NMEA_STR_LEN);
+                if (frame_result == GCLUE_UBX_FRAME_INCOMPLETE) {
+                        /* Frames are at most 64 KiB */
+                        if (frame_length > g_buffered_input_stream_get_buffer_size (stream))
+                                g_buffered_input_stream_set_buffer_size (stream, frame_length);
+                        break;
                 }
 
-                nmea_skip_delim (G_BUFFERED_INPUT_STREAM (data_input_stream),
-                                 source->priv->cancellable);
-
-                if (nmea_check_delim (G_BUFFERED_INPUT_STREAM (data_input_stream))) {
-                    g_clear_pointer (&message, g_free);
-                    message = g_data_input_stream_read_upto
-                            (data_input_stream,
-                             NMEA_LINE_END, NMEA_LINE_END_CTR,
-                             &data_size, NULL, &error);
-                } else {
-                    break;
+                if (class == GCLUE_UBX_CLASS_NAV && id == GCLUE_UBX_ID_NAV_PVT) {
+                        GClueLocation *fix;
+
+                        fix = gclue_ubx_nav_pvt_to_location (payload,
+                                                             payload_length);
+                        if (fix != NULL) {
+                                g_clear_pointer (&location, gclue_location_unref);
+                                location = fix;
+                        }
                 }
-        } while (TRUE);
+                consumed += frame_length;
+        }
 
-        i = 0;
-        if (gga[0])
-                sentences[i++] = gga;
-        if (rmc[0])
-                sentences[i++] = rmc;
-        sentences[i] = NULL;
+        /* Only skips buffered data, doesn't block */
+        g_input_stream_skip (G_INPUT_STREAM (stream), consumed, NULL, NULL);
 
-        if (i > 0) {
-                prev_location = gclue_location_source_get_location
-                        (GCLUE_LOCATION_SOURCE (source));
-                location = gclue_location_create_from_nmeas (sentences,
-                                                             prev_location);
-                if (location) {
-                        gclue_location_source_set_location
-                                (GCLUE_LOCATION_SOURCE (source), location);
-                }
+        if (location)
+                on_connection_fix (connection, location);
+
+        g_buffered_input_stream_fill_async (stream,
+                                            -1,
+                                            G_PRIORITY_DEFAULT,
+                                            connection->cancellable,
+                                            on_read_ubx,
+                                            connection);
+}
+
+static void
+on_read_gpsd_report (GObject      *object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+        GDataInputStream *data_input_stream = G_DATA_INPUT_STREAM (object);
+        NMEAConnection *connection;
+        g_autoptr(GClueLocation) location = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *report = NULL;
+        gsize length;
+
+        report = g_data_input_stream_read_line_finish (data_input_stream,
+                                                       result,
+                                                       &length,
+                                                       &error);
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        connection = user_data;
+
+        if (report == NULL) {
+                stream_failed (connection, error);
+                return;
+        }
+
+        location = gclue_gpsd_report_to_location (report, length);
+        if (location)
+                on_connection_fix (connection, location);
+
+        g_data_input_stream_read_line_async (data_input_stream,
+                                             G_PRIORITY_DEFAULT,
+                                             connection->cancellable,
+                                             on_read_gpsd_report,
+                                             connection);
+}
+
+static void
+on_gpsd_watch_sent (GObject      *object,
+                    GAsyncResult *result,
+                    gpointer      user_data)
+{
+        NMEAConnection *connection;
+        g_autoptr(GError) error = NULL;
+
+        if (!g_output_stream_write_all_finish (G_OUTPUT_STREAM (object),
+                                               result,
+                                               NULL,
+                                               &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+
+                stream_failed (user_data, error);
+                return;
         }
+        connection = user_data;
 
-        g_data_input_stream_read_upto_async (data_input_stream,
-                                             NMEA_LINE_END,
-                                             NMEA_LINE_END_CTR,
+        g_data_input_stream_read_line_async (connection->input_stream,
                                              G_PRIORITY_DEFAULT,
-                                             source->priv->cancellable,
-                                             on_read_nmea_sentence,
-                                             source);
+                                             connection->cancellable,
+                                             on_read_gpsd_report,
+                                             connection);
+}
+
+static void
+on_read_protocol_detection (GObject      *object,
+                            GAsyncResult *result,
+                            gpointer      user_data)
+{
+        GBufferedInputStream *stream = G_BUFFERED_INPUT_STREAM (object);
+        NMEAConnection *connection;
+        g_autoptr(GError) error = NULL;
+        const guint8 *buf;
+        gsize buf_size, offset;
+
+        if (g_buffered_input_stream_fill_finish (stream, result, &error) <= 0) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+
+                stream_failed (user_data, error);
+                return;
+        }
+        connection = user_data;
+
+        buf = g_buffered_input_stream_peek_buffer (stream, &buf_size);
+        connection->protocol = gclue_gnss_protocol_detect (buf, buf_size, &offset);
+        g_input_stream_skip (G_INPUT_STREAM (stream), offset, NULL, NULL);
+
+        switch (connection->protocol) {
+        case GCLUE_GNSS_PROTOCOL_NMEA:
+                read_nmea (connection);
+                break;
+
+        case GCLUE_GNSS_PROTOCOL_UBX:
+                g_buffered_input_stream_fill_async (stream,
+                                                    -1,
+                                                    G_PRIORITY_DEFAULT,
+                                                    connection->cancellable,
+                                                    on_read_ubx,
+                                                    connection);
+                break;
+
+        case GCLUE_GNSS_PROTOCOL_GPSD:
+                /* gpsd only greets us until asked for reports */
+                g_output_stream_write_all_async
+                        (g_io_stream_get_output_stream (G_IO_STREAM (connection->connection)),
+                         GCLUE_GPSD_WATCH_COMMAND,
+                         strlen (GCLUE_GPSD_WATCH_COMMAND),
+                         G_PRIORITY_DEFAULT,
+                         connection->cancellable,
+                         on_gpsd_watch_sent,
+                         connection);
+                break;
+
+        default:
+                /* Only noise so far, keep looking */
+                g_buffered_input_stream_fill_async (stream,
+                                                    -1,
+                                                    G_PRIORITY_DEFAULT,
+                                                    connection->cancellable,
+                                                    on_read_protocol_detection,
+                                                    connection);
+                return;
+        }
+
+        g_debug ("NMEA service %s speaks %s",
+                 connection->service->identifier,
+                 gclue_gnss_protocol_to_string (connection->protocol));
 }
 
 static void
@@ -798,11 +1109,11 @@ on_connection_to_location_server (GObject      *object,
                                   gpointer      user_data)
 {
         GSocketClient *client = G_SOCKET_CLIENT (object);
-        GClueNMEASource *source;
-        g_autoptr(GSocketConnection) connection = NULL;
+        NMEAConnection *connection;
+        g_autoptr(GSocketConnection) socket_connection = NULL;
         g_autoptr(GError) error = NULL;
 
-        connection = g_socket_client_connect_to_host_finish
+        socket_connection = g_socket_client_connect_to_host_finish
                 (client,
                  result,
                  &error);
@@ -811,90 +1122,71 @@ on_connection_to_location_server (GObject      *object,
                 return;
         }
 
-        source = GCLUE_NMEA_SOURCE (user_data);
+        connection = user_data;
 
         if (error != NULL) {
                 g_warning ("Failed to connect to NMEA service: %s", error->message);
-                service_broken (source);
+                service_broken (connection);
                 return;
         }
 
-        g_assert (connection);
-        g_debug ("NMEA service connected.");
+        g_assert (socket_connection);
+        g_debug ("NMEA service %s connected.", connection->service->identifier);
 
-        g_assert (!source->priv->connection);
-        source->priv->connection = g_steal_pointer (&connection);
+        g_assert (!connection->connection);
+        connection->connection = g_steal_pointer (&socket_connection);
 
-        g_assert (!source->priv->input_stream);
-        source->priv->input_stream = g_data_input_stream_new
-                (g_io_stream_get_input_stream (G_IO_STREAM (source->priv->connection)));
+        g_assert (!connection->input_stream);
+        connection->input_stream = g_data_input_stream_new
+                (g_io_stream_get_input_stream (G_IO_STREAM (connection->connection)));
 
-        g_data_input_stream_read_upto_async (source->priv->input_stream,
-                                             NMEA_LINE_END,
-                                             NMEA_LINE_END_CTR,
-                                             G_PRIORITY_DEFAULT,
-                                             source->priv->cancellable,
-                                             on_read_nmea_sentence,
-                                             source);
+        /* Besides NMEA, the service may send UBX or be gpsd */
+        g_buffered_input_stream_fill_async (G_BUFFERED_INPUT_STREAM (connection->input_stream),
+                                            -1,
+                                            G_PRIORITY_DEFAULT,
+                                            connection->cancellable,
+                                            on_read_protocol_detection,
+                                            connection);
 }
 
 static void
-try_connect_to_service (GClueNMEASource *source)
+connect_to_service (GClueNMEASource  *source,
+                    AvahiServiceInfo *service)
 {
         GClueNMEASourcePrivate *priv = source->priv;
+        NMEAConnection *connection;
 
-        if (!gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source))) {
-                g_warn_if_fail (!priv->active_service);
-
-                return;
-        }
-
-        if (priv->active_service)
-                return;
-
-        if (priv->try_services == NULL)
-                return;
-
-        g_assert (!priv->cancellable);
-        priv->cancellable = g_cancellable_new ();
-
-        g_assert (!priv->client);
-        priv->client = g_socket_client_new ();
-
-        /* The service with the highest accuracy will be stored in the beginning
-         * of the list.
-         */
-        priv->active_service = (AvahiServiceInfo *) priv->try_services->data;
+        connection = nmea_connection_new (source, service);
+        priv->connections = g_list_append (priv->connections, connection);
 
         g_debug ("Trying to connect to NMEA %sservice %s:%u.",
-                 priv->active_service->is_socket ? "socket " : "",
-                 priv->active_service->host_name,
-                 (unsigned int) priv->active_service->port);
+                 service->is_socket ? "socket " : "",
+                 service->host_name,
+                 (unsigned int) service->port);
 
-        if (!priv->active_service->is_socket) {
+        if (!service->is_socket) {
                 g_socket_client_connect_to_host_async
-                        (priv->client,
-                         priv->active_service->host_name,
-                         priv->active_service->port,
-                         priv->cancellable,
+                        (connection->client,
+                         service->host_name,
+                         service->port,
+                         connection->cancellable,
                          on_connection_to_location_server,
-                         source);
+                         connection);
         } else {
                 g_autoptr(GSocketAddress) addr = NULL;
 
-                addr = g_unix_socket_address_new (priv->active_service->host_name);
-                g_socket_client_connect_async (priv->client,
+                addr = g_unix_socket_address_new (service->host_name);
+                g_socket_client_connect_async (connection->client,
                                G_SOCKET_CONNECTABLE (addr),
-                               priv->cancellable,
+                               connection->cancellable,
                                on_connection_to_location_server,
-                               source);
+                               connection);
         }
 }
 
 static gboolean
 remove_avahi_services_from_list (GClueNMEASource *source, GList **list)
 {
-        GClueNMEASourcePrivate *priv = source->priv;
         gboolean removed_active = FALSE;
         GList *l = *list;
 
@@ -903,9 +1195,12 @@ remove_avahi_services_from_list (GClueNMEASource *source, GList **list)
                 AvahiServiceInfo *service = l->data;
 
                 if (!service->is_socket) {
-                        if (service == priv->active_service) {
+                        NMEAConnection *connection;
+
+                        connection = find_connection (source, service);
+                        if (connection != NULL) {
                                 g_debug ("Active NMEA service was Avahi-provided, disconnecting.");
-                                disconnect_from_service (source);
+                                disconnect_from_service (source, connection);
                                 removed_active = TRUE;
                         }
 
@@ -942,7 +1237,7 @@ gclue_nmea_source_finalize (GObject *gnmea)
         G_OBJECT_CLASS (gclue_nmea_source_parent_class)->finalize (gnmea);
 
         disconnect_avahi_client (source);
-        disconnect_from_service (source);
+        disconnect_from_services (source);
 
         if (priv->accuracy_refresh_source) {
                 g_source_remove (priv->accuracy_refresh_source);
@@ -960,6 +1255,7 @@ gclue_nmea_source_finalize (GObject *gnmea)
                           avahi_service_free);
         g_list_free_full (g_steal_pointer (&priv->broken_services),
                           avahi_service_free);
+        g_clear_pointer (&priv->filter, gclue_location_filter_free);
 }
 
 static void
@@ -1046,6 +1342,10 @@ gclue_nmea_source_init (GClueNMEASource *source)
 
         config = gclue_config_get_singleton ();
 
+        priv->max_connections = gclue_config_get_nmea_max_services (config);
+        if (priv->max_connections > 1)
+                priv->filter = gclue_location_filter_new ();
+
         nmea_socket = gclue_config_get_nmea_socket (config);
         if (nmea_socket != NULL) {
                 add_new_service_socket (source,
@@ -1098,7 +1398,7 @@ gclue_nmea_source_start (GClueLocationSource *source)
                 return base_result;
 
         try_connect_avahi_client (GCLUE_NMEA_SOURCE (source));
-        reconnect_service (GCLUE_NMEA_SOURCE (source));
+        reconnect_services (GCLUE_NMEA_SOURCE (source));
 
         return base_result;
 }
@@ -1117,7 +1417,7 @@ gclue_nmea_source_stop (GClueLocationSource *source)
         if (base_result == GCLUE_LOCATION_SOURCE_STOP_RESULT_STILL_USED)
                 return base_result;
 
-        disconnect_from_service (GCLUE_NMEA_SOURCE (source));
+        disconnect_from_services (GCLUE_NMEA_SOURCE (source));
 
         return base_result;
 }
@@ -49,26 +49,430 @@ gclue_nmea_type_is (const char *msg, const char *nmeatype)
 GTimeSpan
 gclue_nmea_timestamp_to_timespan (const gchar *timestamp)
 {
-        gint its, hours, minutes;
-        gdouble ts, seconds_f;
-        gchar *endptr;
+        GClueNMEAField field;
 
-        if (!timestamp || !*timestamp)
-            return -1;
+        if (!timestamp)
+                return -1;
+
+        field.data = timestamp;
+        field.length = strlen (timestamp);
+
+        return gclue_nmea_field_to_timespan (&field);
+}
+
+/*
+ * The functions below parse sentences in place, without any allocation, as
+ * they are on the path of every sentence of receivers sending at 10 Hz or
+ * more.
+ */
+
+static gint
+hex_value (char c)
+{
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
 
-        ts = g_ascii_strtod (timestamp, &endptr);
-        if (endptr != timestamp + g_utf8_strlen(timestamp, 12) ||
-            ts < 0.0 ||
-            ts >= 235960.0)
+        return -1;
+}
+
+/**
+ * gclue_nmea_sentence_parse:
+ * @sentence: (out caller-allocates): the parsed sentence
+ * @msg: NMEA sentence
+ * @length: length of @msg, or -1 if it is nul-terminated
+ *
+ * Splits @msg into fields, which point into @msg so it has to outlive
+ * @sentence. Trailing line ends are ignored. If @msg has a checksum, it is
+ * verified.
+ *
+ * Returns: %FALSE if @msg is not a valid NMEA sentence or its checksum is
+ * wrong.
+ **/
+gboolean
+gclue_nmea_sentence_parse (GClueNMEASentence *sentence,
+                           const char        *msg,
+                           gssize             length)
+{
+        const char *p, *end, *star = NULL, *field_start;
+        guint8 checksum = 0;
+
+        if (length < 0)
+                length = strlen (msg);
+        end = msg + length;
+
+        while (end > msg && (end[-1] == '\r' || end[-1] == '\n'))
+                end--;
+
+        sentence->n_fields = 0;
+        if (end - msg < 6 || msg[0] != '$')
+                return FALSE;
+
+        field_start = msg + 1;
+        for (p = msg + 1; p < end; p++) {
+                if (*p == '*') {
+                        star = p;
+                        break;
+                }
+
+                checksum ^= (guint8) *p;
+                if (*p != ',')
+                        continue;
+
+                if (sentence->n_fields == GCLUE_NMEA_MAX_FIELDS - 1)
+                        return FALSE;
+                sentence->fields[sentence->n_fields].data = field_start;
+                sentence->fields[sentence->n_fields].length = p - field_start;
+                sentence->n_fields++;
+                field_start = p + 1;
+        }
+        sentence->fields[sentence->n_fields].data = field_start;
+        sentence->fields[sentence->n_fields].length = p - field_start;
+        sentence->n_fields++;
+
+        /* The checksum is optional, but if there is one it must match */
+        if (star != NULL) {
+                gint high, low;
+
+                if (end - star != 3)
+                        return FALSE;
+
+                high = hex_value (star[1]);
+                low = hex_value (star[2]);
+                if (high < 0 || low < 0 || ((high << 4) | low) != checksum)
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * gclue_nmea_sentence_is_type:
+ * @sentence: a parsed NMEA sentence
+ * @nmeatype: A three character NMEA sentence type string ("GGA", "RMC" etc.)
+ *
+ * Returns: whether @sentence is of the given type, from any talker
+ **/
+gboolean
+gclue_nmea_sentence_is_type (const GClueNMEASentence *sentence,
+                             const char              *nmeatype)
+{
+        const GClueNMEAField *address = &sentence->fields[0];
+
+        return sentence->n_fields > 0 &&
+               address->length == 5 &&
+               memcmp (address->data + 2, nmeatype, 3) == 0;
+}
+
+/**
+ * gclue_nmea_sentence_get_field:
+ * @sentence: a parsed NMEA sentence
+ * @index: index of the field, the address being 0
+ *
+ * Returns: (transfer none): the field, empty if @sentence has fewer fields
+ **/
+const GClueNMEAField *
+gclue_nmea_sentence_get_field (const GClueNMEASentence *sentence,
+                               guint                    index)
+{
+        static const GClueNMEAField empty = { "", 0 };
+
+        if (index >= sentence->n_fields)
+                return &empty;
+
+        return &sentence->fields[index];
+}
+
+/* Talkers of satellite receivers, combined solutions first */
+static const char * const gnss_talkers[] = {
+        "GN", /* Multiple constellations */
+        "GP", /* GPS */
+        "GL", /* GLONASS */
+        "GA", /* Galileo */
+        "BD", /* BeiDou */
+        "GB", /* BeiDou, NMEA 4.11 */
+        "GQ", /* QZSS */
+        NULL
+};
+
+/**
+ * gclue_nmea_get_gnss_talkers:
+ *
+ * Returns: (transfer none): the %NULL-terminated list of the talker IDs of
+ * satellite receivers, in order of preference.
+ **/
+const char * const *
+gclue_nmea_get_gnss_talkers (void)
+{
+        return gnss_talkers;
+}
+
+/**
+ * gclue_nmea_sentence_is_gnss:
+ * @sentence: a parsed NMEA sentence
+ *
+ * Returns: whether @sentence was sent by a satellite receiver, of any
+ * constellation.
+ **/
+gboolean
+gclue_nmea_sentence_is_gnss (const GClueNMEASentence *sentence)
+{
+        const GClueNMEAField *address = &sentence->fields[0];
+        guint i;
+
+        if (sentence->n_fields == 0 || address->length != 5)
+                return FALSE;
+
+        for (i = 0; gnss_talkers[i] != NULL; i++) {
+                if (memcmp (address->data, gnss_talkers[i], 2) == 0)
+                        return TRUE;
+        }
+
+        return FALSE;
+}
+
+/**
+ * gclue_nmea_sentence_is_fix_data:
+ * @sentence: a parsed NMEA sentence
+ *
+ * Returns: whether @sentence is used by gclue_location_create_from_nmeas():
+ * GGA, RMC, GSA, GST, VTG, or the first GSV of a sequence, from a satellite
+ * receiver.
+ **/
+gboolean
+gclue_nmea_sentence_is_fix_data (const GClueNMEASentence *sentence)
+{
+        if (!gclue_nmea_sentence_is_gnss (sentence))
+                return FALSE;
+
+        /* All GSVs of a sequence have the number of satellites in view */
+        if (gclue_nmea_sentence_is_type (sentence, "GSV"))
+                return gclue_nmea_field_equal
+                        (gclue_nmea_sentence_get_field (sentence, 2), "1");
+
+        return gclue_nmea_sentence_is_type (sentence, "GGA") ||
+               gclue_nmea_sentence_is_type (sentence, "RMC") ||
+               gclue_nmea_sentence_is_type (sentence, "GSA") ||
+               gclue_nmea_sentence_is_type (sentence, "GST") ||
+               gclue_nmea_sentence_is_type (sentence, "VTG");
+}
+
+gboolean
+gclue_nmea_field_is_empty (const GClueNMEAField *field)
+{
+        return field->length == 0;
+}
+
+gboolean
+gclue_nmea_field_equal (const GClueNMEAField *field,
+                        const char           *str)
+{
+        return strlen (str) == field->length &&
+               memcmp (field->data, str, field->length) == 0;
+}
+
+/* Parses [-]digits[.digits] into an integer and the number of decimals */
+static gboolean
+parse_decimal (const char *data,
+               gsize       length,
+               gint64     *mantissa,
+               guint      *n_decimals)
+{
+        const char *p = data, *end = data + length;
+        gboolean negative = FALSE, dot = FALSE;
+        guint n_digits = 0;
+
+        *mantissa = 0;
+        *n_decimals = 0;
+
+        if (p < end && (*p == '-' || *p == '+')) {
+                negative = *p == '-';
+                p++;
+        }
+
+        for (; p < end; p++) {
+                if (*p == '.' && !dot) {
+                        dot = TRUE;
+                        continue;
+                }
+                if (!g_ascii_isdigit (*p))
+                        return FALSE;
+
+                /* Digits beyond what fits are below any receiver's precision */
+                if (n_digits == 18) {
+                        if (!dot)
+                                return FALSE;
+                        continue;
+                }
+
+                *mantissa = *mantissa * 10 + (*p - '0');
+                n_digits++;
+                if (dot)
+                        (*n_decimals)++;
+        }
+
+        if (n_digits == 0)
+                return FALSE;
+
+        if (negative)
+                *mantissa = -*mantissa;
+
+        return TRUE;
+}
+
+static const gdouble powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+        1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+/**
+ * gclue_nmea_field_to_double:
+ * @field: a field
+ * @value: (out): the value
+ *
+ * Returns: %FALSE if @field is empty or not a decimal number
+ **/
+gboolean
+gclue_nmea_field_to_double (const GClueNMEAField *field,
+                            gdouble              *value)
+{
+        gint64 mantissa;
+        guint n_decimals;
+
+        if (!parse_decimal (field->data, field->length, &mantissa, &n_decimals))
+                return FALSE;
+
+        *value = mantissa / powers_of_ten[n_decimals];
+
+        return TRUE;
+}
+
+/**
+ * gclue_nmea_field_to_int:
+ * @field: a field
+ * @value: (out): the value
+ *
+ * Returns: %FALSE if @field is empty or not an integer
+ **/
+gboolean
+gclue_nmea_field_to_int (const GClueNMEAField *field,
+                         gint64               *value)
+{
+        guint n_decimals;
+
+        return parse_decimal (field->data, field->length, value, &n_decimals) &&
+               n_decimals == 0;
+}
+
+/* Fixed point unit of coordinates: 1e-7 minutes, below a centimeter */
+#define COORDINATE_DECIMALS 7
+
+/**
+ * gclue_nmea_field_to_coordinate:
+ * @field: a coordinate field, in the (d)ddmm.mmmm format
+ * @direction: the following direction field, 'N', 'S', 'E' or 'W'
+ * @degrees: (out): the coordinate in degrees, negative south and west
+ *
+ * Returns: %FALSE if the fields are empty or invalid
+ **/
+gboolean
+gclue_nmea_field_to_coordinate (const GClueNMEAField *field,
+                                const GClueNMEAField *direction,
+                                gdouble              *degrees)
+{
+        const char *p = field->data, *end = field->data + field->length;
+        gint64 whole = 0, fraction = 0;
+        guint n_decimals = 0;
+
+        if (direction->length != 1 ||
+            (direction->data[0] != 'N' && direction->data[0] != 'S' &&
+             direction->data[0] != 'E' && direction->data[0] != 'W'))
+                return FALSE;
+
+        for (; p < end && g_ascii_isdigit (*p); p++) {
+                whole = whole * 10 + (*p - '0');
+                if (p - field->data >= 5)
+                        return FALSE;
+        }
+        /* At least the minutes and a degree digit */
+        if (p - field->data < 3)
+                return FALSE;
+
+        if (p < end) {
+                if (*p != '.')
+                        return FALSE;
+
+                for (p++; p < end; p++) {
+                        if (!g_ascii_isdigit (*p))
+                                return FALSE;
+                        if (n_decimals < COORDINATE_DECIMALS) {
+                                fraction = fraction * 10 + (*p - '0');
+                                n_decimals++;
+                        }
+                }
+        }
+        for (; n_decimals < COORDINATE_DECIMALS; n_decimals++)
+                fraction *= 10;
+
+        /* Minutes, in 1e-7 units, are converted in one go */
+        *degrees = (whole / 100) +
+                   ((whole % 100) * 10000000 + fraction) / (60 * 1e7);
+
+        if (direction->data[0] == 'S' || direction->data[0] == 'W')
+                *degrees = -*degrees;
+
+        return TRUE;
+}
+
+/**
+ * gclue_nmea_field_to_timespan:
+ * @field: a time field, in the hhmmss(.sss) format
+ *
+ * Returns: a GTimeSpan (gint64) value of microseconds since midnight,
+ * or -1, if reading fails.
+ **/
+GTimeSpan
+gclue_nmea_field_to_timespan (const GClueNMEAField *field)
+{
+        const char *d = field->data;
+        gint64 fraction;
+        guint n_decimals, i, hours, minutes, seconds;
+
+        if (field->length < 6)
+                return -1;
+        for (i = 0; i < 6; i++) {
+                if (!g_ascii_isdigit (d[i]))
+                        return -1;
+        }
+
+        hours = (d[0] - '0') * 10 + (d[1] - '0');
+        minutes = (d[2] - '0') * 10 + (d[3] - '0');
+        seconds = (d[4] - '0') * 10 + (d[5] - '0');
+        if (hours > 23 || minutes > 59 || seconds > 59)
                 return -1;
 
-        its = (gint) ts;  /* Truncate towards zero */
-        hours = its / 10000;
-        minutes = (its - 10000 * hours) / 100;
-        seconds_f = ts - 10000 * hours - 100 * minutes;  /* Seconds plus fraction */
+        /* Fraction of second, to microseconds */
+        fraction = 0;
+        if (field->length > 6) {
+                if (d[6] != '.' || field->length == 7)
+                        return -1;
+
+                for (i = 7, n_decimals = 0; i < field->length; i++) {
+                        if (!g_ascii_isdigit (d[i]))
+                                return -1;
+                        if (n_decimals < 6) {
+                                fraction = fraction * 10 + (d[i] - '0');
+                                n_decimals++;
+                        }
+                }
+                for (; n_decimals < 6; n_decimals++)
+                        fraction *= 10;
+        }
 
-        return (GTimeSpan) G_USEC_PER_SEC * (3600 * hours +
-                                               60 * minutes +
-                                                    seconds_f);
+        return (GTimeSpan) G_USEC_PER_SEC * (3600 * hours + 60 * minutes + seconds) +
+               fraction;
 }
 
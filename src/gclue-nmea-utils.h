@@ -23,9 +23,49 @@
 
 G_BEGIN_DECLS
 
+/* Enough for any standard sentence, GSV with four satellites has 20 */
+#define GCLUE_NMEA_MAX_FIELDS 40
+
+/* A field of a sentence, pointing into the sentence, not nul-terminated */
+typedef struct {
+        const char *data;
+        gsize length;
+} GClueNMEAField;
+
+typedef struct {
+        /* The first one is the address, e.g. "GPGGA" */
+        GClueNMEAField fields[GCLUE_NMEA_MAX_FIELDS];
+        guint n_fields;
+} GClueNMEASentence;
+
 gboolean         gclue_nmea_type_is              (const char *msg, const char *nmeatype);
 GTimeSpan        gclue_nmea_timestamp_to_timespan (const gchar *timestamp);
 
+gboolean         gclue_nmea_sentence_parse       (GClueNMEASentence    *sentence,
+                                                  const char           *msg,
+                                                  gssize                length);
+gboolean         gclue_nmea_sentence_is_type     (const GClueNMEASentence *sentence,
+                                                  const char           *nmeatype);
+const GClueNMEAField *
+                 gclue_nmea_sentence_get_field   (const GClueNMEASentence *sentence,
+                                                  guint                 index);
+gboolean         gclue_nmea_sentence_is_gnss     (const GClueNMEASentence *sentence);
+gboolean         gclue_nmea_sentence_is_fix_data (const GClueNMEASentence *sentence);
+const char * const *
+                 gclue_nmea_get_gnss_talkers     (void);
+
+gboolean         gclue_nmea_field_is_empty       (const GClueNMEAField *field);
+gboolean         gclue_nmea_field_equal          (const GClueNMEAField *field,
+                                                  const char           *str);
+gboolean         gclue_nmea_field_to_double      (const GClueNMEAField *field,
+                                                  gdouble              *value);
+gboolean         gclue_nmea_field_to_int         (const GClueNMEAField *field,
+                                                  gint64               *value);
+gboolean         gclue_nmea_field_to_coordinate  (const GClueNMEAField *field,
+                                                  const GClueNMEAField *direction,
+                                                  gdouble              *degrees);
+GTimeSpan        gclue_nmea_field_to_timespan    (const GClueNMEAField *field);
+
 G_END_DECLS
 
 #endif /* GCLUE_NMEA_UTILS_H */
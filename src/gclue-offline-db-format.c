@@ -0,0 +1,281 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+#include "gclue-offline-db-format.h"
+
+/*
+ * The offline database is meant to be memory-mapped read-only. All integers
+ * in it are big-endian, coordinates are in units of 1e-7 degrees and ranges
+ * in meters. It starts with a header:
+ *
+ *   0   magic "GCLUEODB"
+ *   8   version (u32)
+ *   12  number of records per index block (u32)
+ *   16  number of WiFi records (u32)
+ *   20  number of cell records (u32)
+ *   24  offset of the WiFi records (u64)
+ *   32  offset of the cell records (u64)
+ *   40  offset of the WiFi index (u64)
+ *   48  offset of the cell index (u64)
+ *   56  file size (u64)
+ *   64  SHA-256 of everything after the header, followed by the first 64
+ *       bytes of the header
+ *
+ * The WiFi records (16 bytes each) are sorted by BSSID:
+ *
+ *   BSSID (6 bytes), range (u16), latitude (i32), longitude (i32)
+ *
+ * The cell records (28 bytes each) are sorted by their first 13 bytes:
+ *
+ *   MCC (u16), MNC (u16), LAC (u32), cell ID (u32), radio (u8, same values
+ *   as GClueTowerTec), reserved (3 bytes), range (u32), latitude (i32),
+ *   longitude (i32)
+ *
+ * Each index holds the key of the first record of every block of records,
+ * zero-padded to 8 bytes for WiFi and 16 for cells. Lookups first search
+ * the small index, then only the pages of a single block.
+ *
+ * Records are compared with memcmp(), so no decoding is needed to search.
+ */
+
+void
+gclue_offline_db_header_init (GClueOfflineDBHeader *header,
+                              guint32               block_records,
+                              guint32               n_wifi,
+                              guint32               n_cells)
+{
+        header->block_records = block_records;
+        header->n_wifi = n_wifi;
+        header->n_cells = n_cells;
+
+        header->wifi_offset = GCLUE_OFFLINE_DB_HEADER_SIZE;
+        header->cell_offset = header->wifi_offset +
+                (guint64) n_wifi * GCLUE_OFFLINE_DB_WIFI_RECORD_SIZE;
+        header->wifi_index_offset = header->cell_offset +
+                (guint64) n_cells * GCLUE_OFFLINE_DB_CELL_RECORD_SIZE;
+        header->cell_index_offset = header->wifi_index_offset +
+                gclue_offline_db_n_blocks (n_wifi, block_records) *
+                GCLUE_OFFLINE_DB_WIFI_INDEX_ENTRY_SIZE;
+        header->size = header->cell_index_offset +
+                gclue_offline_db_n_blocks (n_cells, block_records) *
+                GCLUE_OFFLINE_DB_CELL_INDEX_ENTRY_SIZE;
+}
+
+static void
+header_write_checked (const GClueOfflineDBHeader *header,
+                      guint8                     *data)
+{
+        memset (data, 0, GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE);
+        memcpy (data, GCLUE_OFFLINE_DB_MAGIC, strlen (GCLUE_OFFLINE_DB_MAGIC));
+        gclue_offline_db_write_uint32 (data + 8, GCLUE_OFFLINE_DB_VERSION);
+        gclue_offline_db_write_uint32 (data + 12, header->block_records);
+        gclue_offline_db_write_uint32 (data + 16, header->n_wifi);
+        gclue_offline_db_write_uint32 (data + 20, header->n_cells);
+        gclue_offline_db_write_uint64 (data + 24, header->wifi_offset);
+        gclue_offline_db_write_uint64 (data + 32, header->cell_offset);
+        gclue_offline_db_write_uint64 (data + 40, header->wifi_index_offset);
+        gclue_offline_db_write_uint64 (data + 48, header->cell_index_offset);
+        gclue_offline_db_write_uint64 (data + 56, header->size);
+}
+
+/**
+ * gclue_offline_db_header_write:
+ * @header: the header to write
+ * @checksum: a checksum of type %GCLUE_OFFLINE_DB_CHECKSUM_TYPE, already
+ * updated with the rest of the file
+ * @data: (out caller-allocates): %GCLUE_OFFLINE_DB_HEADER_SIZE bytes
+ *
+ * Serializes @header, finishing @checksum in the process.
+ **/
+void
+gclue_offline_db_header_write (const GClueOfflineDBHeader *header,
+                               GChecksum                  *checksum,
+                               guint8                     *data)
+{
+        gsize digest_len = GCLUE_OFFLINE_DB_CHECKSUM_SIZE;
+
+        header_write_checked (header, data);
+        g_checksum_update (checksum, data, GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE);
+        g_checksum_get_digest (checksum,
+                               data + GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE,
+                               &digest_len);
+}
+
+/**
+ * gclue_offline_db_header_read:
+ * @data: the whole database
+ * @size: the size of @data
+ * @header: (out): the header
+ * @verify_checksum: whether to verify the checksum
+ * @error: return location for a #GError
+ *
+ * Parses the header of the database in @data, checking it is consistent with
+ * @size and, if @verify_checksum is set, verifying the checksum of the whole
+ * file. That reads all of it, which can be skipped for files already
+ * verified.
+ *
+ * Returns: %TRUE if @data is a valid database.
+ **/
+gboolean
+gclue_offline_db_header_read (const guint8         *data,
+                              gsize                 size,
+                              GClueOfflineDBHeader *header,
+                              gboolean              verify_checksum,
+                              GError              **error)
+{
+        GClueOfflineDBHeader expected = { 0 };
+        g_autoptr(GChecksum) checksum = NULL;
+        guint8 digest[GCLUE_OFFLINE_DB_CHECKSUM_SIZE];
+        gsize digest_len = sizeof (digest);
+        guint32 version;
+
+        if (size < GCLUE_OFFLINE_DB_HEADER_SIZE ||
+            memcmp (data, GCLUE_OFFLINE_DB_MAGIC, strlen (GCLUE_OFFLINE_DB_MAGIC)) != 0) {
+                g_set_error_literal (error,
+                                     G_IO_ERROR,
+                                     G_IO_ERROR_INVALID_DATA,
+                                     "Not an offline location database");
+                return FALSE;
+        }
+
+        version = gclue_offline_db_read_uint32 (data + 8);
+        if (version != GCLUE_OFFLINE_DB_VERSION) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_NOT_SUPPORTED,
+                             "Unsupported database version %u",
+                             version);
+                return FALSE;
+        }
+
+        header->block_records = gclue_offline_db_read_uint32 (data + 12);
+        header->n_wifi = gclue_offline_db_read_uint32 (data + 16);
+        header->n_cells = gclue_offline_db_read_uint32 (data + 20);
+        header->wifi_offset = gclue_offline_db_read_uint64 (data + 24);
+        header->cell_offset = gclue_offline_db_read_uint64 (data + 32);
+        header->wifi_index_offset = gclue_offline_db_read_uint64 (data + 40);
+        header->cell_index_offset = gclue_offline_db_read_uint64 (data + 48);
+        header->size = gclue_offline_db_read_uint64 (data + 56);
+
+        /* The layout is fully determined by the counts, don't trust the
+         * offsets beyond that. */
+        if (header->block_records > 0) {
+                gclue_offline_db_header_init (&expected,
+                                              header->block_records,
+                                              header->n_wifi,
+                                              header->n_cells);
+        }
+        if (header->block_records == 0 ||
+            header->wifi_offset != expected.wifi_offset ||
+            header->cell_offset != expected.cell_offset ||
+            header->wifi_index_offset != expected.wifi_index_offset ||
+            header->cell_index_offset != expected.cell_index_offset ||
+            header->size != expected.size ||
+            header->size != size) {
+                g_set_error (error,
+                             G_IO_ERROR,
+                             G_IO_ERROR_INVALID_DATA,
+                             "Inconsistent database header (file size %"
+                             G_GSIZE_FORMAT " bytes)",
+                             size);
+                return FALSE;
+        }
+
+        if (!verify_checksum)
+                return TRUE;
+
+        checksum = g_checksum_new (GCLUE_OFFLINE_DB_CHECKSUM_TYPE);
+        g_checksum_update (checksum,
+                           data + GCLUE_OFFLINE_DB_HEADER_SIZE,
+                           size - GCLUE_OFFLINE_DB_HEADER_SIZE);
+        g_checksum_update (checksum, data, GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE);
+        g_checksum_get_digest (checksum, digest, &digest_len);
+        if (memcmp (digest,
+                    data + GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE,
+                    GCLUE_OFFLINE_DB_CHECKSUM_SIZE) != 0) {
+                g_set_error_literal (error,
+                                     G_IO_ERROR,
+                                     G_IO_ERROR_INVALID_DATA,
+                                     "Database checksum mismatch");
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* Index of the first record not smaller than @key in [@low, @high) */
+static guint32
+lower_bound (const guint8 *records,
+             guint32       low,
+             guint32       high,
+             gsize         record_size,
+             const guint8 *key,
+             gsize         key_size)
+{
+        while (low < high) {
+                guint32 mid = low + (high - low) / 2;
+
+                if (memcmp (records + (gsize) mid * record_size, key, key_size) < 0)
+                        low = mid + 1;
+                else
+                        high = mid;
+        }
+
+        return low;
+}
+
+/**
+ * gclue_offline_db_lookup:
+ * @records: the sorted records
+ * @n_records: the number of records
+ * @record_size: the size of a record
+ * @index: the block index of @records
+ * @index_entry_size: the size of an index entry
+ * @block_records: the number of records per block
+ * @key: the key to look up, compared with the start of records
+ * @key_size: the size of @key, at most @index_entry_size
+ *
+ * Returns: the position of the first record not smaller than @key, or
+ * @n_records if there is none.
+ **/
+guint32
+gclue_offline_db_lookup (const guint8 *records,
+                         guint32       n_records,
+                         gsize         record_size,
+                         const guint8 *index,
+                         gsize         index_entry_size,
+                         guint32       block_records,
+                         const guint8 *key,
+                         gsize         key_size)
+{
+        guint32 n_blocks, block;
+        guint64 low, high;
+
+        n_blocks = gclue_offline_db_n_blocks (n_records, block_records);
+        block = lower_bound (index, 0, n_blocks, index_entry_size, key, key_size);
+        if (block == 0)
+                return 0;
+
+        /* The first record of @block is not smaller than @key, so the
+         * answer is in the previous block or is that record. */
+        low = (guint64) (block - 1) * block_records;
+        high = MIN ((guint64) block * block_records, n_records);
+
+        return lower_bound (records, low, high, record_size, key, key_size);
+}
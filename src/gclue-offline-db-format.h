@@ -0,0 +1,142 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_OFFLINE_DB_FORMAT_H
+#define GCLUE_OFFLINE_DB_FORMAT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* File layout shared by the daemon and geoclue-db-compile, see
+ * gclue-offline-db-format.c for the description. */
+
+#define GCLUE_OFFLINE_DB_MAGIC "GCLUEODB"
+#define GCLUE_OFFLINE_DB_VERSION 2
+#define GCLUE_OFFLINE_DB_HEADER_SIZE 96
+/* Part of the header covered by the checksum, the checksum follows */
+#define GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE 64
+#define GCLUE_OFFLINE_DB_CHECKSUM_TYPE G_CHECKSUM_SHA256
+#define GCLUE_OFFLINE_DB_CHECKSUM_SIZE 32
+
+#define GCLUE_OFFLINE_DB_DEFAULT_BLOCK_RECORDS 256
+
+#define GCLUE_OFFLINE_DB_WIFI_RECORD_SIZE 16
+#define GCLUE_OFFLINE_DB_WIFI_KEY_SIZE 6
+#define GCLUE_OFFLINE_DB_WIFI_INDEX_ENTRY_SIZE 8
+
+#define GCLUE_OFFLINE_DB_CELL_RECORD_SIZE 28
+/* MCC, MNC, LAC and cell ID */
+#define GCLUE_OFFLINE_DB_CELL_ID_SIZE 12
+/* The above plus the radio type */
+#define GCLUE_OFFLINE_DB_CELL_KEY_SIZE 13
+#define GCLUE_OFFLINE_DB_CELL_INDEX_ENTRY_SIZE 16
+
+#define GCLUE_OFFLINE_DB_COORDINATE_SCALE 1e7
+
+typedef struct {
+        guint32 block_records;
+        guint32 n_wifi;
+        guint32 n_cells;
+        guint64 wifi_offset;
+        guint64 cell_offset;
+        guint64 wifi_index_offset;
+        guint64 cell_index_offset;
+        guint64 size;
+} GClueOfflineDBHeader;
+
+static inline guint16
+gclue_offline_db_read_uint16 (const guint8 *data)
+{
+        return ((guint16) data[0] << 8) | data[1];
+}
+
+static inline guint32
+gclue_offline_db_read_uint32 (const guint8 *data)
+{
+        return ((guint32) data[0] << 24) | ((guint32) data[1] << 16) |
+               ((guint32) data[2] << 8) | data[3];
+}
+
+static inline guint64
+gclue_offline_db_read_uint64 (const guint8 *data)
+{
+        return ((guint64) gclue_offline_db_read_uint32 (data) << 32) |
+               gclue_offline_db_read_uint32 (data + 4);
+}
+
+static inline void
+gclue_offline_db_write_uint16 (guint8 *data, guint16 value)
+{
+        data[0] = value >> 8;
+        data[1] = value;
+}
+
+static inline void
+gclue_offline_db_write_uint32 (guint8 *data, guint32 value)
+{
+        data[0] = value >> 24;
+        data[1] = value >> 16;
+        data[2] = value >> 8;
+        data[3] = value;
+}
+
+static inline void
+gclue_offline_db_write_uint64 (guint8 *data, guint64 value)
+{
+        gclue_offline_db_write_uint32 (data, value >> 32);
+        gclue_offline_db_write_uint32 (data + 4, value);
+}
+
+static inline guint64
+gclue_offline_db_n_blocks (guint32 n_records,
+                           guint32 block_records)
+{
+        return ((guint64) n_records + block_records - 1) / block_records;
+}
+
+void
+gclue_offline_db_header_init (GClueOfflineDBHeader *header,
+                              guint32               block_records,
+                              guint32               n_wifi,
+                              guint32               n_cells);
+
+void
+gclue_offline_db_header_write (const GClueOfflineDBHeader *header,
+                               GChecksum                  *checksum,
+                               guint8                     *data);
+
+gboolean
+gclue_offline_db_header_read (const guint8         *data,
+                              gsize                 size,
+                              GClueOfflineDBHeader *header,
+                              gboolean              verify_checksum,
+                              GError              **error);
+
+guint32
+gclue_offline_db_lookup (const guint8 *records,
+                         guint32       n_records,
+                         gsize         record_size,
+                         const guint8 *index,
+                         gsize         index_entry_size,
+                         guint32       block_records,
+                         const guint8 *key,
+                         gsize         key_size);
+
+G_END_DECLS
+
+#endif /* GCLUE_OFFLINE_DB_FORMAT_H */
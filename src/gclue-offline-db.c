@@ -0,0 +1,1024 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include "gclue-offline-db.h"
+#include "gclue-offline-db-format.h"
+#include "gclue-config.h"
+
+/**
+ * SECTION:gclue-offline-db
+ * @short_description: Local WiFi and cell tower database
+ *
+ * Looks up the positions of WiFi access points and cell towers in a local
+ * database and computes a location from them, without any network access.
+ *
+ * The database is created by geoclue-db-compile, its format is described in
+ * gclue-offline-db-format.c. It is memory-mapped read-only and searched in
+ * place, so its pages are shared through the page cache and only those
+ * around the looked up networks are ever read after loading.
+ *
+ * When enabled, the positions of access points are also learned locally from
+ * accurate (GPS) locations and the access points seen along with them, and
+ * used before the database. They are kept in the state directory.
+ **/
+
+#define EARTH_RADIUS_M 6372795.0
+
+/* Matching APs further apart than this (plus their ranges) are assumed to
+ * not be seen from the same place, i.e. one of them has moved. */
+#define WIFI_MAX_CLUSTER_DISTANCE 500.0
+/* Same as what the web service requires, a single AP is too easy to get
+ * wrong (moved APs, mobile hotspots). */
+#define WIFI_MIN_MATCHES 2
+#define WIFI_MIN_ACCURACY 20.0
+/* Signal level of APs whose level is unknown */
+#define WIFI_DEFAULT_SIGNAL -80
+
+#define CELL_DEFAULT_RANGE 5000.0
+#define CELL_MIN_ACCURACY 500.0
+
+/* Only learn from fixes at least this accurate, in meters */
+#define LEARN_ACCURACY_THRESHOLD 50.0
+/* Minimum time between learned fixes, in seconds. Both WiFi sources see the
+ * same scans, and consecutive fixes mostly repeat the same information. */
+#define LEARN_TIME_THRESHOLD 5
+/* Skip APs that were last seen longer ago than this (in seconds), or than it
+ * takes to move this far (in meters) at the current speed. */
+#define LEARN_MAX_BSS_AGE 10.0
+#define LEARN_MAX_BSS_DISTANCE 50.0
+/* An AP seen this far (plus its range) from its learned position has moved,
+ * start over with it. */
+#define LEARN_MAX_MOVE_DISTANCE 1000.0
+/* Learned APs seen fewer times than this aren't used for lookups */
+#define LEARN_MIN_OBSERVATIONS 3
+/* When over this many learned APs, drop the least recently seen 10% */
+#define LEARN_MAX_APS 50000
+#define LEARN_SAVE_DELAY 60 /* seconds */
+
+/* The file, as identified by its stat() data and checksum, last verified.
+ * The service exits when idle, it would read the whole database each time
+ * it starts otherwise. */
+#define VERIFIED_FILE_NAME "offline-db-verified"
+#define VERIFIED_TYPE "(tttt@ay)"
+
+#define LEARNED_FILE_NAME "wifi-learned"
+#define LEARNED_FILE_VERSION 1
+#define LEARNED_AP_TYPE "(tddddut)"
+
+typedef struct {
+        gint64 bssid;     /* Packed BSSID, also the hash table key */
+        gdouble weight;   /* Sum of the weights of the observations */
+        gdouble latitude; /* Weighted mean of the observations */
+        gdouble longitude;
+        gdouble m2;       /* Weighted sum of squared distances to the mean, in m² */
+        guint32 n_observations;
+        guint64 last_seen;
+} LearnedAP;
+
+struct _GClueOfflineDBPrivate
+{
+        GMappedFile *file;
+        GStatBuf stat_buf;
+        GStatBuf rejected_stat;
+
+        GClueOfflineDBHeader header;
+        const guint8 *wifi_records;
+        const guint8 *wifi_index;
+        const guint8 *cell_records;
+        const guint8 *cell_index;
+
+        GHashTable *learned; /* Packed BSSID → LearnedAP, NULL if disabled */
+        char *learned_path;
+        guint64 last_learned;
+        guint save_timeout_id;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueOfflineDB,
+                         gclue_offline_db,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueOfflineDB))
+
+typedef struct {
+        gdouble latitude;
+        gdouble longitude;
+        gdouble range;
+        gdouble weight;
+} Match;
+
+static gboolean
+read_position (const guint8 *data,
+               Match        *match)
+{
+        match->latitude = (gint32) gclue_offline_db_read_uint32 (data) /
+                          GCLUE_OFFLINE_DB_COORDINATE_SCALE;
+        match->longitude = (gint32) gclue_offline_db_read_uint32 (data + 4) /
+                           GCLUE_OFFLINE_DB_COORDINATE_SCALE;
+
+        return match->latitude >= -90 && match->latitude <= 90 &&
+               match->longitude >= -180 && match->longitude <= 180;
+}
+
+static gint64
+bssid_to_key (const guint8 *bssid)
+{
+        gint64 key = 0;
+        guint i;
+
+        for (i = 0; i < GCLUE_OFFLINE_DB_BSSID_LEN; i++)
+                key = (key << 8) | bssid[i];
+
+        return key;
+}
+
+static gdouble
+learned_ap_get_range (const LearnedAP *ap)
+{
+        return sqrt (ap->m2 / ap->weight);
+}
+
+static gboolean
+lookup_learned_bss (GClueOfflineDB        *db,
+                    const GClueOfflineBss *bss,
+                    Match                 *match)
+{
+        LearnedAP *ap;
+        gint64 key;
+
+        if (db->priv->learned == NULL)
+                return FALSE;
+
+        key = bssid_to_key (bss->bssid);
+        ap = g_hash_table_lookup (db->priv->learned, &key);
+        if (ap == NULL || ap->n_observations < LEARN_MIN_OBSERVATIONS)
+                return FALSE;
+
+        match->latitude = ap->latitude;
+        match->longitude = ap->longitude;
+        match->range = learned_ap_get_range (ap);
+
+        return TRUE;
+}
+
+static gboolean
+lookup_bss (GClueOfflineDB        *db,
+            const GClueOfflineBss *bss,
+            Match                 *match)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        const guint8 *record;
+        guint32 i;
+
+        /* What we've seen ourselves is the most up to date */
+        if (lookup_learned_bss (db, bss, match))
+                return TRUE;
+
+        if (priv->file == NULL)
+                return FALSE;
+
+        i = gclue_offline_db_lookup (priv->wifi_records,
+                                     priv->header.n_wifi,
+                                     GCLUE_OFFLINE_DB_WIFI_RECORD_SIZE,
+                                     priv->wifi_index,
+                                     GCLUE_OFFLINE_DB_WIFI_INDEX_ENTRY_SIZE,
+                                     priv->header.block_records,
+                                     bss->bssid,
+                                     GCLUE_OFFLINE_DB_WIFI_KEY_SIZE);
+        if (i >= priv->header.n_wifi)
+                return FALSE;
+
+        record = priv->wifi_records + (gsize) i * GCLUE_OFFLINE_DB_WIFI_RECORD_SIZE;
+        if (memcmp (record, bss->bssid, GCLUE_OFFLINE_DB_WIFI_KEY_SIZE) != 0)
+                return FALSE;
+
+        match->range = gclue_offline_db_read_uint16 (record + 6);
+        return read_position (record + 8, match);
+}
+
+static gboolean
+lookup_cell (GClueOfflineDB         *db,
+             const GClueOfflineCell *cell,
+             Match                  *match)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        guint8 key[GCLUE_OFFLINE_DB_CELL_ID_SIZE];
+        const guint8 *found = NULL;
+        guint32 i;
+
+        if (priv->file == NULL)
+                return FALSE;
+
+        gclue_offline_db_write_uint16 (key, cell->mcc);
+        gclue_offline_db_write_uint16 (key + 2, cell->mnc);
+        gclue_offline_db_write_uint32 (key + 4, cell->lac);
+        gclue_offline_db_write_uint32 (key + 8, cell->cell_id);
+
+        /* The same IDs can exist for several radio types, prefer ours but
+         * take any if there's no exact match. */
+        for (i = gclue_offline_db_lookup (priv->cell_records,
+                                          priv->header.n_cells,
+                                          GCLUE_OFFLINE_DB_CELL_RECORD_SIZE,
+                                          priv->cell_index,
+                                          GCLUE_OFFLINE_DB_CELL_INDEX_ENTRY_SIZE,
+                                          priv->header.block_records,
+                                          key,
+                                          GCLUE_OFFLINE_DB_CELL_ID_SIZE);
+             i < priv->header.n_cells;
+             i++) {
+                const guint8 *record = priv->cell_records +
+                        (gsize) i * GCLUE_OFFLINE_DB_CELL_RECORD_SIZE;
+
+                if (memcmp (record, key, GCLUE_OFFLINE_DB_CELL_ID_SIZE) != 0)
+                        break;
+
+                if (found == NULL)
+                        found = record;
+                if (record[GCLUE_OFFLINE_DB_CELL_ID_SIZE] == cell->tec) {
+                        found = record;
+                        break;
+                }
+        }
+
+        if (found == NULL)
+                return FALSE;
+
+        match->range = gclue_offline_db_read_uint32 (found + 16);
+        return read_position (found + 20, match);
+}
+
+/* Good enough for the short distances we compare */
+static gdouble
+get_distance (const Match *a,
+              const Match *b)
+{
+        gdouble x, y;
+
+        x = (b->longitude - a->longitude) *
+            cos ((a->latitude + b->latitude) / 2 * G_PI / 180);
+        y = b->latitude - a->latitude;
+
+        return sqrt (x * x + y * y) * G_PI / 180 * EARTH_RADIUS_M;
+}
+
+static gboolean
+matches_are_close (const Match *a,
+                   const Match *b)
+{
+        return get_distance (a, b) <=
+               WIFI_MAX_CLUSTER_DISTANCE + a->range + b->range;
+}
+
+static GClueLocation *
+locate_from_wifi (GArray *matches)
+{
+        Match *anchor = NULL, centroid = { 0 };
+        guint anchor_neighbours = 0;
+        gdouble total_weight = 0, range = 0, spread = 0, accuracy;
+        guint n_used = 0;
+        guint i, j;
+
+        /* Anchor on the AP that most others agree with, so that a moved AP
+         * can't drag the position away. */
+        for (i = 0; i < matches->len; i++) {
+                Match *match = &g_array_index (matches, Match, i);
+                guint neighbours = 0;
+
+                for (j = 0; j < matches->len; j++) {
+                        if (matches_are_close (match, &g_array_index (matches, Match, j)))
+                                neighbours++;
+                }
+
+                if (anchor == NULL || neighbours > anchor_neighbours ||
+                    (neighbours == anchor_neighbours && match->weight > anchor->weight)) {
+                        anchor = match;
+                        anchor_neighbours = neighbours;
+                }
+        }
+
+        if (anchor == NULL || anchor_neighbours < WIFI_MIN_MATCHES)
+                return NULL;
+
+        for (i = 0; i < matches->len; i++) {
+                Match *match = &g_array_index (matches, Match, i);
+
+                if (!matches_are_close (anchor, match)) {
+                        match->weight = 0;
+                        continue;
+                }
+
+                centroid.latitude += match->latitude * match->weight;
+                centroid.longitude += match->longitude * match->weight;
+                range += match->range * match->weight;
+                total_weight += match->weight;
+                n_used++;
+        }
+
+        centroid.latitude /= total_weight;
+        centroid.longitude /= total_weight;
+        range /= total_weight;
+
+        for (i = 0; i < matches->len; i++) {
+                Match *match = &g_array_index (matches, Match, i);
+                gdouble distance;
+
+                if (match->weight == 0)
+                        continue;
+
+                distance = get_distance (&centroid, match);
+                spread += distance * distance * match->weight;
+        }
+        spread = sqrt (spread / total_weight);
+
+        accuracy = MAX (MAX (range, spread), WIFI_MIN_ACCURACY);
+        g_debug ("Offline WiFi location from %u of %u known APs", n_used, matches->len);
+
+        return gclue_location_new (centroid.latitude,
+                                   centroid.longitude,
+                                   accuracy,
+                                   "Offline WiFi");
+}
+
+/**
+ * gclue_offline_db_locate:
+ * @db: a #GClueOfflineDB
+ * @bsss: (array length=n_bsss): the WiFi access points currently seen
+ * @n_bsss: the number of elements in @bsss
+ * @cell: (nullable): the current cell tower
+ * @error: return location for a #GError
+ *
+ * Computes a location from the signal-weighted positions of the known access
+ * points in @bsss, falling back to the position of @cell when there aren't
+ * enough of them.
+ *
+ * Returns: (transfer full): the location, or %NULL if @db doesn't know
+ * enough of the given networks.
+ **/
+GClueLocation *
+gclue_offline_db_locate (GClueOfflineDB         *db,
+                         const GClueOfflineBss  *bsss,
+                         guint                   n_bsss,
+                         const GClueOfflineCell *cell,
+                         GError                **error)
+{
+        g_autoptr(GArray) matches = NULL;
+        Match match;
+        guint i;
+
+        g_return_val_if_fail (GCLUE_IS_OFFLINE_DB (db), NULL);
+
+        matches = g_array_sized_new (FALSE, FALSE, sizeof (Match), n_bsss);
+        for (i = 0; i < n_bsss; i++) {
+                gint16 signal = bsss[i].signal < 0 ? bsss[i].signal : WIFI_DEFAULT_SIGNAL;
+
+                if (!lookup_bss (db, &bsss[i], &match))
+                        continue;
+
+                /* Received amplitude, the usual weighting for centroids */
+                match.weight = pow (10, signal / 20.0);
+                g_array_append_val (matches, match);
+        }
+
+        if (matches->len >= WIFI_MIN_MATCHES) {
+                GClueLocation *location = locate_from_wifi (matches);
+
+                if (location != NULL)
+                        return location;
+        }
+
+        if (cell != NULL && lookup_cell (db, cell, &match)) {
+                gdouble accuracy = match.range > 0 ? match.range : CELL_DEFAULT_RANGE;
+
+                g_debug ("Offline 3GPP location from cell %u/%u/%u/%u",
+                         cell->mcc, cell->mnc, cell->lac, cell->cell_id);
+
+                return gclue_location_new (match.latitude,
+                                           match.longitude,
+                                           MAX (accuracy, CELL_MIN_ACCURACY),
+                                           "Offline 3GPP");
+        }
+
+        g_set_error (error,
+                     G_IO_ERROR,
+                     G_IO_ERROR_NOT_FOUND,
+                     "Not enough known networks in offline database "
+                     "(%u of %u WiFi APs%s)",
+                     matches->len, n_bsss,
+                     cell != NULL ? ", unknown cell" : "");
+        return NULL;
+}
+
+/**
+ * gclue_offline_db_has_data:
+ * @db: a #GClueOfflineDB
+ *
+ * Returns: %TRUE if @db has a database loaded or has learned any access
+ * points, i.e. whether a lookup has any chance to succeed.
+ **/
+gboolean
+gclue_offline_db_has_data (GClueOfflineDB *db)
+{
+        g_return_val_if_fail (GCLUE_IS_OFFLINE_DB (db), FALSE);
+
+        return db->priv->file != NULL ||
+               (db->priv->learned != NULL &&
+                g_hash_table_size (db->priv->learned) > 0);
+}
+
+static void
+learn_bss (GClueOfflineDB        *db,
+           const GClueOfflineBss *bss,
+           const Match           *fix,
+           guint64                timestamp)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        gint16 signal = bss->signal < 0 ? bss->signal : WIFI_DEFAULT_SIGNAL;
+        gdouble weight, distance = 0, new_distance;
+        gint64 key = bssid_to_key (bss->bssid);
+        LearnedAP *ap;
+        Match mean;
+
+        /* Stronger signal means closer, and inaccurate fixes count less */
+        weight = pow (10, signal / 20.0) / MAX (fix->range, 1.0);
+
+        ap = g_hash_table_lookup (priv->learned, &key);
+        if (ap != NULL) {
+                mean.latitude = ap->latitude;
+                mean.longitude = ap->longitude;
+                distance = get_distance (&mean, fix);
+
+                if (distance > LEARN_MAX_MOVE_DISTANCE + learned_ap_get_range (ap)) {
+                        g_debug ("WiFi AP seen %.0f m away from its learned "
+                                 "position, relearning it", distance);
+                        g_hash_table_remove (priv->learned, &key);
+                        ap = NULL;
+                }
+        }
+
+        if (ap == NULL) {
+                ap = g_new0 (LearnedAP, 1);
+                ap->bssid = key;
+                ap->weight = weight;
+                ap->latitude = fix->latitude;
+                ap->longitude = fix->longitude;
+                ap->n_observations = 1;
+                ap->last_seen = timestamp;
+                g_hash_table_replace (priv->learned, &ap->bssid, ap);
+
+                return;
+        }
+
+        /* Weighted incremental mean and variance (West, 1979), with the
+         * deviations measured in meters. */
+        ap->weight += weight;
+        ap->latitude += (fix->latitude - ap->latitude) * weight / ap->weight;
+        ap->longitude += (fix->longitude - ap->longitude) * weight / ap->weight;
+        mean.latitude = ap->latitude;
+        mean.longitude = ap->longitude;
+        new_distance = get_distance (&mean, fix);
+        ap->m2 += weight * distance * new_distance;
+
+        if (ap->n_observations < G_MAXUINT32)
+                ap->n_observations++;
+        ap->last_seen = timestamp;
+}
+
+static gint
+compare_learned_ap_last_seen (gconstpointer a,
+                              gconstpointer b)
+{
+        const LearnedAP *ap_a = *(const LearnedAP **) a;
+        const LearnedAP *ap_b = *(const LearnedAP **) b;
+
+        return (ap_a->last_seen > ap_b->last_seen) -
+               (ap_a->last_seen < ap_b->last_seen);
+}
+
+static void
+learned_trim (GClueOfflineDB *db)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        g_autoptr(GPtrArray) aps = NULL;
+        GHashTableIter iter;
+        gpointer value;
+        guint n_evict, i;
+
+        if (g_hash_table_size (priv->learned) <= LEARN_MAX_APS)
+                return;
+
+        aps = g_ptr_array_sized_new (g_hash_table_size (priv->learned));
+        g_hash_table_iter_init (&iter, priv->learned);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+                g_ptr_array_add (aps, value);
+        g_ptr_array_sort (aps, compare_learned_ap_last_seen);
+
+        /* Make room for a while, not just for the next AP */
+        n_evict = aps->len - LEARN_MAX_APS / 10 * 9;
+        for (i = 0; i < n_evict; i++) {
+                LearnedAP *ap = g_ptr_array_index (aps, i);
+
+                g_hash_table_remove (priv->learned, &ap->bssid);
+        }
+
+        g_debug ("Dropped %u least recently seen learned WiFi APs", n_evict);
+}
+
+static void
+learned_save (GClueOfflineDB *db)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *dir = NULL;
+        GVariantBuilder builder;
+        GHashTableIter iter;
+        gpointer value;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" LEARNED_AP_TYPE));
+        g_hash_table_iter_init (&iter, priv->learned);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                LearnedAP *ap = value;
+
+                g_variant_builder_add (&builder,
+                                       LEARNED_AP_TYPE,
+                                       (guint64) ap->bssid,
+                                       ap->weight,
+                                       ap->latitude,
+                                       ap->longitude,
+                                       ap->m2,
+                                       ap->n_observations,
+                                       ap->last_seen);
+        }
+        variant = g_variant_ref_sink (g_variant_new ("(u@a" LEARNED_AP_TYPE ")",
+                                                     LEARNED_FILE_VERSION,
+                                                     g_variant_builder_end (&builder)));
+
+        dir = g_path_get_dirname (priv->learned_path);
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("Failed to create directory '%s': %s",
+                           dir, g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (priv->learned_path,
+                                       g_variant_get_data (variant),
+                                       g_variant_get_size (variant),
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600,
+                                       &error)) {
+                g_warning ("Failed to save learned WiFi APs: %s",
+                           error->message);
+                return;
+        }
+
+        g_debug ("Saved %u learned WiFi APs to '%s'",
+                 g_hash_table_size (priv->learned), priv->learned_path);
+}
+
+static gboolean
+on_save_timeout (gpointer user_data)
+{
+        GClueOfflineDB *db = GCLUE_OFFLINE_DB (user_data);
+
+        db->priv->save_timeout_id = 0;
+        learned_save (db);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+learned_load (GClueOfflineDB *db)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        g_autoptr(GMappedFile) file = NULL;
+        g_autoptr(GBytes) bytes = NULL;
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GVariant) aps = NULL;
+        g_autoptr(GError) error = NULL;
+        GVariantIter iter;
+        guint64 bssid, last_seen;
+        gdouble weight, latitude, longitude, m2;
+        guint32 version, n_observations;
+
+        file = g_mapped_file_new (priv->learned_path, FALSE, &error);
+        if (file == NULL) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load learned WiFi APs: %s",
+                                   error->message);
+                return;
+        }
+
+        /* Not trusted, GVariant returns default values for anything
+         * malformed and we check the values below. */
+        bytes = g_mapped_file_get_bytes (file);
+        variant = g_variant_new_from_bytes (G_VARIANT_TYPE ("(ua" LEARNED_AP_TYPE ")"),
+                                            bytes,
+                                            FALSE);
+        g_variant_get (variant, "(u@a" LEARNED_AP_TYPE ")", &version, &aps);
+        if (version != LEARNED_FILE_VERSION) {
+                g_warning ("Ignoring learned WiFi APs file '%s' in unknown format",
+                           priv->learned_path);
+                return;
+        }
+
+        g_variant_iter_init (&iter, aps);
+        while (g_variant_iter_next (&iter,
+                                    LEARNED_AP_TYPE,
+                                    &bssid,
+                                    &weight,
+                                    &latitude,
+                                    &longitude,
+                                    &m2,
+                                    &n_observations,
+                                    &last_seen)) {
+                LearnedAP *ap;
+
+                if (!(weight > 0 && m2 >= 0 && isfinite (weight) && isfinite (m2) &&
+                      latitude >= -90 && latitude <= 90 &&
+                      longitude >= -180 && longitude <= 180 &&
+                      n_observations > 0))
+                        continue;
+
+                ap = g_new0 (LearnedAP, 1);
+                ap->bssid = bssid;
+                ap->weight = weight;
+                ap->latitude = latitude;
+                ap->longitude = longitude;
+                ap->m2 = m2;
+                ap->n_observations = n_observations;
+                ap->last_seen = last_seen;
+                g_hash_table_replace (priv->learned, &ap->bssid, ap);
+        }
+
+        g_debug ("Loaded %u learned WiFi APs from '%s'",
+                 g_hash_table_size (priv->learned), priv->learned_path);
+        learned_trim (db);
+}
+
+/**
+ * gclue_offline_db_should_learn:
+ * @db: a #GClueOfflineDB
+ * @location: a location
+ *
+ * Cheap check to do before collecting the access points to pass to
+ * gclue_offline_db_learn().
+ *
+ * Returns: %TRUE if learning is enabled, @location is accurate enough and
+ * no other location has just been learned from.
+ **/
+gboolean
+gclue_offline_db_should_learn (GClueOfflineDB *db,
+                               GClueLocation  *location)
+{
+        gdouble accuracy;
+        guint64 timestamp;
+
+        g_return_val_if_fail (GCLUE_IS_OFFLINE_DB (db), FALSE);
+        g_return_val_if_fail (location != NULL, FALSE);
+
+        if (db->priv->learned == NULL)
+                return FALSE;
+
+        accuracy = gclue_location_get_accuracy (location);
+        if (accuracy < 0 || accuracy > LEARN_ACCURACY_THRESHOLD)
+                return FALSE;
+
+        timestamp = gclue_location_get_timestamp (location);
+        return timestamp < db->priv->last_learned ||
+               timestamp - db->priv->last_learned >= LEARN_TIME_THRESHOLD;
+}
+
+/**
+ * gclue_offline_db_learn:
+ * @db: a #GClueOfflineDB
+ * @bsss: (array length=n_bsss): the WiFi access points seen at @location
+ * @n_bsss: the number of elements in @bsss
+ * @location: an accurate location, e.g. from GPS
+ *
+ * Refines the learned positions of the access points in @bsss from
+ * @location. Does nothing if learning is disabled, @location isn't accurate
+ * enough or another location has just been learned from.
+ **/
+void
+gclue_offline_db_learn (GClueOfflineDB        *db,
+                        const GClueOfflineBss *bsss,
+                        guint                  n_bsss,
+                        GClueLocation         *location)
+{
+        GClueOfflineDBPrivate *priv;
+        gdouble speed, max_age;
+        guint64 timestamp;
+        guint n_learned = 0;
+        Match fix;
+        guint i;
+
+        g_return_if_fail (GCLUE_IS_OFFLINE_DB (db));
+        g_return_if_fail (location != NULL);
+
+        if (!gclue_offline_db_should_learn (db, location))
+                return;
+
+        priv = db->priv;
+        fix.latitude = gclue_location_get_latitude (location);
+        fix.longitude = gclue_location_get_longitude (location);
+        fix.range = gclue_location_get_accuracy (location);
+        timestamp = gclue_location_get_timestamp (location);
+
+        max_age = LEARN_MAX_BSS_AGE;
+        speed = gclue_location_get_speed (location);
+        if (speed > 0)
+                max_age = MIN (max_age, LEARN_MAX_BSS_DISTANCE / speed);
+
+        for (i = 0; i < n_bsss; i++) {
+                if (bsss[i].age > max_age)
+                        continue;
+
+                learn_bss (db, &bsss[i], &fix, timestamp);
+                n_learned++;
+        }
+
+        if (n_learned == 0)
+                return;
+
+        priv->last_learned = timestamp;
+        g_debug ("Learned from %u of %u WiFi APs, %u known",
+                 n_learned, n_bsss, g_hash_table_size (priv->learned));
+
+        learned_trim (db);
+        if (priv->save_timeout_id == 0)
+                priv->save_timeout_id = g_timeout_add_seconds (LEARN_SAVE_DELAY,
+                                                               on_save_timeout,
+                                                               db);
+}
+
+static gboolean
+same_file (const GStatBuf *a,
+           const GStatBuf *b)
+{
+        return a->st_dev == b->st_dev &&
+               a->st_ino == b->st_ino &&
+               a->st_size == b->st_size &&
+               a->st_mtime == b->st_mtime;
+}
+
+static char *
+get_verified_path (void)
+{
+        return g_build_filename (STATEDIR, VERIFIED_FILE_NAME, NULL);
+}
+
+static gboolean
+is_verified (const GStatBuf *stat_buf,
+             const guint8   *data)
+{
+        g_autofree char *path = get_verified_path ();
+        g_autofree char *contents = NULL;
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GVariant) digest = NULL;
+        guint64 dev, ino, size, mtime;
+        gconstpointer digest_data;
+        gsize length, digest_len;
+
+        if (!g_file_get_contents (path, &contents, &length, NULL))
+                return FALSE;
+
+        /* Not trusted either, malformed data gives default values */
+        variant = g_variant_new_from_data (G_VARIANT_TYPE (VERIFIED_TYPE),
+                                           contents,
+                                           length,
+                                           FALSE,
+                                           NULL,
+                                           NULL);
+        g_variant_get (variant, VERIFIED_TYPE, &dev, &ino, &size, &mtime, &digest);
+        digest_data = g_variant_get_fixed_array (digest, &digest_len, 1);
+
+        return dev == (guint64) stat_buf->st_dev &&
+               ino == (guint64) stat_buf->st_ino &&
+               size == (guint64) stat_buf->st_size &&
+               mtime == (guint64) stat_buf->st_mtime &&
+               digest_len == GCLUE_OFFLINE_DB_CHECKSUM_SIZE &&
+               memcmp (digest_data,
+                       data + GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE,
+                       GCLUE_OFFLINE_DB_CHECKSUM_SIZE) == 0;
+}
+
+static void
+set_verified (const GStatBuf *stat_buf,
+              const guint8   *data)
+{
+        g_autofree char *path = get_verified_path ();
+        g_autofree char *dir = NULL;
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GError) error = NULL;
+        GVariant *digest;
+
+        digest = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                            data + GCLUE_OFFLINE_DB_HEADER_CHECKED_SIZE,
+                                            GCLUE_OFFLINE_DB_CHECKSUM_SIZE,
+                                            1);
+        variant = g_variant_ref_sink (g_variant_new (VERIFIED_TYPE,
+                                                     (guint64) stat_buf->st_dev,
+                                                     (guint64) stat_buf->st_ino,
+                                                     (guint64) stat_buf->st_size,
+                                                     (guint64) stat_buf->st_mtime,
+                                                     digest));
+
+        dir = g_path_get_dirname (path);
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("Failed to create directory '%s': %s",
+                           dir, g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (path,
+                                       g_variant_get_data (variant),
+                                       g_variant_get_size (variant),
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600,
+                                       &error))
+                g_warning ("Failed to save '%s': %s", path, error->message);
+}
+
+static gboolean
+load_file (GClueOfflineDB *db,
+           const char     *path,
+           const GStatBuf *stat_buf,
+           GError        **error)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        g_autoptr(GMappedFile) file = NULL;
+        GClueOfflineDBHeader header;
+        const guint8 *data;
+        gboolean verified;
+        gsize size;
+
+        file = g_mapped_file_new (path, FALSE, error);
+        if (file == NULL)
+                return FALSE;
+
+        data = (const guint8 *) g_mapped_file_get_contents (file);
+        size = g_mapped_file_get_length (file);
+        verified = size >= GCLUE_OFFLINE_DB_HEADER_SIZE &&
+                   is_verified (stat_buf, data);
+        if (!gclue_offline_db_header_read (data, size, &header, !verified, error))
+                return FALSE;
+        if (!verified)
+                set_verified (stat_buf, data);
+
+        g_clear_pointer (&priv->file, g_mapped_file_unref);
+        priv->file = g_steal_pointer (&file);
+        priv->stat_buf = *stat_buf;
+        priv->header = header;
+        priv->wifi_records = data + header.wifi_offset;
+        priv->wifi_index = data + header.wifi_index_offset;
+        priv->cell_records = data + header.cell_offset;
+        priv->cell_index = data + header.cell_index_offset;
+
+        g_debug ("Loaded offline database '%s' with %u WiFi APs and %u cells",
+                 path, header.n_wifi, header.n_cells);
+
+        return TRUE;
+}
+
+/* Loads the database if the file has been replaced. */
+static void
+update_file (GClueOfflineDB *db,
+             const char     *path)
+{
+        GClueOfflineDBPrivate *priv = db->priv;
+        g_autoptr(GError) error = NULL;
+        GStatBuf stat_buf;
+
+        if (g_stat (path, &stat_buf) != 0) {
+                if (priv->file == NULL)
+                        g_warning ("Failed to load offline database '%s': %s",
+                                   path, g_strerror (errno));
+                return;
+        }
+
+        if ((priv->file != NULL && same_file (&priv->stat_buf, &stat_buf)) ||
+            same_file (&priv->rejected_stat, &stat_buf))
+                return;
+
+        if (!load_file (db, path, &stat_buf, &error)) {
+                g_warning ("Failed to load offline database '%s': %s%s",
+                           path, error->message,
+                           priv->file != NULL ? ", keeping the previous one" : "");
+                priv->rejected_stat = stat_buf;
+        }
+}
+
+static void
+gclue_offline_db_finalize (GObject *object)
+{
+        GClueOfflineDBPrivate *priv = GCLUE_OFFLINE_DB (object)->priv;
+
+        g_clear_handle_id (&priv->save_timeout_id, g_source_remove);
+        g_clear_pointer (&priv->learned, g_hash_table_unref);
+        g_clear_pointer (&priv->learned_path, g_free);
+        g_clear_pointer (&priv->file, g_mapped_file_unref);
+
+        G_OBJECT_CLASS (gclue_offline_db_parent_class)->finalize (object);
+}
+
+static void
+gclue_offline_db_init (GClueOfflineDB *db)
+{
+        db->priv = gclue_offline_db_get_instance_private (db);
+}
+
+static void
+gclue_offline_db_class_init (GClueOfflineDBClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gclue_offline_db_finalize;
+}
+
+/* Called when the last source using the database releases it, e.g. before
+ * the daemon exits for inactivity, which may well come before the delayed
+ * save. */
+static void
+on_toggle_ref (gpointer data,
+               GObject *object,
+               gboolean is_last_ref)
+{
+        GClueOfflineDB *db = GCLUE_OFFLINE_DB (object);
+
+        if (!is_last_ref || db->priv->save_timeout_id == 0)
+                return;
+
+        g_clear_handle_id (&db->priv->save_timeout_id, g_source_remove);
+        learned_save (db);
+}
+
+/**
+ * gclue_offline_db_get_singleton:
+ *
+ * The database is reloaded when the file has been replaced since it was last
+ * loaded. If the new file is invalid, the previous database stays in use.
+ *
+ * Returns: (transfer full) (nullable): the offline database, or %NULL if none
+ * is configured or could be loaded and learning is disabled.
+ **/
+GClueOfflineDB *
+gclue_offline_db_get_singleton (void)
+{
+        /* Not a weak reference: sources come and go with clients. A toggle
+         * reference, to save the learned APs once no source uses them
+         * anymore. */
+        static GClueOfflineDB *db = NULL;
+        GClueConfig *config;
+        const char *path;
+        gboolean learn;
+
+        config = gclue_config_get_singleton ();
+        path = gclue_config_get_wifi_offline_database (config);
+        learn = gclue_config_get_wifi_learn_locations (config);
+        if (path == NULL && !learn)
+                return NULL;
+
+        if (db == NULL) {
+                db = g_object_new (GCLUE_TYPE_OFFLINE_DB, NULL);
+                g_object_add_toggle_ref (G_OBJECT (db), on_toggle_ref, NULL);
+                g_object_unref (db);
+
+                if (learn) {
+                        db->priv->learned = g_hash_table_new_full (g_int64_hash,
+                                                                   g_int64_equal,
+                                                                   NULL,
+                                                                   g_free);
+                        db->priv->learned_path = g_build_filename (STATEDIR,
+                                                                   LEARNED_FILE_NAME,
+                                                                   NULL);
+                        learned_load (db);
+                }
+        }
+
+        if (path != NULL)
+                update_file (db, path);
+
+        if (db->priv->file == NULL && db->priv->learned == NULL)
+                return NULL;
+
+        return g_object_ref (db);
+}
@@ -0,0 +1,97 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_OFFLINE_DB_H
+#define GCLUE_OFFLINE_DB_H
+
+#include <glib-object.h>
+#include "gclue-location.h"
+#include "gclue-3g-tower.h"
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_OFFLINE_DB            (gclue_offline_db_get_type())
+#define GCLUE_OFFLINE_DB(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_OFFLINE_DB, GClueOfflineDB))
+#define GCLUE_OFFLINE_DB_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_OFFLINE_DB, GClueOfflineDBClass))
+#define GCLUE_IS_OFFLINE_DB(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_OFFLINE_DB))
+#define GCLUE_IS_OFFLINE_DB_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_OFFLINE_DB))
+#define GCLUE_OFFLINE_DB_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_OFFLINE_DB, GClueOfflineDBClass))
+
+typedef struct _GClueOfflineDB        GClueOfflineDB;
+typedef struct _GClueOfflineDBClass   GClueOfflineDBClass;
+typedef struct _GClueOfflineDBPrivate GClueOfflineDBPrivate;
+
+struct _GClueOfflineDB
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueOfflineDBPrivate *priv;
+};
+
+struct _GClueOfflineDBClass
+{
+        GObjectClass parent_class;
+};
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GClueOfflineDB, g_object_unref)
+
+#define GCLUE_OFFLINE_DB_BSSID_LEN 6
+
+/* A WiFi access point seen in a scan. */
+typedef struct {
+        guint8 bssid[GCLUE_OFFLINE_DB_BSSID_LEN];
+        gint16 signal; /* dBm */
+        guint age;     /* Seconds since it was last seen, only for learning */
+} GClueOfflineBss;
+
+/* The cell tower the modem is registered with. */
+typedef struct {
+        guint16 mcc;
+        guint16 mnc;
+        guint32 lac;
+        guint32 cell_id;
+        GClueTowerTec tec;
+} GClueOfflineCell;
+
+GType gclue_offline_db_get_type (void) G_GNUC_CONST;
+
+GClueOfflineDB *gclue_offline_db_get_singleton (void);
+
+GClueLocation *
+gclue_offline_db_locate (GClueOfflineDB         *db,
+                         const GClueOfflineBss  *bsss,
+                         guint                   n_bsss,
+                         const GClueOfflineCell *cell,
+                         GError                **error);
+
+gboolean
+gclue_offline_db_has_data (GClueOfflineDB *db);
+
+gboolean
+gclue_offline_db_should_learn (GClueOfflineDB *db,
+                               GClueLocation  *location);
+
+void
+gclue_offline_db_learn (GClueOfflineDB        *db,
+                        const GClueOfflineBss *bsss,
+                        guint                  n_bsss,
+                        GClueLocation         *location);
+
+G_END_DECLS
+
+#endif /* GCLUE_OFFLINE_DB_H */
@@ -30,6 +30,7 @@
 
 #define DEFAULT_ACCURACY_LEVEL GCLUE_ACCURACY_LEVEL_CITY
 #define DEFAULT_AGENT_STARTUP_WAIT_SECS 5
+#define MAX_BATCH_SIZE 1000
 
 static void
 gclue_service_client_client_iface_init (GClueDBusClientIface *iface);
@@ -53,6 +54,13 @@ struct _GClueServiceClientPrivate
         guint distance_threshold;
         guint time_threshold;
 
+        /* Locations waiting to be sent together */
+        GPtrArray *batch;
+        guint batch_timeout_id;
+
+        /* When the client was last started, i.e. authorized, in seconds */
+        guint64 start_time;
+
         GClueLocator *locator;
 
         /* Number of times location has been updated */
@@ -95,31 +103,173 @@ next_location_path (GClueServiceClient *client)
         return g_steal_pointer (&path);
 }
 
-/* We don't use the gdbus-codegen provided gclue_client_emit_location_updated()
- * as that sends the signal to all listeners on the bus
+/* We don't use the gdbus-codegen provided gclue_client_emit_*() functions
+ * as those send the signals to all listeners on the bus
  */
 static gboolean
-emit_location_updated (GClueServiceClient *client,
-                       const char         *old,
-                       const char         *new,
-                       GError            **error)
+emit_signal (GClueServiceClient *client,
+             const char         *signal_name,
+             GVariant           *parameters,
+             GError            **error)
 {
         GClueServiceClientPrivate *priv = client->priv;
-        GVariant *variant;
         const char *peer;
 
-        variant = g_variant_new ("(oo)", old, new);
         peer = gclue_client_info_get_bus_name (priv->client_info);
 
         return g_dbus_connection_emit_signal (priv->connection,
                                               peer,
                                               priv->path,
                                               "org.freedesktop.GeoClue2.Client",
-                                              "LocationUpdated",
-                                              variant,
+                                              signal_name,
+                                              parameters,
                                               error);
 }
 
+static gboolean
+emit_location_updated (GClueServiceClient *client,
+                       const char         *old,
+                       const char         *new,
+                       GError            **error)
+{
+        return emit_signal (client,
+                            "LocationUpdated",
+                            g_variant_new ("(oo)", old, new),
+                            error);
+}
+
+/* Same keys and values as the properties of the Location objects */
+static gboolean
+emit_inline_location_updated (GClueServiceClient *client,
+                              GClueLocation      *location,
+                              GError            **error)
+{
+        GVariantBuilder builder;
+        const char *description;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&builder, "{sv}", "Latitude",
+                               g_variant_new_double
+                                (gclue_location_get_latitude (location)));
+        g_variant_builder_add (&builder, "{sv}", "Longitude",
+                               g_variant_new_double
+                                (gclue_location_get_longitude (location)));
+        g_variant_builder_add (&builder, "{sv}", "Accuracy",
+                               g_variant_new_double
+                                (gclue_location_get_accuracy (location)));
+        g_variant_builder_add (&builder, "{sv}", "Altitude",
+                               g_variant_new_double
+                                (gclue_location_get_altitude (location)));
+        g_variant_builder_add (&builder, "{sv}", "Speed",
+                               g_variant_new_double
+                                (gclue_location_get_speed (location)));
+        g_variant_builder_add (&builder, "{sv}", "Heading",
+                               g_variant_new_double
+                                (gclue_location_get_heading (location)));
+        g_variant_builder_add (&builder, "{sv}", "Timestamp",
+                               g_variant_new ("(tt)",
+                                              (guint64) gclue_location_get_timestamp (location),
+                                              (guint64) 0));
+        description = gclue_location_get_description (location);
+        g_variant_builder_add (&builder, "{sv}", "Description",
+                               g_variant_new_string (description ? description : ""));
+
+        return emit_signal (client,
+                            "InlineLocationUpdated",
+                            g_variant_new ("(a{sv})", &builder),
+                            error);
+}
+
+static guint
+get_batch_size (GClueServiceClient *client)
+{
+        return MIN (gclue_dbus_client_get_batch_size (GCLUE_DBUS_CLIENT (client)),
+                    MAX_BATCH_SIZE);
+}
+
+static void
+flush_batch (GClueServiceClient *client)
+{
+        GClueServiceClientPrivate *priv = client->priv;
+        GVariantBuilder builder;
+        g_autoptr(GError) error = NULL;
+        guint i;
+
+        g_clear_handle_id (&priv->batch_timeout_id, g_source_remove);
+        if (priv->batch == NULL || priv->batch->len == 0)
+                return;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ddddddt)"));
+        for (i = 0; i < priv->batch->len; i++) {
+                GClueLocation *location = g_ptr_array_index (priv->batch, i);
+
+                g_variant_builder_add (&builder,
+                                       "(ddddddt)",
+                                       gclue_location_get_latitude (location),
+                                       gclue_location_get_longitude (location),
+                                       gclue_location_get_accuracy (location),
+                                       gclue_location_get_altitude (location),
+                                       gclue_location_get_speed (location),
+                                       gclue_location_get_heading (location),
+                                       (guint64) gclue_location_get_timestamp (location));
+        }
+        g_debug ("Sending batch of %u locations", priv->batch->len);
+        g_ptr_array_set_size (priv->batch, 0);
+
+        if (!emit_signal (client,
+                          "LocationsBatched",
+                          g_variant_new ("(a(ddddddt))", &builder),
+                          &error))
+                g_warning ("Failed to send location batch: %s",
+                           error->message);
+}
+
+static gboolean
+on_batch_timeout (gpointer user_data)
+{
+        GClueServiceClient *client = GCLUE_SERVICE_CLIENT (user_data);
+
+        client->priv->batch_timeout_id = 0;
+        flush_batch (client);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+add_to_batch (GClueServiceClient *client,
+              GClueLocation      *location)
+{
+        GClueServiceClientPrivate *priv = client->priv;
+        guint latency;
+
+        /* Locations are shared, so there is no copy */
+        if (priv->batch == NULL)
+                priv->batch = g_ptr_array_new_full
+                        (get_batch_size (client),
+                         (GDestroyNotify) gclue_location_unref);
+        g_ptr_array_add (priv->batch, gclue_location_ref (location));
+
+        if (priv->batch->len >= get_batch_size (client)) {
+                flush_batch (client);
+                return;
+        }
+
+        latency = gclue_dbus_client_get_batch_latency (GCLUE_DBUS_CLIENT (client));
+        if (priv->batch_timeout_id == 0 && latency > 0)
+                priv->batch_timeout_id = g_timeout_add_seconds
+                        (latency, on_batch_timeout, client);
+}
+
+static void
+clear_batch (GClueServiceClient *client)
+{
+        GClueServiceClientPrivate *priv = client->priv;
+
+        g_clear_handle_id (&priv->batch_timeout_id, g_source_remove);
+        if (priv->batch != NULL)
+                g_ptr_array_set_size (priv->batch, 0);
+}
+
 static gboolean
 distance_below_threshold (GClueServiceClient *client,
                           GClueLocation      *location)
@@ -184,6 +334,32 @@ below_threshold (GClueServiceClient *client,
                 time_below_threshold (client, location));
 }
 
+/* Updates the exported location object instead of replacing it, for clients
+ * that asked for it */
+static void
+update_location_in_place (GClueServiceClient *client,
+                          GClueLocation      *new_location)
+{
+        GClueServiceClientPrivate *priv = client->priv;
+        g_autoptr(GError) error = NULL;
+        const char *path;
+
+        g_object_set (priv->location,
+                      "location", new_location,
+                      NULL);
+        /* Clients read the new values when they get the signal */
+        g_dbus_interface_skeleton_flush
+                (G_DBUS_INTERFACE_SKELETON (priv->location));
+
+        g_clear_pointer (&priv->signaled_location, gclue_location_unref);
+        priv->signaled_location = gclue_location_ref (new_location);
+
+        path = gclue_service_location_get_path (priv->location);
+        if (!emit_location_updated (client, path, path, &error))
+                g_warning ("Failed to update location info: %s",
+                           error->message);
+}
+
 static gboolean
 on_prev_location_timeout (gpointer user_data)
 {
@@ -209,6 +385,30 @@ on_locator_location_changed (GObject    *gobject,
         if (new_location == NULL)
                 return; /* No location found yet */
 
+        if (get_batch_size (client) > 0) {
+                if (below_threshold (client, new_location))
+                        return;
+
+                g_clear_pointer (&priv->signaled_location, gclue_location_unref);
+                priv->signaled_location = gclue_location_ref (new_location);
+                add_to_batch (client, new_location);
+
+                return;
+        }
+
+        if (gclue_dbus_client_get_inline_location (GCLUE_DBUS_CLIENT (client))) {
+                if (below_threshold (client, new_location))
+                        return;
+
+                g_clear_pointer (&priv->signaled_location, gclue_location_unref);
+                priv->signaled_location = gclue_location_ref (new_location);
+
+                if (!emit_inline_location_updated (client, new_location, &error))
+                        goto error_out;
+
+                return;
+        }
+
         if (priv->location != NULL && below_threshold (client, new_location)) {
                 g_debug ("Updating location, below threshold");
                 g_object_set (priv->location,
@@ -217,6 +417,12 @@ on_locator_location_changed (GObject    *gobject,
                 return;
         }
 
+        if (priv->location != NULL &&
+            gclue_dbus_client_get_reuse_location (GCLUE_DBUS_CLIENT (client))) {
+                update_location_in_place (client, new_location);
+                return;
+        }
+
         if (priv->prev_location != NULL)
                 // Lets try to ensure that apps are not still accessing the
                 // last location before unrefing (and therefore destroying) it.
@@ -239,8 +445,8 @@ on_locator_location_changed (GObject    *gobject,
 
         gclue_dbus_client_set_location (GCLUE_DBUS_CLIENT (client), path);
 
-        g_clear_object (&priv->signaled_location);
-        priv->signaled_location = g_object_ref (new_location);
+        g_clear_pointer (&priv->signaled_location, gclue_location_unref);
+        priv->signaled_location = gclue_location_ref (new_location);
 
         if (!emit_location_updated (client, prev_path, path, &error))
                 goto error_out;
@@ -257,6 +463,7 @@ start_client (GClueServiceClient *client, GClueAccuracyLevel accuracy_level)
         GClueServiceClientPrivate *priv = client->priv;
 
         gclue_dbus_client_set_active (GCLUE_DBUS_CLIENT (client), TRUE);
+        priv->start_time = g_get_real_time () / G_USEC_PER_SEC;
         priv->locator = gclue_locator_new (accuracy_level);
         gclue_locator_set_time_threshold (priv->locator, priv->time_threshold);
         g_signal_connect_object (priv->locator,
@@ -270,6 +477,7 @@ start_client (GClueServiceClient *client, GClueAccuracyLevel accuracy_level)
 static void
 stop_client (GClueServiceClient *client)
 {
+        clear_batch (client);
         g_clear_object (&client->priv->locator);
         gclue_dbus_client_set_active (GCLUE_DBUS_CLIENT (client), FALSE);
 }
@@ -625,6 +833,8 @@ static gboolean
 gclue_service_client_handle_stop (GClueDBusClient       *client,
                                   GDBusMethodInvocation *invocation)
 {
+        /* The client asked for it, so it still gets what was collected */
+        flush_batch (GCLUE_SERVICE_CLIENT (client));
         stop_client (GCLUE_SERVICE_CLIENT (client));
         gclue_dbus_client_complete_stop (client, invocation);
         g_debug ("'%s' stopped.", gclue_dbus_client_get_desktop_id (client));
@@ -632,6 +842,54 @@ gclue_service_client_handle_stop (GClueDBusClient       *client,
         return TRUE;
 }
 
+static gboolean
+gclue_service_client_handle_get_history (GClueDBusClient       *client,
+                                         GDBusMethodInvocation *invocation,
+                                         guint64                since,
+                                         guint                  max_locations)
+{
+        GClueServiceClientPrivate *priv = GCLUE_SERVICE_CLIENT (client)->priv;
+        g_autoptr(GArray) history = NULL;
+        GVariantBuilder builder;
+        guint i;
+
+        /* Only authorized clients have a locator */
+        if (priv->locator == NULL) {
+                g_dbus_method_invocation_return_error_literal (invocation,
+                                                               G_DBUS_ERROR,
+                                                               G_DBUS_ERROR_ACCESS_DENIED,
+                                                               "Client not started");
+                return TRUE;
+        }
+
+        /* The history is shared with other applications, which may have
+         * been allowed to locate the device when this one wasn't */
+        history = gclue_locator_get_history (priv->locator,
+                                             MAX (since, priv->start_time),
+                                             max_locations);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ddddddt)"));
+        for (i = 0; i < history->len; i++) {
+                GClueLocatorHistoryEntry *entry;
+
+                entry = &g_array_index (history, GClueLocatorHistoryEntry, i);
+                g_variant_builder_add (&builder,
+                                       "(ddddddt)",
+                                       entry->latitude,
+                                       entry->longitude,
+                                       entry->accuracy,
+                                       entry->altitude,
+                                       entry->speed,
+                                       entry->heading,
+                                       entry->timestamp);
+        }
+        gclue_dbus_client_complete_get_history (client,
+                                                invocation,
+                                                g_variant_builder_end (&builder));
+
+        return TRUE;
+}
+
 static void
 gclue_service_client_finalize (GObject *object)
 {
@@ -650,7 +908,9 @@ gclue_service_client_finalize (GObject *object)
         g_clear_object (&priv->locator);
         g_clear_object (&priv->location);
         g_clear_object (&priv->prev_location);
-        g_clear_object (&priv->signaled_location);
+        g_clear_pointer (&priv->signaled_location, gclue_location_unref);
+        g_clear_handle_id (&priv->batch_timeout_id, g_source_remove);
+        g_clear_pointer (&priv->batch, g_ptr_array_unref);
         g_clear_object (&priv->client_info);
 
         /* Chain up to the parent class */
@@ -837,6 +1097,14 @@ gclue_service_client_handle_set_property (GDBusConnection *connection,
                 g_debug ("%s: New time-threshold:  %u",
                          G_OBJECT_TYPE_NAME (client),
                          priv->time_threshold);
+        } else if (ret && (strcmp (property_name, "BatchSize") == 0 ||
+                           strcmp (property_name, "BatchLatency") == 0)) {
+                /* Deliver what was collected under the previous settings */
+                flush_batch (GCLUE_SERVICE_CLIENT (client));
+                g_debug ("%s: New batch size %u, latency %u s",
+                         G_OBJECT_TYPE_NAME (client),
+                         gclue_dbus_client_get_batch_size (client),
+                         gclue_dbus_client_get_batch_latency (client));
         }
 
         return ret;
@@ -916,6 +1184,7 @@ gclue_service_client_client_iface_init (GClueDBusClientIface *iface)
 {
         iface->handle_start = gclue_service_client_handle_start;
         iface->handle_stop = gclue_service_client_handle_stop;
+        iface->handle_get_history = gclue_service_client_handle_get_history;
 }
 
 static gboolean
@@ -109,7 +109,7 @@ gclue_service_location_get_property (GObject    *object,
                          sec,
                          gclue_dbus_location_get_description (location));
 
-                g_value_take_object (value, loc);
+                g_value_take_boxed (value, loc);
                 break;
         }
 
@@ -143,11 +143,10 @@ gclue_service_location_set_property (GObject      *object,
         {
                 GClueDBusLocation *location;
                 GClueLocation *loc;
-                gdouble altitude;
                 GVariant *timestamp;
 
                 location = GCLUE_DBUS_LOCATION (object);
-                loc = g_value_get_object (value);
+                loc = g_value_get_boxed (value);
                 gclue_dbus_location_set_latitude
                         (location, gclue_location_get_latitude (loc));
                 gclue_dbus_location_set_longitude
@@ -166,9 +165,9 @@ gclue_service_location_set_property (GObject      *object,
                          (guint64) 0);
                 gclue_dbus_location_set_timestamp
                         (location, timestamp);
-                altitude = gclue_location_get_altitude (loc);
-                if (altitude != GCLUE_LOCATION_ALTITUDE_UNKNOWN)
-                        gclue_dbus_location_set_altitude (location, altitude);
+                /* Also when unknown, the location may be updated in place */
+                gclue_dbus_location_set_altitude
+                        (location, gclue_location_get_altitude (loc));
                 break;
         }
 
@@ -335,11 +334,11 @@ gclue_service_location_class_init (GClueServiceLocationClass *klass)
                                          PROP_CONNECTION,
                                          gParamSpecs[PROP_CONNECTION]);
 
-        gParamSpecs[PROP_LOCATION] = g_param_spec_object ("location",
-                                                          "Location",
-                                                          "Location",
-                                                          GCLUE_TYPE_LOCATION,
-                                                          G_PARAM_READWRITE);
+        gParamSpecs[PROP_LOCATION] = g_param_spec_boxed ("location",
+                                                         "Location",
+                                                         "Location",
+                                                         GCLUE_TYPE_LOCATION,
+                                                         G_PARAM_READWRITE);
         g_object_class_install_property (object_class,
                                          PROP_LOCATION,
                                          gParamSpecs[PROP_LOCATION]);
@@ -32,6 +32,7 @@
 #include "gclue-enums.h"
 #include "gclue-locator.h"
 #include "gclue-config.h"
+#include "gclue-wifi.h"
 
 static void
 gclue_service_manager_manager_iface_init (GClueDBusManagerIface *iface);
@@ -89,6 +90,7 @@ log_client_list (gpointer user_data)
         g_message ("SIGUSR1 received, printing client list:");
         if (!manager->priv->clients) {
                 g_message ("    (No clients)");
+                gclue_wifi_log_cache_usage ();
                 return G_SOURCE_CONTINUE;
         }
         g_message ("    System  Active  UID     Id");
@@ -108,6 +110,7 @@ log_client_list (gpointer user_data)
                 active = gclue_dbus_client_get_active (dbus_client) ? y : n;
                 g_message ("    %s       %s       %-7d %s", system, active, uid, id);
         }
+        gclue_wifi_log_cache_usage ();
         return G_SOURCE_CONTINUE;
 }
 
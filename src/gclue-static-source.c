@@ -179,7 +179,7 @@ close_file_clear_location (GClueStaticSource *source)
                 return;
 
         g_debug ("Static source clearing location");
-        g_clear_object (&priv->location);
+        g_clear_pointer (&priv->location, gclue_location_unref);
         location_updated (source);
 }
 
@@ -193,7 +193,7 @@ gclue_static_source_finalize (GObject *gstatic)
 
         close_file (source);
 
-        g_clear_object (&priv->location);
+        g_clear_pointer (&priv->location, gclue_location_unref);
         g_clear_handle_id (&priv->location_set_timer, g_source_remove);
 
         g_clear_object (&priv->monitor);
@@ -306,7 +306,7 @@ on_line_read (GObject *object,
         close_file (source);
 
         g_debug ("Static source read a new location");
-        g_clear_object (&priv->location);
+        g_clear_pointer (&priv->location, gclue_location_unref);
         priv->location = gclue_location_new_full (priv->latitude,
                                                   priv->longitude,
                                                   accuracy,
@@ -0,0 +1,462 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <config.h>
+#include "gclue-submit-spool.h"
+#include "gclue-mozilla.h"
+#include "gclue-http.h"
+
+/**
+ * SECTION:gclue-submit-spool
+ * @short_description: Queue of pending location submissions
+ *
+ * Keeps the geosubmit items created from GPS locations until they can be
+ * sent, so that none are lost while the network is unavailable. Items are
+ * sent in batches of several items per request rather than as they come,
+ * so the modem isn't woken up and a connection isn't set up for each of
+ * them. Failed requests are retried with exponential backoff, except
+ * for those the server rejected as invalid, which are dropped.
+ *
+ * The queue is shared by all sources and is kept in the state directory, one
+ * JSON item per line, so that it survives restarts of the service.
+ **/
+
+#define SPOOL_FILE_NAME "submission-spool"
+/* Oldest items are dropped beyond this */
+#define SPOOL_MAX_ITEMS 1000
+#define SPOOL_MAX_AGE (7 * 24 * 60 * 60) /* seconds */
+/* Send once there are this many items, or the oldest is this old */
+#define SPOOL_BATCH_SIZE 10
+#define SPOOL_BATCH_MAX_DELAY (15 * 60) /* seconds */
+#define SPOOL_MAX_ITEMS_PER_REQUEST 100
+#define SPOOL_RETRY_MIN_DELAY 60 /* seconds */
+#define SPOOL_RETRY_MAX_DELAY (60 * 60) /* seconds */
+
+typedef struct {
+        char *json;
+        guint64 timestamp; /* of the location, in seconds */
+} SpoolItem;
+
+struct _GClueSubmitSpoolPrivate
+{
+        GQueue items; /* SpoolItem, oldest first */
+        char *path;
+
+        char *url;
+        /* Items at the head of the queue being sent, kept there until the
+         * request is done */
+        guint n_sending;
+        guint retry_timeout_id;
+        guint retry_delay;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GClueSubmitSpool,
+                         gclue_submit_spool,
+                         G_TYPE_OBJECT,
+                         G_ADD_PRIVATE (GClueSubmitSpool))
+
+static void send_items (GClueSubmitSpool *spool, gboolean force);
+
+static void
+spool_item_free (SpoolItem *item)
+{
+        g_free (item->json);
+        g_free (item);
+}
+
+static void
+spool_drop_head (GClueSubmitSpool *spool,
+                 guint             n_items)
+{
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+        guint i;
+
+        for (i = 0; i < n_items; i++)
+                spool_item_free (g_queue_pop_head (&priv->items));
+}
+
+/* Items being sent are left alone, they are trimmed once the request is
+ * done if it failed. */
+static void
+spool_trim (GClueSubmitSpool *spool)
+{
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+        guint64 cutoff = g_get_real_time () / G_USEC_PER_SEC - SPOOL_MAX_AGE;
+        guint n_dropped = 0;
+
+        while (priv->items.length > priv->n_sending) {
+                SpoolItem *item = g_queue_peek_nth (&priv->items,
+                                                    priv->n_sending);
+
+                if (priv->items.length <= SPOOL_MAX_ITEMS &&
+                    item->timestamp >= cutoff)
+                        break;
+
+                spool_item_free (g_queue_pop_nth (&priv->items,
+                                                  priv->n_sending));
+                n_dropped++;
+        }
+
+        if (n_dropped > 0)
+                g_debug ("Dropped %u unsent location submissions", n_dropped);
+}
+
+static void
+spool_save (GClueSubmitSpool *spool)
+{
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+        g_autoptr(GString) data = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *dir = NULL;
+        GList *l;
+
+        if (priv->items.length == 0) {
+                if (g_unlink (priv->path) < 0 && errno != ENOENT)
+                        g_warning ("Failed to remove '%s': %s",
+                                   priv->path, g_strerror (errno));
+                return;
+        }
+
+        data = g_string_new (NULL);
+        for (l = priv->items.head; l != NULL; l = l->next) {
+                SpoolItem *item = l->data;
+
+                g_string_append (data, item->json);
+                g_string_append_c (data, '\n');
+        }
+
+        dir = g_path_get_dirname (priv->path);
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("Failed to create directory '%s': %s",
+                           dir, g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (priv->path,
+                                       data->str,
+                                       data->len,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600,
+                                       &error))
+                g_warning ("Failed to save pending location submissions: %s",
+                           error->message);
+}
+
+static gboolean
+spool_append (GClueSubmitSpool *spool,
+              JsonNode         *node,
+              const char       *json)
+{
+        JsonObject *object;
+        SpoolItem *item;
+
+        if (!JSON_NODE_HOLDS_OBJECT (node))
+                return FALSE;
+
+        object = json_node_get_object (node);
+        if (!json_object_has_member (object, "timestamp"))
+                return FALSE;
+
+        item = g_new0 (SpoolItem, 1);
+        item->json = g_strdup (json);
+        item->timestamp = json_object_get_int_member (object, "timestamp") / 1000;
+        g_queue_push_tail (&spool->priv->items, item);
+
+        return TRUE;
+}
+
+static void
+spool_load (GClueSubmitSpool *spool)
+{
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+        g_autoptr(JsonParser) parser = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        guint i, n_invalid = 0;
+
+        if (!g_file_get_contents (priv->path, &contents, NULL, &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load pending location submissions: %s",
+                                   error->message);
+                return;
+        }
+
+        parser = json_parser_new ();
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+                if (lines[i][0] == '\0')
+                        continue;
+
+                if (!json_parser_load_from_data (parser, lines[i], -1, NULL) ||
+                    !spool_append (spool, json_parser_get_root (parser), lines[i]))
+                        n_invalid++;
+        }
+
+        if (n_invalid > 0)
+                g_warning ("Ignored %u invalid entries in '%s'",
+                           n_invalid, priv->path);
+        spool_trim (spool);
+
+        g_debug ("Loaded %u pending location submissions", priv->items.length);
+}
+
+static gboolean
+on_retry_timeout (gpointer user_data)
+{
+        GClueSubmitSpool *spool = GCLUE_SUBMIT_SPOOL (user_data);
+
+        spool->priv->retry_timeout_id = 0;
+        send_items (spool, TRUE);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_retry (GClueSubmitSpool *spool)
+{
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+
+        if (priv->retry_delay == 0)
+                priv->retry_delay = SPOOL_RETRY_MIN_DELAY;
+        else
+                priv->retry_delay = MIN (priv->retry_delay * 2,
+                                         SPOOL_RETRY_MAX_DELAY);
+
+        g_debug ("Retrying location submission in %u seconds",
+                 priv->retry_delay);
+        g_clear_handle_id (&priv->retry_timeout_id, g_source_remove);
+        priv->retry_timeout_id = g_timeout_add_seconds (priv->retry_delay,
+                                                        on_retry_timeout,
+                                                        spool);
+}
+
+/* Client errors other than timeouts and rate limiting mean the items would
+ * be rejected again. */
+static gboolean
+status_is_final (guint status)
+{
+        return status >= 400 && status < 500 &&
+               status != SOUP_STATUS_REQUEST_TIMEOUT &&
+               status != 429; /* Too Many Requests */
+}
+
+static void
+submit_query_callback (SoupSession  *session,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+        g_autoptr(GClueSubmitSpool) spool = GCLUE_SUBMIT_SPOOL (user_data);
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+        g_autoptr(GBytes) body = NULL;
+        g_autoptr(GError) local_error = NULL;
+        g_autofree char *contents = NULL;
+        g_autofree char *uri_str = NULL;
+        SoupMessage *query;
+        guint n_sent, status;
+
+        n_sent = priv->n_sending;
+        priv->n_sending = 0;
+
+        query = soup_session_get_async_result_message (session, result);
+        uri_str = g_uri_to_string (soup_message_get_uri (query));
+
+        body = soup_session_send_and_read_finish (session, result, &local_error);
+        if (!body) {
+                g_warning ("Failed to submit location data to '%s' (no body): %s",
+                           uri_str, local_error->message);
+                spool_trim (spool);
+                schedule_retry (spool);
+                return;
+        }
+        contents = g_strndup (g_bytes_get_data (body, NULL), g_bytes_get_size (body));
+
+        status = soup_message_get_status (query);
+        if (status_is_final (status)) {
+                g_warning ("Location data rejected by '%s': %s, dropping %u locations",
+                           uri_str, soup_message_get_reason_phrase (query), n_sent);
+        } else if (!gclue_mozilla_parse_submit_response (contents,
+                                                         status,
+                                                         &local_error)) {
+                g_warning ("Failed to submit location data to '%s': %s",
+                           uri_str, soup_message_get_reason_phrase (query));
+                spool_trim (spool);
+                schedule_retry (spool);
+                return;
+        } else {
+                g_debug ("Successfully submitted %u locations to '%s'",
+                         n_sent, uri_str);
+        }
+        priv->retry_delay = 0;
+
+        spool_drop_head (spool, n_sent);
+        spool_save (spool);
+
+        /* Whatever is left was due along with what was just sent */
+        send_items (spool, TRUE);
+}
+
+static void
+send_items (GClueSubmitSpool *spool,
+            gboolean          force)
+{
+        GClueSubmitSpoolPrivate *priv = spool->priv;
+        g_autoptr(SoupSession) session = NULL;
+        g_autoptr(SoupMessage) query = NULL;
+        g_autofree const char **items = NULL;
+        guint n_items, i;
+        GList *l;
+
+        if (priv->n_sending > 0 || priv->retry_timeout_id != 0 ||
+            priv->items.length == 0 || priv->url == NULL)
+                return;
+
+        if (!force) {
+                SpoolItem *oldest = g_queue_peek_head (&priv->items);
+                guint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+                if (priv->items.length < SPOOL_BATCH_SIZE &&
+                    now < oldest->timestamp + SPOOL_BATCH_MAX_DELAY)
+                        return;
+        }
+
+        n_items = MIN (priv->items.length, SPOOL_MAX_ITEMS_PER_REQUEST);
+        items = g_new (const char *, n_items);
+        for (i = 0, l = priv->items.head; i < n_items; i++, l = l->next)
+                items[i] = ((SpoolItem *) l->data)->json;
+
+        query = gclue_mozilla_create_submit_query (priv->url, items, n_items);
+        priv->n_sending = n_items;
+        session = gclue_http_get_session ();
+        soup_session_send_and_read_async (session,
+                                          query,
+                                          G_PRIORITY_DEFAULT,
+                                          NULL,
+                                          (GAsyncReadyCallback) submit_query_callback,
+                                          g_object_ref (spool));
+}
+
+/**
+ * gclue_submit_spool_add:
+ * @spool: a #GClueSubmitSpool
+ * @item: an item of a geosubmit v2 request
+ *
+ * Queues @item, it is sent by a later gclue_submit_spool_flush().
+ **/
+void
+gclue_submit_spool_add (GClueSubmitSpool *spool,
+                        JsonNode         *item)
+{
+        g_autoptr(JsonGenerator) generator = NULL;
+        g_autofree char *json = NULL;
+
+        g_return_if_fail (GCLUE_IS_SUBMIT_SPOOL (spool));
+
+        generator = json_generator_new ();
+        json_generator_set_root (generator, item);
+        json = json_generator_to_data (generator, NULL);
+
+        if (!spool_append (spool, item, json)) {
+                g_warning ("Ignoring invalid location submission");
+                return;
+        }
+
+        spool_trim (spool);
+        spool_save (spool);
+}
+
+/**
+ * gclue_submit_spool_flush:
+ * @spool: a #GClueSubmitSpool
+ * @url: the geosubmit v2 URL
+ * @force: whether to send all pending items now, e.g. as the network has
+ * just become available
+ *
+ * Sends pending items to @url if enough of them have accumulated, or
+ * regardless with @force. Also cancels the backoff of failed requests with
+ * @force.
+ **/
+void
+gclue_submit_spool_flush (GClueSubmitSpool *spool,
+                          const char       *url,
+                          gboolean          force)
+{
+        GClueSubmitSpoolPrivate *priv;
+
+        g_return_if_fail (GCLUE_IS_SUBMIT_SPOOL (spool));
+        g_return_if_fail (url != NULL);
+
+        priv = spool->priv;
+        if (g_strcmp0 (priv->url, url) != 0) {
+                g_free (priv->url);
+                priv->url = g_strdup (url);
+        }
+
+        if (force)
+                g_clear_handle_id (&priv->retry_timeout_id, g_source_remove);
+
+        send_items (spool, force);
+}
+
+static void
+gclue_submit_spool_finalize (GObject *object)
+{
+        GClueSubmitSpoolPrivate *priv = GCLUE_SUBMIT_SPOOL (object)->priv;
+
+        /* Everything is already saved */
+        g_clear_handle_id (&priv->retry_timeout_id, g_source_remove);
+        g_queue_clear_full (&priv->items, (GDestroyNotify) spool_item_free);
+        g_clear_pointer (&priv->url, g_free);
+        g_clear_pointer (&priv->path, g_free);
+
+        G_OBJECT_CLASS (gclue_submit_spool_parent_class)->finalize (object);
+}
+
+static void
+gclue_submit_spool_init (GClueSubmitSpool *spool)
+{
+        spool->priv = gclue_submit_spool_get_instance_private (spool);
+
+        g_queue_init (&spool->priv->items);
+        spool->priv->path = g_build_filename (STATEDIR, SPOOL_FILE_NAME, NULL);
+        spool_load (spool);
+}
+
+static void
+gclue_submit_spool_class_init (GClueSubmitSpoolClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gclue_submit_spool_finalize;
+}
+
+GClueSubmitSpool *
+gclue_submit_spool_get_singleton (void)
+{
+        static GClueSubmitSpool *spool = NULL;
+
+        if (!spool) {
+                spool = g_object_new (GCLUE_TYPE_SUBMIT_SPOOL, NULL);
+                g_object_add_weak_pointer (G_OBJECT (spool), (gpointer) &spool);
+        } else
+                g_object_ref (spool);
+
+        return spool;
+}
@@ -0,0 +1,66 @@
+/* vim: set et ts=8 sw=8: */
+/*
+ * Geoclue is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * Geoclue is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with Geoclue; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef GCLUE_SUBMIT_SPOOL_H
+#define GCLUE_SUBMIT_SPOOL_H
+
+#include <glib-object.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+#define GCLUE_TYPE_SUBMIT_SPOOL            (gclue_submit_spool_get_type())
+#define GCLUE_SUBMIT_SPOOL(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), GCLUE_TYPE_SUBMIT_SPOOL, GClueSubmitSpool))
+#define GCLUE_SUBMIT_SPOOL_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  GCLUE_TYPE_SUBMIT_SPOOL, GClueSubmitSpoolClass))
+#define GCLUE_IS_SUBMIT_SPOOL(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GCLUE_TYPE_SUBMIT_SPOOL))
+#define GCLUE_IS_SUBMIT_SPOOL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  GCLUE_TYPE_SUBMIT_SPOOL))
+#define GCLUE_SUBMIT_SPOOL_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  GCLUE_TYPE_SUBMIT_SPOOL, GClueSubmitSpoolClass))
+
+typedef struct _GClueSubmitSpool        GClueSubmitSpool;
+typedef struct _GClueSubmitSpoolClass   GClueSubmitSpoolClass;
+typedef struct _GClueSubmitSpoolPrivate GClueSubmitSpoolPrivate;
+
+struct _GClueSubmitSpool
+{
+        GObject parent;
+
+        /*< private >*/
+        GClueSubmitSpoolPrivate *priv;
+};
+
+struct _GClueSubmitSpoolClass
+{
+        GObjectClass parent_class;
+};
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GClueSubmitSpool, g_object_unref)
+
+GType gclue_submit_spool_get_type (void) G_GNUC_CONST;
+
+GClueSubmitSpool *gclue_submit_spool_get_singleton (void);
+
+void
+gclue_submit_spool_add   (GClueSubmitSpool *spool,
+                          JsonNode         *item);
+void
+gclue_submit_spool_flush (GClueSubmitSpool *spool,
+                          const char       *url,
+                          gboolean          force);
+
+G_END_DECLS
+
+#endif /* GCLUE_SUBMIT_SPOOL_H */
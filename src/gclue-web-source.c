@@ -28,6 +28,8 @@
 #include "gclue-error.h"
 #include "gclue-location.h"
 #include "gclue-mozilla.h"
+#include "gclue-submit-spool.h"
+#include "gclue-http.h"
 #include "config.h"
 
 /**
@@ -43,10 +45,12 @@ struct _GClueWebSourcePrivate {
 
         GClueAccuracyLevel accuracy_level;
 
-        SoupSession *soup_session;
+        GClueOfflineDB *offline_db;
+        GClueSubmitSpool *submit_spool;
 
-        SoupMessage *query;
         const char *query_data_description;
+        guint64 n_queries;
+        guint64 last_applied_query;
 
         gulong network_changed_id;
         gulong connectivity_changed_id;
@@ -58,6 +62,7 @@ struct _GClueWebSourcePrivate {
         gboolean locate_url_reachable;
         gboolean submit_url_reachable;
         gboolean refresh_needed;
+        gboolean location_from_cache;
 };
 
 enum
@@ -73,7 +78,20 @@ G_DEFINE_ABSTRACT_TYPE_WITH_CODE (GClueWebSource,
                                   GCLUE_TYPE_LOCATION_SOURCE,
                                   G_ADD_PRIVATE (GClueWebSource))
 
-static void refresh_callback (SoupSession  *session,
+typedef struct {
+        SoupMessage *query;
+        const char *query_data_description;
+        guint64 serial;
+} RefreshData;
+
+static void
+refresh_data_free (RefreshData *data)
+{
+        g_clear_object (&data->query);
+        g_free (data);
+}
+
+static void refresh_callback (GObject      *source_object,
                               GAsyncResult *result,
                               gpointer      user_data);
 
@@ -83,8 +101,10 @@ gclue_web_source_real_refresh_async (GClueWebSource      *source,
                                      GAsyncReadyCallback  callback,
                                      gpointer             user_data)
 {
+        GClueWebSourceClass *klass = GCLUE_WEB_SOURCE_GET_CLASS (source);
         g_autoptr(GTask) task = NULL;
         g_autoptr(GError) local_error = NULL;
+        RefreshData *data;
 
         task = g_task_new (source, cancellable, callback, user_data);
         g_task_set_source_tag (task, gclue_web_source_real_refresh_async);
@@ -97,40 +117,58 @@ gclue_web_source_real_refresh_async (GClueWebSource      *source,
                 return;
         }
 
+        if (source->priv->offline_db != NULL) {
+                g_autoptr(GClueLocation) location = NULL;
+
+                location = klass->locate_offline (source,
+                                                  source->priv->offline_db,
+                                                  &local_error);
+                if (location != NULL) {
+                        gclue_location_source_set_location
+                                (GCLUE_LOCATION_SOURCE (source), location);
+                        g_task_return_pointer (task,
+                                               g_steal_pointer (&location),
+                                               (GDestroyNotify) gclue_location_unref);
+                        return;
+                }
+
+                g_debug ("Offline lookup failed: %s", local_error->message);
+                g_clear_error (&local_error);
+        }
+
         if (!source->priv->locate_url_reachable) {
                 g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NETWORK_UNREACHABLE,
                                          "Cannot reach locate URL");
                 return;
         }
 
-        if (source->priv->query != NULL) {
-                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_PENDING,
-                                         "Refresh already in progress");
-                return;
-        }
+        /* Refreshes may overlap, each keeps its own query. Identical
+         * ones share a single request. */
+        data = g_new0 (RefreshData, 1);
+        g_task_set_task_data (task, data, (GDestroyNotify) refresh_data_free);
 
-        source->priv->query = GCLUE_WEB_SOURCE_GET_CLASS (source)->create_query
-                (source, &source->priv->query_data_description, &local_error);
-        if (source->priv->query == NULL) {
+        data->query = klass->create_query
+                (source, &data->query_data_description, &local_error);
+        if (data->query == NULL) {
                 g_task_return_error (task, g_steal_pointer (&local_error));
                 return;
         }
+        data->serial = ++source->priv->n_queries;
 
-        soup_session_send_and_read_async (source->priv->soup_session,
-                                          source->priv->query,
-                                          G_PRIORITY_DEFAULT,
-                                          cancellable,
-                                          (GAsyncReadyCallback)refresh_callback,
-                                          g_steal_pointer (&task));
+        gclue_http_query_send_async (data->query,
+                                     cancellable,
+                                     refresh_callback,
+                                     g_steal_pointer (&task));
 }
 
 static void
-refresh_callback (SoupSession  *session,
+refresh_callback (GObject      *source_object,
                   GAsyncResult *result,
                   gpointer      user_data)
 {
         g_autoptr(GTask) task = g_steal_pointer (&user_data);
         GClueWebSource *web;
+        RefreshData *data;
         g_autoptr(SoupMessage) query = NULL;
         g_autoptr(GBytes) body = NULL;
         g_autoptr(GError) local_error = NULL;
@@ -141,9 +179,9 @@ refresh_callback (SoupSession  *session,
         GUri *uri;
 
         web = GCLUE_WEB_SOURCE (g_task_get_source_object (task));
-        query = g_steal_pointer (&web->priv->query);
+        data = g_task_get_task_data (task);
 
-        body = soup_session_send_and_read_finish (session, result, &local_error);
+        body = gclue_http_query_send_finish (result, &query, &local_error);
         if (!body) {
                 g_task_return_error (task, g_steal_pointer (&local_error));
                 return;
@@ -162,6 +200,9 @@ refresh_callback (SoupSession  *session,
         short_contents = g_strndup (contents, 256);
         g_debug ("Got a response of %" G_GSIZE_FORMAT " bytes from '%s' starting with:\n%s",
                  strlen(contents), str, short_contents);
+
+        /* Describes the data of this query, not of the latest one */
+        web->priv->query_data_description = data->query_data_description;
         location = GCLUE_WEB_SOURCE_GET_CLASS (web)->parse_response (web,
                                                                      contents,
                                                                      &local_error);
@@ -170,10 +211,17 @@ refresh_callback (SoupSession  *session,
                 return;
         }
 
-        gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (web),
-                                            location);
+        /* Don't go back to an older location if responses come out of order */
+        if (data->serial > web->priv->last_applied_query) {
+                web->priv->last_applied_query = data->serial;
+                web->priv->location_from_cache = FALSE;
+                gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (web),
+                                                    location);
+        } else {
+                g_debug ("Ignoring location from a superseded query");
+        }
 
-        g_task_return_pointer (task, g_steal_pointer (&location), g_object_unref);
+        g_task_return_pointer (task, g_steal_pointer (&location), (GDestroyNotify) gclue_location_unref);
 }
 
 
@@ -198,12 +246,11 @@ query_callback (GObject      *source_object,
         /* Ignore returned location */
         GClueLocation *location = GCLUE_WEB_SOURCE_GET_CLASS (web)->refresh_finish (web, result, &local_error);
         if (location)
-                g_object_unref (location);
+                gclue_location_unref (location);
 
         if (local_error != NULL &&
             !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
-                if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED) &&
-                    !g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_PENDING)) {
+                if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_INITIALIZED)) {
                         g_warning ("Failed to query location: %s",
                                    local_error->message);
                 } else {
@@ -217,11 +264,17 @@ void
 gclue_web_source_refresh_available_accuracy_level (GClueWebSource *web)
 {
         GClueAccuracyLevel new, existing;
+        gboolean can_locate;
+
+        /* With an offline database we don't depend on the network */
+        can_locate = web->priv->locate_url_reachable ||
+                     (web->priv->offline_db != NULL &&
+                      gclue_offline_db_has_data (web->priv->offline_db));
 
         existing = gclue_location_source_get_available_accuracy_level
                         (GCLUE_LOCATION_SOURCE (web));
         new = GCLUE_WEB_SOURCE_GET_CLASS (web)->get_available_accuracy_level
-                        (web, web->priv->locate_url_reachable);
+                        (web, can_locate);
         if (new != existing) {
                 g_debug ("Available accuracy level from %s: %u",
                          G_OBJECT_TYPE_NAME (web), new);
@@ -277,8 +330,10 @@ locate_url_checked_cb (GObject      *source_object,
                 return;
 
         current_location = gclue_location_source_get_location (GCLUE_LOCATION_SOURCE (web));
-        if (!current_location || (g_get_real_time () / G_USEC_PER_SEC)
+        if (!current_location || web->priv->location_from_cache ||
+            (g_get_real_time () / G_USEC_PER_SEC)
             > (gclue_location_get_timestamp (current_location) + WEB_LOCATION_TIMEOUT)) {
+                web->priv->location_from_cache = FALSE;
                 g_debug ("Network changed: Refreshing");
                 gclue_web_source_refresh_available_accuracy_level (web);
                 if (gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (web)))
@@ -312,12 +367,17 @@ submit_url_checked_cb (GObject      *source_object,
         web = GCLUE_WEB_SOURCE (user_data);
         last_reachable = web->priv->submit_url_reachable;
         web->priv->submit_url_reachable = reachable;
-        if (last_reachable == reachable) {
-                return;
+        if (last_reachable != reachable) {
+                g_debug ("Network changed: %s",
+                         reachable ? "Enabling submit URL queries" :
+                                     "Disabling submit URL queries");
         }
-        g_debug ("Network changed: %s",
-                 reachable ? "Enabling submit URL queries" :
-                             "Disabling submit URL queries");
+
+        /* Send what was queued while we were offline */
+        if (reachable && web->priv->submit_spool != NULL)
+                gclue_submit_spool_flush (web->priv->submit_spool,
+                                          web->priv->submit_url,
+                                          !last_reachable);
 }
 
 static void
@@ -343,6 +403,22 @@ on_network_changed (GNetworkMonitor *unused_monitor G_GNUC_UNUSED,
 
         cancellable_cancel_recreate (web);
 
+        /* A location cached for the new network doesn't need the locate URL
+         * to be reachable, so serve it before checking. The query still
+         * follows once it is, to revalidate it. */
+        if (GCLUE_WEB_SOURCE_GET_CLASS (web)->get_cached_location != NULL &&
+            gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (web))) {
+                g_autoptr(GClueLocation) location = NULL;
+
+                location = GCLUE_WEB_SOURCE_GET_CLASS (web)->get_cached_location (web);
+                if (location != NULL) {
+                        g_debug ("Network changed: Using cached location");
+                        gclue_location_source_set_location
+                                (GCLUE_LOCATION_SOURCE (web), location);
+                        web->priv->location_from_cache = TRUE;
+                }
+        }
+
         if (web->priv->submit_url) {
                 submit_addr = g_network_address_parse_uri (web->priv->submit_url,
                                                            80, NULL);
@@ -431,56 +507,25 @@ gclue_web_source_finalize (GObject *gsource)
                 priv->connectivity_changed_id = 0;
         }
 
-        if (priv->soup_session) {
-                soup_session_abort (priv->soup_session);
-                g_clear_object (&priv->soup_session);
-        }
-
-        g_clear_object (&priv->query);
+        g_clear_object (&priv->offline_db);
+        g_clear_object (&priv->submit_spool);
         g_clear_object (&priv->cancellable);
 
         G_OBJECT_CLASS (gclue_web_source_parent_class)->finalize (gsource);
 }
 
-static char *
-get_os_info (void)
-{
-        g_autofree char *pretty_name = NULL;
-        g_autofree char *os_name = g_get_os_info (G_OS_INFO_KEY_NAME);
-        g_autofree char *os_version = g_get_os_info (G_OS_INFO_KEY_VERSION);
-
-        if (os_name && os_version)
-                return g_strdup_printf ("%s; %s", os_name, os_version);
-
-        pretty_name = g_get_os_info (G_OS_INFO_KEY_PRETTY_NAME);
-        if (pretty_name)
-                return g_steal_pointer (&pretty_name);
-
-        /* Translators: Not marked as translatable as debug output should stay English */
-        return g_strdup ("Unknown");
-}
-
-#define USER_AGENT (PACKAGE_NAME "/" PACKAGE_VERSION)
-
-static char *
-get_user_agent (void)
-{
-        g_autofree char *os_info = get_os_info ();
-        return g_strdup_printf ("%s (%s)", USER_AGENT, os_info);
-}
-
 static void
 gclue_web_source_constructed (GObject *object)
 {
         GNetworkMonitor *monitor;
         GClueWebSourcePrivate *priv = GCLUE_WEB_SOURCE (object)->priv;
-        g_autofree char *user_agent = get_user_agent ();
 
         G_OBJECT_CLASS (gclue_web_source_parent_class)->constructed (object);
 
-        priv->soup_session = soup_session_new ();
-        soup_session_set_proxy_resolver (priv->soup_session, NULL);
-        soup_session_set_user_agent (priv->soup_session, user_agent);
+        if (GCLUE_WEB_SOURCE_GET_CLASS (object)->locate_offline != NULL)
+                priv->offline_db = gclue_offline_db_get_singleton ();
+        if (GCLUE_WEB_SOURCE_GET_CLASS (object)->create_submit_item != NULL)
+                priv->submit_spool = gclue_submit_spool_get_singleton ();
 
         monitor = g_network_monitor_get_default ();
         priv->network_changed_id =
@@ -585,42 +630,6 @@ gclue_web_source_refresh (GClueWebSource *source)
         GCLUE_WEB_SOURCE_GET_CLASS (source)->refresh_async (source, NULL, query_callback, NULL);
 }
 
-static void
-submit_query_callback (SoupSession  *session,
-                       GAsyncResult *result,
-                       gpointer      user_data)
-{
-        GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
-        g_autoptr(GBytes) body = NULL;
-        g_autoptr(GError) local_error = NULL;
-        g_autofree char *contents = NULL;
-        SoupMessage *query;
-        g_autofree char *uri_str = NULL;
-        gint status_code;
-
-        query = soup_session_get_async_result_message (session, result);
-        uri_str = g_uri_to_string (soup_message_get_uri (query));
-
-        body = soup_session_send_and_read_finish (session, result, &local_error);
-        if (!body) {
-                g_warning ("Failed to submit location data to '%s' (no body): %s",
-                           uri_str, local_error->message);
-                return;
-        }
-        contents = g_strndup (g_bytes_get_data (body, NULL), g_bytes_get_size (body));
-
-        status_code = soup_message_get_status (query);
-
-        if (!GCLUE_WEB_SOURCE_GET_CLASS (web)->parse_submit_response
-                        (web, contents, status_code, &local_error)) {
-                g_warning ("Failed to submit location data to '%s': %s",
-                           uri_str, soup_message_get_reason_phrase (query));
-                return;
-        }
-
-        g_debug ("Successfully submitted location data to '%s'", uri_str);
-}
-
 #define SUBMISSION_ACCURACY_THRESHOLD 100
 #define SUBMISSION_TIME_THRESHOLD     60  /* seconds */
 
@@ -631,16 +640,24 @@ on_submit_source_location_notify (GObject    *source_object,
 {
         GClueLocationSource *source = GCLUE_LOCATION_SOURCE (source_object);
         GClueWebSource *web = GCLUE_WEB_SOURCE (user_data);
+        GClueWebSourceClass *klass = GCLUE_WEB_SOURCE_GET_CLASS (web);
         GClueLocation *location;
-        g_autoptr(SoupMessage) query = NULL;
+        g_autoptr(JsonNode) item = NULL;
         g_autoptr(GError) error = NULL;
 
-        if (!web->priv->submit_url_reachable)
+        location = gclue_location_source_get_location (source);
+        if (location == NULL)
                 return;
 
-        location = gclue_location_source_get_location (source);
-        if (location == NULL ||
-            gclue_location_get_accuracy (location) >
+        /* Learning is local, it doesn't need the network nor submission */
+        if (web->priv->offline_db != NULL && klass->learn_location != NULL)
+                klass->learn_location (web, web->priv->offline_db, location);
+
+        /* Queued even when offline, and sent once back online */
+        if (web->priv->submit_spool == NULL || web->priv->submit_url == NULL)
+                return;
+
+        if (gclue_location_get_accuracy (location) >
             SUBMISSION_ACCURACY_THRESHOLD ||
             gclue_location_get_accuracy (location) ==
             GCLUE_LOCATION_ACCURACY_UNKNOWN ||
@@ -650,25 +667,21 @@ on_submit_source_location_notify (GObject    *source_object,
 
         web->priv->last_submitted = gclue_location_get_timestamp (location);
 
-        query = GCLUE_WEB_SOURCE_GET_CLASS (web)->create_submit_query
-                                        (web,
-                                         location,
-                                         &error);
-        if (query == NULL) {
+        item = klass->create_submit_item (web, location, &error);
+        if (item == NULL) {
                 if (error != NULL) {
-                        g_warning ("Failed to create submission query: %s",
+                        g_warning ("Failed to create submission item: %s",
                                    error->message);
                 }
 
                 return;
         }
 
-        soup_session_send_and_read_async (web->priv->soup_session,
-                                          query,
-                                          G_PRIORITY_DEFAULT,
-                                          NULL,
-                                          (GAsyncReadyCallback)submit_query_callback,
-                                          web);
+        gclue_submit_spool_add (web->priv->submit_spool, item);
+        if (web->priv->submit_url_reachable)
+                gclue_submit_spool_flush (web->priv->submit_spool,
+                                          web->priv->submit_url,
+                                          FALSE);
 }
 
 /**
@@ -679,13 +692,19 @@ on_submit_source_location_notify (GObject    *source_object,
  * for submitting location data to resource being used by @source. This will be
  * a #GClueModemGPS but we don't assume that here, in case we later add a
  * non-modem GPS source and would like to pass that instead.
+ *
+ * The locations of @submit_source are also used to learn the positions of
+ * networks locally, if enabled.
  **/
 void
 gclue_web_source_set_submit_source (GClueWebSource      *web,
                                     GClueLocationSource *submit_source)
 {
+        GClueWebSourceClass *klass = GCLUE_WEB_SOURCE_GET_CLASS (web);
+
         /* Not implemented by subclass */
-        if (GCLUE_WEB_SOURCE_GET_CLASS (web)->create_submit_query == NULL)
+        if (klass->create_submit_item == NULL &&
+            klass->learn_location == NULL)
                 return;
 
         g_signal_connect_object (G_OBJECT (submit_source),
@@ -25,7 +25,9 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "gclue-location-source.h"
+#include "gclue-offline-db.h"
 #include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
 
 G_BEGIN_DECLS
 
@@ -76,17 +78,19 @@ struct _GClueWebSourceClass {
         GClueLocation *   (*parse_response)      (GClueWebSource *source,
                                                   const char *content,
                                                   GError    **error);
-        SoupMessage *     (*create_submit_query) (GClueWebSource  *source,
+        JsonNode *        (*create_submit_item)  (GClueWebSource  *source,
                                                   GClueLocation   *location,
                                                   GError         **error);
-        gboolean          (*parse_submit_response)
-                                                 (GClueWebSource *source,
-                                                  const char     *content,
-                                                  gint            status_code,
-                                                  GError        **error);
         GClueAccuracyLevel (*get_available_accuracy_level)
                                                  (GClueWebSource *source,
                                                   gboolean        network_available);
+        GClueLocation *   (*locate_offline)      (GClueWebSource *source,
+                                                  GClueOfflineDB *db,
+                                                  GError        **error);
+        void              (*learn_location)      (GClueWebSource *source,
+                                                  GClueOfflineDB *db,
+                                                  GClueLocation  *location);
+        GClueLocation *   (*get_cached_location) (GClueWebSource *source);
 };
 
 void gclue_web_source_refresh           (GClueWebSource      *source);
@@ -19,6 +19,9 @@
  * Authors: Zeeshan Ali (Khattak) <zeeshanak@gnome.org>
  */
 
+#include <config.h>
+
+#include <errno.h>
 #include <stdlib.h>
 #include <glib.h>
 #include <string.h>
@@ -34,6 +37,16 @@
  */
 #define WIFI_SCAN_TIMEOUT_LOW_ACCURACY  300
 
+/* The interval between scans starts at the above and doubles, up to this
+ * many times the above, as long as scans keep finding the same APs. It goes
+ * back to the above as soon as they change a lot or we move fast.
+ */
+#define WIFI_SCAN_TIMEOUT_MAX_FACTOR 8
+/* Fraction of the APs of a scan gone in the next one */
+#define WIFI_SCAN_LOW_CHURN  0.1
+#define WIFI_SCAN_HIGH_CHURN 0.3
+#define WIFI_SCAN_HIGH_SPEED 2.0 /* Meters per second */
+
 /* WiFi APs at and below this signal level in scan results are ignored.
  * In dBm units.
  */
@@ -55,6 +68,31 @@
  */
 #define CACHE_ENTRY_MATCH_SIGNAL_WINDOW 10
 
+/* When there is no entry for exactly the same set of BSSs, reuse a location
+ * cached for a similar enough set: the Jaccard index of the two BSSID sets has
+ * to be at least this, and signals of the common BSSs have to match as above.
+ */
+#define CACHE_ENTRY_MATCH_MIN_SIMILARITY 0.75
+
+/* Rough heap use of a cached GClueLocation, including its description. Only
+ * used to account for the memory used by the cache.
+ */
+#define CACHE_ENTRY_LOCATION_SIZE 256
+
+/* The persistent cache file is an append-only log, so that new entries can be
+ * flushed as they come in without rewriting the whole file: a header followed
+ * by records, each one being a serialised CACHE_RECORD_TYPE variant prefixed
+ * by its size. Records are padded to 8 bytes so that they can be used in place
+ * from the mapped file. The file gets rewritten whenever entries are pruned.
+ */
+#define CACHE_FILE_MAGIC "GCWIFIC"
+#define CACHE_FILE_VERSION 1
+#define CACHE_FILE_HEADER_SIZE 16
+#define CACHE_RECORD_HEADER_SIZE 8
+#define CACHE_RECORD_PADDING(size) ((8 - ((size) % 8)) % 8)
+/* key, signals, latitude, longitude, accuracy, altitude, timestamp, description */
+#define CACHE_RECORD_TYPE "((usttaay)anddddts)"
+
 /**
  * SECTION:gclue-wifi
  * @short_description: WiFi-based geolocation
@@ -63,14 +101,18 @@
  * Contains functions to get the geolocation based on nearby WiFi networks.
  **/
 
+enum {
+        BSS_SET_CHANGED,
+        SIGNAL_LAST
+};
+
+static guint signals[SIGNAL_LAST];
+
 static GClueLocationSourceStartResult
 gclue_wifi_start (GClueLocationSource *source);
 static GClueLocationSourceStopResult
 gclue_wifi_stop (GClueLocationSource *source);
 
-static guint
-variant_hash (gconstpointer key);
-
 static void
 gclue_wifi_refresh_async (GClueWebSource      *source,
                           GCancellable        *cancellable,
@@ -84,20 +126,158 @@ gclue_wifi_refresh_finish (GClueWebSource  *source,
 static void
 disconnect_cache_prune_timeout (GClueWifi *wifi);
 
+/* Cache keys pack the tower and the sorted list of BSSIDs into a single
+ * fixed-layout block of memory, so they can be hashed and compared as such.
+ * They are allocated zeroed, hence padding never gets in the way of memcmp().
+ */
 typedef struct {
+        guint hash;
+        guint n_bssids;
+        GClue3GTower tower;
+        guint8 bssids[];  /* n_bssids * BSSID_LEN, sorted */
+} LocationCacheKey;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LocationCacheKey, g_rc_box_release)
+
+#define LOCATION_CACHE_KEY_SIZE(n_bssids) \
+        (G_STRUCT_OFFSET (LocationCacheKey, bssids) + (n_bssids) * BSSID_LEN)
+
+/* The bssids are left for the caller to fill in, followed by a call to
+ * location_cache_key_seal().
+ */
+static LocationCacheKey *
+location_cache_key_alloc (const GClue3GTower *tower,
+                          guint               n_bssids)
+{
+        LocationCacheKey *key;
+
+        key = g_rc_box_alloc0 (MAX (sizeof (LocationCacheKey),
+                                    LOCATION_CACHE_KEY_SIZE (n_bssids)));
+        key->n_bssids = n_bssids;
+        key->tower.tec = tower->tec;
+        g_strlcpy (key->tower.opc, tower->opc, sizeof (key->tower.opc));
+        key->tower.lac = tower->lac;
+        key->tower.cell_id = tower->cell_id;
+
+        return key;
+}
+
+/* FNV-1a over everything but the hash itself. */
+static void
+location_cache_key_seal (LocationCacheKey *key)
+{
+        const guint8 *data = (const guint8 *) &key->n_bssids;
+        gsize size = LOCATION_CACHE_KEY_SIZE (key->n_bssids) -
+                     G_STRUCT_OFFSET (LocationCacheKey, n_bssids);
+        guint32 hash = 2166136261u;
+        gsize i;
+
+        for (i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 16777619u;
+        }
+
+        key->hash = hash;
+}
+
+static const guint8 *
+location_cache_key_get_bssid (const LocationCacheKey *key,
+                              guint                   i)
+{
+        return key->bssids + i * BSSID_LEN;
+}
+
+static guint
+location_cache_key_hash (gconstpointer key)
+{
+        return ((const LocationCacheKey *) key)->hash;
+}
+
+static gboolean
+location_cache_key_equal (gconstpointer a,
+                          gconstpointer b)
+{
+        const LocationCacheKey *key_a = a;
+        const LocationCacheKey *key_b = b;
+
+        return key_a->hash == key_b->hash &&
+               key_a->n_bssids == key_b->n_bssids &&
+               memcmp (key_a, key_b, LOCATION_CACHE_KEY_SIZE (key_a->n_bssids)) == 0;
+}
+
+static char *
+location_cache_key_to_string (const LocationCacheKey *key)
+{
+        GString *str = g_string_new (NULL);
+        guint i;
+
+        g_string_append_printf (str, "(%u, '%s', %lu, %lu, [",
+                                (guint) key->tower.tec,
+                                key->tower.opc,
+                                key->tower.lac,
+                                key->tower.cell_id);
+        for (i = 0; i < key->n_bssids; i++) {
+                const guint8 *bssid = location_cache_key_get_bssid (key, i);
+
+                g_string_append_printf (str,
+                                        "%s%02x:%02x:%02x:%02x:%02x:%02x",
+                                        i > 0 ? ", " : "",
+                                        bssid[0], bssid[1], bssid[2],
+                                        bssid[3], bssid[4], bssid[5]);
+        }
+        g_string_append (str, "])");
+
+        return g_string_free (str, FALSE);
+}
+
+/* Printing keys is expensive with many BSSs, only do it if it'll be seen. */
+static char *
+location_cache_key_to_debug_string (const LocationCacheKey *key)
+{
+        if (g_log_writer_default_would_drop (G_LOG_LEVEL_DEBUG, G_LOG_DOMAIN))
+                return NULL;
+
+        return location_cache_key_to_string (key);
+}
+
+static guint64
+bssid_to_uint64 (const guint8 *bssid)
+{
+        guint64 value = 0;
+        guint i;
+
+        for (i = 0; i < BSSID_LEN; i++)
+                value = (value << 8) | bssid[i];
+
+        return value;
+}
+
+typedef struct {
+        LocationCacheKey *key;  /* (owned) */
         GArray *signals;
         GClueLocation *location;
+        GList bucket_link;  /* in LocationCacheValue.elements */
+        GList lru_link;  /* in GClueWifiPrivate.cache_lru, most recently used first */
 } LocationCacheElement;
 
 static LocationCacheElement *
-location_cache_element_new (GArray *signals,
+add_cached_location (GClueWifi *wifi,
+                     LocationCacheKey *key, GArray **signals,
+                     GClueLocation *location);
+
+static LocationCacheElement *
+location_cache_element_new (LocationCacheKey *key,
+                            GArray *signals,
                             GClueLocation *location)
 {
         LocationCacheElement *element;
 
         element = g_slice_new (LocationCacheElement);
+        element->key = g_rc_box_acquire (key);
         element->signals = signals;
-        element->location = g_object_ref (location);
+        element->location = gclue_location_ref (location);
+        element->bucket_link = (GList) { element, NULL, NULL };
+        element->lru_link = (GList) { element, NULL, NULL };
         return element;
 }
 
@@ -105,14 +285,26 @@ static void location_cache_element_free (gpointer data)
 {
         LocationCacheElement *element = data;
 
+        g_clear_pointer (&element->key, g_rc_box_release);
         if (element->signals)
                 g_array_free (element->signals, TRUE);
-        g_clear_object (&element->location);
+        g_clear_pointer (&element->location, gclue_location_unref);
         g_slice_free (LocationCacheElement, element);
 }
 
+/* Rough heap use of an element, including its share of the BSSID index. */
+static gsize
+location_cache_element_size (LocationCacheElement *element)
+{
+        return sizeof (LocationCacheElement) +
+               LOCATION_CACHE_KEY_SIZE (element->key->n_bssids) +
+               element->signals->len * sizeof (gint16) +
+               element->key->n_bssids * sizeof (gpointer) +
+               CACHE_ENTRY_LOCATION_SIZE;
+}
+
 typedef struct {
-        GList *elements;
+        GQueue elements;  /* (element-type LocationCacheElement) linked through bucket_link */
 } LocationCacheValue;
 
 static LocationCacheValue *
@@ -121,15 +313,17 @@ location_cache_value_new (void)
         LocationCacheValue *value;
 
         value = g_slice_new (LocationCacheValue);
-        value->elements = NULL;
+        g_queue_init (&value->elements);
         return value;
 }
 
 static void location_cache_value_free (gpointer data)
 {
         LocationCacheValue *value = data;
+        GList *link;
 
-        g_list_free_full (value->elements, location_cache_element_free);
+        while ((link = g_queue_pop_head_link (&value->elements)) != NULL)
+                location_cache_element_free (link->data);
         g_slice_free (LocationCacheValue, value);
 }
 
@@ -141,6 +335,7 @@ struct _GClueWifiPrivate {
         GHashTable *bss_proxies;
         GHashTable *ignored_bss_proxies;
         gboolean bss_list_changed;
+        GHashTable *scan_bssids;  /* (element-type utf8) BSSIDs of the last scan */
 
         gulong bss_added_id;
         gulong bss_removed_id;
@@ -148,10 +343,21 @@ struct _GClueWifiPrivate {
         guint scan_wait_id;
 
         guint scan_timeout;
+        guint scan_interval;  /* 0 until the first scan */
 
-        GHashTable *location_cache;  /* (element-type GVariant LocationCacheValue) (owned) */
+        GHashTable *location_cache;  /* (element-type LocationCacheKey LocationCacheValue) (owned) */
+        GHashTable *location_cache_index;  /* (element-type guint64 GPtrArray<LocationCacheElement>) (owned) */
         guint cache_prune_timeout_id;
         guint cache_hits, cache_misses;
+        GQueue cache_lru;  /* (element-type LocationCacheElement) linked through lru_link */
+        gsize cache_memory_size;
+        guint cache_max_entries;  /* 0 for no limit */
+        gsize cache_max_memory_size;  /* 0 for no limit */
+        guint cache_file_stale_records;
+
+        char *cache_file_path;  /* (nullable) if persistence is disabled */
+        gboolean cache_loaded;
+        gboolean cache_file_valid;
 
 #if GLIB_CHECK_VERSION(2, 64, 0)
         GMemoryMonitor *memory_monitor;
@@ -163,10 +369,18 @@ static SoupMessage *
 gclue_wifi_create_query (GClueWebSource *source,
                          const char **query_data_description,
                          GError        **error);
-static SoupMessage *
-gclue_wifi_create_submit_query (GClueWebSource  *source,
-                                GClueLocation   *location,
-                                GError         **error);
+static GClueLocation *
+gclue_wifi_locate_offline (GClueWebSource *source,
+                           GClueOfflineDB *db,
+                           GError        **error);
+static void
+gclue_wifi_learn_location (GClueWebSource *source,
+                           GClueOfflineDB *db,
+                           GClueLocation  *location);
+static JsonNode *
+gclue_wifi_create_submit_item (GClueWebSource  *source,
+                               GClueLocation   *location,
+                               GError         **error);
 static GClueAccuracyLevel
 gclue_wifi_get_available_accuracy_level (GClueWebSource *source,
                                          gboolean        net_available);
@@ -198,15 +412,6 @@ gclue_wifi_parse_response (GClueWebSource *source,
         return gclue_mozilla_parse_response (content, location_description, error);
 }
 
-static gboolean
-gclue_wifi_parse_submit_response (GClueWebSource *source,
-                                  const char     *content,
-                                  gint            status_code,
-                                  GError        **error)
-{
-        return gclue_mozilla_parse_submit_response (content, status_code, error);
-}
-
 static void
 gclue_wifi_finalize (GObject *gwifi)
 {
@@ -223,7 +428,10 @@ gclue_wifi_finalize (GObject *gwifi)
         g_clear_object (&wifi->priv->interface);
         g_clear_pointer (&wifi->priv->bss_proxies, g_hash_table_unref);
         g_clear_pointer (&wifi->priv->ignored_bss_proxies, g_hash_table_unref);
+        g_clear_pointer (&wifi->priv->scan_bssids, g_hash_table_unref);
+        g_clear_pointer (&wifi->priv->location_cache_index, g_hash_table_unref);
         g_clear_pointer (&wifi->priv->location_cache, g_hash_table_unref);
+        g_clear_pointer (&wifi->priv->cache_file_path, g_free);
         g_clear_object (&wifi->priv->mozilla);
         g_clear_object (&wifi->priv->intf_cancellable);
 }
@@ -243,13 +451,35 @@ gclue_wifi_class_init (GClueWifiClass *klass)
         web_class->refresh_async = gclue_wifi_refresh_async;
         web_class->refresh_finish = gclue_wifi_refresh_finish;
         web_class->create_query = gclue_wifi_create_query;
+        web_class->locate_offline = gclue_wifi_locate_offline;
+        web_class->learn_location = gclue_wifi_learn_location;
         web_class->parse_response = gclue_wifi_parse_response;
-        web_class->create_submit_query = gclue_wifi_create_submit_query;
-        web_class->parse_submit_response = gclue_wifi_parse_submit_response;
+        web_class->create_submit_item = gclue_wifi_create_submit_item;
         web_class->get_available_accuracy_level =
                 gclue_wifi_get_available_accuracy_level;
         gwifi_class->finalize = gclue_wifi_finalize;
         gwifi_class->constructed = gclue_wifi_constructed;
+
+        /**
+         * GClueWifi::bss-set-changed:
+         * @wifi: the #GClueWifi
+         * @overlap: the fraction of the access points of the previous scan
+         * still visible
+         *
+         * Emitted after a scan whose access points differ from the
+         * previous one, a hint that the device might have moved.
+         **/
+        signals[BSS_SET_CHANGED] =
+                g_signal_new ("bss-set-changed",
+                              GCLUE_TYPE_WIFI,
+                              G_SIGNAL_RUN_LAST,
+                              0,
+                              NULL,
+                              NULL,
+                              g_cclosure_marshal_VOID__DOUBLE,
+                              G_TYPE_NONE,
+                              1,
+                              G_TYPE_DOUBLE);
 }
 
 static void
@@ -534,10 +764,116 @@ gboolean gclue_wifi_should_skip_bsss (GClueAccuracyLevel level)
         return level < GCLUE_ACCURACY_LEVEL_STREET;
 }
 
+/* Remembers the BSSIDs of the scan, returning the fraction of the previous
+ * ones that are still there. */
+static gdouble
+update_scan_bssids (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        g_autoptr(GHashTable) prev = g_steal_pointer (&priv->scan_bssids);
+        GHashTableIter iter;
+        gpointer value;
+        guint n_common = 0;
+
+        priv->scan_bssids = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+        g_hash_table_iter_init (&iter, priv->bss_proxies);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                char bssid[BSSID_STR_LEN + 1] = { 0 };
+
+                if (!get_bssid_from_bss (WPA_BSS (value), bssid))
+                        continue;
+
+                if (prev != NULL && g_hash_table_contains (prev, bssid))
+                        n_common++;
+                g_hash_table_add (priv->scan_bssids, g_strdup (bssid));
+        }
+
+        if (prev == NULL || g_hash_table_size (prev) == 0)
+                return 1.0;
+
+        return (gdouble) n_common / g_hash_table_size (prev);
+}
+
+static GClueAccuracyLevel
+get_accuracy_level (GClueWifi *wifi);
+
+static void
+schedule_scan (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+
+        /* If there was another scan already scheduled, cancel that and
+         * re-schedule. Regardless of our internal book-keeping, this can happen
+         * if wpa_supplicant emits the `ScanDone` signal due to a scan being
+         * initiated by another client. */
+        if (priv->scan_timeout != 0) {
+                g_source_remove (priv->scan_timeout);
+                priv->scan_timeout = 0;
+        }
+
+        priv->scan_timeout = g_timeout_add_seconds (priv->scan_interval,
+                                                    on_scan_timeout,
+                                                    wifi);
+        g_debug ("Next WiFi scan scheduled in %u seconds", priv->scan_interval);
+}
+
+/* Adapts the interval between scans to how much the APs around change */
+static gboolean
+update_scan_interval (GClueWifi *wifi,
+                      gdouble    overlap)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        GClueLocation *location;
+        GClueMinUINT *threshold;
+        guint min_interval, max_interval, interval;
+        gdouble churn = 1.0 - overlap;
+
+        /* With high-enough accuracy requests, we need to scan more often since
+         * user's location can change quickly. With low accuracy, we don't since
+         * we wouldn't want to drain power unnecessarily.
+         */
+        if (get_accuracy_level (wifi) >= GCLUE_ACCURACY_LEVEL_STREET)
+                min_interval = WIFI_SCAN_TIMEOUT_HIGH_ACCURACY;
+        else
+                min_interval = WIFI_SCAN_TIMEOUT_LOW_ACCURACY;
+        max_interval = min_interval * WIFI_SCAN_TIMEOUT_MAX_FACTOR;
+
+        /* No client wants locations more often than this */
+        threshold = gclue_location_source_get_time_threshold
+                        (GCLUE_LOCATION_SOURCE (wifi));
+        min_interval = MAX (min_interval, gclue_min_uint_get_value (threshold));
+        max_interval = MAX (max_interval, min_interval);
+
+        location = gclue_location_source_get_location (GCLUE_LOCATION_SOURCE (wifi));
+
+        if (priv->scan_interval == 0 ||
+            churn >= WIFI_SCAN_HIGH_CHURN ||
+            (location != NULL &&
+             gclue_location_get_speed (location) >= WIFI_SCAN_HIGH_SPEED))
+                interval = min_interval;
+        else if (churn <= WIFI_SCAN_LOW_CHURN)
+                interval = priv->scan_interval * 2;
+        else
+                interval = priv->scan_interval;
+        interval = CLAMP (interval, min_interval, max_interval);
+
+        if (interval == priv->scan_interval)
+                return FALSE;
+
+        g_debug ("WiFi scan interval now %u seconds (%.0f%% of APs changed)",
+                 interval, churn * 100);
+        priv->scan_interval = interval;
+
+        return TRUE;
+}
+
 static gboolean
 on_scan_wait_done (gpointer wifi)
 {
         GClueWifiPrivate *priv;
+        gdouble overlap = 1.0;
+        gboolean first_scan;
 
         g_return_val_if_fail (GCLUE_IS_WIFI (wifi), G_SOURCE_REMOVE);
         priv = GCLUE_WIFI(wifi)->priv;
@@ -545,7 +881,13 @@ on_scan_wait_done (gpointer wifi)
         /* We have the latest scan result */
         gclue_mozilla_set_wifi (priv->mozilla, wifi);
 
+        first_scan = priv->scan_bssids == NULL;
         if (priv->bss_list_changed) {
+                overlap = update_scan_bssids (GCLUE_WIFI (wifi));
+
+                if (overlap < 1.0)
+                        g_signal_emit (wifi, signals[BSS_SET_CHANGED], 0, overlap);
+
                 priv->bss_list_changed = FALSE;
                 g_debug ("WiFi BSS list changed, refreshing location…");
                 gclue_mozilla_set_bss_dirty (priv->mozilla);
@@ -553,6 +895,12 @@ on_scan_wait_done (gpointer wifi)
         }
         priv->scan_wait_id = 0;
 
+        /* Nothing to compare the first scan with */
+        if (!first_scan &&
+            update_scan_interval (GCLUE_WIFI (wifi), overlap) &&
+            priv->interface != NULL)
+                schedule_scan (GCLUE_WIFI (wifi));
+
         return G_SOURCE_REMOVE;
 }
 
@@ -572,7 +920,6 @@ on_scan_done (WPAInterface *object,
 {
         GClueWifi *wifi = GCLUE_WIFI (user_data);
         GClueWifiPrivate *priv = wifi->priv;
-        guint timeout;
 
         if (!success) {
                 g_warning ("WiFi scan failed");
@@ -588,27 +935,11 @@ on_scan_done (WPAInterface *object,
 
         priv->scan_wait_id = g_timeout_add_seconds (1, on_scan_wait_done, wifi);
 
-        /* If there was another scan already scheduled, cancel that and
-         * re-schedule. Regardless of our internal book-keeping, this can happen
-         * if wpa_supplicant emits the `ScanDone` signal due to a scan being
-         * initiated by another client. */
-        if (priv->scan_timeout != 0) {
-                g_source_remove (priv->scan_timeout);
-                priv->scan_timeout = 0;
-        }
-
-        /* With high-enough accuracy requests, we need to scan more often since
-         * user's location can change quickly. With low accuracy, we don't since
-         * we wouldn't want to drain power unnecessarily.
-         */
-        if (get_accuracy_level (wifi) >= GCLUE_ACCURACY_LEVEL_STREET)
-                timeout = WIFI_SCAN_TIMEOUT_HIGH_ACCURACY;
-        else
-                timeout = WIFI_SCAN_TIMEOUT_LOW_ACCURACY;
-        priv->scan_timeout = g_timeout_add_seconds (timeout,
-                                                    on_scan_timeout,
-                                                    wifi);
-        g_debug ("WiFi scan done, next scheduled in %u seconds", timeout);
+        /* Adjusted once the results are in */
+        if (priv->scan_interval == 0)
+                update_scan_interval (wifi, 0.0);
+        g_debug ("WiFi scan done");
+        schedule_scan (wifi);
 }
 
 static void
@@ -703,55 +1034,478 @@ disconnect_bss_signals (GClueWifi *wifi)
 
         g_hash_table_remove_all (priv->bss_proxies);
         g_hash_table_remove_all (priv->ignored_bss_proxies);
+        g_clear_pointer (&priv->scan_bssids, g_hash_table_unref);
+        priv->scan_interval = 0;
 }
 
+/* The index maps each BSSID to the cache elements it is part of. */
 static void
-cache_prune (GClueWifi *wifi)
+cache_index_add (GClueWifi            *wifi,
+                 LocationCacheElement *element)
+{
+        GHashTable *index = wifi->priv->location_cache_index;
+        guint i;
+
+        for (i = 0; i < element->key->n_bssids; i++) {
+                guint64 bssid;
+                GPtrArray *elements;
+
+                bssid = bssid_to_uint64 (location_cache_key_get_bssid (element->key, i));
+                elements = g_hash_table_lookup (index, &bssid);
+                if (elements == NULL) {
+                        elements = g_ptr_array_new ();
+                        g_hash_table_insert (index,
+                                             g_memdup2 (&bssid, sizeof (bssid)),
+                                             elements);
+                }
+
+                g_ptr_array_add (elements, element);
+        }
+}
+
+static void
+cache_index_remove (GClueWifi            *wifi,
+                    LocationCacheElement *element)
+{
+        GHashTable *index = wifi->priv->location_cache_index;
+        guint i;
+
+        for (i = 0; i < element->key->n_bssids; i++) {
+                guint64 bssid;
+                GPtrArray *elements;
+
+                bssid = bssid_to_uint64 (location_cache_key_get_bssid (element->key, i));
+                elements = g_hash_table_lookup (index, &bssid);
+                if (elements == NULL)
+                        continue;
+
+                g_ptr_array_remove_fast (elements, element);
+                if (elements->len == 0)
+                        g_hash_table_remove (index, &bssid);
+        }
+}
+
+static void
+cache_remove_element (GClueWifi            *wifi,
+                      LocationCacheElement *element)
 {
         GClueWifiPrivate *priv = wifi->priv;
-        GHashTableIter iter;
-        gpointer value;
+        LocationCacheValue *value;
+
+        value = g_hash_table_lookup (priv->location_cache, element->key);
+        g_assert (value != NULL);
+
+        g_queue_unlink (&priv->cache_lru, &element->lru_link);
+        g_queue_unlink (&value->elements, &element->bucket_link);
+        cache_index_remove (wifi, element);
+        priv->cache_memory_size -= location_cache_element_size (element);
+
+        /* Removed the last element with this key? Remove the key then. */
+        if (g_queue_is_empty (&value->elements))
+                g_hash_table_remove (priv->location_cache, element->key);
+
+        location_cache_element_free (element);
+}
+
+static void
+cache_touch_element (GClueWifi            *wifi,
+                     LocationCacheElement *element)
+{
+        GQueue *lru = &wifi->priv->cache_lru;
+
+        g_queue_unlink (lru, &element->lru_link);
+        g_queue_push_head_link (lru, &element->lru_link);
+}
+
+/* Evicts the least recently used elements until the cache fits in its
+ * limits, always keeping the most recently used one.
+ */
+static void
+cache_enforce_limits (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        guint evicted = 0;
+
+        while (priv->cache_lru.length > 1 &&
+               ((priv->cache_max_entries > 0 &&
+                 priv->cache_lru.length > priv->cache_max_entries) ||
+                (priv->cache_max_memory_size > 0 &&
+                 priv->cache_memory_size > priv->cache_max_memory_size))) {
+                cache_remove_element (wifi, g_queue_peek_tail (&priv->cache_lru));
+                evicted++;
+        }
+
+        if (evicted == 0)
+                return;
+
+        priv->cache_file_stale_records += evicted;
+        g_debug ("Evicted %u elements from cache (new size: %u elements, "
+                 "%" G_GSIZE_FORMAT " bytes)",
+                 evicted, priv->cache_lru.length, priv->cache_memory_size);
+}
+
+static void
+cache_file_header_append (GByteArray *buffer)
+{
+        guint8 header[CACHE_FILE_HEADER_SIZE] = { 0 };
+        guint32 version = CACHE_FILE_VERSION;
+        guint32 byte_order = G_BYTE_ORDER;
+
+        memcpy (header, CACHE_FILE_MAGIC, sizeof (CACHE_FILE_MAGIC));
+        memcpy (header + 8, &version, sizeof (version));
+        memcpy (header + 12, &byte_order, sizeof (byte_order));
+        g_byte_array_append (buffer, header, sizeof (header));
+}
+
+static gboolean
+cache_file_header_valid (const guint8 *data,
+                         gsize         size)
+{
+        guint32 version, byte_order;
+
+        if (size < CACHE_FILE_HEADER_SIZE ||
+            memcmp (data, CACHE_FILE_MAGIC, sizeof (CACHE_FILE_MAGIC)) != 0)
+                return FALSE;
+
+        memcpy (&version, data + 8, sizeof (version));
+        memcpy (&byte_order, data + 12, sizeof (byte_order));
+
+        return version == CACHE_FILE_VERSION && byte_order == G_BYTE_ORDER;
+}
+
+static void
+cache_record_append (GByteArray           *buffer,
+                     LocationCacheElement *element)
+{
+        static const guint8 padding[8] = { 0 };
+        LocationCacheKey *key = element->key;
+        GClueLocation *location = element->location;
+        const char *description;
+        g_autoptr(GVariant) record = NULL;
+        GVariantBuilder bssids;
+        guint32 header[2] = { 0, 0 };
+        gsize size;
+        guint offset, i;
+
+        g_variant_builder_init (&bssids, G_VARIANT_TYPE ("aay"));
+        for (i = 0; i < key->n_bssids; i++)
+                g_variant_builder_add_value (&bssids,
+                                             g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                                        location_cache_key_get_bssid (key, i),
+                                                                        BSSID_LEN,
+                                                                        1));
+
+        description = gclue_location_get_description (location);
+        record = g_variant_new ("((ustt@aay)@anddddts)",
+                                (guint32) key->tower.tec,
+                                key->tower.opc,
+                                (guint64) key->tower.lac,
+                                (guint64) key->tower.cell_id,
+                                g_variant_builder_end (&bssids),
+                                g_variant_new_fixed_array (G_VARIANT_TYPE_INT16,
+                                                           element->signals->data,
+                                                           element->signals->len,
+                                                           sizeof (gint16)),
+                                gclue_location_get_latitude (location),
+                                gclue_location_get_longitude (location),
+                                gclue_location_get_accuracy (location),
+                                gclue_location_get_altitude (location),
+                                gclue_location_get_timestamp (location),
+                                description != NULL ? description : "");
+        g_variant_ref_sink (record);
+
+        size = g_variant_get_size (record);
+        header[0] = size;
+        g_byte_array_append (buffer, (const guint8 *) header, sizeof (header));
+
+        offset = buffer->len;
+        g_byte_array_set_size (buffer, offset + size);
+        g_variant_store (record, buffer->data + offset);
+        g_byte_array_append (buffer, padding, CACHE_RECORD_PADDING (size));
+}
+
+static gboolean
+cache_add_record (GClueWifi *wifi,
+                  GVariant  *record,
+                  guint64    cutoff_seconds)
+{
+        g_autoptr(GVariant) bssids = NULL;
+        g_autoptr(GVariant) signals_variant = NULL;
+        g_autoptr(LocationCacheKey) key = NULL;
+        g_autoptr(GArray) signals = NULL;
+        g_autoptr(GClueLocation) location = NULL;
+        GClue3GTower tower = { 0 };
+        const char *opc;
+        guint32 tec;
+        guint64 lac, cell_id;
+        const gint16 *signals_data;
+        gsize n_signals, n_bssids, i;
+        gdouble latitude, longitude, accuracy, altitude;
+        guint64 timestamp;
+        const char *description;
+
+        g_variant_get (record,
+                       "((u&stt@aay)@anddddt&s)",
+                       &tec,
+                       &opc,
+                       &lac,
+                       &cell_id,
+                       &bssids,
+                       &signals_variant,
+                       &latitude,
+                       &longitude,
+                       &accuracy,
+                       &altitude,
+                       &timestamp,
+                       &description);
+        if (timestamp <= cutoff_seconds)
+                return FALSE;
+
+        n_bssids = g_variant_n_children (bssids);
+        signals_data = g_variant_get_fixed_array (signals_variant,
+                                                  &n_signals,
+                                                  sizeof (gint16));
+        if (n_signals != n_bssids ||
+            strlen (opc) >= sizeof (tower.opc) ||
+            latitude < -90 || latitude > 90 ||
+            longitude < -180 || longitude > 180 ||
+            accuracy < 0)
+                return FALSE;
+
+        tower.tec = tec;
+        g_strlcpy (tower.opc, opc, sizeof (tower.opc));
+        tower.lac = lac;
+        tower.cell_id = cell_id;
+        key = location_cache_key_alloc (&tower, n_bssids);
+        for (i = 0; i < n_bssids; i++) {
+                g_autoptr(GVariant) bssid = g_variant_get_child_value (bssids, i);
+                const guint8 *bssid_data;
+                gsize bssid_len;
+
+                bssid_data = g_variant_get_fixed_array (bssid, &bssid_len, 1);
+                if (bssid_len != BSSID_LEN)
+                        return FALSE;
+
+                memcpy (key->bssids + i * BSSID_LEN, bssid_data, BSSID_LEN);
+        }
+        location_cache_key_seal (key);
+
+        signals = g_array_sized_new (FALSE, FALSE, sizeof (gint16), n_signals);
+        g_array_append_vals (signals, signals_data, n_signals);
+        location = gclue_location_new_full (latitude,
+                                            longitude,
+                                            accuracy,
+                                            GCLUE_LOCATION_SPEED_UNKNOWN,
+                                            GCLUE_LOCATION_HEADING_UNKNOWN,
+                                            altitude,
+                                            timestamp,
+                                            description[0] != '\0' ? description : NULL);
+        add_cached_location (wifi, key, &signals, location);
+
+        return TRUE;
+}
+
+/* Rewrites the whole cache file from the in-memory cache. */
+static void
+cache_save (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        g_autoptr(GByteArray) buffer = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *dir = NULL;
+        GList *l;
+
+        /* Don't overwrite entries we haven't loaded yet. */
+        if (priv->cache_file_path == NULL || !priv->cache_loaded)
+                return;
+
+        buffer = g_byte_array_new ();
+        cache_file_header_append (buffer);
+
+        /* Least recently used first, so loading restores the LRU order. */
+        for (l = priv->cache_lru.tail; l; l = l->prev)
+                cache_record_append (buffer, l->data);
+
+        priv->cache_file_valid = FALSE;
+
+        dir = g_path_get_dirname (priv->cache_file_path);
+        if (g_mkdir_with_parents (dir, 0700) < 0) {
+                g_warning ("Failed to create directory '%s': %s",
+                           dir, g_strerror (errno));
+                return;
+        }
+
+        if (!g_file_set_contents_full (priv->cache_file_path,
+                                       (const char *) buffer->data,
+                                       buffer->len,
+                                       G_FILE_SET_CONTENTS_CONSISTENT,
+                                       0600,
+                                       &error)) {
+                g_warning ("Failed to save WiFi cache: %s", error->message);
+                return;
+        }
+
+        priv->cache_file_valid = TRUE;
+        priv->cache_file_stale_records = 0;
+        g_debug ("Saved WiFi cache to '%s' (%u bytes)",
+                 priv->cache_file_path, buffer->len);
+}
+
+/* Flushes a single new cache entry to the cache file. */
+static void
+cache_file_append (GClueWifi            *wifi,
+                   LocationCacheElement *element)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        g_autoptr(GByteArray) buffer = NULL;
+        g_autoptr(GFile) file = NULL;
+        g_autoptr(GFileOutputStream) stream = NULL;
+        g_autoptr(GError) error = NULL;
+
+        if (priv->cache_file_path == NULL)
+                return;
+
+        /* No usable file yet (or the last write failed), or it's mostly
+         * evicted entries, write it all out.
+         */
+        if (!priv->cache_file_valid ||
+            priv->cache_file_stale_records > priv->cache_lru.length) {
+                cache_save (wifi);
+                return;
+        }
+
+        buffer = g_byte_array_new ();
+        cache_record_append (buffer, element);
+
+        file = g_file_new_for_path (priv->cache_file_path);
+        stream = g_file_append_to (file, G_FILE_CREATE_PRIVATE, NULL, &error);
+        if (stream == NULL ||
+            !g_output_stream_write_all (G_OUTPUT_STREAM (stream),
+                                        buffer->data,
+                                        buffer->len,
+                                        NULL,
+                                        NULL,
+                                        &error) ||
+            !g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, &error)) {
+                g_warning ("Failed to append to WiFi cache file '%s': %s",
+                           priv->cache_file_path, error->message);
+                priv->cache_file_valid = FALSE;
+        }
+}
+
+static void
+cache_load (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        g_autoptr(GMappedFile) file = NULL;
+        g_autoptr(GBytes) bytes = NULL;
+        g_autoptr(GError) error = NULL;
+        const guint8 *data;
+        gsize size, offset;
         guint64 cutoff_seconds;
-        guint old_cache_size, removed_elements = 0;
+        guint n_records = 0, n_loaded = 0;
+        gboolean truncated = FALSE;
 
-        old_cache_size = g_hash_table_size (priv->location_cache);
-        cutoff_seconds = g_get_real_time () / G_USEC_PER_SEC - CACHE_ENTRY_MAX_AGE_SECONDS;
+        if (priv->cache_loaded || priv->cache_file_path == NULL)
+                return;
+        priv->cache_loaded = TRUE;
 
-        g_hash_table_iter_init (&iter, priv->location_cache);
-        while (g_hash_table_iter_next (&iter, NULL, &value)) {
-                LocationCacheValue *lcvalue = (LocationCacheValue *)value;
-                GList *l = lcvalue->elements;
+        file = g_mapped_file_new (priv->cache_file_path, FALSE, &error);
+        if (file == NULL) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("Failed to load WiFi cache: %s",
+                                   error->message);
+                return;
+        }
 
-                g_assert (l);
-                while (l) {
-                        LocationCacheElement *element = (LocationCacheElement *)l->data;
-                        GList *lnext = l->next;
+        bytes = g_mapped_file_get_bytes (file);
+        data = g_bytes_get_data (bytes, &size);
+        if (!cache_file_header_valid (data, size)) {
+                g_warning ("Ignoring WiFi cache file '%s' in unknown format",
+                           priv->cache_file_path);
+                return;
+        }
 
-                        /* Keep this location? */
-                        if (gclue_location_get_timestamp (element->location) >
-                            cutoff_seconds)
-                                goto next_el;
+        cutoff_seconds = g_get_real_time () / G_USEC_PER_SEC - CACHE_ENTRY_MAX_AGE_SECONDS;
 
-                        location_cache_element_free (element);
-                        lcvalue->elements = g_list_delete_link (lcvalue->elements, l);
-                        removed_elements++;
+        offset = CACHE_FILE_HEADER_SIZE;
+        while (offset < size) {
+                g_autoptr(GBytes) record_bytes = NULL;
+                g_autoptr(GVariant) record = NULL;
+                guint32 record_size;
 
-                        /* Deleted the last entry (element) in this hash bucket?
-                         * Remove this hash table entry then.
-                         */
-                        if (!lcvalue->elements) {
-                                g_assert (!lnext);
-                                g_hash_table_iter_remove (&iter);
-                        }
+                if (size - offset < CACHE_RECORD_HEADER_SIZE) {
+                        truncated = TRUE;
+                        break;
+                }
+
+                memcpy (&record_size, data + offset, sizeof (record_size));
+                offset += CACHE_RECORD_HEADER_SIZE;
+                if (record_size > size - offset) {
+                        truncated = TRUE;
+                        break;
+                }
 
-                next_el:
-                        l = lnext;
+                record_bytes = g_bytes_new_from_bytes (bytes, offset, record_size);
+                record = g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_RECORD_TYPE),
+                                                   record_bytes,
+                                                   FALSE);
+                if (!g_variant_is_normal_form (record)) {
+                        truncated = TRUE;
+                        break;
                 }
+
+                offset += record_size + CACHE_RECORD_PADDING (record_size);
+                n_records++;
+                if (cache_add_record (wifi, record, cutoff_seconds))
+                        n_loaded++;
         }
 
-        g_debug ("Pruned cache (old size: %u, new size: %u, removed elements: %u)",
-                 old_cache_size, g_hash_table_size (priv->location_cache),
-                 removed_elements);
+        g_debug ("Loaded %u of %u entries from WiFi cache file '%s'",
+                 n_loaded, n_records, priv->cache_file_path);
+        if (truncated)
+                g_warning ("WiFi cache file '%s' is corrupted, rewriting it",
+                           priv->cache_file_path);
+
+        /* Drop expired, evicted and unreadable records from the file. */
+        if (truncated || n_loaded < n_records || priv->cache_file_stale_records > 0)
+                cache_save (wifi);
+        else
+                priv->cache_file_valid = TRUE;
+}
+
+static void
+cache_prune (GClueWifi *wifi)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        GList *l, *lnext;
+        guint64 cutoff_seconds;
+        guint old_cache_size, removed_elements = 0;
+
+        old_cache_size = priv->cache_lru.length;
+        cutoff_seconds = g_get_real_time () / G_USEC_PER_SEC - CACHE_ENTRY_MAX_AGE_SECONDS;
+
+        for (l = priv->cache_lru.head; l; l = lnext) {
+                LocationCacheElement *element = (LocationCacheElement *)l->data;
+
+                lnext = l->next;
+
+                /* Keep this location? */
+                if (gclue_location_get_timestamp (element->location) >
+                    cutoff_seconds)
+                        continue;
+
+                cache_remove_element (wifi, element);
+                removed_elements++;
+        }
+
+        g_debug ("Pruned cache (old size: %u, new size: %u elements, "
+                 "%" G_GSIZE_FORMAT " bytes, removed elements: %u)",
+                 old_cache_size, priv->cache_lru.length,
+                 priv->cache_memory_size, removed_elements);
+
+        if (removed_elements > 0 || priv->cache_file_stale_records > 0)
+                cache_save (wifi);
 }
 
 #if GLIB_CHECK_VERSION(2, 64, 0)
@@ -761,7 +1515,14 @@ cache_empty (GClueWifi *wifi)
         GClueWifiPrivate *priv = wifi->priv;
 
         g_debug ("Emptying cache");
+        g_hash_table_remove_all (priv->location_cache_index);
         g_hash_table_remove_all (priv->location_cache);
+        g_queue_init (&priv->cache_lru);
+        priv->cache_memory_size = 0;
+
+        /* Otherwise the dropped entries come back on the next load */
+        priv->cache_file_stale_records = 0;
+        cache_save (wifi);
 }
 #endif  /* GLib ≥ 2.64.0 */
 
@@ -852,6 +1613,7 @@ gclue_wifi_start (GClueLocationSource *source)
         if (base_result != GCLUE_LOCATION_SOURCE_START_RESULT_OK)
                 return base_result;
 
+        cache_load (GCLUE_WIFI (source));
         connect_cache_prune_timeout (GCLUE_WIFI (source));
         connect_bss_signals (GCLUE_WIFI (source));
 
@@ -1010,10 +1772,19 @@ gclue_wifi_init (GClueWifi *wifi)
                                                                  g_str_equal,
                                                                  g_free,
                                                                  g_object_unref);
-        wifi->priv->location_cache = g_hash_table_new_full (variant_hash,
-                                                            g_variant_equal,
-                                                            (GDestroyNotify) g_variant_unref,
+        wifi->priv->location_cache = g_hash_table_new_full (location_cache_key_hash,
+                                                            location_cache_key_equal,
+                                                            g_rc_box_release,
                                                             location_cache_value_free);
+        wifi->priv->location_cache_index = g_hash_table_new_full (g_int64_hash,
+                                                                  g_int64_equal,
+                                                                  g_free,
+                                                                  (GDestroyNotify) g_ptr_array_unref);
+        g_queue_init (&wifi->priv->cache_lru);
+        wifi->priv->cache_max_entries =
+                gclue_config_get_wifi_cache_max_entries (config);
+        wifi->priv->cache_max_memory_size =
+                (gsize) gclue_config_get_wifi_cache_max_memory (config) * 1024;
 }
 
 static void
@@ -1026,6 +1797,14 @@ gclue_wifi_constructed (GObject *object)
 
         G_OBJECT_CLASS (gclue_wifi_parent_class)->constructed (object);
 
+        if (gclue_config_get_wifi_persistent_cache (gclue_config_get_singleton ())) {
+                /* Two instances may exist, each needs its own file. */
+                const char *name = get_accuracy_level (wifi) <= GCLUE_ACCURACY_LEVEL_NEIGHBORHOOD ?
+                                   "wifi-cache-low-accuracy" : "wifi-cache";
+
+                priv->cache_file_path = g_build_filename (STATEDIR, name, NULL);
+        }
+
         /* FIXME: We should be using async variant */
         priv->supplicant = wpa_supplicant_proxy_new_for_bus_sync
                         (G_BUS_TYPE_SYSTEM,
@@ -1058,6 +1837,8 @@ gclue_wifi_constructed (GObject *object)
                                     wifi);
 }
 
+static GClueWifi *wifi_singletons[] = { NULL, NULL };
+
 static void
 on_wifi_destroyed (gpointer data,
                    GObject *where_the_object_was)
@@ -1078,7 +1859,7 @@ on_wifi_destroyed (gpointer data,
 GClueWifi *
 gclue_wifi_get_singleton (GClueAccuracyLevel level)
 {
-        static GClueWifi *wifi[] = { NULL, NULL };
+        GClueWifi **wifi = wifi_singletons;
         guint i;
         gboolean scramble_location = FALSE;
         gboolean compute_movement = FALSE;
@@ -1114,6 +1895,38 @@ wifi_should_skip_tower (GClueWifi *wifi)
         return gclue_3g_should_skip_tower (get_accuracy_level (wifi));
 }
 
+/**
+ * gclue_wifi_log_cache_usage:
+ *
+ * Logs how full the location cache of each existing WiFi source is, and how
+ * often it was hit, to tune the "cache-max-entries" and "cache-max-memory"
+ * configuration limits.
+ **/
+void
+gclue_wifi_log_cache_usage (void)
+{
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (wifi_singletons); i++) {
+                GClueWifiPrivate *priv;
+
+                if (wifi_singletons[i] == NULL)
+                        continue;
+
+                priv = wifi_singletons[i]->priv;
+                g_message ("    WiFi cache (%s): %u/%u locations, "
+                           "%" G_GSIZE_FORMAT "/%" G_GSIZE_FORMAT " KiB, "
+                           "%u hits, %u misses",
+                           i == 0 ? "neighborhood" : "street",
+                           priv->cache_lru.length,
+                           priv->cache_max_entries,
+                           priv->cache_memory_size / 1024,
+                           priv->cache_max_memory_size / 1024,
+                           priv->cache_hits,
+                           priv->cache_misses);
+        }
+}
+
 /* Can return NULL, signifying an empty BSS list. */
 GList *
 gclue_wifi_get_bss_list (GClueWifi *wifi)
@@ -1154,14 +1967,34 @@ create_query:
                                            query_data_description, error);
 }
 
-static SoupMessage *
-gclue_wifi_create_submit_query (GClueWebSource  *source,
-                                GClueLocation   *location,
-                                GError         **error)
+static GClueLocation *
+gclue_wifi_locate_offline (GClueWebSource *source,
+                           GClueOfflineDB *db,
+                           GError        **error)
+{
+        GClueWifi *wifi = GCLUE_WIFI (source);
+
+        return gclue_mozilla_locate_offline (wifi->priv->mozilla, db,
+                                             wifi_should_skip_tower (wifi), FALSE,
+                                             error);
+}
+
+static void
+gclue_wifi_learn_location (GClueWebSource *source,
+                           GClueOfflineDB *db,
+                           GClueLocation  *location)
+{
+        GClueWifi *wifi = GCLUE_WIFI (source);
+
+        gclue_mozilla_learn_offline (wifi->priv->mozilla, db, location);
+}
+
+static JsonNode *
+gclue_wifi_create_submit_item (GClueWebSource  *source,
+                               GClueLocation   *location,
+                               GError         **error)
 {
         GClueWifi *wifi = GCLUE_WIFI (source);
-        SoupMessage *msg;
-        const char *submit_url;
         GClueConfig *config = gclue_config_get_singleton ();
 
         if (!gclue_config_get_wifi_submit_data (config))
@@ -1184,53 +2017,15 @@ gclue_wifi_create_submit_query (GClueWebSource  *source,
                 return NULL;
         }
 
-        submit_url = gclue_web_source_get_submit_url (source);
-        msg = gclue_mozilla_create_submit_query (wifi->priv->mozilla,
-                                                 submit_url,
+        return gclue_mozilla_create_submit_item (wifi->priv->mozilla,
                                                  location,
                                                  error);
-        return msg;
 }
 
 static void refresh_cb (GObject      *source_object,
                         GAsyncResult *result,
                         gpointer      user_data);
 
-static gint
-bss_compare (gconstpointer a,
-             gconstpointer b)
-{
-        WPABSS **_bss_a = (WPABSS **) a;
-        WPABSS **_bss_b = (WPABSS **) b;
-        WPABSS *bss_a = WPA_BSS (*_bss_a);
-        WPABSS *bss_b = WPA_BSS (*_bss_b);
-        GVariant *bssid_a = wpa_bss_get_bssid (bss_a);
-        GVariant *bssid_b = wpa_bss_get_bssid (bss_b);
-        g_autoptr(GBytes) bssid_bytes_a = NULL;
-        g_autoptr(GBytes) bssid_bytes_b = NULL;
-
-        /* Can’t use g_variant_compare() as it isn’t defined over `ay` types */
-        if (bssid_a == NULL && bssid_b == NULL)
-                return 0;
-        else if (bssid_a == NULL)
-                return -1;
-        else if (bssid_b == NULL)
-                return 1;
-
-        bssid_bytes_a = g_variant_get_data_as_bytes (bssid_a);
-        bssid_bytes_b = g_variant_get_data_as_bytes (bssid_b);
-
-        return g_bytes_compare (bssid_bytes_a, bssid_bytes_b);
-}
-
-static guint
-variant_hash (gconstpointer key)
-{
-        GVariant *variant = (GVariant *) key;
-        g_autoptr(GBytes) bytes = g_variant_get_data_as_bytes (variant);
-        return g_bytes_hash (bytes);
-}
-
 static void location_cache_key_fill_tower (GClueWifi *wifi, GClue3GTower *tower)
 {
         GClueWifiPrivate *priv = wifi->priv;
@@ -1248,83 +2043,79 @@ static void location_cache_key_fill_tower (GClueWifi *wifi, GClue3GTower *tower)
         *tower = *moztower;
 }
 
-static void location_cache_key_add_tower (GClueWifi *wifi, GVariantBuilder *builder)
+typedef struct {
+        guint8 bssid[BSSID_LEN];
+        gint16 signal;
+} ScannedBSS;
+
+static gint
+scanned_bss_compare (gconstpointer a,
+                     gconstpointer b)
 {
-        GClue3GTower tower;
+        const ScannedBSS *bss_a = a;
+        const ScannedBSS *bss_b = b;
 
-        location_cache_key_fill_tower (wifi, &tower);
-        g_variant_builder_add (builder, "u", (guint32)tower.tec);
-        g_variant_builder_add (builder, "s", tower.opc);
-        g_variant_builder_add (builder, "t", (guint64)tower.lac);
-        g_variant_builder_add (builder, "t", (guint64)tower.cell_id);
+        return memcmp (bss_a->bssid, bss_b->bssid, BSSID_LEN);
 }
 
-static GPtrArray *
-get_location_cache_bss_array (GClueWifi *wifi)
+/* The Mozilla service puts BSSID and signal strength for each BSS into its
+ * query. Pack the BSSIDs into a key, sorted by MAC address, and return their
+ * signals in the same order in @signals_out.
+ */
+static LocationCacheKey *
+get_location_cache_key (GClueWifi *wifi,
+                        GArray   **signals_out)
 {
+        g_autoptr(GArray) scanned = NULL;  /* (element-type ScannedBSS) */
+        g_autoptr(GArray) signals = NULL;
+        LocationCacheKey *key;
+        GClue3GTower tower;
         GHashTableIter iter;
         gpointer value;
-        g_autoptr(GPtrArray) bss_array = g_ptr_array_new_with_free_func (NULL);  /* (element-type WPABSS) */
+        guint i;
 
-        /* The Mozilla service puts BSSID and signal strength for each BSS into
-         * its query. Pack the whole lot into a #GVariant for simplicity, sorted
-         * by MAC address. The sorting has to happen in an array beforehand,
-         * as variants are immutable.
-         */
+        scanned = g_array_sized_new (FALSE, FALSE, sizeof (ScannedBSS),
+                                     g_hash_table_size (wifi->priv->bss_proxies));
         g_hash_table_iter_init (&iter, wifi->priv->bss_proxies);
-
         while (g_hash_table_iter_next (&iter, NULL, &value)) {
                 WPABSS *bss = WPA_BSS (value);
-                if (bss != NULL)
-                        g_ptr_array_add (bss_array, bss);
-        }
-
-        g_ptr_array_sort (bss_array, bss_compare);
-
-        return g_steal_pointer (&bss_array);
-}
-
-static GVariant *
-get_location_cache_hashtable_key (GClueWifi *wifi, GPtrArray *bss_array)
-{
-        guint i;
-        GVariantBuilder builder;
-
-        /* Serialise to a variant. */
-        g_variant_builder_init (&builder, G_VARIANT_TYPE ("(usttaay)"));
-        location_cache_key_add_tower (wifi, &builder);
-
-        g_variant_builder_open (&builder, G_VARIANT_TYPE ("aay"));
-        for (i = 0; i < bss_array->len; i++) {
-                WPABSS *bss = WPA_BSS (bss_array->pdata[i]);
+                ScannedBSS scanned_bss;
                 GVariant *bssid;
+                const guint8 *bssid_data;
+                gsize bssid_len;
+
+                if (bss == NULL)
+                        continue;
 
                 bssid = wpa_bss_get_bssid (bss);
                 if (bssid == NULL)
                         continue;
 
-                g_variant_builder_add_value (&builder, bssid);
+                bssid_data = g_variant_get_fixed_array (bssid, &bssid_len, 1);
+                if (bssid_len != BSSID_LEN)
+                        continue;
+
+                memcpy (scanned_bss.bssid, bssid_data, BSSID_LEN);
+                scanned_bss.signal = wpa_bss_get_signal (bss);
+                g_array_append_val (scanned, scanned_bss);
         }
-        g_variant_builder_close (&builder);
 
-        return g_variant_builder_end (&builder);
-}
+        g_array_sort (scanned, scanned_bss_compare);
 
-static GArray *
-get_location_cache_signal_array (GClueWifi *wifi, GPtrArray *bss_array)
-{
-        g_autoptr(GArray) signal_array = NULL;
-        guint i;
-
-        signal_array = g_array_sized_new (FALSE, FALSE, sizeof (gint16), bss_array->len);
-        for (i = 0; i < bss_array->len; i++) {
-                WPABSS *bss = WPA_BSS (bss_array->pdata[i]);
-                gint16 signal = wpa_bss_get_signal (bss);
+        location_cache_key_fill_tower (wifi, &tower);
+        key = location_cache_key_alloc (&tower, scanned->len);
+        signals = g_array_sized_new (FALSE, FALSE, sizeof (gint16), scanned->len);
+        for (i = 0; i < scanned->len; i++) {
+                ScannedBSS *scanned_bss = &g_array_index (scanned, ScannedBSS, i);
 
-                g_array_append_val (signal_array, signal);
+                memcpy (key->bssids + i * BSSID_LEN, scanned_bss->bssid, BSSID_LEN);
+                g_array_append_val (signals, scanned_bss->signal);
         }
+        location_cache_key_seal (key);
 
-        return g_steal_pointer (&signal_array);
+        *signals_out = g_steal_pointer (&signals);
+
+        return key;
 }
 
 static gboolean cached_signals_match (GArray *signals1, GArray *signals2)
@@ -1348,27 +2139,140 @@ static gboolean cached_signals_match (GArray *signals1, GArray *signals2)
         return TRUE;
 }
 
-static GClueLocation *
-find_cached_location (GHashTable *cache, GVariant *key, GArray *signals)
+/* Like cached_signals_match(), but only compares the signals of the BSSs
+ * present in both keys.
+ */
+static gboolean
+cached_common_signals_match (LocationCacheKey *key1, GArray *signals1,
+                             LocationCacheKey *key2, GArray *signals2)
+{
+        guint n1 = MIN (key1->n_bssids, signals1->len);
+        guint n2 = MIN (key2->n_bssids, signals2->len);
+        guint i = 0, j = 0;
+
+        while (i < n1 && j < n2) {
+                gint cmp = memcmp (location_cache_key_get_bssid (key1, i),
+                                   location_cache_key_get_bssid (key2, j),
+                                   BSSID_LEN);
+                gint s1, s2;
+
+                if (cmp < 0) {
+                        i++;
+                        continue;
+                } else if (cmp > 0) {
+                        j++;
+                        continue;
+                }
+
+                s1 = g_array_index (signals1, gint16, i++);
+                s2 = g_array_index (signals2, gint16, j++);
+                if (ABS (s1 - s2) > CACHE_ENTRY_MATCH_SIGNAL_WINDOW / 2)
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+static gboolean
+cache_key_towers_equal (LocationCacheKey *key1, LocationCacheKey *key2)
 {
-        g_autofree gchar *key_str = g_variant_print (key, FALSE);
-        GClueLocation *location = NULL;
+        return memcmp (&key1->tower, &key2->tower, sizeof (key1->tower)) == 0;
+}
+
+static LocationCacheElement *
+find_similar_cached_location (GClueWifi        *wifi,
+                              LocationCacheKey *key,
+                              GArray           *signals)
+{
+        GClueWifiPrivate *priv = wifi->priv;
+        g_autoptr(GHashTable) overlaps = NULL;  /* (element-type LocationCacheElement guint) */
+        LocationCacheElement *best = NULL;
+        gdouble best_similarity = 0;
+        GHashTableIter iter;
+        gpointer element_ptr, count_ptr;
+        guint i;
+
+        /* Count the BSSs each cached element has in common with the scan. */
+        overlaps = g_hash_table_new (g_direct_hash, g_direct_equal);
+        for (i = 0; i < key->n_bssids; i++) {
+                guint64 bssid = bssid_to_uint64 (location_cache_key_get_bssid (key, i));
+                GPtrArray *elements;
+                guint j;
+
+                elements = g_hash_table_lookup (priv->location_cache_index, &bssid);
+                if (elements == NULL)
+                        continue;
+
+                for (j = 0; j < elements->len; j++) {
+                        gpointer element = g_ptr_array_index (elements, j);
+                        guint count;
+
+                        count = GPOINTER_TO_UINT (g_hash_table_lookup (overlaps, element));
+                        g_hash_table_insert (overlaps, element, GUINT_TO_POINTER (count + 1));
+                }
+        }
+
+        g_hash_table_iter_init (&iter, overlaps);
+        while (g_hash_table_iter_next (&iter, &element_ptr, &count_ptr)) {
+                LocationCacheElement *element = element_ptr;
+                guint count = GPOINTER_TO_UINT (count_ptr);
+                gsize n_union;
+                gdouble similarity;
+
+                n_union = key->n_bssids + element->key->n_bssids - count;
+                similarity = (gdouble) count / n_union;
+                if (similarity < CACHE_ENTRY_MATCH_MIN_SIMILARITY)
+                        continue;
+
+                if (best != NULL &&
+                    (similarity < best_similarity ||
+                     (similarity == best_similarity &&
+                      gclue_location_get_accuracy (element->location) >=
+                      gclue_location_get_accuracy (best->location))))
+                        continue;
+
+                /* The index is BSSID-only, check the tower too. */
+                if (!cache_key_towers_equal (element->key, key))
+                        continue;
+
+                if (!cached_common_signals_match (element->key, element->signals,
+                                                  key, signals))
+                        continue;
+
+                best = element;
+                best_similarity = similarity;
+        }
+
+        if (best != NULL)
+                g_debug ("Cache hit for a similar BSS set (similarity %.2f): "
+                         "got location %p (%s)",
+                         best_similarity, best->location,
+                         gclue_location_get_description (best->location));
+
+        return best;
+}
+
+static LocationCacheElement *
+find_cached_location (GClueWifi *wifi, LocationCacheKey *key, GArray *signals)
+{
+        g_autofree gchar *key_str = location_cache_key_to_debug_string (key);
+        LocationCacheElement *found = NULL;
         LocationCacheValue *value;
         GList *l;
 
-        value = g_hash_table_lookup (cache, key);
+        value = g_hash_table_lookup (wifi->priv->location_cache, key);
         if (!value) {
                 g_debug ("Cache miss for key %s", key_str);
-                return NULL;
+                return find_similar_cached_location (wifi, key, signals);
         }
 
-        g_assert (value->elements);
-        for (l = value->elements; l; l = l->next) {
+        g_assert (!g_queue_is_empty (&value->elements));
+        for (l = value->elements.head; l; l = l->next) {
                 LocationCacheElement *element = l->data;
 
-                if (location &&
+                if (found &&
                     gclue_location_get_accuracy (element->location) >=
-                    gclue_location_get_accuracy (location)) {
+                    gclue_location_get_accuracy (found->location)) {
                         /* Have at least as accurate location already,
                          * don't bother with comparing signals.
                          */
@@ -1378,33 +2282,34 @@ find_cached_location (GHashTable *cache, GVariant *key, GArray *signals)
                 if (!cached_signals_match (element->signals, signals))
                         continue;
 
-                location = element->location;
+                found = element;
         }
 
-        if (location) {
+        if (found) {
                 g_debug ("Cache hit for key %s: got location %p (%s)",
-                         key_str, location,
-                         gclue_location_get_description (location));
+                         key_str, found->location,
+                         gclue_location_get_description (found->location));
         } else {
                 g_debug ("Cache had key %s, but with different signals", key_str);
+                found = find_similar_cached_location (wifi, key, signals);
         }
 
-        return location;
+        return found;
 }
 
 typedef struct {
-        GVariant *cache_key;
+        LocationCacheKey *cache_key;
         GArray *signals;
 } RefreshTaskData;
 
 static RefreshTaskData *
-refresh_task_data_new (GVariant *cache_key,
+refresh_task_data_new (LocationCacheKey *cache_key,
                        GArray *signals)
 {
         RefreshTaskData *tdata;
 
         tdata = g_slice_new (RefreshTaskData);
-        tdata->cache_key = g_variant_ref (cache_key);
+        tdata->cache_key = g_rc_box_acquire (cache_key);
         tdata->signals = signals;
         return tdata;
 }
@@ -1413,7 +2318,7 @@ static void refresh_task_data_free (gpointer data)
 {
         RefreshTaskData *rdata = data;
 
-        g_clear_pointer (&rdata->cache_key, g_variant_unref);
+        g_clear_pointer (&rdata->cache_key, g_rc_box_release);
         if (rdata->signals)
                 g_array_free (rdata->signals, TRUE);
         g_slice_free (RefreshTaskData, rdata);
@@ -1426,11 +2331,10 @@ gclue_wifi_refresh_async (GClueWebSource      *source,
                           gpointer             user_data)
 {
         GClueWifi *wifi = GCLUE_WIFI (source);
-        GClueLocation *cached_location;
+        LocationCacheElement *cached;
         RefreshTaskData *tdata;
         g_autoptr(GTask) task = g_task_new (source, cancellable, callback, user_data);
-        g_autoptr(GPtrArray) bss_array = NULL;
-        g_autoptr(GVariant) cache_key = NULL;
+        g_autoptr(LocationCacheKey) cache_key = NULL;
         g_autoptr(GArray) signal_array = NULL;
 
         g_task_set_source_tag (task, gclue_wifi_refresh_async);
@@ -1443,23 +2347,22 @@ gclue_wifi_refresh_async (GClueWebSource      *source,
                 return;
         }
 
-        bss_array = get_location_cache_bss_array (wifi);
-        cache_key = get_location_cache_hashtable_key (wifi, bss_array);
-        signal_array = get_location_cache_signal_array (wifi, bss_array);
-        cached_location = find_cached_location (wifi->priv->location_cache, cache_key, signal_array);
+        cache_key = get_location_cache_key (wifi, &signal_array);
+        cached = find_cached_location (wifi, cache_key, signal_array);
 
         if (gclue_location_source_get_active (GCLUE_LOCATION_SOURCE (source))) {
                 /* Try the cache. */
-                if (cached_location != NULL) {
+                if (cached != NULL) {
                         g_autoptr(GClueLocation) new_location = NULL;
 
                         wifi->priv->cache_hits++;
+                        cache_touch_element (wifi, cached);
 
                         /* Duplicate the location so its timestamp is updated. */
-                        new_location = gclue_location_duplicate_fresh (cached_location);
+                        new_location = gclue_location_duplicate_fresh (cached->location);
                         gclue_location_source_set_location (GCLUE_LOCATION_SOURCE (source), new_location);
 
-                        g_task_return_pointer (task, g_steal_pointer (&new_location), g_object_unref);
+                        g_task_return_pointer (task, g_steal_pointer (&new_location), (GDestroyNotify) gclue_location_unref);
                         return;
                 }
 
@@ -1473,22 +2376,31 @@ gclue_wifi_refresh_async (GClueWebSource      *source,
         GCLUE_WEB_SOURCE_CLASS (gclue_wifi_parent_class)->refresh_async (source, cancellable, refresh_cb, g_steal_pointer (&task));
 }
 
-static void
-add_cached_location (GHashTable *cache,
-                     GVariant *key, GArray **signals,
+static LocationCacheElement *
+add_cached_location (GClueWifi *wifi,
+                     LocationCacheKey *key, GArray **signals,
                      GClueLocation *location)
 {
+        GHashTable *cache = wifi->priv->location_cache;
         LocationCacheValue *value;
         LocationCacheElement *element;
 
         value = g_hash_table_lookup (cache, key);
         if (!value) {
                 value = location_cache_value_new ();
-                g_hash_table_insert (cache, g_variant_ref (key), value);
+                g_hash_table_insert (cache, g_rc_box_acquire (key), value);
         }
 
-        element = location_cache_element_new (g_steal_pointer (signals), location);
-        value->elements = g_list_prepend (value->elements, element);
+        element = location_cache_element_new (key, g_steal_pointer (signals), location);
+        g_queue_push_head_link (&value->elements, &element->bucket_link);
+        g_queue_push_head_link (&wifi->priv->cache_lru, &element->lru_link);
+        cache_index_add (wifi, element);
+        wifi->priv->cache_memory_size += location_cache_element_size (element);
+
+        /* Never evicts the new element, it's the most recently used. */
+        cache_enforce_limits (wifi);
+
+        return element;
 }
 
 static void
@@ -1502,6 +2414,7 @@ refresh_cb (GObject      *source_object,
         g_autoptr(GClueLocation) location = NULL;
         g_autoptr(GError) local_error = NULL;
         RefreshTaskData *tdata;
+        LocationCacheElement *element;
         g_autofree gchar *cache_key_str = NULL;
         double cache_hit_ratio;
 
@@ -1515,10 +2428,11 @@ refresh_cb (GObject      *source_object,
 
         /* Cache the result. */
         tdata = g_task_get_task_data (task);
-        cache_key_str = g_variant_print (tdata->cache_key, FALSE);
-        add_cached_location (wifi->priv->location_cache,
-                             tdata->cache_key, &tdata->signals,
-                             location);
+        cache_key_str = location_cache_key_to_debug_string (tdata->cache_key);
+        element = add_cached_location (wifi,
+                                       tdata->cache_key, &tdata->signals,
+                                       location);
+        cache_file_append (wifi, element);
 
         if (wifi->priv->cache_hits || wifi->priv->cache_misses) {
                 double cache_attempts;
@@ -1530,13 +2444,15 @@ refresh_cb (GObject      *source_object,
                 cache_hit_ratio = 0;
         }
 
-        g_debug ("Adding %s / %s to cache (new size: %u; hit ratio %.2f%%)",
+        g_debug ("Adding %s / %s to cache (new size: %u elements, "
+                 "%" G_GSIZE_FORMAT " bytes; hit ratio %.2f%%)",
                  cache_key_str,
                  gclue_location_get_description (location),
-                 g_hash_table_size (wifi->priv->location_cache),
+                 wifi->priv->cache_lru.length,
+                 wifi->priv->cache_memory_size,
                  cache_hit_ratio);
 
-        g_task_return_pointer (task, g_steal_pointer (&location), g_object_unref);
+        g_task_return_pointer (task, g_steal_pointer (&location), (GDestroyNotify) gclue_location_unref);
 }
 
 static GClueLocation *
@@ -65,6 +65,7 @@ struct _GClueWifiClass {
 GClueWifi *        gclue_wifi_get_singleton      (GClueAccuracyLevel level);
 gboolean gclue_wifi_should_skip_bsss (GClueAccuracyLevel level);
 GList *gclue_wifi_get_bss_list (GClueWifi *wifi);
+void gclue_wifi_log_cache_usage (void);
 
 G_END_DECLS
 